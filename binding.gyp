@@ -2,9 +2,28 @@
   "targets": [
     {
       "target_name": "pumpkin",
-      "sources": ["src/native/pumpkin.c", "src/native/pumpkin_core.c"],
+      "sources": [
+        "src/native/pumpkin.c",
+        "src/native/pumpkin_core.c",
+        "src/native/tile_sched.c",
+        "src/native/tile_arena.c",
+        "src/native/tile_slab.c",
+        "src/native/tile_png.c",
+        "src/native/palette.c",
+        "src/native/quantize.c",
+        "src/native/tile_archive.c",
+        "src/native/tile_pmtiles.c",
+        "src/native/tile_hash.c",
+        "src/native/tile_io.c",
+        "src/native/tar_stream.c",
+        "src/native/tile_untar.c",
+        "src/native/tar_ingest.c",
+        "src/native/tile_manifest.c",
+        "src/native/mercator.c"
+      ],
       "cflags_c": ["-std=c11", "-O3", "-lm", "-march=native"],
-      "defines": ["NAPI_VERSION=8"]
+      "defines": ["NAPI_VERSION=8"],
+      "libraries": ["-lz"]
     }
   ]
 }
@@ -1,14 +1,28 @@
 import axios from "axios";
-import { createWriteStream, createReadStream, mkdirSync, readdirSync, renameSync, unlinkSync } from "fs";
+import { createWriteStream, createReadStream, mkdirSync, rmSync, type WriteStream } from "fs";
 import { dirname } from "path";
 import { Readable } from "stream";
 import { fileURLToPath } from "url";
-import { execSync } from "child_process";
+import { once } from "events";
+import { createGunzip } from "zlib";
+import { nativePumpkin } from "../src/pumpkin/native.ts";
 
 const __filename = fileURLToPath(import.meta.url);
 const __dirname = dirname(__filename);
 
-export async function downloadArchive(repo: string = "murolem/wplace-archives", releaseTag?: string, outDir = __dirname + "/../archive") {
+type ChunkSink = (chunk: Buffer) => Promise<void>;
+
+/**
+ * Downloads a release and extracts it into outDir while it downloads. With extract set to false the archive is only
+ * decompressed to `${outDir}.tar`, whose tiles can be read in place with nativePumpkin.openTileArchive.
+ * Returns the directory or tar written.
+ */
+export async function downloadArchive(
+	repo: string = "murolem/wplace-archives",
+	releaseTag?: string,
+	outDir = __dirname + "/../archive",
+	{ extract = true }: { extract?: boolean } = {},
+): Promise<string> {
 	const { data: release } = await axios(`https://api.github.com/repos/${repo}/releases/tags/${releaseTag || "latest"}`);
 
 	const release_tag_name = releaseTag || release.tag_name;
@@ -17,96 +31,156 @@ export async function downloadArchive(repo: string = "murolem/wplace-archives",
 
 	console.log(`Found ${assets.length} assets in release ${release_tag_name}.`);
 
-	// Download all parts in parallel to temp files, then concatenate.
-	const outArchivePath = __dirname + "/archive.tar.gz";
 	const partsDir = __dirname + "/archive_parts";
 	mkdirSync(partsDir, { recursive: true });
 
 	const sortedAssets = [...assets].sort((a: any, b: any) => a.name.localeCompare(b.name));
-	console.log(`Downloading ${sortedAssets.length} parts in parallel...`);
 
-	type PartResult = { index: number; name: string; path: string; size: number };
+	// one failed part stops the others and whatever they feed
+	const controller = new AbortController();
+
+	if (!extract) {
+		const tarPath = `${outDir}.tar`;
+		const gunzip = createGunzip();
+		const out = createWriteStream(tarPath);
+		const done = once(gunzip.pipe(out), "finish");
+		try {
+			await streamParts(sortedAssets, partsDir, controller, async (chunk) => {
+				if (!gunzip.write(chunk)) await once(gunzip, "drain");
+			});
+		} catch (error) {
+			gunzip.destroy();
+			out.destroy();
+			rmSync(tarPath, { force: true });
+			throw error;
+		}
+		gunzip.end();
+		await done;
+		console.log(`Decompressed archive written to ${tarPath}`);
+		return tarPath;
+	}
+
+	// Inflating, tar parsing and file writes all happen natively off the event loop, a push resolves once the
+	// writers have room for its files, which throttles the downloads to the disk.
+	mkdirSync(outDir, { recursive: true });
+	const untar = nativePumpkin.createUntar(outDir, true, 4);
+	controller.signal.addEventListener("abort", () => nativePumpkin.untarAbort(untar));
+	await streamParts(sortedAssets, partsDir, controller, (chunk) => nativePumpkin.untarPush(untar, chunk));
+	// only reached when every part went through
+	const stats = await nativePumpkin.untarFinish(untar);
+	console.log(`Extracted ${stats.files} files and ${stats.links} links (${(stats.bytes / 1024 / 1024).toFixed(1)} MB) to ${outDir}`);
+	if (stats.skipped) console.log(`Skipped ${stats.skipped} entries with unsafe names or of other types`);
+	return outDir;
+}
+
+/**
+ * Downloads all parts at once and feeds their bytes to sink in order. The part whose turn it is streams straight into
+ * the sink, parts that are ahead of it are spooled to partsDir until their turn and deleted after. The first part to
+ * fail aborts controller, which stops the other downloads; the spools are deleted and the error is thrown once every
+ * part has stopped.
+ */
+async function streamParts(assets: any[], partsDir: string, controller: AbortController, sink: ChunkSink) {
+	const { signal } = controller;
+	let turn = 0;
+	const waiting = new Map<number, () => void>();
+	const advance = () => {
+		turn++;
+		waiting.get(turn)?.();
+		waiting.delete(turn);
+	};
+	const waitForTurn = (index: number) =>
+		index === turn
+			? Promise.resolve()
+			: new Promise<void>((resolve, reject) => {
+					waiting.set(index, resolve);
+					signal.addEventListener("abort", () => reject(signal.reason), { once: true });
+				});
+
+	console.log(`Downloading ${assets.length} parts in parallel...`);
+
+	async function fetchPart(asset: any, index: number) {
+		try {
+			await fetchPartOnce(asset, index);
+		} catch (err) {
+			if (!signal.aborted) controller.abort(err);
+			throw err;
+		}
+	}
 
-	async function downloadPart(asset: any, index: number): Promise<PartResult> {
-		const partPath = `${partsDir}/part_${index.toString().padStart(4, "0")}_${asset.name}`;
+	async function fetchPartOnce(asset: any, index: number) {
+		const spoolPath = `${partsDir}/part_${index.toString().padStart(4, "0")}_${asset.name}`;
 		const sizeMB = (asset.size / 1024 / 1024).toFixed(1);
 		process.stdout.write(`Downloading ${asset.name} (0/${sizeMB} MB)\n`);
+		let spool: WriteStream | null = null;
+		let loaded = 0;
+		let sinkFailed = false; // a corrupt archive is not fixed by downloading it again
+
 		const maxRetries = 5;
-		let attempt = 0;
-		while (attempt < maxRetries) {
+		for (let attempt = 1; ; attempt++) {
 			try {
-				const response = await axios<Readable>(asset.browser_download_url, { responseType: "stream" });
-				const stream: Readable = response.data as unknown as Readable;
-				const fileStream = createWriteStream(partPath);
-				let loaded = 0;
-				return await new Promise<PartResult>((resolve, reject) => {
-					stream.on("data", (chunk: Buffer) => {
-						loaded += chunk.length;
-						if (loaded === asset.size || loaded % (32 * 1024 * 1024) < chunk.length) {
-							const pct = Math.min(100, Math.round((loaded / asset.size) * 100));
-							process.stdout.write(`\r${asset.name} ${pct}% ${(loaded / 1024 / 1024).toFixed(1)}/${sizeMB} MB   `);
-						}
-					});
-					stream.on("error", (err) => {
-						reject(err);
-					});
-					fileStream.on("error", (err) => {
-						reject(err);
-					});
-					fileStream.on("finish", () => {
-						process.stdout.write(`\r${asset.name} 100% ${sizeMB}/${sizeMB} MB\n`);
-						resolve({ index, name: asset.name, path: partPath, size: asset.size });
-					});
-					stream.pipe(fileStream);
+				// resume where a failed attempt stopped, a server ignoring the range sends everything again
+				signal.throwIfAborted();
+				const response = await axios<Readable>(asset.browser_download_url, {
+					responseType: "stream",
+					signal,
+					headers: loaded ? { Range: `bytes=${loaded}-` } : {},
 				});
+				let skip = response.status === 206 ? 0 : loaded;
+				for await (let chunk of response.data as unknown as Readable) {
+					if (skip) {
+						const dropped = Math.min(skip, chunk.length);
+						chunk = chunk.subarray(dropped);
+						skip -= dropped;
+						if (!chunk.length) continue;
+					}
+					if (!spool && index === turn) {
+						await sink(chunk).catch((err) => {
+							sinkFailed = true;
+							throw err;
+						});
+					} else {
+						spool ??= createWriteStream(spoolPath);
+						if (!spool.write(chunk)) await once(spool, "drain");
+					}
+					loaded += chunk.length;
+					if (loaded === asset.size || loaded % (32 * 1024 * 1024) < chunk.length) {
+						const pct = Math.min(100, Math.round((loaded / asset.size) * 100));
+						process.stdout.write(`\r${asset.name} ${pct}% ${(loaded / 1024 / 1024).toFixed(1)}/${sizeMB} MB   `);
+					}
+				}
+				process.stdout.write(`\r${asset.name} 100% ${sizeMB}/${sizeMB} MB\n`);
+				break;
 			} catch (err: any) {
-				attempt++;
-				if (attempt < maxRetries) {
-					process.stdout.write(
-						`\nError downloading ${asset.name} (attempt ${attempt}): ${err.code || err.message}. Retrying...\n`,
-					);
-					await new Promise((res) => setTimeout(res, 2000 * attempt));
-				} else {
-					process.stdout.write(`\nFailed to download ${asset.name} after ${maxRetries} attempts.\n`);
-					throw err;
+				if (sinkFailed || signal.aborted || attempt >= maxRetries) {
+					if (!sinkFailed && !signal.aborted)
+						process.stdout.write(`\nFailed to download ${asset.name} after ${maxRetries} attempts.\n`);
+					spool?.destroy();
+					if (spool) rmSync(spoolPath, { force: true });
+					throw signal.aborted ? signal.reason : err;
 				}
+				process.stdout.write(`\nError downloading ${asset.name} (attempt ${attempt}): ${err.code || err.message}. Retrying...\n`);
+				await new Promise((res) => setTimeout(res, 2000 * attempt));
 			}
 		}
-		throw new Error(`Failed to download ${asset.name} after ${maxRetries} attempts.`);
-	}
 
-	const resultsParts: PartResult[] = await Promise.all(sortedAssets.map((a, i) => downloadPart(a, i)));
-	console.log("All parts downloaded. Concatenating...");
-
-	// Concatenate in order
-	await new Promise<void>(async (resolve, reject) => {
-		const combinedStream = createWriteStream(outArchivePath, { flags: "w" });
-		combinedStream.on("error", reject);
-		for (const part of resultsParts) {
-			await new Promise<void>((res, rej) => {
-				const rs = createReadStream(part.path);
-				rs.on("error", rej);
-				rs.on("end", res);
-				rs.pipe(combinedStream, { end: false });
-			});
+		if (spool) {
+			try {
+				spool.end();
+				await once(spool, "finish");
+				await waitForTurn(index);
+				for await (const chunk of createReadStream(spoolPath)) {
+					signal.throwIfAborted();
+					await sink(chunk);
+				}
+			} finally {
+				rmSync(spoolPath, { force: true });
+			}
 		}
-		combinedStream.end();
-		combinedStream.on("finish", resolve);
-	});
-
-	console.log(`Combined archive written to ${outArchivePath}`);
-
-	// Cleanup part files
-	for (const part of resultsParts) {
-		try {
-			unlinkSync(part.path);
-		} catch {}
+		advance();
 	}
-	// Optionally remove partsDir (keeping empty dir is harmless)
-
-	mkdirSync(outDir, { recursive: true });
 
-	execSync(`tar -xzf ${outArchivePath} -C ${outDir}`, {
-		stdio: "pipe",
-	});
+	// a failed part aborted the others, they are all stopped and their spools gone once this settles
+	await Promise.allSettled(assets.map((a, i) => fetchPart(a, i)));
+	if (signal.aborted) throw signal.reason;
+	console.log("All parts downloaded.");
 }
@@ -1,14 +1,12 @@
 import axios from "axios";
 import { Octokit } from "octokit";
-import * as tar from "tar";
-import * as fsp from "fs/promises";
 import * as path from "path";
 import PQueue from "p-queue";
 // import { s3 } from "./s3_client";
 import { parentPort, Worker, isMainThread, workerData } from "worker_threads";
-import { cpus, tmpdir } from "os";
+import { cpus } from "os";
 import { awsS3 } from "./s3_client.ts";
-import { DeleteObjectsCommand, ListObjectsV2Command, PutObjectCommand } from "@aws-sdk/client-s3";
+import { DeleteObjectCommand, DeleteObjectsCommand, GetObjectCommand, ListObjectsV2Command, PutObjectCommand } from "@aws-sdk/client-s3";
 import { getSignedUrl } from "@aws-sdk/s3-request-presigner";
 import { setGlobalDispatcher, Agent } from "undici";
 import { fileURLToPath } from "url";
@@ -17,6 +15,8 @@ import { render, Text } from "ink";
 import { state } from "./s3_ui.tsx";
 import "./s3_ui.tsx";
 import { observable } from "mobx";
+import { nativePumpkin, type TarIngestEntry } from "../src/pumpkin/native.ts";
+import { blobKey, manifestKey } from "./s3_tiles.ts";
 
 const __filename = fileURLToPath(import.meta.url);
 const __dirname = path.dirname(__filename);
@@ -39,12 +39,6 @@ const octokit = new Octokit({
 const owner = "murolem";
 const repo = "wplace-archives";
 
-const BASE_TMP_DIR = path.join(tmpdir(), "wplace", "tiles");
-
-const ensureDir = async (dir: string) => {
-	await fsp.mkdir(dir, { recursive: true });
-};
-
 async function deleteTilesPrefix(prefix: string) {
 	let continuationToken: string | undefined;
 
@@ -114,122 +108,173 @@ async function streamConcatenateAsset(asset: any, releaseName: string, tries = 0
 	}
 }
 
-const queue = new PQueue({ concurrency: 1000 * 2 });
+// Tiles are stored once by content: blobs/<hash> holds the bytes, manifests/<release> maps the z/x/y of every tile of
+// a release to its hash (src/native/tile_manifest.h). Most tiles are the same as in the release before, so a release
+// only uploads the blobs no synced manifest references yet.
+//
+// Releases synced before this layout still have their tiles at tiles/<release>/<z>/<x>/<y>.png, and nothing writes
+// that path anymore. Readers resolve tiles through s3_tiles.ts, which handles both layouts. The old prefixes are
+// deleted as their releases age out below, so after a week no release uses them.
+
+// Release archives hold <x>/<y>.png of the base level, pyramids <z>/<x>/<y>.png.
+const BASE_ZOOM = 11;
+
+function parseTilePath(fileName: string): [number, number, number] | undefined {
+	const match = /^(?:(\d+)\/)?(\d+)\/(\d+)\.png$/.exec(fileName);
+	if (!match) return;
+	return [match[1] === undefined ? BASE_ZOOM : +match[1], +match[2], +match[3]];
+}
+
+// The tiles of a release in the shape encodeTileManifest takes, without a string per tile.
+class TileList {
+	zxy = new Uint32Array(3 * 4096);
+	hashes = Buffer.alloc(16 * 4096);
+	count = 0;
+	private index = new Map<number, number>(); // (z, x, y) -> position, for hard links to earlier tiles
+
+	add(z: number, x: number, y: number, hash: string | Buffer) {
+		const key = (z * 4096 + x) * 4096 + y;
+		let i = this.index.get(key);
+		if (i === undefined) {
+			if (this.count * 3 === this.zxy.length) {
+				const zxy = new Uint32Array(this.zxy.length * 2);
+				zxy.set(this.zxy);
+				this.zxy = zxy;
+				this.hashes = Buffer.concat([this.hashes, Buffer.alloc(this.hashes.length)]);
+			}
+			i = this.count++;
+			this.index.set(key, i);
+		}
+		this.zxy.set([z, x, y], i * 3);
+		if (typeof hash === "string") this.hashes.write(hash, i * 16, "hex");
+		else hash.copy(this.hashes, i * 16);
+	}
 
-async function streamConcatenateAssets(assets: any[], keys = new Set<string>(), releaseName: string) {
-	const parseStream = new tar.Parser({});
+	hashOf(z: number, x: number, y: number) {
+		const i = this.index.get((z * 4096 + x) * 4096 + y);
+		return i === undefined ? undefined : this.hashes.subarray(i * 16, i * 16 + 16);
+	}
 
+	encode() {
+		return nativePumpkin.encodeTileManifest(this.zxy.subarray(0, this.count * 3), this.hashes.subarray(0, this.count * 16));
+	}
+}
+
+// Every entry in flight holds one slot of the native ingest ring until its upload is done, so the slots bound both the
+// uploads running at once and the memory they use. Tiles are a few KB, larger files get a buffer of their own.
+const INGEST_SLOTS = 2000;
+const INGEST_SLOT_SIZE = 64 * 1024;
+
+/** Uploads the blobs of a release missing from known, which is updated, and returns its manifest. */
+async function streamConcatenateAssets(assets: any[], known: Set<string>, releaseName: string) {
 	const s = state.downloadReleases[releaseName]!;
+	const uploads = new Set<Promise<void>>();
+	const tiles = new TileList();
+	let failed = 0;
+
+	const processEntry = async (entry: TarIngestEntry) => {
+		s.currentFile = entry.name;
+
+		const fileName = entry.name.split("/").slice(1).join("/"); // drop top-level folder to match previous behavior
+		const coords = parseTilePath(fileName);
+		if (!coords) {
+			s.skippingCurrentFile = true;
+			return;
+		}
 
-	parseStream.on("entry", (entry) =>
-		queue.add(async () => {
-			try {
-				// console.log(`Processing entry: ${entry.path} (${entry.type})`);
-				if (entry.type !== "File") {
-					entry.resume();
-					return;
-				}
-				s.currentFile = entry.path;
-
-				const originalPath: string = entry.path;
-				const fileName = originalPath.split("/").slice(1).join("/"); // drop top-level folder to match previous behavior
-				const s3Key = `tiles/${releaseName}/${fileName}`;
-
-				if (keys.has(s3Key)) {
-					s.skippingCurrentFile = true;
-					entry.resume();
-					return;
-				}
-
-				s.skippingCurrentFile = false;
-
-				const content = await new Promise<Buffer>((resolve, reject) => {
-					const chunks: Buffer[] = [];
-					entry.on("data", (chunk: Buffer) => {
-						chunks.push(chunk);
-					});
-					entry.on("end", () => {
-						resolve(Buffer.concat(chunks));
-					});
-					entry.on("error", (err: any) => {
-						reject(err);
-					});
-				});
+		// the pyramid stores duplicate tiles as hard links to the first copy, which is already in the list
+		if (entry.type === "link") {
+			const target = parseTilePath(entry.linkName.split("/").slice(1).join("/"));
+			const hash = target && tiles.hashOf(...target);
+			if (hash) tiles.add(...coords, hash);
+			else failed++;
+			return;
+		}
 
-				s.extracted++;
+		s.extracted++;
+		tiles.add(...coords, entry.hash);
 
-				await uploadToS3({
-					releaseName,
-					fileName,
-					content,
-				});
-			} catch (error) {
-				console.error("Error processing entry:", error);
-			}
-		}),
-	);
+		s.skippingCurrentFile = known.has(entry.hash);
+		if (s.skippingCurrentFile) return;
 
-	const QUEUE = Object.getOwnPropertySymbols(parseStream).find((s) => s.description === "queue")!;
-	const BUFFER = Object.getOwnPropertySymbols(parseStream).find((s) => s.description === "buffer")!;
+		known.add(entry.hash);
+		try {
+			await uploadToS3({ key: blobKey(entry.hash), releaseName, content: entry.data });
+		} catch (error) {
+			known.delete(entry.hash);
+			failed++;
+			console.error("Error processing entry:", error);
+		}
+	};
+
+	// Entries are parsed and hashed natively while the pushes run, this only starts their uploads and gives the slots
+	// back.
+	const startUploads = () => {
+		for (const entry of nativePumpkin.ingestTake(ingest)) {
+			const upload = processEntry(entry).finally(() => {
+				nativePumpkin.ingestRelease(ingest, entry.slot);
+				uploads.delete(upload);
+				s.queueRunning = uploads.size;
+			});
+			uploads.add(upload);
+		}
+		s.queueRunning = uploads.size;
+	};
+	const ingest = nativePumpkin.createTarIngest(INGEST_SLOTS, INGEST_SLOT_SIZE, true, startUploads);
 
 	s.fetchingDownload = true;
 
-	for (const asset of assets) {
-		const stream = await streamConcatenateAsset(asset, releaseName);
-
-		for await (const chunk of stream) {
-			s.queueSize = queue.size;
-			s.queueRunning = queue.pending;
-			s.queueTar = (parseStream as any)[QUEUE].pending;
+	try {
+		for (const asset of assets) {
+			const stream = await streamConcatenateAsset(asset, releaseName);
 
-			// @ts-ignore
-			if (parseStream[QUEUE]?.length > 200) {
-				await new Promise((resolve) => parseStream.once("drain", resolve));
-			}
-			await queue.onSizeLessThan(1); // maximum backpressure
+			// a push resolves once every entry of the chunk has a slot, which holds the download back to the uploads
+			for await (const chunk of stream) await nativePumpkin.ingestPush(ingest, chunk);
 
-			parseStream.write(chunk);
+			s.downloaded++;
 		}
-
-		s.downloaded++;
+	} catch (error) {
+		nativePumpkin.ingestCancel(ingest);
+		throw error;
+	} finally {
+		s.fetchingDownload = false;
+		// the last entries may be ready before their notification arrives
+		startUploads();
+		while (uploads.size) await Promise.all(uploads);
 	}
 
-	s.fetchingDownload = false;
-
-	await queue.onIdle();
+	if (!nativePumpkin.ingestFinish(ingest)) throw new Error(`Truncated archive for release ${releaseName}`);
+	// a manifest must never reference a blob that is not there
+	if (failed) throw new Error(`${failed} tiles of release ${releaseName} could not be stored`);
 
-	parseStream.end();
+	return tiles.encode();
 }
 
-async function uploadToS3(opts: { releaseName: string; fileName: string; content: Buffer; tries?: number }) {
-	if (!opts.fileName || opts.fileName.endsWith("/")) return;
-	if (opts.content.length === 0 && !opts.fileName.includes(".")) return;
-
+async function uploadToS3(opts: { key: string; releaseName: string; content: Uint8Array; tries?: number }) {
 	if (opts.tries === undefined) {
 		opts.tries = 0;
 	}
 
 	const s = state.downloadReleases[opts.releaseName]!;
 
-	const key = `tiles/${opts.releaseName}/${opts.fileName}`;
-
 	try {
 		const url = await getSignedUrl(
 			awsS3,
 			new PutObjectCommand({
 				Bucket: process.env.S3_BUCKET_NAME,
-				Key: key,
+				Key: opts.key,
 			}),
 		);
 
-		await fetch(url, {
+		const response = await fetch(url, {
 			method: "PUT",
 			body: opts.content as any,
 		});
+		if (!response.ok) throw new Error(`HTTP ${response.status}`);
 		s.uploaded++;
 	} catch (error) {
 		if (opts.tries >= 3) {
-			console.error(`Failed to upload ${key} after ${opts.tries} tries:`, error);
+			console.error(`Failed to upload ${opts.key} after ${opts.tries} tries:`, error);
 			throw error;
 		}
 
@@ -238,48 +283,43 @@ async function uploadToS3(opts: { releaseName: string; fileName: string; content
 	}
 }
 
-async function downloadRelease(release: any) {
-	// Discover existing keys in S3 so we can skip
-	const keys = new Set<string>();
+async function listManifests() {
+	const names: string[] = [];
 	let continuationToken: string | undefined;
+	do {
+		const page = await awsS3.send(
+			new ListObjectsV2Command({
+				Bucket: process.env.S3_BUCKET_NAME,
+				Prefix: manifestKey(""),
+				ContinuationToken: continuationToken,
+			}),
+		);
+		for (const obj of page.Contents ?? []) names.push(obj.Key!.slice(manifestKey("").length));
+		continuationToken = page.IsTruncated ? page.NextContinuationToken : undefined;
+	} while (continuationToken);
+	return names.sort();
+}
+
+async function readManifestHashes(releaseName: string, into = new Set<string>()) {
+	const { Body } = await awsS3.send(new GetObjectCommand({ Bucket: process.env.S3_BUCKET_NAME, Key: manifestKey(releaseName) }));
+	const { hashes } = nativePumpkin.decodeTileManifest(await Body!.transformToByteArray());
+	for (let i = 0; i < hashes.length; i += 16) into.add(hashes.toString("hex", i, i + 16));
+	return into;
+}
 
-	let pages = 1;
+async function downloadRelease(release: any, known: Set<string>) {
 	const s = (state.downloadReleases[release.name] ||= observable({
 		name: release.name,
 		start: Date.now(),
 		assets: 0,
-		pages,
+		pages: 0,
 		tiles: 0,
 		extracted: 0,
 		uploaded: 0,
 		downloaded: 0,
 	}));
 
-	while (true) {
-		s.fetchingList = true;
-		const page = await awsS3.send(
-			new ListObjectsV2Command({
-				Bucket: process.env.S3_BUCKET_NAME,
-				Prefix: `tiles/${release.name}/`,
-				MaxKeys: 1000,
-				ContinuationToken: continuationToken,
-			}),
-		);
-		s.assets! += page.KeyCount || 0;
-		s.pages = pages++;
-
-		for (const obj of page.Contents ?? []) {
-			if (obj.Key) keys.add(obj.Key);
-		}
-
-		const isTruncated = page.IsTruncated;
-		const next = page.NextContinuationToken;
-		if (!isTruncated || !next) break;
-		continuationToken = next;
-	}
-
-	s.pages = 0;
-	s.assets = 0;
+	s.fetchingList = true;
 
 	// Fetch the list of assets for this release
 	const assetsResp = await octokit.rest.repos.listReleaseAssets({
@@ -295,14 +335,64 @@ async function downloadRelease(release: any) {
 
 	const assetsSorted = assetsResp.data.slice().sort((a, b) => a.name.localeCompare(b.name));
 
-	const { name } = release;
-	const baseDir = path.join(BASE_TMP_DIR, name);
-	await ensureDir(baseDir);
+	const manifest = await streamConcatenateAssets(assetsSorted, known, release.name);
+
+	// written last, a release without a manifest is synced again from the start
+	await awsS3.send(
+		new PutObjectCommand({
+			Bucket: process.env.S3_BUCKET_NAME,
+			Key: manifestKey(release.name),
+			Body: manifest,
+		}),
+	);
+
+	s.finished = true;
+}
 
-	// Create a tar parser and stream entries to disk one-by-one
+// A blob younger than this may belong to a sync that has not written its manifest yet.
+const BLOB_GRACE_MS = 1000 * 60 * 60 * 24 * 2;
 
-	await streamConcatenateAssets(assetsSorted, keys, release.name);
+/** Deletes the blobs no manifest references anymore. */
+async function collectBlobs() {
+	const s = (state.deleting[blobKey("")] ||= observable({ name: "unreferenced blobs", start: Date.now() }));
 
+	s.fetchingList = true;
+	const referenced = new Set<string>();
+	for (const name of await listManifests()) await readManifestHashes(name, referenced);
+
+	let continuationToken: string | undefined;
+	do {
+		const page = await awsS3.send(
+			new ListObjectsV2Command({
+				Bucket: process.env.S3_BUCKET_NAME,
+				Prefix: blobKey(""),
+				ContinuationToken: continuationToken,
+			}),
+		);
+		s.pages = (s.pages || 0) + 1;
+		s.found = (s.found || 0) + (page.KeyCount || 0);
+
+		const unreferenced = (page.Contents ?? []).filter(
+			(obj) =>
+				!referenced.has(obj.Key!.slice(blobKey("").length)) &&
+				Date.now() - (obj.LastModified?.getTime() ?? Date.now()) > BLOB_GRACE_MS,
+		);
+		if (unreferenced.length) {
+			s.fetchingDelete = true;
+			await awsS3.send(
+				new DeleteObjectsCommand({
+					Bucket: process.env.S3_BUCKET_NAME!,
+					Delete: { Objects: unreferenced.map((obj) => ({ Key: obj.Key! })) },
+				}),
+			);
+			s.fetchingDelete = false;
+			s.deleted = (s.deleted || 0) + unreferenced.length;
+		}
+
+		continuationToken = page.IsTruncated ? page.NextContinuationToken : undefined;
+	} while (continuationToken);
+
+	s.fetchingList = false;
 	s.finished = true;
 }
 
@@ -358,10 +448,20 @@ async function main() {
 
 	await deleteQueue.addAll(
 		toDelete.map((release) => async () => {
+			await awsS3.send(new DeleteObjectCommand({ Bucket: process.env.S3_BUCKET_NAME, Key: manifestKey(release.name) }));
+			// releases synced before the content addressed layout
 			await deleteTilesPrefix(`tiles/${release.name}/`);
 		}),
 	);
 
+	// Every blob a synced manifest references is there already, the blobs of the releases synced now are added as they
+	// go. Releases age out after a week, so this reads a week of manifests.
+	const manifests = await listManifests();
+	const known = new Set<string>();
+	for (const name of manifests) await readManifestHashes(name, known);
+	const synced = new Set(manifests);
+	toSync = toSync.filter((release) => !synced.has(release.name));
+
 	const workers = [];
 
 	// const cpuCount = 1; // cpus().length;
@@ -378,10 +478,10 @@ async function main() {
 
 		if (cpuCount === 1 || 1 == 1) {
 			for (const release of releasesForThisWorker) {
-				await downloadRelease(release);
+				await downloadRelease(release, known);
 			}
 
-			process.exit();
+			break;
 		}
 
 		const worker = new Worker(__filename, {
@@ -408,13 +508,19 @@ async function main() {
 			}),
 		);
 	}
+
+	await Promise.all(workers);
+	// on every run, a run with nothing to sync still leaves the blobs of the manifests deleted above
+	await collectBlobs();
+	process.exit();
 }
 // downloadArchive();
 
 async function doWork(data: any) {
 	const releases: any[] = data.releases;
+	const known = new Set<string>();
 	for (const release of releases) {
-		await downloadRelease(release);
+		await downloadRelease(release, known);
 	}
 	parentPort?.postMessage("Worker done");
 }
@@ -0,0 +1,82 @@
+import { GetObjectCommand, NoSuchKey } from "@aws-sdk/client-s3";
+import { fileURLToPath } from "url";
+import { awsS3 } from "./s3_client.ts";
+import { nativePumpkin } from "../src/pumpkin/native.ts";
+
+// Reads tiles of the releases s3_sync.ts stored in the bucket. Releases synced before the content addressed layout have
+// their tiles at tiles/<release>/<z>/<x>/<y>.png, newer ones at blobs/<hash>, found through manifests/<release>. The
+// old prefixes go away as their releases age out of the sync, until then both are read here, so a consumer only needs
+// tileKey or getTile instead of building keys itself.
+//
+//   node scripts/s3_tiles.ts <release> <z> <x> <y> > tile.png
+
+export const blobKey = (hash: string) => `blobs/${hash}`;
+export const manifestKey = (releaseName: string) => `manifests/${releaseName}`;
+export const legacyTileKey = (releaseName: string, z: number, x: number, y: number) => `tiles/${releaseName}/${z}/${x}/${y}.png`;
+
+type Resolved = { hashes: Buffer; index: Map<number, number> } | null; // null for a release without a manifest
+
+// The decoded manifests of the releases read so far. A manifest never changes once written.
+const manifests = new Map<string, Promise<Resolved>>();
+
+async function getObject(key: string) {
+	try {
+		const { Body } = await awsS3.send(new GetObjectCommand({ Bucket: process.env.S3_BUCKET_NAME, Key: key }));
+		return await Body!.transformToByteArray();
+	} catch (error) {
+		if (error instanceof NoSuchKey) return undefined;
+		throw error;
+	}
+}
+
+async function loadManifest(releaseName: string): Promise<Resolved> {
+	const data = await getObject(manifestKey(releaseName));
+	if (!data) return null;
+	const { tiles, hashes } = nativePumpkin.decodeTileManifest(data);
+	// z, x, y, hash index quadruples
+	const index = new Map<number, number>();
+	for (let i = 0; i < tiles.length; i += 4) index.set((tiles[i] * 4096 + tiles[i + 1]) * 4096 + tiles[i + 2], tiles[i + 3]);
+	return { hashes, index };
+}
+
+function manifestOf(releaseName: string) {
+	let manifest = manifests.get(releaseName);
+	if (!manifest) {
+		manifest = loadManifest(releaseName);
+		manifests.set(releaseName, manifest);
+		manifest.catch(() => manifests.delete(releaseName));
+	}
+	return manifest;
+}
+
+/**
+ * The key of a tile of a release: its blob when the release has a manifest, undefined if the manifest does not list
+ * it, and the legacy tiles/ key for a release synced before manifests.
+ */
+export async function tileKey(releaseName: string, z: number, x: number, y: number) {
+	const manifest = await manifestOf(releaseName);
+	if (!manifest) return legacyTileKey(releaseName, z, x, y);
+	const hash = manifest.index.get((z * 4096 + x) * 4096 + y);
+	if (hash === undefined) return undefined;
+	return blobKey(manifest.hashes.toString("hex", hash * 16, hash * 16 + 16));
+}
+
+/** The PNG of a tile of a release, undefined if the release does not have it. */
+export async function getTile(releaseName: string, z: number, x: number, y: number) {
+	const key = await tileKey(releaseName, z, x, y);
+	return key === undefined ? undefined : getObject(key);
+}
+
+if (process.argv[1] === fileURLToPath(import.meta.url)) {
+	const [releaseName, z, x, y] = process.argv.slice(2);
+	if (!releaseName || [z, x, y].some((v) => !/^\d+$/.test(v ?? ""))) {
+		console.error("usage: node scripts/s3_tiles.ts <release> <z> <x> <y> > tile.png");
+		process.exit(2);
+	}
+	const tile = await getTile(releaseName, +z!, +x!, +y!);
+	if (!tile) {
+		console.error(`${releaseName} has no tile ${z}/${x}/${y}`);
+		process.exit(1);
+	}
+	process.stdout.write(tile);
+}
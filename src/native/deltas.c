@@ -0,0 +1,273 @@
+// Packs the delta tiles from one release to the next into a PMTiles archive:
+//
+//   deltas [--min-z Z] [--max-z Z] [--threads N] [--tile-size PX]
+//          --out FILE A B
+//
+// A and B are tile directories, release tars or PMTiles archives, as for
+// tilediff. For every z/x/y that either stores, the archive holds the delta
+// tile (tile_delta.h) turning the palette plane of A into the one of B, so a
+// viewer scrubbing the timeline with the tile of A at hand fetches that
+// instead of the whole PNG of B. Tiles with identical bytes are settled
+// without decoding and all share the one unchanged delta tile.
+//
+// Parent levels are taken from pyramids built with --filter mode, whose
+// tiles are exact palette colours. A level one of the releases stores no
+// tile of is skipped, as a release tar without parents would otherwise look
+// like every parent was added or removed. tileserve answers
+// /tiles/delta-<slug>/<z>/<x>/<y>.delta from DIR/delta-<slug>.pmtiles, with
+// the slug of B.
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "palette.h"
+#include "thread_pool.h"
+#include "tile_delta.h"
+#include "tile_io.h"
+#include "tile_pmtiles.h"
+#include "tile_source.h"
+
+#define BASE_Z 11
+#define BATCH 4096 // tiles encoded in parallel, then added in order
+
+typedef enum { SAME, CHANGED, ADDED, REMOVED, FAILED } status_t;
+
+typedef struct {
+  tile_buf_t buf[2];
+  uint8_t *rgba;
+  uint8_t *plane[2];
+} worker_t;
+
+typedef struct {
+  tile_source_t src[2];
+  uint32_t z, tile_size;
+  uint32_t tiles[BATCH]; // x << 16 | y, in tile id order
+  tile_buf_t out[BATCH]; // empty for the unchanged delta tile
+  uint8_t status[BATCH];
+  size_t png_bytes[BATCH]; // of the tile in B
+  worker_t *workers;
+} job_t;
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s [--min-z Z] [--max-z Z] [--threads N] [--tile-size PX]\n"
+          "          --out FILE A B\n",
+          argv0);
+}
+
+static void delta_job(void *ctx, size_t item, uint32_t thread) {
+  job_t *j = ctx;
+  worker_t *w = &j->workers[thread];
+  uint32_t x = j->tiles[item] >> 16, y = j->tiles[item] & 0xFFFF;
+  size_t pixels = (size_t)j->tile_size * j->tile_size;
+  tile_buf_t *out = &j->out[item];
+  out->len = 0;
+
+  const uint8_t *data[2] = {NULL, NULL};
+  size_t len[2] = {0, 0};
+  bool has[2];
+  for (int i = 0; i < 2; i++)
+    has[i] = tile_source_read(&j->src[i], j->z, x, y, &w->buf[i], &data[i],
+                              &len[i]);
+  j->png_bytes[item] = len[1];
+
+  if (has[0] && has[1] && len[0] == len[1] &&
+      memcmp(data[0], data[1], len[0]) == 0) {
+    j->status[item] = SAME; // out stays empty for the shared delta tile
+    return;
+  }
+
+  // a missing tile is transparent
+  for (int i = 0; i < 2; i++) {
+    if (!has[i]) {
+      memset(w->plane[i], PALETTE_TRANSPARENT, pixels);
+    } else if (!tile_source_decode_plane(data[i], len[i], j->tile_size,
+                                         w->rgba, w->plane[i])) {
+      fprintf(stderr, "\nSkipping unreadable tile %u/%u/%u of %s\n", j->z, x,
+              y, j->src[i].path);
+      j->status[item] = FAILED;
+      return;
+    }
+  }
+  uint32_t changed;
+  if (!tile_delta_tile_encode(w->plane[0], w->plane[1], j->tile_size, out,
+                              &changed))
+    j->status[item] = FAILED;
+  else
+    j->status[item] = !changed  ? SAME
+                      : !has[0] ? ADDED
+                      : !has[1] ? REMOVED
+                                : CHANGED;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+  uint32_t min_z = 0, max_z = BASE_Z, tile_size = 1000;
+  uint32_t threads = thread_pool_default_threads();
+  const char *out = NULL, *paths[2] = {NULL, NULL};
+  int npaths = 0;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+    if (strncmp(arg, "--", 2) != 0 && npaths < 2) {
+      paths[npaths++] = arg;
+      continue;
+    }
+    if (!val) {
+      usage(argv[0]);
+      return 1;
+    }
+    i++;
+    if (strcmp(arg, "--min-z") == 0)
+      min_z = (uint32_t)atoi(val);
+    else if (strcmp(arg, "--max-z") == 0)
+      max_z = (uint32_t)atoi(val);
+    else if (strcmp(arg, "--threads") == 0)
+      threads = (uint32_t)atoi(val);
+    else if (strcmp(arg, "--tile-size") == 0)
+      tile_size = (uint32_t)atoi(val);
+    else if (strcmp(arg, "--out") == 0)
+      out = val;
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (npaths != 2 || !out || min_z > max_z || max_z > 14 || tile_size == 0 ||
+      tile_size > 0xFFFF || threads == 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  job_t *j = calloc(1, sizeof(job_t));
+  if (!j) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+  j->tile_size = tile_size;
+  for (int i = 0; i < 2; i++) {
+    if (!tile_source_open(&j->src[i], paths[i], BASE_Z)) {
+      fprintf(stderr, "Failed to open %s\n", paths[i]);
+      if (i)
+        tile_source_close(&j->src[0]);
+      return 1;
+    }
+  }
+
+  pmtiles_writer_t w;
+  if (!pmtiles_writer_init(&w, out)) {
+    fprintf(stderr, "Cannot create %s\n", out);
+    return 1;
+  }
+  w.tile_type = PMTILES_TYPE_UNKNOWN;
+
+  double start = now();
+  size_t pixels = (size_t)tile_size * tile_size;
+  j->workers = calloc(threads, sizeof(worker_t));
+  bool ok = j->workers != NULL;
+  for (uint32_t t = 0; ok && t < threads; t++) {
+    worker_t *wk = &j->workers[t];
+    wk->rgba = malloc(pixels * 4);
+    wk->plane[0] = malloc(pixels);
+    wk->plane[1] = malloc(pixels);
+    ok = wk->rgba && wk->plane[0] && wk->plane[1];
+  }
+  // what every tile with the same bytes in both releases gets, encoded from
+  // a cleared plane against itself
+  tile_buf_t unchanged = {0};
+  uint32_t changed;
+  if (ok)
+    memset(j->workers[0].plane[0], 0, pixels);
+  ok = ok && tile_delta_tile_encode(j->workers[0].plane[0],
+                                    j->workers[0].plane[0], tile_size,
+                                    &unchanged, &changed);
+
+  size_t totals[FAILED + 1] = {0};
+  uint64_t delta_bytes = 0, png_bytes = 0;
+  for (uint32_t z = min_z; ok && z <= max_z; z++) {
+    size_t dim = (size_t)1 << z;
+    uint8_t *occupied[2] = {calloc(dim * dim, 1), calloc(dim * dim, 1)};
+    ok = occupied[0] && occupied[1];
+    size_t found[2] = {0, 0};
+    for (int i = 0; ok && i < 2; i++)
+      found[i] = tile_source_scan_level(&j->src[i], z, occupied[i]);
+    if (ok && (!found[0] || !found[1])) {
+      if (found[0] || found[1])
+        fprintf(stderr, "Skipping z=%u, only %s has tiles there\n", z,
+                found[0] ? paths[0] : paths[1]);
+      free(occupied[0]);
+      free(occupied[1]);
+      continue;
+    }
+
+    // the union of both, walked in tile id order a batch at a time
+    j->z = z;
+    uint64_t first = pmtiles_tile_id(z, 0, 0), d = 0;
+    size_t level = 0;
+    while (ok && d < dim * dim) {
+      size_t n = 0;
+      for (; d < dim * dim && n < BATCH; d++) {
+        uint32_t tz, x, y;
+        pmtiles_tile_coords(first + d, &tz, &x, &y);
+        size_t at = ((size_t)y << z) + x;
+        if (occupied[0][at] | occupied[1][at])
+          j->tiles[n++] = x << 16 | y;
+      }
+      thread_pool_for(threads, n, delta_job, j);
+      for (size_t i = 0; ok && i < n; i++) {
+        totals[j->status[i]]++;
+        if (j->status[i] == FAILED)
+          continue;
+        const tile_buf_t *t = j->out[i].len ? &j->out[i] : &unchanged;
+        delta_bytes += t->len;
+        png_bytes += j->png_bytes[i];
+        ok = pmtiles_add(&w, z, j->tiles[i] >> 16, j->tiles[i] & 0xFFFF,
+                         t->data, t->len);
+      }
+      level += n;
+    }
+    fprintf(stderr, "z=%u: %zu tiles\n", z, level);
+    free(occupied[0]);
+    free(occupied[1]);
+  }
+
+  ok = ok && pmtiles_finish(&w, "{\"name\":\"wplace\",\"format\":\"wpdt\"}");
+  if (!ok)
+    fprintf(stderr, "Failed to write %s\n", out);
+  else
+    fprintf(stderr,
+            "%zu unchanged, %zu changed, %zu added, %zu removed in %.1fs: "
+            "%.1f MiB of deltas for %.1f MiB of tiles\n",
+            totals[SAME], totals[CHANGED], totals[ADDED], totals[REMOVED],
+            now() - start, (double)delta_bytes / (1 << 20),
+            (double)png_bytes / (1 << 20));
+  if (totals[FAILED])
+    fprintf(stderr, "%zu tiles failed\n", totals[FAILED]);
+
+  pmtiles_writer_destroy(&w);
+  for (uint32_t t = 0; j->workers && t < threads; t++) {
+    worker_t *wk = &j->workers[t];
+    tile_buf_free(&wk->buf[0]);
+    tile_buf_free(&wk->buf[1]);
+    free(wk->rgba);
+    free(wk->plane[0]);
+    free(wk->plane[1]);
+  }
+  for (size_t i = 0; i < BATCH; i++)
+    tile_buf_free(&j->out[i]);
+  tile_buf_free(&unchanged);
+  free(j->workers);
+  tile_source_close(&j->src[0]);
+  tile_source_close(&j->src[1]);
+  free(j);
+  return ok && !totals[FAILED] ? 0 : 1;
+}
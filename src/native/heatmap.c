@@ -0,0 +1,381 @@
+// Builds an activity heatmap pyramid from a history store: how many pixel
+// changes every area of the canvas saw across the releases ingested there.
+//
+//   heatmap --history STORE [--out DIR] [--counts DIR] [--grid N]
+//           [--threads N]
+//
+// Every z=11 tile gets an N x N grid of change counts (250 by default, 4x4
+// pixel cells of a 1000px tile). Each parent is the 2x2 sum of its four
+// children rather than the average scripts/vips.py takes for the canvas, so
+// every level adds up to the same total and a zoomed out tile still shows
+// all the activity beneath it.
+//
+// Runs are incremental. Only the releases ingested since the last run are
+// folded in, and only the ancestor chains of the tiles they touched are
+// rebuilt, in one recursive pass per subtree like pyramid. The counts are
+// kept zlib compressed in --counts, each base tile recording the newest
+// release it includes so a run cut short never counts a release twice, and
+// are rendered to --out/<z>/<x>/<y>.png coloured by changes per pixel on a
+// log scale.
+
+#define _DEFAULT_SOURCE
+#include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "thread_pool.h"
+#include "tile_history.h"
+#include "tile_io.h"
+#include "tile_png.h"
+#include "tile_reduce.h"
+
+#define BASE_Z 11
+#define SPLIT_Z 5
+#define COUNTS_MAGIC "WPHEAT01"
+
+// density range of the colour ramp, in log2 changes per pixel
+#define RAMP_MIN -14.0
+#define RAMP_MAX 3.0
+
+typedef struct {
+  char magic[8];
+  int64_t through; // newest release folded in, base tiles only
+  uint32_t grid;
+  uint32_t reserved;
+} counts_header_t;
+
+typedef struct {
+  uint32_t *levels[BASE_Z + 1]; // counts of the node being built per level
+  uint8_t *plane;               // rendered colours
+  tile_buf_t buffer;
+} worker_t;
+
+typedef struct {
+  const tile_history_t *h;
+  const char *out, *counts;
+  uint32_t grid, cell;
+  size_t first; // first release not folded in yet
+  uint8_t *dirty[BASE_Z + 1];
+  uint32_t z_job;
+  worker_t *workers;
+  atomic_size_t written[BASE_Z + 1];
+  atomic_size_t failed;
+} heatmap_t;
+
+static uint8_t heat_palette[64][4];
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s --history STORE [--out DIR] [--counts DIR] [--grid N]\n"
+          "          [--threads N]\n",
+          argv0);
+}
+
+// Transparent, then blue through cyan and yellow to red, more opaque as it
+// gets hotter.
+static void init_palette(void) {
+  static const float stops[4][5] = {{0.0f, 30, 60, 200, 110},
+                                    {0.33f, 0, 200, 220, 160},
+                                    {0.66f, 250, 220, 0, 200},
+                                    {1.0f, 230, 20, 20, 235}};
+  for (int i = 1; i < 64; i++) {
+    float t = (float)(i - 1) / 62.0f;
+    int s = t < stops[1][0] ? 0 : t < stops[2][0] ? 1 : 2;
+    float f = (t - stops[s][0]) / (stops[s + 1][0] - stops[s][0]);
+    for (int c = 0; c < 4; c++)
+      heat_palette[i][c] = (uint8_t)lrintf(stops[s][c + 1] +
+                                           f * (stops[s + 1][c + 1] -
+                                                stops[s][c + 1]));
+  }
+}
+
+static bool counts_path(const heatmap_t *m, char *out, size_t size,
+                        uint32_t z, uint32_t x, uint32_t y) {
+  int n = snprintf(out, size, "%s/%u/%u/%u.heat", m->counts, z, x, y);
+  return n > 0 && (size_t)n < size;
+}
+
+// Reads the counts of a node, false if it has none yet.
+static bool load_counts(const heatmap_t *m, worker_t *w, uint32_t z,
+                        uint32_t x, uint32_t y, uint32_t *counts,
+                        int64_t *through) {
+  char path[4096];
+  counts_header_t header;
+  uLongf len = (uLongf)m->grid * m->grid * sizeof(uint32_t);
+  if (!counts_path(m, path, sizeof(path), z, x, y) ||
+      !tile_io_read(path, &w->buffer) || w->buffer.len < sizeof(header))
+    return false;
+  memcpy(&header, w->buffer.data, sizeof(header));
+  if (memcmp(header.magic, COUNTS_MAGIC, 8) != 0 || header.grid != m->grid ||
+      uncompress((uint8_t *)counts, &len, w->buffer.data + sizeof(header),
+                 w->buffer.len - sizeof(header)) != Z_OK ||
+      len != (uLongf)m->grid * m->grid * sizeof(uint32_t)) {
+    fprintf(stderr, "\nIgnoring unreadable counts %s\n", path);
+    return false;
+  }
+  *through = header.through;
+  return true;
+}
+
+static bool save_counts(const heatmap_t *m, worker_t *w, uint32_t z,
+                        uint32_t x, uint32_t y, const uint32_t *counts,
+                        int64_t through) {
+  char path[4096];
+  size_t raw = (size_t)m->grid * m->grid * sizeof(uint32_t);
+  uLongf len = compressBound(raw);
+  counts_header_t header = {.through = through, .grid = m->grid};
+  memcpy(header.magic, COUNTS_MAGIC, 8);
+  if (!counts_path(m, path, sizeof(path), z, x, y) ||
+      !tile_buf_reserve(&w->buffer, sizeof(header) + len))
+    return false;
+  memcpy(w->buffer.data, &header, sizeof(header));
+  return compress2(w->buffer.data + sizeof(header), &len,
+                   (const uint8_t *)counts, raw, 6) == Z_OK &&
+         tile_io_mkdirs_for(path) &&
+         tile_io_write(path, w->buffer.data, sizeof(header) + len);
+}
+
+// Colours by changes per pixel, so all levels share one scale.
+static bool render(heatmap_t *m, worker_t *w, uint32_t z, uint32_t x,
+                   uint32_t y, const uint32_t *counts) {
+  double cell_pixels = (double)m->cell * m->cell * (double)(1u << (BASE_Z - z)) *
+                       (double)(1u << (BASE_Z - z));
+  size_t cells = (size_t)m->grid * m->grid;
+  for (size_t i = 0; i < cells; i++) {
+    if (!counts[i]) {
+      w->plane[i] = 0;
+      continue;
+    }
+    double t = (log2((double)counts[i] / cell_pixels) - RAMP_MIN) /
+               (RAMP_MAX - RAMP_MIN);
+    t = t < 0 ? 0 : t > 1 ? 1 : t;
+    w->plane[i] = (uint8_t)(1 + lrint(t * 62));
+  }
+
+  char path[4096];
+  uint8_t *png;
+  size_t png_len;
+  if (!tile_io_path(path, sizeof(path), m->out, z, x, y) ||
+      !tile_io_mkdirs_for(path) ||
+      !tile_png_encode_indexed(w->plane, m->grid, m->grid, m->grid,
+                               (const uint8_t(*)[4])heat_palette, 64, 6,
+                               TILE_PNG_FAST, &png, &png_len))
+    return false;
+  bool ok = tile_io_write(path, png, png_len);
+  free(png);
+  return ok;
+}
+
+// Adds the releases from first on that the base tile has not seen yet.
+static bool fold_base(heatmap_t *m, worker_t *w, uint32_t x, uint32_t y,
+                      uint32_t *counts, int64_t *through) {
+  const tile_history_t *h = m->h;
+  if (!load_counts(m, w, BASE_Z, x, y, counts, through)) {
+    memset(counts, 0, (size_t)m->grid * m->grid * sizeof(uint32_t));
+    *through = INT64_MIN;
+  }
+  for (size_t i = m->first; i < h->release_count; i++) {
+    if (h->releases[i].time > *through &&
+        !tile_history_count_cells(h, i, x, y, m->cell, counts))
+      return false;
+  }
+  *through = h->releases[h->release_count - 1].time;
+  return true;
+}
+
+static bool is_dirty(const heatmap_t *m, uint32_t z, uint32_t x, uint32_t y) {
+  return m->dirty[z][((size_t)y << z) + x] != 0;
+}
+
+// Brings the counts of a dirty node up to date into w->levels[z], from its
+// dirty children built here and the others read back, and writes them.
+static bool build_node(heatmap_t *m, worker_t *w, uint32_t z, uint32_t x,
+                       uint32_t y) {
+  uint32_t *counts = w->levels[z];
+  int64_t through = 0;
+  bool ok;
+  if (z == BASE_Z) {
+    ok = fold_base(m, w, x, y, counts, &through);
+  } else {
+    uint32_t *child = w->levels[z + 1], half = m->grid / 2;
+    int64_t unused;
+    memset(counts, 0, (size_t)m->grid * m->grid * sizeof(uint32_t));
+    ok = true;
+    for (uint32_t q = 0; q < 4 && ok; q++) {
+      uint32_t cx = x * 2 + (q & 1), cy = y * 2 + (q >> 1);
+      bool has = is_dirty(m, z + 1, cx, cy)
+                     ? (ok = build_node(m, w, z + 1, cx, cy))
+                     : load_counts(m, w, z + 1, cx, cy, child, &unused);
+      if (has)
+        tile_reduce_sum_u32(child, m->grid, m->grid, m->grid,
+                            counts + (size_t)(q >> 1) * half * m->grid +
+                                (q & 1) * half,
+                            m->grid);
+    }
+  }
+  ok = ok && save_counts(m, w, z, x, y, counts, through) &&
+       render(m, w, z, x, y, counts);
+  m->dirty[z][((size_t)y << z) + x] = 0;
+  if (ok)
+    atomic_fetch_add(&m->written[z], 1);
+  else
+    atomic_fetch_add(&m->failed, 1);
+  return ok;
+}
+
+static void build_job(void *ctx, size_t item, uint32_t thread) {
+  heatmap_t *m = ctx;
+  uint32_t dim = 1u << m->z_job;
+  uint32_t x = (uint32_t)(item % dim), y = (uint32_t)(item / dim);
+  if (is_dirty(m, m->z_job, x, y))
+    build_node(m, &m->workers[thread], m->z_job, x, y);
+}
+
+// The time of the newest release of the last run, from counts/last.
+static bool read_last(const heatmap_t *m, int64_t *last) {
+  char path[4096];
+  tile_buf_t b = {0};
+  snprintf(path, sizeof(path), "%s/last", m->counts);
+  bool ok = tile_io_read(path, &b) && tile_buf_reserve(&b, b.len + 1);
+  if (ok) {
+    b.data[b.len] = 0;
+    *last = strtoll((const char *)b.data, NULL, 10);
+  }
+  tile_buf_free(&b);
+  return ok;
+}
+
+static bool write_last(const heatmap_t *m, int64_t last) {
+  char path[4096], text[32];
+  snprintf(path, sizeof(path), "%s/last", m->counts);
+  int n = snprintf(text, sizeof(text), "%lld\n", (long long)last);
+  return tile_io_mkdirs_for(path) &&
+         tile_io_write(path, (const uint8_t *)text, (size_t)n);
+}
+
+int main(int argc, char **argv) {
+  const char *store = NULL, *out = "public/tiles/heatmap",
+             *counts = "heatmap_counts";
+  uint32_t grid = 250, threads = thread_pool_default_threads();
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[++i] : NULL;
+    if (!val) {
+      usage(argv[0]);
+      return 1;
+    }
+    if (strcmp(arg, "--history") == 0)
+      store = val;
+    else if (strcmp(arg, "--out") == 0)
+      out = val;
+    else if (strcmp(arg, "--counts") == 0)
+      counts = val;
+    else if (strcmp(arg, "--grid") == 0)
+      grid = (uint32_t)atoi(val);
+    else if (strcmp(arg, "--threads") == 0)
+      threads = (uint32_t)atoi(val);
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (!store || grid < 2 || grid % 2 || threads == 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  tile_history_t h;
+  if (!tile_history_open(&h, store, 0, false)) {
+    fprintf(stderr, "Failed to open %s\n", store);
+    return 1;
+  }
+  if (h.tile_size % grid) {
+    fprintf(stderr, "--grid %u does not divide the %upx tiles\n", grid,
+            h.tile_size);
+    return 1;
+  }
+  heatmap_t m = {.h = &h, .out = out, .counts = counts, .grid = grid,
+                 .cell = h.tile_size / grid};
+  int64_t last;
+  if (read_last(&m, &last)) {
+    while (m.first < h.release_count && h.releases[m.first].time <= last)
+      m.first++;
+  }
+  if (m.first == h.release_count) {
+    fprintf(stderr, "No releases since the last run\n");
+    tile_history_close(&h);
+    return 0;
+  }
+
+  bool ok = true;
+  for (uint32_t z = 0; z <= BASE_Z && ok; z++)
+    ok = (m.dirty[z] = calloc((size_t)1 << (z * 2), 1)) != NULL;
+  m.workers = ok ? calloc(threads, sizeof(worker_t)) : NULL;
+  ok = m.workers != NULL;
+  for (uint32_t t = 0; ok && t < threads; t++) {
+    worker_t *w = &m.workers[t];
+    for (uint32_t z = 0; ok && z <= BASE_Z; z++)
+      ok = (w->levels[z] = malloc((size_t)grid * grid * 4)) != NULL;
+    ok = ok && (w->plane = malloc((size_t)grid * grid)) != NULL;
+  }
+  if (!ok) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+  init_palette();
+
+  // the touched base tiles and their ancestors
+  size_t touched = 0;
+  for (size_t i = m.first; i < h.release_count; i++) {
+    for (uint32_t k = 0; k < h.releases[i].count; k++) {
+      uint32_t tile = h.releases[i].entries[k].tile;
+      uint32_t x = tile >> 16, y = tile & 0xFFFF;
+      if (x >> BASE_Z || y >> BASE_Z)
+        continue;
+      uint8_t *flag = &m.dirty[BASE_Z][((size_t)y << BASE_Z) + x];
+      touched += !*flag;
+      *flag = 1;
+    }
+  }
+  for (uint32_t z = BASE_Z; z > 0; z--) {
+    uint32_t dim = 1u << z;
+    for (size_t i = 0; i < (size_t)dim * dim; i++) {
+      if (m.dirty[z][i])
+        m.dirty[z - 1][(i / dim / 2) * (dim / 2) + i % dim / 2] = 1;
+    }
+  }
+  fprintf(stderr, "Folding %zu releases touching %zu tiles into %s\n",
+          h.release_count - m.first, touched, counts);
+
+  // subtrees below SPLIT_Z in parallel, then the levels above them, whose
+  // children are on disk by then
+  for (int32_t z = SPLIT_Z; z >= 0; z--) {
+    m.z_job = (uint32_t)z;
+    thread_pool_for(threads, (size_t)1 << (z * 2), build_job, &m);
+  }
+
+  for (uint32_t z = BASE_Z + 1; z-- > 0;)
+    fprintf(stderr, "Heatmap z=%u: %zu tiles written\n", z,
+            atomic_load(&m.written[z]));
+  size_t failed = atomic_load(&m.failed);
+  if (failed)
+    fprintf(stderr, "%zu tiles failed, run again to retry\n", failed);
+  else if (!write_last(&m, h.releases[h.release_count - 1].time))
+    failed = 1;
+
+  for (uint32_t t = 0; t < threads; t++) {
+    for (uint32_t z = 0; z <= BASE_Z; z++)
+      free(m.workers[t].levels[z]);
+    free(m.workers[t].plane);
+    tile_buf_free(&m.workers[t].buffer);
+  }
+  free(m.workers);
+  for (uint32_t z = 0; z <= BASE_Z; z++)
+    free(m.dirty[z]);
+  tile_history_close(&h);
+  return failed ? 1 : 0;
+}
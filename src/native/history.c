@@ -0,0 +1,409 @@
+// Keeps the pixel change history of the z=11 base tiles and answers when a
+// pixel changed and to what.
+//
+//   history ingest STORE --time MS [--previous PREV] [--threads N]
+//                  [--tile-size PX] [--keyframe-every N] RELEASE
+//   history pixel STORE X Y
+//   history tile STORE X Y MS > tile.png
+//   history frames STORE X Y DIR
+//   history info STORE
+//
+// Releases are ingested oldest first, each against the one before it (an
+// extracted directory, release tar or PMTiles archive like tilediff takes),
+// and only the pixels that differ are stored, or the whole tile, compressed,
+// where that takes less room. Without --previous the release is compared
+// with an empty canvas, which is how the first one goes into an empty store;
+// --previous is refused there, as the store would start from a diff.
+//
+// Every --keyframe-every releases (24 by default, 0 for never) the whole
+// release is stored as well, so that tile can rebuild tile X,Y of z=11 as it
+// was at any time from the keyframe before it and at most that many patches.
+// frames writes the tile at every release that changed it to DIR/<time>.png,
+// stepping forward from the last state rebuilt.
+//
+// pixel takes the global pixel coordinates of z=11 and prints every change
+// as "time index", oldest first, the palette index being the colour the
+// pixel took at that release.
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "palette.h"
+#include "thread_pool.h"
+#include "tile_history.h"
+#include "tile_png.h"
+#include "tile_source.h"
+
+#define BASE_Z 11
+
+typedef struct {
+  tile_buf_t buf[2], patch;
+  uint8_t *rgba;
+  uint8_t *plane[2];
+} worker_t;
+
+typedef struct {
+  tile_source_t src[2]; // previous, current
+  bool has_previous;
+  uint32_t tile_size;
+  uint32_t *tiles; // x << 16 | y of every tile in either release
+  size_t count;
+  tile_history_batch_t batch;
+  worker_t *workers;
+  size_t failed; // tiles, counted under the batch lock
+} job_t;
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s ingest STORE --time MS [--previous PREV] [--threads N]\n"
+          "                 [--tile-size PX] [--keyframe-every N] RELEASE\n"
+          "       %s pixel STORE X Y\n"
+          "       %s tile STORE X Y MS\n"
+          "       %s frames STORE X Y DIR\n"
+          "       %s info STORE\n",
+          argv0, argv0, argv0, argv0, argv0);
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void ingest_job(void *ctx, size_t item, uint32_t thread) {
+  job_t *j = ctx;
+  worker_t *w = &j->workers[thread];
+  uint32_t x = j->tiles[item] >> 16, y = j->tiles[item] & 0xFFFF;
+  size_t pixels = (size_t)j->tile_size * j->tile_size;
+
+  const uint8_t *data[2] = {NULL, NULL};
+  size_t len[2] = {0, 0};
+  bool has[2] = {false, false};
+  for (int i = 0; i < 2; i++) {
+    if (i || j->has_previous)
+      has[i] = tile_source_read(&j->src[i], BASE_Z, x, y, &w->buf[i],
+                                &data[i], &len[i]);
+  }
+  bool same = has[0] && has[1] && len[0] == len[1] &&
+              memcmp(data[0], data[1], len[0]) == 0;
+  if (same && !j->batch.keyframe)
+    return;
+
+  // a missing tile is transparent
+  for (int i = same ? 1 : 0; i < 2; i++) {
+    if (!has[i]) {
+      memset(w->plane[i], PALETTE_TRANSPARENT, pixels);
+    } else if (!tile_source_decode_plane(data[i], len[i], j->tile_size,
+                                         w->rgba, w->plane[i])) {
+      fprintf(stderr, "\nUnreadable tile %u/%u/%u of %s\n", BASE_Z, x, y,
+              j->src[i].path);
+      pthread_mutex_lock(&j->batch.lock);
+      j->failed++;
+      j->batch.failed = true;
+      pthread_mutex_unlock(&j->batch.lock);
+      return;
+    }
+  }
+  if ((!same && !tile_history_add(&j->batch, x, y, w->plane[0],
+                                 w->plane[1], &w->patch)) ||
+      (j->batch.keyframe && has[1] &&
+       !tile_history_add_keyframe(&j->batch, x, y, w->plane[1], &w->patch))) {
+    pthread_mutex_lock(&j->batch.lock);
+    j->failed++;
+    pthread_mutex_unlock(&j->batch.lock);
+  }
+}
+
+// Every tile of either release, x major like the tar and directory order.
+static bool collect_tiles(job_t *j) {
+  size_t dim = (size_t)1 << BASE_Z;
+  uint8_t *occupied = calloc(dim * dim, 1);
+  if (!occupied)
+    return false;
+  for (int i = j->has_previous ? 0 : 1; i < 2; i++) {
+    size_t found = tile_source_scan_level(&j->src[i], BASE_Z, occupied);
+    fprintf(stderr, "Found %zu tiles in %s\n", found, j->src[i].path);
+  }
+  for (size_t i = 0; i < dim * dim; i++)
+    j->count += occupied[i];
+  j->tiles = malloc((j->count ? j->count : 1) * sizeof(uint32_t));
+  size_t n = 0;
+  for (size_t x = 0; j->tiles && x < dim; x++) {
+    for (size_t y = 0; y < dim; y++) {
+      if (occupied[y * dim + x])
+        j->tiles[n++] = (uint32_t)(x << 16 | y);
+    }
+  }
+  free(occupied);
+  return j->tiles != NULL;
+}
+
+static int ingest(int argc, char **argv) {
+  const char *store = argc > 2 ? argv[2] : NULL, *previous = NULL,
+             *release = NULL;
+  uint32_t threads = thread_pool_default_threads(), tile_size = 1000;
+  uint32_t keyframe_every = 24;
+  long long time = -1;
+  for (int i = 3; i < argc; i++) {
+    const char *arg = argv[i];
+    if (strncmp(arg, "--", 2) != 0 && !release) {
+      release = arg;
+      continue;
+    }
+    const char *val = i + 1 < argc ? argv[++i] : NULL;
+    if (!val)
+      return 2;
+    if (strcmp(arg, "--time") == 0)
+      time = atoll(val);
+    else if (strcmp(arg, "--previous") == 0)
+      previous = val;
+    else if (strcmp(arg, "--threads") == 0)
+      threads = (uint32_t)atoi(val);
+    else if (strcmp(arg, "--tile-size") == 0)
+      tile_size = (uint32_t)atoi(val);
+    else if (strcmp(arg, "--keyframe-every") == 0)
+      keyframe_every = (uint32_t)atoi(val);
+    else
+      return 2;
+  }
+  if (!store || !release || time < 0 || threads == 0 || tile_size == 0 ||
+      tile_size > 0xFFFF)
+    return 2;
+
+  tile_history_t h;
+  if (!tile_history_open(&h, store, tile_size, true)) {
+    fprintf(stderr, "Failed to open %s for %upx tiles\n", store, tile_size);
+    return 1;
+  }
+  // the patches of the first release must rebuild it from an empty canvas
+  if (previous && !h.release_count) {
+    fprintf(stderr, "%s is empty, its first release is ingested without "
+                    "--previous\n", store);
+    tile_history_close(&h);
+    return 1;
+  }
+  job_t j = {.tile_size = tile_size, .has_previous = previous != NULL};
+  bool keyframe = keyframe_every &&
+                  tile_history_since_keyframe(&h) + 1 >= keyframe_every;
+  if (!tile_history_begin(&h, time, keyframe, &j.batch)) {
+    fprintf(stderr, "%s already has a release at or after %lld\n", store, time);
+    tile_history_close(&h);
+    return 1;
+  }
+  const char *failed = NULL;
+  if (previous && !tile_source_open(&j.src[0], previous, BASE_Z))
+    failed = previous;
+  else if (!tile_source_open(&j.src[1], release, BASE_Z))
+    failed = release;
+  if (failed) {
+    fprintf(stderr, "Failed to open %s\n", failed);
+    tile_source_close(&j.src[0]);
+    tile_history_abort(&j.batch);
+    tile_history_close(&h);
+    return 1;
+  }
+
+  double start = now();
+  size_t pixels = (size_t)tile_size * tile_size;
+  j.workers = calloc(threads, sizeof(worker_t));
+  bool ok = j.workers != NULL;
+  for (uint32_t t = 0; ok && t < threads; t++) {
+    worker_t *w = &j.workers[t];
+    w->rgba = malloc(pixels * 4);
+    w->plane[0] = malloc(pixels);
+    w->plane[1] = malloc(pixels);
+    ok = w->rgba && w->plane[0] && w->plane[1];
+  }
+  ok = ok && collect_tiles(&j);
+  if (!ok) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+
+  size_t before = h.data_len;
+  thread_pool_for(threads, j.count, ingest_job, &j);
+  size_t patches = j.batch.count;
+  ok = tile_history_commit(&j.batch);
+  if (ok)
+    fprintf(stderr,
+            "Ingested %lld%s: %zu of %zu tiles changed, %zu bytes in %.1fs, "
+            "%zu releases in %s\n",
+            time, keyframe ? " with a keyframe" : "", patches, j.count,
+            h.data_len - before, now() - start, h.release_count, store);
+  else
+    fprintf(stderr, "Failed to ingest %s, %zu tiles failed\n", release,
+            j.failed);
+
+  for (uint32_t t = 0; t < threads; t++) {
+    worker_t *w = &j.workers[t];
+    tile_buf_free(&w->buf[0]);
+    tile_buf_free(&w->buf[1]);
+    tile_buf_free(&w->patch);
+    free(w->rgba);
+    free(w->plane[0]);
+    free(w->plane[1]);
+  }
+  free(j.workers);
+  free(j.tiles);
+  tile_source_close(&j.src[0]);
+  tile_source_close(&j.src[1]);
+  tile_history_close(&h);
+  return ok ? 0 : 1;
+}
+
+static int pixel(const char *store, uint32_t px, uint32_t py) {
+  tile_history_t h;
+  if (!tile_history_open(&h, store, 0, false)) {
+    fprintf(stderr, "Failed to open %s\n", store);
+    return 1;
+  }
+  uint32_t size = h.tile_size;
+  double start = now();
+  size_t n = tile_history_pixel(&h, px / size, py / size, px % size,
+                                py % size, NULL, 0);
+  tile_history_change_t *changes =
+      n == SIZE_MAX ? NULL : malloc((n ? n : 1) * sizeof(*changes));
+  if (changes)
+    n = tile_history_pixel(&h, px / size, py / size, px % size, py % size,
+                           changes, n);
+  double took = now() - start;
+
+  int ret = 0;
+  if (!changes || n == SIZE_MAX) {
+    fprintf(stderr, "Failed to read the history of %u,%u\n", px, py);
+    ret = 1;
+  } else {
+    for (size_t i = 0; i < n; i++)
+      printf("%lld %u\n", (long long)changes[i].time, changes[i].index);
+    fprintf(stderr, "%zu changes over %zu releases in %.0fus\n", n,
+            h.release_count, took * 1e6);
+  }
+  free(changes);
+  tile_history_close(&h);
+  return ret;
+}
+
+static bool write_tile(const char *path, const uint8_t *plane,
+                       uint32_t size) {
+  uint8_t *png;
+  size_t png_len;
+  if (!tile_png_encode_indexed(plane, size, size, size, wplace_palette,
+                               PALETTE_SIZE, 6, TILE_PNG_FAST, &png,
+                               &png_len))
+    return false;
+  bool ok = path ? tile_io_write(path, png, png_len)
+                 : fwrite(png, 1, png_len, stdout) == png_len;
+  free(png);
+  return ok;
+}
+
+static int tile(const char *store, uint32_t x, uint32_t y, long long time) {
+  tile_history_t h;
+  if (!tile_history_open(&h, store, 0, false)) {
+    fprintf(stderr, "Failed to open %s\n", store);
+    return 1;
+  }
+  uint8_t *plane = malloc((size_t)h.tile_size * h.tile_size);
+  double start = now();
+  bool ok = plane && tile_history_plane(&h, x, y, time, plane);
+  double took = now() - start;
+  if (ok)
+    ok = write_tile(NULL, plane, h.tile_size);
+  if (ok)
+    fprintf(stderr, "Rebuilt %u/%u/%u at %lld in %.1fms\n", BASE_Z, x, y, time,
+            took * 1e3);
+  else
+    fprintf(stderr, "Failed to rebuild %u/%u/%u at %lld\n", BASE_Z, x, y, time);
+  free(plane);
+  tile_history_close(&h);
+  return ok ? 0 : 1;
+}
+
+static int frames(const char *store, uint32_t x, uint32_t y, const char *dir) {
+  tile_history_t h;
+  tile_history_cache_t cache;
+  if (!tile_history_open(&h, store, 0, false)) {
+    fprintf(stderr, "Failed to open %s\n", store);
+    return 1;
+  }
+  uint8_t *plane = malloc((size_t)h.tile_size * h.tile_size);
+  bool ok = plane && tile_history_cache_init(&cache, &h, 4);
+  size_t written = 0;
+  double start = now();
+  for (size_t i = 0; ok && i < h.release_count; i++) {
+    const tile_history_release_t *r = &h.releases[i];
+    if (!tile_history_find(r, x << 16 | y))
+      continue;
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%lld.png", dir, (long long)r->time);
+    ok = tile_history_cache_plane(&cache, x, y, r->time, plane) &&
+         tile_io_mkdirs_for(path) && write_tile(path, plane, h.tile_size);
+    written += ok;
+  }
+  if (ok)
+    fprintf(stderr, "Wrote %zu frames of %u/%u/%u to %s in %.1fs\n", written,
+            BASE_Z, x, y, dir, now() - start);
+  else
+    fprintf(stderr, "Failed to rebuild %u/%u/%u\n", BASE_Z, x, y);
+  if (plane)
+    tile_history_cache_free(&cache);
+  free(plane);
+  tile_history_close(&h);
+  return ok ? 0 : 1;
+}
+
+static int info(const char *store) {
+  tile_history_t h;
+  if (!tile_history_open(&h, store, 0, false)) {
+    fprintf(stderr, "Failed to open %s\n", store);
+    return 1;
+  }
+  uint64_t patches = 0, patch_bytes = 0, planes = 0, keys = 0, key_bytes = 0;
+  for (size_t i = 0; i < h.release_count; i++) {
+    patches += h.releases[i].count;
+    for (uint32_t k = 0; k < h.releases[i].count; k++) {
+      uint32_t length = h.releases[i].entries[k].length;
+      planes += (length & TILE_HISTORY_PLANE) != 0;
+      patch_bytes += length & ~TILE_HISTORY_PLANE;
+    }
+  }
+  for (size_t i = 0; i < h.keyframe_count; i++) {
+    keys += h.keyframes[i].count;
+    for (uint32_t k = 0; k < h.keyframes[i].count; k++)
+      key_bytes += h.keyframes[i].entries[k].length;
+  }
+  printf("%upx tiles, %zu releases", h.tile_size, h.release_count);
+  if (h.release_count)
+    printf(" from %lld to %lld", (long long)h.releases[0].time,
+           (long long)h.releases[h.release_count - 1].time);
+  printf("\n%llu tile patches, %llu of them whole planes, %llu bytes\n",
+         (unsigned long long)patches, (unsigned long long)planes,
+         (unsigned long long)patch_bytes);
+  printf("%zu keyframes, %llu tiles, %llu bytes\n", h.keyframe_count,
+         (unsigned long long)keys, (unsigned long long)key_bytes);
+  printf("%zu bytes of index\n", h.index_len);
+  tile_history_close(&h);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int ret = 2;
+  if (argc >= 2 && strcmp(argv[1], "ingest") == 0)
+    ret = ingest(argc, argv);
+  else if (argc == 5 && strcmp(argv[1], "pixel") == 0)
+    ret = pixel(argv[2], (uint32_t)atoi(argv[3]), (uint32_t)atoi(argv[4]));
+  else if (argc == 6 && strcmp(argv[1], "tile") == 0)
+    ret = tile(argv[2], (uint32_t)atoi(argv[3]), (uint32_t)atoi(argv[4]),
+               atoll(argv[5]));
+  else if (argc == 6 && strcmp(argv[1], "frames") == 0)
+    ret = frames(argv[2], (uint32_t)atoi(argv[3]), (uint32_t)atoi(argv[4]),
+                 argv[5]);
+  else if (argc == 3 && strcmp(argv[1], "info") == 0)
+    ret = info(argv[2]);
+  if (ret == 2)
+    usage(argv[0]);
+  return ret;
+}
@@ -0,0 +1,346 @@
+#include "mercator.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MERCATOR_X86 1
+#endif
+
+// The scalar and AVX2 code do the same operations in the same order, without
+// fused multiply adds, so they agree to the bit. Divisions by constants are
+// multiplications by the reciprocal, a division costs as much as the whole
+// polynomial.
+
+#define PI 3.14159265358979323846
+#define DEG (180.0 / PI)
+#define RAD (PI / 180.0)
+#define MAX_LAT 85.05112878 // clampLat of mercator.ts
+#define MAX_T 40.0 // exp(-40) is below the precision of the result anyway
+#define LOG2E 1.44269504088896340736
+#define LN2_HI 6.93147180369123816490e-01 // ln 2 = LN2_HI + LN2_LO, the
+#define LN2_LO 1.90821492927058770002e-10 // first exact in k * LN2_HI
+#define SQRT2 1.41421356237309504880
+
+// Taylor coefficients, highest power first. Past the reductions below the
+// first left out term is under 1e-18 in every case.
+static const double exp_c[] = {
+    1.0 / 6227020800.0, 1.0 / 479001600.0, 1.0 / 39916800.0,
+    1.0 / 3628800.0,    1.0 / 362880.0,    1.0 / 40320.0,
+    1.0 / 5040.0,       1.0 / 720.0,       1.0 / 120.0,
+    1.0 / 24.0,         1.0 / 6.0,         1.0 / 2.0,
+    1.0,                1.0}; // e^r, |r| <= ln 2 / 2
+static const double atan_c[] = {
+    1.0 / 25.0,  -1.0 / 23.0, 1.0 / 21.0, -1.0 / 19.0, 1.0 / 17.0,
+    -1.0 / 15.0, 1.0 / 13.0,  -1.0 / 11.0, 1.0 / 9.0,  -1.0 / 7.0,
+    1.0 / 5.0,   -1.0 / 3.0,  1.0}; // atan(v) / v in v^2, v <= tan(pi / 16)
+static const double sin_c[] = {
+    -1.0 / 25852016738884976640000.0, 1.0 / 51090942171709440000.0,
+    -1.0 / 121645100408832000.0,      1.0 / 355687428096000.0,
+    -1.0 / 1307674368000.0,           1.0 / 6227020800.0,
+    -1.0 / 39916800.0,                1.0 / 362880.0,
+    -1.0 / 5040.0,                    1.0 / 120.0,
+    -1.0 / 6.0,                       1.0}; // sin(p) / p in p^2, p <= 1.485
+static const double log_c[] = {
+    1.0 / 25.0, 1.0 / 23.0, 1.0 / 21.0, 1.0 / 19.0, 1.0 / 17.0,
+    1.0 / 15.0, 1.0 / 13.0, 1.0 / 11.0, 1.0 / 9.0,  1.0 / 7.0,
+    1.0 / 5.0,  1.0 / 3.0,  1.0}; // atanh(f) / f in f^2, |f| <= 0.172
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+static int g_simd = -1; // -1 = not probed yet
+
+void mercator_set_simd(bool enabled) {
+#ifdef MERCATOR_X86
+  g_simd = enabled && __builtin_cpu_supports("avx2");
+#else
+  (void)enabled;
+  g_simd = 0;
+#endif
+}
+
+bool mercator_simd_active(void) {
+  if (g_simd < 0)
+    mercator_set_simd(true);
+  return g_simd == 1;
+}
+
+static double horner(const double *c, size_t n, double x) {
+  double p = c[0];
+  for (size_t i = 1; i < n; i++)
+    p = p * x + c[i];
+  return p;
+}
+
+// e^-a for 0 <= a <= MAX_T
+static double exp_neg(double a) {
+  double k = floor(a * LOG2E + 0.5);
+  double r = (k * LN2_HI - a) + k * LN2_LO;
+  uint64_t bits = (uint64_t)(1023 - (int64_t)k) << 52;
+  double scale;
+  memcpy(&scale, &bits, 8);
+  return horner(exp_c, COUNT(exp_c), r) * scale;
+}
+
+// atan(u) for 0 <= u <= 1, halving the angle twice
+static double atan01(double u) {
+  u = u / (1.0 + sqrt(1.0 + u * u));
+  u = u / (1.0 + sqrt(1.0 + u * u));
+  return 4.0 * (u * horner(atan_c, COUNT(atan_c), u * u));
+}
+
+// ln q for 1 <= q < 2^1023
+static double log_ge1(double q) {
+  uint64_t bits;
+  memcpy(&bits, &q, 8);
+  double e = (double)(bits >> 52) - 1023.0;
+  bits = (bits & 0xFFFFFFFFFFFFFull) | 0x3FF0000000000000ull;
+  double m;
+  memcpy(&m, &bits, 8);
+  if (m > SQRT2) {
+    m = m * 0.5;
+    e = e + 1.0;
+  }
+  double f = (m - 1.0) / (m + 1.0);
+  double ln_m = 2.0 * (f * horner(log_c, COUNT(log_c), f * f));
+  return e * LN2_HI + (e * LN2_LO + ln_m);
+}
+
+// inv_n = 1 / 2^z, inv_scale = 1 / scale
+static void tl_px_to_gps(const double *in, double inv_n, double inv_scale,
+                         double *out) {
+  double x = in[0] + in[2] * inv_scale, y = in[1] + in[3] * inv_scale;
+  out[1] = x * inv_n * 360.0 - 180.0;
+
+  // lat = atan(sinh(t)) = sign(t) (pi / 2 - 2 atan(e^-|t|))
+  double t = PI * (1.0 - 2.0 * y * inv_n);
+  // a NaN stays one instead of clamping to a pole
+  bool nan = !(t == t);
+  double a = fabs(t);
+  a = nan ? 0.0 : a < MAX_T ? a : MAX_T;
+  double lat = PI / 2 - 2.0 * atan01(exp_neg(a));
+  out[0] = nan ? t : copysign(lat, t) * DEG;
+}
+
+static void split(double v, double scale, double *tile, double *px) {
+  double t = floor(v);
+  double p = floor((v - t) * scale + 0.5);
+  if (p == scale) {
+    t = t + 1.0;
+    p = 0.0;
+  }
+  *tile = t;
+  *px = p;
+}
+
+static void gps_to_tl_px(const double *in, double n, double scale,
+                         double *out) {
+  // a NaN stays one instead of clamping to a pole
+  bool nan = !(in[0] == in[0]);
+  double lat = nan ? 0.0 : in[0] < MAX_LAT ? in[0] : MAX_LAT;
+  lat = lat > -MAX_LAT ? lat : -MAX_LAT;
+  double p = lat * RAD;
+  double x = (in[1] + 180.0) * (n / 360.0);
+
+  // ln(tan p + sec p) = sign(p) ln((1 + s) / (1 - s)) / 2, s = sin |p|
+  double a = fabs(p), a2 = a * a;
+  double s = a * horner(sin_c, COUNT(sin_c), a2);
+  double merc = copysign(0.5 * log_ge1((1.0 + s) / (1.0 - s)), p);
+  double y = nan ? in[0] : (1.0 - merc * (1.0 / PI)) * (n * 0.5);
+
+  split(x, scale, &out[0], &out[2]);
+  split(y, scale, &out[1], &out[3]);
+}
+
+#ifdef MERCATOR_X86
+
+typedef struct {
+  __m256d v[4];
+} rows_t;
+
+__attribute__((target("avx2"))) static inline rows_t transpose(rows_t q) {
+  __m256d t0 = _mm256_unpacklo_pd(q.v[0], q.v[1]);
+  __m256d t1 = _mm256_unpackhi_pd(q.v[0], q.v[1]);
+  __m256d t2 = _mm256_unpacklo_pd(q.v[2], q.v[3]);
+  __m256d t3 = _mm256_unpackhi_pd(q.v[2], q.v[3]);
+  return (rows_t){{_mm256_permute2f128_pd(t0, t2, 0x20),
+                   _mm256_permute2f128_pd(t1, t3, 0x20),
+                   _mm256_permute2f128_pd(t0, t2, 0x31),
+                   _mm256_permute2f128_pd(t1, t3, 0x31)}};
+}
+
+__attribute__((target("avx2"))) static inline __m256d
+horner_avx2(const double *c, size_t n, __m256d x) {
+  __m256d p = _mm256_set1_pd(c[0]);
+  for (size_t i = 1; i < n; i++)
+    p = _mm256_add_pd(_mm256_mul_pd(p, x), _mm256_set1_pd(c[i]));
+  return p;
+}
+
+__attribute__((target("avx2"))) static inline __m256d exp_neg_avx2(__m256d a) {
+  const __m256d magic = _mm256_set1_pd(6755399441055744.0); // 1.5 * 2^52
+  __m256d k = _mm256_floor_pd(_mm256_add_pd(
+      _mm256_mul_pd(a, _mm256_set1_pd(LOG2E)), _mm256_set1_pd(0.5)));
+  __m256d r = _mm256_add_pd(
+      _mm256_sub_pd(_mm256_mul_pd(k, _mm256_set1_pd(LN2_HI)), a),
+      _mm256_mul_pd(k, _mm256_set1_pd(LN2_LO)));
+  // k in the low bits of k + magic
+  __m256i ki = _mm256_sub_epi64(_mm256_castpd_si256(_mm256_add_pd(k, magic)),
+                                _mm256_castpd_si256(magic));
+  __m256i bits =
+      _mm256_slli_epi64(_mm256_sub_epi64(_mm256_set1_epi64x(1023), ki), 52);
+  return _mm256_mul_pd(horner_avx2(exp_c, COUNT(exp_c), r),
+                       _mm256_castsi256_pd(bits));
+}
+
+__attribute__((target("avx2"))) static inline __m256d atan01_avx2(__m256d u) {
+  const __m256d one = _mm256_set1_pd(1.0);
+  for (int i = 0; i < 2; i++)
+    u = _mm256_div_pd(u, _mm256_add_pd(one, _mm256_sqrt_pd(_mm256_add_pd(
+                                                one, _mm256_mul_pd(u, u)))));
+  __m256d p = horner_avx2(atan_c, COUNT(atan_c), _mm256_mul_pd(u, u));
+  return _mm256_mul_pd(_mm256_set1_pd(4.0), _mm256_mul_pd(u, p));
+}
+
+__attribute__((target("avx2"))) static inline __m256d log_ge1_avx2(__m256d q) {
+  const __m256d one = _mm256_set1_pd(1.0);
+  const __m256d magic = _mm256_set1_pd(4503599627370496.0); // 2^52
+  __m256i bits = _mm256_castpd_si256(q);
+  // the exponent field as a double through the mantissa of 2^52
+  __m256d e = _mm256_sub_pd(
+      _mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(bits, 52),
+                                          _mm256_castpd_si256(magic))),
+      magic);
+  e = _mm256_sub_pd(e, _mm256_set1_pd(1023.0));
+  __m256d m = _mm256_castsi256_pd(_mm256_or_si256(
+      _mm256_and_si256(bits, _mm256_set1_epi64x(0xFFFFFFFFFFFFFll)),
+      _mm256_castpd_si256(one)));
+  __m256d big = _mm256_cmp_pd(m, _mm256_set1_pd(SQRT2), _CMP_GT_OQ);
+  m = _mm256_blendv_pd(m, _mm256_mul_pd(m, _mm256_set1_pd(0.5)), big);
+  e = _mm256_add_pd(e, _mm256_and_pd(big, one));
+  __m256d f = _mm256_div_pd(_mm256_sub_pd(m, one), _mm256_add_pd(m, one));
+  __m256d p = horner_avx2(log_c, COUNT(log_c), _mm256_mul_pd(f, f));
+  __m256d ln_m = _mm256_mul_pd(_mm256_set1_pd(2.0), _mm256_mul_pd(f, p));
+  return _mm256_add_pd(
+      _mm256_mul_pd(e, _mm256_set1_pd(LN2_HI)),
+      _mm256_add_pd(_mm256_mul_pd(e, _mm256_set1_pd(LN2_LO)), ln_m));
+}
+
+// 4 positions per step. Returns the number done.
+__attribute__((target("avx2"))) static size_t
+tl_px_to_gps_avx2(const double *in, size_t count, double inv_n,
+                  double inv_scale, double *out) {
+  const __m256d sign = _mm256_set1_pd(-0.0);
+  const __m256d vn = _mm256_set1_pd(inv_n), vscale = _mm256_set1_pd(inv_scale);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    rows_t q = {{_mm256_loadu_pd(in + i * 4), _mm256_loadu_pd(in + i * 4 + 4),
+                 _mm256_loadu_pd(in + i * 4 + 8),
+                 _mm256_loadu_pd(in + i * 4 + 12)}};
+    q = transpose(q);
+    __m256d x = _mm256_add_pd(q.v[0], _mm256_mul_pd(q.v[2], vscale));
+    __m256d y = _mm256_add_pd(q.v[1], _mm256_mul_pd(q.v[3], vscale));
+    __m256d lng = _mm256_sub_pd(
+        _mm256_mul_pd(_mm256_mul_pd(x, vn), _mm256_set1_pd(360.0)),
+        _mm256_set1_pd(180.0));
+
+    __m256d t = _mm256_mul_pd(
+        _mm256_set1_pd(PI),
+        _mm256_sub_pd(_mm256_set1_pd(1.0),
+                      _mm256_mul_pd(_mm256_mul_pd(_mm256_set1_pd(2.0), y),
+                                    vn)));
+    __m256d nan = _mm256_cmp_pd(t, t, _CMP_UNORD_Q);
+    __m256d a = _mm256_andnot_pd(
+        nan, _mm256_min_pd(_mm256_andnot_pd(sign, t), _mm256_set1_pd(MAX_T)));
+    __m256d lat = _mm256_sub_pd(
+        _mm256_set1_pd(PI / 2),
+        _mm256_mul_pd(_mm256_set1_pd(2.0), atan01_avx2(exp_neg_avx2(a))));
+    lat = _mm256_or_pd(_mm256_andnot_pd(sign, lat), _mm256_and_pd(t, sign));
+    lat = _mm256_blendv_pd(_mm256_mul_pd(lat, _mm256_set1_pd(DEG)), t, nan);
+
+    __m256d lo = _mm256_unpacklo_pd(lat, lng), hi = _mm256_unpackhi_pd(lat, lng);
+    _mm256_storeu_pd(out + i * 2, _mm256_permute2f128_pd(lo, hi, 0x20));
+    _mm256_storeu_pd(out + i * 2 + 4, _mm256_permute2f128_pd(lo, hi, 0x31));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) static inline void
+split_avx2(__m256d v, __m256d scale, __m256d *tile, __m256d *px) {
+  const __m256d one = _mm256_set1_pd(1.0);
+  __m256d t = _mm256_floor_pd(v);
+  __m256d p = _mm256_floor_pd(_mm256_add_pd(
+      _mm256_mul_pd(_mm256_sub_pd(v, t), scale), _mm256_set1_pd(0.5)));
+  __m256d carry = _mm256_cmp_pd(p, scale, _CMP_EQ_OQ);
+  *tile = _mm256_add_pd(t, _mm256_and_pd(carry, one));
+  *px = _mm256_andnot_pd(carry, p);
+}
+
+__attribute__((target("avx2"))) static size_t
+gps_to_tl_px_avx2(const double *in, size_t count, double n, double scale,
+                  double *out) {
+  const __m256d sign = _mm256_set1_pd(-0.0), one = _mm256_set1_pd(1.0);
+  const __m256d vscale = _mm256_set1_pd(scale);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m256d a0 = _mm256_loadu_pd(in + i * 2), a1 = _mm256_loadu_pd(in + i * 2 + 4);
+    __m256d p0 = _mm256_permute2f128_pd(a0, a1, 0x20);
+    __m256d p1 = _mm256_permute2f128_pd(a0, a1, 0x31);
+    __m256d lat = _mm256_unpacklo_pd(p0, p1), lng = _mm256_unpackhi_pd(p0, p1);
+
+    __m256d nan = _mm256_cmp_pd(lat, lat, _CMP_UNORD_Q);
+    __m256d given = lat;
+    lat = _mm256_andnot_pd(
+        nan, _mm256_max_pd(_mm256_min_pd(lat, _mm256_set1_pd(MAX_LAT)),
+                           _mm256_set1_pd(-MAX_LAT)));
+    __m256d p = _mm256_mul_pd(lat, _mm256_set1_pd(RAD));
+    __m256d x = _mm256_mul_pd(_mm256_add_pd(lng, _mm256_set1_pd(180.0)),
+                              _mm256_set1_pd(n / 360.0));
+
+    __m256d a = _mm256_andnot_pd(sign, p);
+    __m256d s =
+        _mm256_mul_pd(a, horner_avx2(sin_c, COUNT(sin_c), _mm256_mul_pd(a, a)));
+    __m256d merc = _mm256_mul_pd(
+        _mm256_set1_pd(0.5),
+        log_ge1_avx2(_mm256_div_pd(_mm256_add_pd(one, s),
+                                   _mm256_sub_pd(one, s))));
+    merc = _mm256_or_pd(_mm256_andnot_pd(sign, merc), _mm256_and_pd(p, sign));
+    __m256d y = _mm256_mul_pd(
+        _mm256_sub_pd(one, _mm256_mul_pd(merc, _mm256_set1_pd(1.0 / PI))),
+        _mm256_set1_pd(n * 0.5));
+    y = _mm256_blendv_pd(y, given, nan);
+
+    rows_t q;
+    split_avx2(x, vscale, &q.v[0], &q.v[2]);
+    split_avx2(y, vscale, &q.v[1], &q.v[3]);
+    q = transpose(q);
+    for (int k = 0; k < 4; k++)
+      _mm256_storeu_pd(out + i * 4 + k * 4, q.v[k]);
+  }
+  return i;
+}
+
+#endif
+
+void mercator_tl_px_to_gps(const double *tl_px, size_t count, uint32_t z,
+                           double scale, double *lat_lng) {
+  double inv_n = 1.0 / (double)((uint64_t)1 << z), inv_scale = 1.0 / scale;
+  size_t done = 0;
+#ifdef MERCATOR_X86
+  if (mercator_simd_active())
+    done = tl_px_to_gps_avx2(tl_px, count, inv_n, inv_scale, lat_lng);
+#endif
+  for (size_t i = done; i < count; i++)
+    tl_px_to_gps(tl_px + i * 4, inv_n, inv_scale, lat_lng + i * 2);
+}
+
+void mercator_gps_to_tl_px(const double *lat_lng, size_t count, uint32_t z,
+                           double scale, double *tl_px) {
+  double n = (double)((uint64_t)1 << z);
+  size_t done = 0;
+#ifdef MERCATOR_X86
+  if (mercator_simd_active())
+    done = gps_to_tl_px_avx2(lat_lng, count, n, scale, tl_px);
+#endif
+  for (size_t i = done; i < count; i++)
+    gps_to_tl_px(lat_lng + i * 2, n, scale, tl_px + i * 4);
+}
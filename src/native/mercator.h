@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Web Mercator conversions of src/pumpkin/mercator.ts in bulk. A position is
+// a tile TlX, TlY of zoom z and a pixel PxX, PxY in 0..scale-1 inside it,
+// wplace tiles being z=11 with scale 1000. Both directions use polynomial
+// approximations of exp, atan, sin and log instead of libm, within 1e-13
+// degrees of it, a tiny fraction of a pixel.
+
+// Uses the AVX2 kernel when the CPU has it, can be turned off to compare
+// against the scalar code, which gives the same bits.
+void mercator_set_simd(bool enabled);
+bool mercator_simd_active(void);
+
+// count TlX, TlY, PxX, PxY quadruples to lat, lng pairs in degrees.
+void mercator_tl_px_to_gps(const double *tl_px, size_t count, uint32_t z,
+                           double scale, double *lat_lng);
+
+// count lat, lng pairs in degrees to TlX, TlY, PxX, PxY quadruples, with the
+// latitude clamped to the Mercator range and pixels rounded as gpsToTlPx
+// does. in and out may not overlap.
+void mercator_gps_to_tl_px(const double *lat_lng, size_t count, uint32_t z,
+                           double scale, double *tl_px);
@@ -0,0 +1,148 @@
+#include "palette.h"
+#include <pthread.h>
+#include <string.h>
+
+const uint8_t wplace_palette[PALETTE_SIZE][4] = {
+    {0, 0, 0, 0},
+    // free colours
+    {0, 0, 0, 255},
+    {60, 60, 60, 255},
+    {120, 120, 120, 255},
+    {210, 210, 210, 255},
+    {255, 255, 255, 255},
+    {96, 0, 24, 255},
+    {237, 28, 36, 255},
+    {255, 127, 39, 255},
+    {246, 170, 9, 255},
+    {249, 221, 59, 255},
+    {255, 250, 188, 255},
+    {14, 185, 104, 255},
+    {19, 230, 123, 255},
+    {135, 255, 94, 255},
+    {12, 129, 110, 255},
+    {16, 174, 166, 255},
+    {19, 225, 190, 255},
+    {40, 80, 158, 255},
+    {64, 147, 228, 255},
+    {96, 247, 242, 255},
+    {107, 80, 246, 255},
+    {153, 177, 251, 255},
+    {120, 12, 153, 255},
+    {170, 56, 185, 255},
+    {224, 159, 249, 255},
+    {203, 0, 122, 255},
+    {236, 31, 128, 255},
+    {243, 141, 169, 255},
+    {104, 70, 52, 255},
+    {149, 104, 42, 255},
+    {248, 178, 119, 255},
+    // premium colours
+    {170, 170, 170, 255},
+    {165, 14, 30, 255},
+    {250, 128, 114, 255},
+    {228, 92, 26, 255},
+    {156, 132, 49, 255},
+    {197, 173, 49, 255},
+    {232, 212, 95, 255},
+    {74, 107, 58, 255},
+    {90, 148, 74, 255},
+    {132, 197, 115, 255},
+    {15, 121, 159, 255},
+    {187, 250, 242, 255},
+    {125, 199, 255, 255},
+    {77, 49, 184, 255},
+    {74, 66, 132, 255},
+    {122, 113, 196, 255},
+    {181, 174, 241, 255},
+    {155, 82, 73, 255},
+    {209, 128, 120, 255},
+    {250, 182, 164, 255},
+    {219, 164, 99, 255},
+    {123, 99, 82, 255},
+    {156, 132, 107, 255},
+    {214, 181, 148, 255},
+    {209, 128, 81, 255},
+    {255, 197, 165, 255},
+    {109, 100, 63, 255},
+    {148, 140, 107, 255},
+    {205, 197, 158, 255},
+    {51, 57, 65, 255},
+    {109, 117, 141, 255},
+    {179, 185, 209, 255},
+};
+
+// Open addressing table rgb -> index + 1 for the exact lookups, which is what
+// almost every pixel of a wplace tile hits.
+#define EXACT_SLOTS 128
+static uint32_t exact_keys[EXACT_SLOTS];
+static uint8_t exact_values[EXACT_SLOTS];
+static pthread_once_t exact_once = PTHREAD_ONCE_INIT;
+
+static uint32_t exact_slot(uint32_t key) {
+  return (key * 2654435761u) >> 25;
+}
+
+static void build_exact(void) {
+  for (uint32_t i = 1; i < PALETTE_SIZE; i++) {
+    const uint8_t *c = wplace_palette[i];
+    uint32_t key = (uint32_t)c[0] << 16 | (uint32_t)c[1] << 8 | c[2];
+    uint32_t slot = exact_slot(key);
+    while (exact_values[slot])
+      slot = (slot + 1) % EXACT_SLOTS;
+    exact_keys[slot] = key;
+    exact_values[slot] = (uint8_t)(i + 1);
+  }
+}
+
+static uint8_t nearest_index(const uint8_t rgba[4]) {
+  uint32_t best = UINT32_MAX;
+  uint8_t best_index = 1;
+  for (uint32_t i = 1; i < PALETTE_SIZE; i++) {
+    const uint8_t *c = wplace_palette[i];
+    int dr = (int)rgba[0] - c[0], dg = (int)rgba[1] - c[1],
+        db = (int)rgba[2] - c[2];
+    uint32_t d = (uint32_t)(dr * dr + dg * dg + db * db);
+    if (d < best) {
+      best = d;
+      best_index = (uint8_t)i;
+    }
+  }
+  return best_index;
+}
+
+uint8_t palette_index_of(const uint8_t rgba[4]) {
+  if (rgba[3] == 0)
+    return PALETTE_TRANSPARENT;
+
+  pthread_once(&exact_once, build_exact);
+
+  uint32_t key = (uint32_t)rgba[0] << 16 | (uint32_t)rgba[1] << 8 | rgba[2];
+  for (uint32_t slot = exact_slot(key); exact_values[slot];
+       slot = (slot + 1) % EXACT_SLOTS) {
+    if (exact_keys[slot] == key)
+      return (uint8_t)(exact_values[slot] - 1);
+  }
+  return nearest_index(rgba);
+}
+
+void palette_rgba_to_indices(const uint8_t *rgba, size_t count,
+                             uint8_t *out) {
+  // runs of the same colour are the common case in pixel art
+  uint32_t last = 0;
+  uint8_t last_index = PALETTE_TRANSPARENT;
+  for (size_t i = 0; i < count; i++) {
+    uint32_t px;
+    memcpy(&px, rgba + i * 4, 4);
+    if (px != last || i == 0) {
+      last = px;
+      last_index = palette_index_of(rgba + i * 4);
+    }
+    out[i] = last_index;
+  }
+}
+
+void palette_indices_to_rgba(const uint8_t *indices, size_t count,
+                             uint8_t *out) {
+  for (size_t i = 0; i < count; i++)
+    memcpy(out + i * 4, wplace_palette[indices[i] & (PALETTE_SIZE - 1)], 4);
+}
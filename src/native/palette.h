@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Index 0 is transparent, 1..31 are the free wplace colours in the order of
+// scripts/downscale.ts, 32..63 the premium colours.
+#define PALETTE_SIZE 64
+#define PALETTE_TRANSPARENT 0
+
+extern const uint8_t wplace_palette[PALETTE_SIZE][4];
+
+// Index of the palette entry for an RGBA pixel: transparent for alpha 0,
+// the exact entry for palette colours, otherwise the nearest colour.
+uint8_t palette_index_of(const uint8_t rgba[4]);
+
+void palette_rgba_to_indices(const uint8_t *rgba, size_t count, uint8_t *out);
+void palette_indices_to_rgba(const uint8_t *indices, size_t count,
+                             uint8_t *out);
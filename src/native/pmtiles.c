@@ -0,0 +1,100 @@
+// Packs a tile directory into a PMTiles archive and reads tiles back out.
+//
+//   pmtiles pack [--root DIR] [--min-z Z] [--max-z Z] --out FILE
+//   pmtiles get FILE Z X Y > tile.png
+//   pmtiles info FILE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tile_pmtiles.h"
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s pack [--root DIR] [--min-z Z] [--max-z Z] --out FILE\n"
+          "       %s get FILE Z X Y\n"
+          "       %s info FILE\n",
+          argv0, argv0, argv0);
+}
+
+static int pack(int argc, char **argv) {
+  const char *root = "public/tiles", *out = NULL;
+  uint32_t min_z = 0, max_z = 11;
+  for (int i = 2; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[++i] : NULL;
+    if (!val)
+      return 2;
+    if (strcmp(arg, "--root") == 0)
+      root = val;
+    else if (strcmp(arg, "--min-z") == 0)
+      min_z = (uint32_t)atoi(val);
+    else if (strcmp(arg, "--max-z") == 0)
+      max_z = (uint32_t)atoi(val);
+    else if (strcmp(arg, "--out") == 0)
+      out = val;
+    else
+      return 2;
+  }
+  if (!out || min_z > max_z)
+    return 2;
+
+  if (!pmtiles_pack_dir(root, min_z, max_z, out)) {
+    fprintf(stderr, "Failed to pack %s into %s\n", root, out);
+    return 1;
+  }
+  fprintf(stderr, "Packed z=%u..%u of %s into %s\n", min_z, max_z, root, out);
+  return 0;
+}
+
+static int get(const char *path, uint32_t z, uint32_t x, uint32_t y) {
+  pmtiles_reader_t r;
+  if (!pmtiles_open(&r, path)) {
+    fprintf(stderr, "Failed to open %s\n", path);
+    return 1;
+  }
+  tile_buf_t b = {0};
+  bool found = pmtiles_get(&r, z, x, y, &b);
+  if (found)
+    fwrite(b.data, 1, b.len, stdout);
+  else
+    fprintf(stderr, "No tile %u/%u/%u in %s\n", z, x, y, path);
+  tile_buf_free(&b);
+  pmtiles_close(&r);
+  return found ? 0 : 1;
+}
+
+static int info(const char *path) {
+  pmtiles_reader_t r;
+  if (!pmtiles_open(&r, path)) {
+    fprintf(stderr, "Failed to open %s\n", path);
+    return 1;
+  }
+  const pmtiles_header_t *h = &r.header;
+  printf("zoom %u..%u\n", h->min_zoom, h->max_zoom);
+  printf("%llu tiles, %llu directory entries, %llu distinct\n",
+         (unsigned long long)h->addressed_tiles,
+         (unsigned long long)h->tile_entries,
+         (unsigned long long)h->tile_contents);
+  printf("root directory %llu bytes, leaf directories %llu bytes\n",
+         (unsigned long long)h->root_length,
+         (unsigned long long)h->leaf_length);
+  printf("tile data %llu bytes\n", (unsigned long long)h->data_length);
+  pmtiles_close(&r);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int ret = 2;
+  if (argc >= 2 && strcmp(argv[1], "pack") == 0)
+    ret = pack(argc, argv);
+  else if (argc == 6 && strcmp(argv[1], "get") == 0)
+    ret = get(argv[2], (uint32_t)atoi(argv[3]), (uint32_t)atoi(argv[4]),
+              (uint32_t)atoi(argv[5]));
+  else if (argc == 3 && strcmp(argv[1], "info") == 0)
+    ret = info(argv[2]);
+  if (ret == 2)
+    usage(argv[0]);
+  return ret;
+}
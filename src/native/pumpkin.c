@@ -1,4 +1,15 @@
+#include "mercator.h"
 #include "pumpkin_core.h"
+#include "quantize.h"
+#include "tar_ingest.h"
+#include "tile_archive.h"
+#include "tile_arena.h"
+#include "tile_manifest.h"
+#include "tile_pmtiles.h"
+#include "tile_png.h"
+#include "tile_sched.h"
+#include "tile_untar.h"
+#include "tile_slab.h"
 #include <node_api.h>
 #include <stdlib.h>
 #include <string.h>
@@ -17,6 +28,22 @@
 
 static pumpkin_t g_pumpkin = {0};
 
+// Node loads the shared object once per process but calls init once per env,
+// the main thread and every worker thread, so state that must not be shared
+// between threads hangs off the env through napi_set_instance_data instead
+// of a global.
+typedef struct {
+  tile_arena_t arena;
+  tile_slab_t slab;
+  napi_ref *plane_buffers; // external ArrayBuffer per slab plane, lazily made
+} addon_state_t;
+
+static addon_state_t *get_state(napi_env env) {
+  addon_state_t *state = NULL;
+  napi_get_instance_data(env, (void **)&state);
+  return state;
+}
+
 static napi_value js_set_pumpkin(napi_env env, napi_callback_info info) {
   size_t argc = 4;
   napi_value argv[4];
@@ -97,6 +124,1215 @@ static napi_value js_find_pumpkin(napi_env env, napi_callback_info info) {
   return obj;
 }
 
+// Accepts any typed array (Buffer included), also when it is backed by a
+// SharedArrayBuffer, and returns its bytes.
+static bool get_typed_bytes(napi_env env, napi_value value, void **data,
+                            size_t *byte_len) {
+  bool is_typed;
+  if (napi_is_typedarray(env, value, &is_typed) != napi_ok || !is_typed)
+    return false;
+
+  napi_typedarray_type type;
+  size_t length;
+  napi_value arraybuffer;
+  size_t byte_offset;
+  if (napi_get_typedarray_info(env, value, &type, &length, data, &arraybuffer,
+                               &byte_offset) != napi_ok)
+    return false;
+
+  size_t elem = 1;
+  switch (type) {
+  case napi_int16_array:
+  case napi_uint16_array:
+    elem = 2;
+    break;
+  case napi_int32_array:
+  case napi_uint32_array:
+  case napi_float32_array:
+    elem = 4;
+    break;
+  case napi_float64_array:
+  case napi_bigint64_array:
+  case napi_biguint64_array:
+    elem = 8;
+    break;
+  default:
+    break;
+  }
+  *byte_len = length * elem;
+  return true;
+}
+
+static bool is_nullish(napi_env env, napi_value value) {
+  napi_valuetype type;
+  if (napi_typeof(env, value, &type) != napi_ok)
+    return true;
+  return type == napi_null || type == napi_undefined;
+}
+
+static napi_value js_record_tile_stat(napi_env env, napi_callback_info info) {
+  size_t argc = 7;
+  napi_value argv[7];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+
+  if (argc < 7) {
+    napi_throw_type_error(
+        env, NULL,
+        "Expected stats, index, body, pixels, width, height, matched");
+    return NULL;
+  }
+
+  void *stats_ptr, *body_ptr = NULL, *pixels_ptr = NULL;
+  size_t stats_len, body_len = 0, pixels_len = 0;
+  uint32_t index, w, h;
+  bool matched;
+
+  if (!get_typed_bytes(env, argv[0], &stats_ptr, &stats_len)) {
+    napi_throw_type_error(env, NULL, "stats must be a typed array");
+    return NULL;
+  }
+  NAPI_CALL(env, napi_get_value_uint32(env, argv[1], &index));
+  if (!is_nullish(env, argv[2]) &&
+      !get_typed_bytes(env, argv[2], &body_ptr, &body_len)) {
+    napi_throw_type_error(env, NULL, "body must be a typed array or null");
+    return NULL;
+  }
+  if (!is_nullish(env, argv[3]) &&
+      !get_typed_bytes(env, argv[3], &pixels_ptr, &pixels_len)) {
+    napi_throw_type_error(env, NULL, "pixels must be a typed array or null");
+    return NULL;
+  }
+  NAPI_CALL(env, napi_get_value_uint32(env, argv[4], &w));
+  NAPI_CALL(env, napi_get_value_uint32(env, argv[5], &h));
+  NAPI_CALL(env, napi_get_value_bool(env, argv[6], &matched));
+
+  if (((size_t)index + 1) * sizeof(tile_stat_t) > stats_len) {
+    napi_throw_range_error(env, NULL, "Tile index out of range");
+    return NULL;
+  }
+  if (pixels_ptr && pixels_len < (size_t)w * h * 4) {
+    napi_throw_range_error(env, NULL, "Buffer smaller than expected");
+    return NULL;
+  }
+
+  uint32_t hash = body_ptr ? sched_hash(body_ptr, body_len) : 0;
+  uint8_t density = pixels_ptr ? sched_density(pixels_ptr, w, h) : 0;
+  sched_record(&((tile_stat_t *)stats_ptr)[index], hash, density, matched);
+  return NULL;
+}
+
+static napi_value js_build_scan_order(napi_env env, napi_callback_info info) {
+  size_t argc = 4;
+  napi_value argv[4];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+
+  if (argc < 4) {
+    napi_throw_type_error(env, NULL, "Expected stats, width, height, order");
+    return NULL;
+  }
+
+  void *stats_ptr, *order_ptr;
+  size_t stats_len, order_len;
+  uint32_t w, h;
+
+  if (!get_typed_bytes(env, argv[0], &stats_ptr, &stats_len) ||
+      !get_typed_bytes(env, argv[3], &order_ptr, &order_len)) {
+    napi_throw_type_error(env, NULL, "stats and order must be typed arrays");
+    return NULL;
+  }
+  NAPI_CALL(env, napi_get_value_uint32(env, argv[1], &w));
+  NAPI_CALL(env, napi_get_value_uint32(env, argv[2], &h));
+
+  size_t count = (size_t)w * h;
+  if (stats_len < count * sizeof(tile_stat_t) ||
+      order_len < count * sizeof(uint32_t)) {
+    napi_throw_range_error(env, NULL, "Buffer smaller than expected");
+    return NULL;
+  }
+
+  if (!sched_build_order(stats_ptr, w, h, order_ptr)) {
+    napi_throw_error(env, NULL, "Failed to build scan order");
+    return NULL;
+  }
+  return NULL;
+}
+
+static napi_value js_create_tile_arena(napi_env env, napi_callback_info info) {
+  size_t argc = 2;
+  napi_value argv[2];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+
+  if (argc < 2) {
+    napi_throw_type_error(env, NULL, "Expected slotCount, slotSize");
+    return NULL;
+  }
+
+  uint32_t slot_count, slot_size;
+  NAPI_CALL(env, napi_get_value_uint32(env, argv[0], &slot_count));
+  NAPI_CALL(env, napi_get_value_uint32(env, argv[1], &slot_size));
+
+  addon_state_t *state = get_state(env);
+  if (state->arena.base) {
+    napi_throw_error(env, NULL, "Tile arena already created");
+    return NULL;
+  }
+
+  if (!tile_arena_init(&state->arena, slot_count, slot_size)) {
+    napi_throw_error(env, NULL, "Failed to create tile arena");
+    return NULL;
+  }
+
+  // The memory is owned by the arena and lives as long as the env, JS only
+  // gets a view so the slots are never copied or collected.
+  napi_value arraybuffer, result, slot_size_value;
+  NAPI_CALL(env, napi_create_external_arraybuffer(
+                     env, state->arena.base,
+                     state->arena.slot_size * state->arena.slot_count, NULL,
+                     NULL, &arraybuffer));
+  NAPI_CALL(env, napi_create_uint32(env, (uint32_t)state->arena.slot_size,
+                                    &slot_size_value));
+  NAPI_CALL(env, napi_create_object(env, &result));
+  NAPI_CALL(env,
+            napi_set_named_property(env, result, "buffer", arraybuffer));
+  NAPI_CALL(env,
+            napi_set_named_property(env, result, "slotSize", slot_size_value));
+  return result;
+}
+
+static napi_value js_acquire_tile_slot(napi_env env, napi_callback_info info) {
+  (void)info;
+  napi_value result;
+  int32_t slot = tile_arena_acquire(&get_state(env)->arena);
+  NAPI_CALL(env, napi_create_int32(env, slot, &result));
+  return result;
+}
+
+static napi_value js_release_tile_slot(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value argv[1];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+
+  uint32_t slot;
+  NAPI_CALL(env, napi_get_value_uint32(env, argv[0], &slot));
+
+  if (!tile_arena_release(&get_state(env)->arena, slot)) {
+    napi_throw_range_error(env, NULL, "Invalid tile slot");
+    return NULL;
+  }
+  return NULL;
+}
+
+static napi_value js_create_tile_slab(napi_env env, napi_callback_info info) {
+  size_t argc = 2;
+  napi_value argv[2];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+
+  if (argc < 2) {
+    napi_throw_type_error(env, NULL, "Expected maxPlanes, planeSize");
+    return NULL;
+  }
+
+  uint32_t max_planes, plane_size;
+  NAPI_CALL(env, napi_get_value_uint32(env, argv[0], &max_planes));
+  NAPI_CALL(env, napi_get_value_uint32(env, argv[1], &plane_size));
+
+  addon_state_t *state = get_state(env);
+  if (state->slab.planes) {
+    napi_throw_error(env, NULL, "Tile slab already created");
+    return NULL;
+  }
+
+  state->plane_buffers = calloc(max_planes ? max_planes : 1, sizeof(napi_ref));
+  if (!state->plane_buffers ||
+      !tile_slab_init(&state->slab, plane_size, max_planes)) {
+    free(state->plane_buffers);
+    state->plane_buffers = NULL;
+    napi_throw_error(env, NULL, "Failed to create tile slab");
+    return NULL;
+  }
+  return NULL;
+}
+
+// Returns a Uint8Array over the first `len` bytes of a slab plane.
+static napi_status plane_view(napi_env env, addon_state_t *state,
+                              uint32_t plane, size_t len, napi_value *result) {
+  napi_status status;
+  napi_value arraybuffer;
+
+  if (state->plane_buffers[plane]) {
+    status = napi_get_reference_value(env, state->plane_buffers[plane],
+                                      &arraybuffer);
+  } else {
+    status = napi_create_external_arraybuffer(
+        env, tile_slab_plane(&state->slab, plane), state->slab.plane_size,
+        NULL, NULL, &arraybuffer);
+    if (status == napi_ok)
+      status = napi_create_reference(env, arraybuffer, 1,
+                                     &state->plane_buffers[plane]);
+  }
+  if (status != napi_ok)
+    return status;
+
+  return napi_create_typedarray(env, napi_uint8_array, len, arraybuffer, 0,
+                                result);
+}
+
+typedef struct {
+  napi_async_work work;
+  napi_deferred deferred;
+  napi_ref body_ref; // keeps the compressed body alive while decoding
+  const uint8_t *body;
+  size_t body_len;
+  uint32_t plane;
+  uint8_t *out;
+  size_t out_size;
+  uint32_t width;
+  uint32_t height;
+  bool ok;
+} decode_job_t;
+
+static void decode_execute(napi_env env, void *data) {
+  (void)env;
+  decode_job_t *job = data;
+  job->ok = tile_png_decode_rgba(job->body, job->body_len, job->out,
+                                 job->out_size, &job->width, &job->height);
+}
+
+static void decode_complete(napi_env env, napi_status status, void *data) {
+  decode_job_t *job = data;
+  addon_state_t *state = get_state(env);
+
+  napi_delete_reference(env, job->body_ref);
+  napi_delete_async_work(env, job->work);
+
+  napi_value result = NULL;
+  if (status == napi_ok && job->ok) {
+    napi_value plane, view, width, height;
+    if (napi_create_object(env, &result) != napi_ok ||
+        napi_create_uint32(env, job->plane, &plane) != napi_ok ||
+        plane_view(env, state, job->plane, (size_t)job->width * job->height * 4,
+                   &view) != napi_ok ||
+        napi_create_uint32(env, job->width, &width) != napi_ok ||
+        napi_create_uint32(env, job->height, &height) != napi_ok ||
+        napi_set_named_property(env, result, "plane", plane) != napi_ok ||
+        napi_set_named_property(env, result, "data", view) != napi_ok ||
+        napi_set_named_property(env, result, "width", width) != napi_ok ||
+        napi_set_named_property(env, result, "height", height) != napi_ok)
+      result = NULL;
+  }
+
+  if (result) {
+    napi_resolve_deferred(env, job->deferred, result);
+  } else {
+    tile_slab_return(&state->slab, job->plane);
+
+    napi_value message, error;
+    napi_create_string_utf8(env, "Failed to decode tile", NAPI_AUTO_LENGTH,
+                            &message);
+    napi_create_error(env, NULL, message, &error);
+    napi_reject_deferred(env, job->deferred, error);
+  }
+  free(job);
+}
+
+// Decodes a PNG body on the libuv pool into a borrowed slab plane. Returns
+// null without blocking when every plane is borrowed.
+static napi_value js_decode_tile(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value argv[1];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+
+  addon_state_t *state = get_state(env);
+  if (!state->slab.planes) {
+    napi_throw_error(env, NULL, "Tile slab not created");
+    return NULL;
+  }
+
+  void *body_ptr;
+  size_t body_len;
+  if (argc < 1 || !get_typed_bytes(env, argv[0], &body_ptr, &body_len)) {
+    napi_throw_type_error(env, NULL, "Expected body buffer");
+    return NULL;
+  }
+
+  int32_t plane = tile_slab_borrow(&state->slab);
+  if (plane < 0) {
+    napi_value null_value;
+    NAPI_CALL(env, napi_get_null(env, &null_value));
+    return null_value;
+  }
+
+  decode_job_t *job = calloc(1, sizeof(decode_job_t));
+  if (!job) {
+    tile_slab_return(&state->slab, (uint32_t)plane);
+    napi_throw_error(env, NULL, "Failed to allocate decode job");
+    return NULL;
+  }
+  job->body = body_ptr;
+  job->body_len = body_len;
+  job->plane = (uint32_t)plane;
+  job->out = tile_slab_plane(&state->slab, (uint32_t)plane);
+  job->out_size = state->slab.plane_size;
+
+  napi_value promise, name;
+  if (napi_create_reference(env, argv[0], 1, &job->body_ref) != napi_ok ||
+      napi_create_promise(env, &job->deferred, &promise) != napi_ok ||
+      napi_create_string_utf8(env, "decodeTile", NAPI_AUTO_LENGTH, &name) !=
+          napi_ok ||
+      napi_create_async_work(env, NULL, name, decode_execute, decode_complete,
+                             job, &job->work) != napi_ok ||
+      napi_queue_async_work(env, job->work) != napi_ok) {
+    tile_slab_return(&state->slab, (uint32_t)plane);
+    free(job);
+    napi_throw_error(env, NULL, "Failed to queue decode job");
+    return NULL;
+  }
+  return promise;
+}
+
+static napi_value js_release_tile_plane(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value argv[1];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+
+  uint32_t plane;
+  NAPI_CALL(env, napi_get_value_uint32(env, argv[0], &plane));
+
+  if (!tile_slab_return(&get_state(env)->slab, plane)) {
+    napi_throw_range_error(env, NULL, "Invalid tile plane");
+    return NULL;
+  }
+  return NULL;
+}
+
+static napi_value js_quantize_tile(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value argv[1];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+
+  void *pixels;
+  size_t len;
+  if (argc < 1 || !get_typed_bytes(env, argv[0], &pixels, &len)) {
+    napi_throw_type_error(env, NULL, "pixels must be a typed array");
+    return NULL;
+  }
+  if (len % 4 != 0) {
+    napi_throw_range_error(env, NULL, "Expected RGBA pixels");
+    return NULL;
+  }
+
+  quantize_rgba(pixels, len / 4);
+  return NULL;
+}
+
+// An opened archive stays mapped until the handle is closed or collected.
+// Tiles are handed out as copies, so no Buffer outlives the mapping and
+// JavaScript never writes into it.
+typedef struct {
+  tile_archive_t archive;
+  bool closed;
+} archive_handle_t;
+
+static void archive_handle_finalize(napi_env env, void *data, void *hint) {
+  (void)env;
+  (void)hint;
+  archive_handle_t *h = data;
+  if (!h->closed)
+    tile_archive_close(&h->archive);
+  free(h);
+}
+
+static archive_handle_t *get_archive(napi_env env, napi_value value) {
+  archive_handle_t *h = NULL;
+  napi_valuetype type;
+  if (napi_typeof(env, value, &type) != napi_ok || type != napi_external ||
+      napi_get_value_external(env, value, (void **)&h) != napi_ok || !h ||
+      h->closed) {
+    napi_throw_type_error(env, NULL, "Expected an open tile archive");
+    return NULL;
+  }
+  return h;
+}
+
+static napi_value js_open_tile_archive(napi_env env, napi_callback_info info) {
+  size_t argc = 2;
+  napi_value argv[2];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+
+  char path[4096];
+  size_t path_len;
+  if (argc < 1 || napi_get_value_string_utf8(env, argv[0], path, sizeof(path),
+                                             &path_len) != napi_ok) {
+    napi_throw_type_error(env, NULL, "Expected path");
+    return NULL;
+  }
+  uint32_t default_z = 11;
+  if (argc >= 2 && !is_nullish(env, argv[1]))
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[1], &default_z));
+
+  archive_handle_t *h = calloc(1, sizeof(archive_handle_t));
+  if (!h || !tile_archive_open(&h->archive, path, default_z)) {
+    free(h);
+    napi_throw_error(env, NULL, "Failed to open tile archive");
+    return NULL;
+  }
+  napi_value result;
+  if (napi_create_external(env, h, archive_handle_finalize, NULL, &result) !=
+      napi_ok) {
+    tile_archive_close(&h->archive);
+    free(h);
+    napi_throw_error(env, NULL, "Failed to open tile archive");
+    return NULL;
+  }
+  return result;
+}
+
+// Returns a copy of the tile, the mapping itself is read-only.
+static napi_value js_read_archive_tile(napi_env env, napi_callback_info info) {
+  size_t argc = 4;
+  napi_value argv[4];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+
+  if (argc < 4) {
+    napi_throw_type_error(env, NULL, "Expected archive, z, x, y");
+    return NULL;
+  }
+  archive_handle_t *h = get_archive(env, argv[0]);
+  if (!h)
+    return NULL;
+  uint32_t z, x, y;
+  NAPI_CALL(env, napi_get_value_uint32(env, argv[1], &z));
+  NAPI_CALL(env, napi_get_value_uint32(env, argv[2], &x));
+  NAPI_CALL(env, napi_get_value_uint32(env, argv[3], &y));
+
+  const uint8_t *data;
+  size_t len;
+  napi_value result;
+  if (!tile_archive_find(&h->archive, z, x, y, &data, &len)) {
+    NAPI_CALL(env, napi_get_null(env, &result));
+    return result;
+  }
+  NAPI_CALL(env, napi_create_buffer_copy(env, len, data, NULL, &result));
+  return result;
+}
+
+static napi_value js_close_tile_archive(napi_env env,
+                                        napi_callback_info info) {
+  size_t argc = 1;
+  napi_value argv[1];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+
+  archive_handle_t *h = argc < 1 ? NULL : get_archive(env, argv[0]);
+  if (!h)
+    return NULL;
+  tile_archive_close(&h->archive);
+  h->closed = true;
+  return NULL;
+}
+
+// Streaming extraction, pushes and the final wait run on the libuv pool so
+// inflating and back pressure from the writers never block the event loop.
+typedef struct {
+  tile_untar_t *untar;
+  bool busy; // a push or finish is in flight
+  bool finished;
+} untar_handle_t;
+
+typedef struct {
+  napi_async_work work;
+  napi_deferred deferred;
+  napi_ref handle_ref, chunk_ref;
+  untar_handle_t *h;
+  const uint8_t *data;
+  size_t len;
+  bool finish;
+  bool ok;
+  tile_untar_stats_t stats;
+} untar_job_t;
+
+static void untar_handle_finalize(napi_env env, void *data, void *hint) {
+  (void)env;
+  (void)hint;
+  untar_handle_t *h = data;
+  tile_untar_destroy(h->untar);
+  free(h);
+}
+
+static napi_value js_create_untar(napi_env env, napi_callback_info info) {
+  size_t argc = 3;
+  napi_value argv[3];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+
+  char out_dir[4096];
+  size_t out_len;
+  if (argc < 1 || napi_get_value_string_utf8(env, argv[0], out_dir,
+                                             sizeof(out_dir),
+                                             &out_len) != napi_ok) {
+    napi_throw_type_error(env, NULL, "Expected outDir");
+    return NULL;
+  }
+  bool gzip = true;
+  uint32_t writers = 4;
+  if (argc >= 2 && !is_nullish(env, argv[1]))
+    NAPI_CALL(env, napi_get_value_bool(env, argv[1], &gzip));
+  if (argc >= 3 && !is_nullish(env, argv[2]))
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[2], &writers));
+
+  untar_handle_t *h = calloc(1, sizeof(untar_handle_t));
+  if (h)
+    h->untar = tile_untar_create(out_dir, gzip, writers);
+  if (!h || !h->untar) {
+    free(h);
+    napi_throw_error(env, NULL, "Failed to start extraction");
+    return NULL;
+  }
+
+  napi_value result;
+  if (napi_create_external(env, h, untar_handle_finalize, NULL, &result) !=
+      napi_ok) {
+    untar_handle_finalize(env, h, NULL);
+    napi_throw_error(env, NULL, "Failed to start extraction");
+    return NULL;
+  }
+  return result;
+}
+
+static void untar_execute(napi_env env, void *data) {
+  (void)env;
+  untar_job_t *job = data;
+  if (job->finish)
+    job->ok = tile_untar_finish(job->h->untar, &job->stats);
+  else
+    job->ok = tile_untar_push(job->h->untar, job->data, job->len);
+}
+
+static napi_status set_u64(napi_env env, napi_value obj, const char *name,
+                           uint64_t v) {
+  napi_value value;
+  napi_status status = napi_create_double(env, (double)v, &value);
+  return status == napi_ok ? napi_set_named_property(env, obj, name, value)
+                           : status;
+}
+
+static void untar_complete(napi_env env, napi_status status, void *data) {
+  untar_job_t *job = data;
+  job->h->busy = false;
+  if (job->chunk_ref)
+    napi_delete_reference(env, job->chunk_ref);
+  napi_delete_reference(env, job->handle_ref);
+  napi_delete_async_work(env, job->work);
+
+  napi_value result = NULL;
+  if (status == napi_ok && job->finish) {
+    // the counts are useful for the error message as well
+    if (napi_create_object(env, &result) != napi_ok ||
+        set_u64(env, result, "files", job->stats.files) != napi_ok ||
+        set_u64(env, result, "links", job->stats.links) != napi_ok ||
+        set_u64(env, result, "dirs", job->stats.dirs) != napi_ok ||
+        set_u64(env, result, "bytes", job->stats.bytes) != napi_ok ||
+        set_u64(env, result, "skipped", job->stats.skipped) != napi_ok ||
+        set_u64(env, result, "failed", job->stats.failed) != napi_ok)
+      result = NULL;
+  } else if (status == napi_ok) {
+    napi_get_undefined(env, &result);
+  }
+
+  if (result && job->ok) {
+    napi_resolve_deferred(env, job->deferred, result);
+  } else {
+    napi_value message, error;
+    napi_create_string_utf8(env,
+                            job->finish ? "Archive incomplete or not extracted"
+                                        : "Corrupt archive",
+                            NAPI_AUTO_LENGTH, &message);
+    napi_create_error(env, NULL, message, &error);
+    if (result)
+      napi_set_named_property(env, error, "stats", result);
+    napi_reject_deferred(env, job->deferred, error);
+  }
+  free(job);
+}
+
+static napi_value queue_untar_job(napi_env env, napi_value handle,
+                                  napi_value chunk, bool finish) {
+  untar_handle_t *h = NULL;
+  napi_valuetype type;
+  if (napi_typeof(env, handle, &type) != napi_ok || type != napi_external ||
+      napi_get_value_external(env, handle, (void **)&h) != napi_ok || !h) {
+    napi_throw_type_error(env, NULL, "Expected an extraction handle");
+    return NULL;
+  }
+  if (h->busy || h->finished) {
+    napi_throw_error(env, NULL,
+                     h->busy ? "Wait for the previous push"
+                             : "Extraction already finished");
+    return NULL;
+  }
+
+  untar_job_t *job = calloc(1, sizeof(untar_job_t));
+  if (!job) {
+    napi_throw_error(env, NULL, "Failed to allocate extraction job");
+    return NULL;
+  }
+  job->h = h;
+  job->finish = finish;
+  void *data = NULL;
+  if (!finish && !get_typed_bytes(env, chunk, &data, &job->len)) {
+    free(job);
+    napi_throw_type_error(env, NULL, "Expected chunk buffer");
+    return NULL;
+  }
+  job->data = data;
+
+  napi_value promise, name;
+  if (napi_create_reference(env, handle, 1, &job->handle_ref) != napi_ok ||
+      (!finish &&
+       napi_create_reference(env, chunk, 1, &job->chunk_ref) != napi_ok) ||
+      napi_create_promise(env, &job->deferred, &promise) != napi_ok ||
+      napi_create_string_utf8(env, "untar", NAPI_AUTO_LENGTH, &name) !=
+          napi_ok ||
+      napi_create_async_work(env, NULL, name, untar_execute, untar_complete,
+                             job, &job->work) != napi_ok ||
+      napi_queue_async_work(env, job->work) != napi_ok) {
+    free(job);
+    napi_throw_error(env, NULL, "Failed to queue extraction job");
+    return NULL;
+  }
+  h->busy = true;
+  h->finished = finish;
+  return promise;
+}
+
+static napi_value js_untar_push(napi_env env, napi_callback_info info) {
+  size_t argc = 2;
+  napi_value argv[2];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+  if (argc < 2) {
+    napi_throw_type_error(env, NULL, "Expected handle, chunk");
+    return NULL;
+  }
+  return queue_untar_job(env, argv[0], argv[1], false);
+}
+
+static napi_value js_untar_finish(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value argv[1];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+  if (argc < 1) {
+    napi_throw_type_error(env, NULL, "Expected handle");
+    return NULL;
+  }
+  return queue_untar_job(env, argv[0], NULL, true);
+}
+
+// Gives up on an extraction. A push in flight rejects, the handle takes no
+// more pushes and is freed with the handle.
+static napi_value js_untar_abort(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value argv[1];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+  untar_handle_t *h = NULL;
+  napi_valuetype type;
+  if (argc < 1 || napi_typeof(env, argv[0], &type) != napi_ok ||
+      type != napi_external ||
+      napi_get_value_external(env, argv[0], (void **)&h) != napi_ok || !h) {
+    napi_throw_type_error(env, NULL, "Expected an extraction handle");
+    return NULL;
+  }
+  tile_untar_abort(h->untar);
+  h->finished = true;
+  return NULL;
+}
+
+// Tar entries for uploads. The producer pushes on the libuv pool and waits
+// there for credits, JS is told through onReady when entries can be taken
+// and returns each slot once its upload is done.
+typedef struct {
+  tar_ingest_t ingest;
+  napi_threadsafe_function on_ready;
+  napi_ref arena_ref; // ArrayBuffer over the slots, entries are views into it
+  size_t refs;        // the handle, on_ready and the ArrayBuffer
+  bool busy;
+} ingest_handle_t;
+
+typedef struct {
+  napi_async_work work;
+  napi_deferred deferred;
+  napi_ref handle_ref, chunk_ref;
+  ingest_handle_t *h;
+  const uint8_t *data;
+  size_t len;
+  bool ok;
+} ingest_job_t;
+
+static void ingest_unref(ingest_handle_t *h) {
+  if (--h->refs > 0)
+    return;
+  tar_ingest_destroy(&h->ingest);
+  free(h);
+}
+
+static void ingest_notify(void *ctx) {
+  ingest_handle_t *h = ctx;
+  napi_call_threadsafe_function(h->on_ready, NULL, napi_tsfn_nonblocking);
+}
+
+// Node closes the function itself on teardown, it must not be released after
+static void ingest_ready_finalize(napi_env env, void *data, void *hint) {
+  (void)env;
+  (void)hint;
+  ingest_handle_t *h = data;
+  h->on_ready = NULL;
+  ingest_unref(h);
+}
+
+static void ingest_handle_finalize(napi_env env, void *data, void *hint) {
+  (void)hint;
+  ingest_handle_t *h = data;
+  if (h->on_ready)
+    napi_release_threadsafe_function(h->on_ready, napi_tsfn_abort);
+  if (h->arena_ref)
+    napi_delete_reference(env, h->arena_ref);
+  ingest_unref(h);
+}
+
+static void ingest_arena_finalize(napi_env env, void *data, void *hint) {
+  (void)env;
+  (void)data;
+  ingest_unref(hint);
+}
+
+static ingest_handle_t *get_ingest(napi_env env, napi_value value) {
+  ingest_handle_t *h = NULL;
+  napi_valuetype type;
+  if (napi_typeof(env, value, &type) != napi_ok || type != napi_external ||
+      napi_get_value_external(env, value, (void **)&h) != napi_ok || !h) {
+    napi_throw_type_error(env, NULL, "Expected an ingest handle");
+    return NULL;
+  }
+  return h;
+}
+
+static napi_value js_create_tar_ingest(napi_env env, napi_callback_info info) {
+  size_t argc = 4;
+  napi_value argv[4];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+
+  if (argc < 4) {
+    napi_throw_type_error(env, NULL,
+                          "Expected slots, slotSize, gzip, onReady");
+    return NULL;
+  }
+  uint32_t slots, slot_size;
+  bool gzip;
+  NAPI_CALL(env, napi_get_value_uint32(env, argv[0], &slots));
+  NAPI_CALL(env, napi_get_value_uint32(env, argv[1], &slot_size));
+  NAPI_CALL(env, napi_get_value_bool(env, argv[2], &gzip));
+
+  ingest_handle_t *h = calloc(1, sizeof(ingest_handle_t));
+  if (!h || !tar_ingest_init(&h->ingest, gzip, slots, slot_size,
+                             ingest_notify, h)) {
+    free(h);
+    napi_throw_error(env, NULL, "Failed to create tar ingest");
+    return NULL;
+  }
+  h->refs = 1;
+
+  napi_value name, arena, result;
+  if (napi_create_string_utf8(env, "tarIngestReady", NAPI_AUTO_LENGTH,
+                              &name) != napi_ok ||
+      napi_create_threadsafe_function(env, argv[3], NULL, name, 0, 1, h,
+                                      ingest_ready_finalize, NULL, NULL,
+                                      &h->on_ready) != napi_ok) {
+    ingest_unref(h);
+    napi_throw_error(env, NULL, "Failed to create tar ingest");
+    return NULL;
+  }
+  h->refs++;
+  // a waiting consumer alone should not keep the process alive
+  napi_unref_threadsafe_function(env, h->on_ready);
+
+  if (napi_create_external(env, h, ingest_handle_finalize, NULL, &result) !=
+      napi_ok) {
+    ingest_handle_finalize(env, h, NULL);
+    napi_throw_error(env, NULL, "Failed to create tar ingest");
+    return NULL;
+  }
+  NAPI_CALL(env, napi_create_external_arraybuffer(
+                     env, h->ingest.arena,
+                     (size_t)h->ingest.slots * h->ingest.slot_size,
+                     ingest_arena_finalize, h, &arena));
+  h->refs++;
+  NAPI_CALL(env, napi_create_reference(env, arena, 1, &h->arena_ref));
+  return result;
+}
+
+static void ingest_execute(napi_env env, void *data) {
+  (void)env;
+  ingest_job_t *job = data;
+  job->ok = tar_ingest_push(&job->h->ingest, job->data, job->len);
+}
+
+static void ingest_complete(napi_env env, napi_status status, void *data) {
+  ingest_job_t *job = data;
+  job->h->busy = false;
+  napi_delete_reference(env, job->chunk_ref);
+  napi_delete_reference(env, job->handle_ref);
+  napi_delete_async_work(env, job->work);
+
+  napi_value undefined, message, error;
+  if (status == napi_ok && job->ok) {
+    napi_get_undefined(env, &undefined);
+    napi_resolve_deferred(env, job->deferred, undefined);
+  } else {
+    napi_create_string_utf8(env,
+                            job->h->ingest.cancelled ? "Tar ingest cancelled"
+                                                     : "Corrupt archive",
+                            NAPI_AUTO_LENGTH, &message);
+    napi_create_error(env, NULL, message, &error);
+    napi_reject_deferred(env, job->deferred, error);
+  }
+  free(job);
+}
+
+static napi_value js_ingest_push(napi_env env, napi_callback_info info) {
+  size_t argc = 2;
+  napi_value argv[2];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+  ingest_handle_t *h = argc < 2 ? NULL : get_ingest(env, argv[0]);
+  if (!h)
+    return NULL;
+  if (h->busy) {
+    napi_throw_error(env, NULL, "Wait for the previous push");
+    return NULL;
+  }
+
+  ingest_job_t *job = calloc(1, sizeof(ingest_job_t));
+  void *chunk;
+  if (!job || !get_typed_bytes(env, argv[1], &chunk, &job->len)) {
+    free(job);
+    napi_throw_type_error(env, NULL, "Expected chunk buffer");
+    return NULL;
+  }
+  job->h = h;
+  job->data = chunk;
+
+  napi_value promise, name;
+  if (napi_create_reference(env, argv[0], 1, &job->handle_ref) != napi_ok ||
+      napi_create_reference(env, argv[1], 1, &job->chunk_ref) != napi_ok ||
+      napi_create_promise(env, &job->deferred, &promise) != napi_ok ||
+      napi_create_string_utf8(env, "ingestPush", NAPI_AUTO_LENGTH, &name) !=
+          napi_ok ||
+      napi_create_async_work(env, NULL, name, ingest_execute, ingest_complete,
+                             job, &job->work) != napi_ok ||
+      napi_queue_async_work(env, job->work) != napi_ok) {
+    free(job);
+    napi_throw_error(env, NULL, "Failed to queue tar ingest push");
+    return NULL;
+  }
+  h->busy = true;
+  return promise;
+}
+
+static napi_value make_ingest_entry(napi_env env, ingest_handle_t *h,
+                                    uint32_t slot) {
+  const tar_ingest_entry_t *e = &h->ingest.entries[slot];
+  napi_value obj, slot_value, type, name, link_name, data, arena;
+  NAPI_CALL(env, napi_create_object(env, &obj));
+  NAPI_CALL(env, napi_create_uint32(env, slot, &slot_value));
+  NAPI_CALL(env, napi_create_string_utf8(
+                     env, e->type == TAR_LINK ? "link" : "file",
+                     NAPI_AUTO_LENGTH, &type));
+  NAPI_CALL(env,
+            napi_create_string_utf8(env, e->name, NAPI_AUTO_LENGTH, &name));
+  NAPI_CALL(env, napi_set_named_property(env, obj, "slot", slot_value));
+  NAPI_CALL(env, napi_set_named_property(env, obj, "type", type));
+  NAPI_CALL(env, napi_set_named_property(env, obj, "name", name));
+
+  if (e->type == TAR_LINK) {
+    NAPI_CALL(env, napi_create_string_utf8(env, e->link_name, NAPI_AUTO_LENGTH,
+                                           &link_name));
+    NAPI_CALL(env, napi_set_named_property(env, obj, "linkName", link_name));
+    return obj;
+  }
+  char hex[TILE_MANIFEST_HASH * 2 + 1];
+  for (int i = 0; i < TILE_MANIFEST_HASH; i++)
+    snprintf(hex + i * 2, 3, "%02x", e->hash[i]);
+  napi_value hash;
+  NAPI_CALL(env, napi_create_string_utf8(env, hex, TILE_MANIFEST_HASH * 2,
+                                         &hash));
+  NAPI_CALL(env, napi_set_named_property(env, obj, "hash", hash));
+
+  if (e->oversize) {
+    void *copy;
+    NAPI_CALL(env, napi_create_buffer_copy(env, e->len, e->data, &copy, &data));
+  } else {
+    NAPI_CALL(env, napi_get_reference_value(env, h->arena_ref, &arena));
+    NAPI_CALL(env, napi_create_typedarray(env, napi_uint8_array, e->len, arena,
+                                          (size_t)slot * h->ingest.slot_size,
+                                          &data));
+  }
+  NAPI_CALL(env, napi_set_named_property(env, obj, "data", data));
+  return obj;
+}
+
+// Takes the entries that are ready. The bytes of a file are a view into its
+// slot and must not be used after the slot is released.
+static napi_value js_ingest_take(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value argv[1];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+  ingest_handle_t *h = argc < 1 ? NULL : get_ingest(env, argv[0]);
+  if (!h)
+    return NULL;
+
+  uint32_t *slots = malloc(h->ingest.slots * sizeof(uint32_t));
+  if (!slots) {
+    napi_throw_error(env, NULL, "Out of memory");
+    return NULL;
+  }
+  uint32_t n = tar_ingest_take(&h->ingest, slots, h->ingest.slots);
+
+  napi_value result = NULL;
+  if (napi_create_array_with_length(env, n, &result) == napi_ok) {
+    for (uint32_t i = 0; i < n && result; i++) {
+      napi_value entry = make_ingest_entry(env, h, slots[i]);
+      if (!entry || napi_set_element(env, result, i, entry) != napi_ok)
+        result = NULL;
+    }
+  }
+  free(slots);
+  return result;
+}
+
+static napi_value js_ingest_release(napi_env env, napi_callback_info info) {
+  size_t argc = 2;
+  napi_value argv[2];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+  ingest_handle_t *h = argc < 2 ? NULL : get_ingest(env, argv[0]);
+  if (!h)
+    return NULL;
+  uint32_t slot;
+  NAPI_CALL(env, napi_get_value_uint32(env, argv[1], &slot));
+  if (!tar_ingest_release(&h->ingest, slot)) {
+    napi_throw_range_error(env, NULL, "Slot not taken");
+    return NULL;
+  }
+  return NULL;
+}
+
+// After the last push: whether the archive was complete.
+static napi_value js_ingest_finish(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value argv[1];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+  ingest_handle_t *h = argc < 1 ? NULL : get_ingest(env, argv[0]);
+  if (!h)
+    return NULL;
+  napi_value result;
+  NAPI_CALL(env, napi_get_boolean(env, !h->busy &&
+                                           tar_ingest_finish(&h->ingest),
+                                  &result));
+  return result;
+}
+
+static napi_value js_ingest_cancel(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value argv[1];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+  ingest_handle_t *h = argc < 1 ? NULL : get_ingest(env, argv[0]);
+  if (h)
+    tar_ingest_cancel(&h->ingest);
+  return NULL;
+}
+
+// Manifest of a release in the content addressed tile store. tiles holds
+// z, x, y triples and hashes 16 bytes for each of them.
+static napi_value js_encode_tile_manifest(napi_env env,
+                                          napi_callback_info info) {
+  size_t argc = 2;
+  napi_value argv[2];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+
+  void *tiles, *hashes;
+  size_t tiles_len, hashes_len;
+  if (argc < 2 || !get_typed_bytes(env, argv[0], &tiles, &tiles_len) ||
+      !get_typed_bytes(env, argv[1], &hashes, &hashes_len) ||
+      tiles_len % (3 * sizeof(uint32_t)) != 0 ||
+      hashes_len != tiles_len / (3 * sizeof(uint32_t)) * TILE_MANIFEST_HASH) {
+    napi_throw_type_error(env, NULL,
+                          "Expected z/x/y triples and 16 byte hashes");
+    return NULL;
+  }
+
+  tile_manifest_t m;
+  tile_buf_t buf = {0};
+  if (!tile_manifest_build(&m, tiles, hashes, hashes_len / TILE_MANIFEST_HASH)) {
+    napi_throw_range_error(env, NULL, "Tile outside its zoom level");
+    return NULL;
+  }
+  bool ok = tile_manifest_encode(&m, &buf);
+  tile_manifest_free(&m);
+
+  napi_value result = NULL;
+  void *copy;
+  if (!ok || napi_create_buffer_copy(env, buf.len, buf.data, &copy,
+                                     &result) != napi_ok) {
+    napi_throw_error(env, NULL, "Failed to encode manifest");
+    result = NULL;
+  }
+  tile_buf_free(&buf);
+  return result;
+}
+
+// Returns { tiles, hashes }: z, x, y, hash index quadruples and the distinct
+// hashes of the release, 16 bytes each.
+static napi_value js_decode_tile_manifest(napi_env env,
+                                          napi_callback_info info) {
+  size_t argc = 1;
+  napi_value argv[1];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+
+  void *data;
+  size_t len;
+  if (argc < 1 || !get_typed_bytes(env, argv[0], &data, &len)) {
+    napi_throw_type_error(env, NULL, "Expected manifest buffer");
+    return NULL;
+  }
+  tile_manifest_t m;
+  if (!tile_manifest_decode(&m, data, len)) {
+    napi_throw_error(env, NULL, "Corrupt manifest");
+    return NULL;
+  }
+
+  napi_value result = NULL, tiles_buf, tiles, hashes;
+  void *out, *copy;
+  if (napi_create_arraybuffer(env, m.count * 4 * sizeof(uint32_t), &out,
+                              &tiles_buf) == napi_ok &&
+      napi_create_typedarray(env, napi_uint32_array, m.count * 4, tiles_buf,
+                             0, &tiles) == napi_ok &&
+      napi_create_buffer_copy(env, m.hash_count * TILE_MANIFEST_HASH,
+                              m.hashes, &copy, &hashes) == napi_ok &&
+      napi_create_object(env, &result) == napi_ok) {
+    uint32_t *q = out;
+    for (size_t i = 0; i < m.count; i++, q += 4) {
+      pmtiles_tile_coords(m.tiles[i].tile_id, &q[0], &q[1], &q[2]);
+      q[3] = m.tiles[i].hash;
+    }
+    if (napi_set_named_property(env, result, "tiles", tiles) != napi_ok ||
+        napi_set_named_property(env, result, "hashes", hashes) != napi_ok)
+      result = NULL;
+  }
+  tile_manifest_free(&m);
+  return result;
+}
+
+// A Float64Array argument of whole groups of width doubles.
+static bool get_float64s(napi_env env, napi_value value, size_t width,
+                         double **data, size_t *count) {
+  bool is_typed;
+  napi_typedarray_type type;
+  size_t length, byte_offset;
+  napi_value arraybuffer;
+  if (napi_is_typedarray(env, value, &is_typed) != napi_ok || !is_typed ||
+      napi_get_typedarray_info(env, value, &type, &length, (void **)data,
+                               &arraybuffer, &byte_offset) != napi_ok ||
+      type != napi_float64_array || length % width != 0)
+    return false;
+  *count = length / width;
+  return true;
+}
+
+typedef void (*mercator_fn)(const double *in, size_t count, uint32_t z,
+                            double scale, double *out);
+
+// (points, z = 11, scale = 1000, out?) for both batch conversions: points
+// holds in_width doubles per point, the result out_width, written to out when
+// given and to a new Float64Array otherwise.
+static napi_value mercator_batch(napi_env env, napi_callback_info info,
+                                 size_t in_width, size_t out_width,
+                                 mercator_fn convert, const char *expected) {
+  size_t argc = 4;
+  napi_value argv[4];
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+
+  double *in;
+  size_t count;
+  if (argc < 1 || !get_float64s(env, argv[0], in_width, &in, &count)) {
+    napi_throw_type_error(env, NULL, expected);
+    return NULL;
+  }
+  uint32_t z = 11;
+  double scale = 1000;
+  if (argc >= 2 && !is_nullish(env, argv[1]))
+    NAPI_CALL(env, napi_get_value_uint32(env, argv[1], &z));
+  if (argc >= 3 && !is_nullish(env, argv[2]))
+    NAPI_CALL(env, napi_get_value_double(env, argv[2], &scale));
+  if (z > 30 || !(scale >= 1)) {
+    napi_throw_range_error(env, NULL, "Expected z <= 30 and scale >= 1");
+    return NULL;
+  }
+
+  napi_value result;
+  double *out;
+  size_t out_count;
+  if (argc >= 4 && !is_nullish(env, argv[3])) {
+    if (!get_float64s(env, argv[3], out_width, &out, &out_count) ||
+        out_count != count) {
+      napi_throw_type_error(env, NULL, "out must be a Float64Array sized "
+                                       "for every point");
+      return NULL;
+    }
+    if (count && out < in + count * in_width && in < out + count * out_width) {
+      napi_throw_range_error(env, NULL, "out overlaps the points");
+      return NULL;
+    }
+    result = argv[3];
+  } else {
+    napi_value buffer;
+    NAPI_CALL(env, napi_create_arraybuffer(env,
+                                           count * out_width * sizeof(double),
+                                           (void **)&out, &buffer));
+    NAPI_CALL(env, napi_create_typedarray(env, napi_float64_array,
+                                          count * out_width, buffer, 0,
+                                          &result));
+  }
+  convert(in, count, z, scale, out);
+  return result;
+}
+
+static napi_value js_tl_px_to_gps_batch(napi_env env,
+                                        napi_callback_info info) {
+  return mercator_batch(env, info, 4, 2, mercator_tl_px_to_gps,
+                        "Expected a Float64Array of TlX, TlY, PxX, PxY");
+}
+
+static napi_value js_gps_to_tl_px_batch(napi_env env,
+                                        napi_callback_info info) {
+  return mercator_batch(env, info, 2, 4, mercator_gps_to_tl_px,
+                        "Expected a Float64Array of lat, lng pairs");
+}
+
+static napi_value js_tile_slab_stats(napi_env env, napi_callback_info info) {
+  (void)info;
+  tile_slab_t *slab = &get_state(env)->slab;
+
+  napi_value obj, in_use, allocated, high_water, max_planes, plane_size;
+  NAPI_CALL(env, napi_create_object(env, &obj));
+  NAPI_CALL(env, napi_create_uint32(env, slab->in_use, &in_use));
+  NAPI_CALL(env, napi_create_uint32(env, slab->allocated, &allocated));
+  NAPI_CALL(env, napi_create_uint32(env, slab->high_water, &high_water));
+  NAPI_CALL(env, napi_create_uint32(env, slab->max_planes, &max_planes));
+  NAPI_CALL(env,
+            napi_create_uint32(env, (uint32_t)slab->plane_size, &plane_size));
+  NAPI_CALL(env, napi_set_named_property(env, obj, "inUse", in_use));
+  NAPI_CALL(env, napi_set_named_property(env, obj, "allocated", allocated));
+  NAPI_CALL(env, napi_set_named_property(env, obj, "highWater", high_water));
+  NAPI_CALL(env, napi_set_named_property(env, obj, "maxPlanes", max_planes));
+  NAPI_CALL(env, napi_set_named_property(env, obj, "planeSize", plane_size));
+  return obj;
+}
+
 static napi_value js_destroy_pumpkin(napi_env env, napi_callback_info info) {
   pumpkin_destroy(&g_pumpkin);
   return NULL;
@@ -107,7 +1343,24 @@ static void addon_destroy(void *arg) {
   pumpkin_destroy(&g_pumpkin);
 }
 
+static void state_destroy(napi_env env, void *data, void *hint) {
+  (void)env;
+  (void)hint;
+  addon_state_t *state = data;
+  tile_arena_destroy(&state->arena);
+  tile_slab_destroy(&state->slab);
+  free(state->plane_buffers);
+  free(state);
+}
+
 static napi_value init(napi_env env, napi_value exports) {
+  addon_state_t *state = calloc(1, sizeof(addon_state_t));
+  if (!state) {
+    napi_throw_error(env, NULL, "Failed to allocate addon state");
+    return NULL;
+  }
+  NAPI_CALL(env, napi_set_instance_data(env, state, state_destroy, NULL));
+
   napi_value set_fn;
   NAPI_CALL(env, napi_create_function(env, "setPumpkinData", NAPI_AUTO_LENGTH,
                                       js_set_pumpkin, NULL, &set_fn));
@@ -126,6 +1379,186 @@ static napi_value init(napi_env env, napi_value exports) {
   NAPI_CALL(env, napi_set_named_property(env, exports, "destoryPumpkinData",
                                          destroy_fn));
 
+  napi_value record_fn;
+  NAPI_CALL(env, napi_create_function(env, "recordTileStat", NAPI_AUTO_LENGTH,
+                                      js_record_tile_stat, NULL, &record_fn));
+  NAPI_CALL(env,
+            napi_set_named_property(env, exports, "recordTileStat", record_fn));
+
+  napi_value order_fn;
+  NAPI_CALL(env, napi_create_function(env, "buildScanOrder", NAPI_AUTO_LENGTH,
+                                      js_build_scan_order, NULL, &order_fn));
+  NAPI_CALL(env,
+            napi_set_named_property(env, exports, "buildScanOrder", order_fn));
+
+  napi_value arena_fn;
+  NAPI_CALL(env, napi_create_function(env, "createTileArena", NAPI_AUTO_LENGTH,
+                                      js_create_tile_arena, NULL, &arena_fn));
+  NAPI_CALL(env,
+            napi_set_named_property(env, exports, "createTileArena", arena_fn));
+
+  napi_value acquire_fn;
+  NAPI_CALL(env, napi_create_function(env, "acquireTileSlot", NAPI_AUTO_LENGTH,
+                                      js_acquire_tile_slot, NULL, &acquire_fn));
+  NAPI_CALL(env, napi_set_named_property(env, exports, "acquireTileSlot",
+                                         acquire_fn));
+
+  napi_value release_fn;
+  NAPI_CALL(env, napi_create_function(env, "releaseTileSlot", NAPI_AUTO_LENGTH,
+                                      js_release_tile_slot, NULL, &release_fn));
+  NAPI_CALL(env, napi_set_named_property(env, exports, "releaseTileSlot",
+                                         release_fn));
+
+  napi_value slab_fn;
+  NAPI_CALL(env, napi_create_function(env, "createTileSlab", NAPI_AUTO_LENGTH,
+                                      js_create_tile_slab, NULL, &slab_fn));
+  NAPI_CALL(env,
+            napi_set_named_property(env, exports, "createTileSlab", slab_fn));
+
+  napi_value decode_fn;
+  NAPI_CALL(env, napi_create_function(env, "decodeTile", NAPI_AUTO_LENGTH,
+                                      js_decode_tile, NULL, &decode_fn));
+  NAPI_CALL(env, napi_set_named_property(env, exports, "decodeTile", decode_fn));
+
+  napi_value plane_fn;
+  NAPI_CALL(env, napi_create_function(env, "releaseTilePlane", NAPI_AUTO_LENGTH,
+                                      js_release_tile_plane, NULL, &plane_fn));
+  NAPI_CALL(env,
+            napi_set_named_property(env, exports, "releaseTilePlane", plane_fn));
+
+  napi_value slab_stats_fn;
+  NAPI_CALL(env, napi_create_function(env, "tileSlabStats", NAPI_AUTO_LENGTH,
+                                      js_tile_slab_stats, NULL,
+                                      &slab_stats_fn));
+  NAPI_CALL(env, napi_set_named_property(env, exports, "tileSlabStats",
+                                         slab_stats_fn));
+
+  napi_value quantize_fn;
+  NAPI_CALL(env, napi_create_function(env, "quantizeTile", NAPI_AUTO_LENGTH,
+                                      js_quantize_tile, NULL, &quantize_fn));
+  NAPI_CALL(env,
+            napi_set_named_property(env, exports, "quantizeTile", quantize_fn));
+
+  napi_value open_archive_fn;
+  NAPI_CALL(env, napi_create_function(env, "openTileArchive", NAPI_AUTO_LENGTH,
+                                      js_open_tile_archive, NULL,
+                                      &open_archive_fn));
+  NAPI_CALL(env, napi_set_named_property(env, exports, "openTileArchive",
+                                         open_archive_fn));
+
+  napi_value read_archive_fn;
+  NAPI_CALL(env, napi_create_function(env, "readArchiveTile", NAPI_AUTO_LENGTH,
+                                      js_read_archive_tile, NULL,
+                                      &read_archive_fn));
+  NAPI_CALL(env, napi_set_named_property(env, exports, "readArchiveTile",
+                                         read_archive_fn));
+
+  napi_value close_archive_fn;
+  NAPI_CALL(env, napi_create_function(env, "closeTileArchive",
+                                      NAPI_AUTO_LENGTH, js_close_tile_archive,
+                                      NULL, &close_archive_fn));
+  NAPI_CALL(env, napi_set_named_property(env, exports, "closeTileArchive",
+                                         close_archive_fn));
+
+  napi_value create_untar_fn;
+  NAPI_CALL(env, napi_create_function(env, "createUntar", NAPI_AUTO_LENGTH,
+                                      js_create_untar, NULL,
+                                      &create_untar_fn));
+  NAPI_CALL(env, napi_set_named_property(env, exports, "createUntar",
+                                         create_untar_fn));
+
+  napi_value untar_push_fn;
+  NAPI_CALL(env, napi_create_function(env, "untarPush", NAPI_AUTO_LENGTH,
+                                      js_untar_push, NULL, &untar_push_fn));
+  NAPI_CALL(env,
+            napi_set_named_property(env, exports, "untarPush", untar_push_fn));
+
+  napi_value untar_finish_fn;
+  NAPI_CALL(env, napi_create_function(env, "untarFinish", NAPI_AUTO_LENGTH,
+                                      js_untar_finish, NULL,
+                                      &untar_finish_fn));
+  NAPI_CALL(env, napi_set_named_property(env, exports, "untarFinish",
+                                         untar_finish_fn));
+
+  napi_value untar_abort_fn;
+  NAPI_CALL(env, napi_create_function(env, "untarAbort", NAPI_AUTO_LENGTH,
+                                      js_untar_abort, NULL,
+                                      &untar_abort_fn));
+  NAPI_CALL(env, napi_set_named_property(env, exports, "untarAbort",
+                                         untar_abort_fn));
+
+  napi_value create_ingest_fn;
+  NAPI_CALL(env, napi_create_function(env, "createTarIngest", NAPI_AUTO_LENGTH,
+                                      js_create_tar_ingest, NULL,
+                                      &create_ingest_fn));
+  NAPI_CALL(env, napi_set_named_property(env, exports, "createTarIngest",
+                                         create_ingest_fn));
+
+  napi_value ingest_push_fn;
+  NAPI_CALL(env, napi_create_function(env, "ingestPush", NAPI_AUTO_LENGTH,
+                                      js_ingest_push, NULL,
+                                      &ingest_push_fn));
+  NAPI_CALL(env, napi_set_named_property(env, exports, "ingestPush",
+                                         ingest_push_fn));
+
+  napi_value ingest_take_fn;
+  NAPI_CALL(env, napi_create_function(env, "ingestTake", NAPI_AUTO_LENGTH,
+                                      js_ingest_take, NULL,
+                                      &ingest_take_fn));
+  NAPI_CALL(env, napi_set_named_property(env, exports, "ingestTake",
+                                         ingest_take_fn));
+
+  napi_value ingest_release_fn;
+  NAPI_CALL(env, napi_create_function(env, "ingestRelease", NAPI_AUTO_LENGTH,
+                                      js_ingest_release, NULL,
+                                      &ingest_release_fn));
+  NAPI_CALL(env, napi_set_named_property(env, exports, "ingestRelease",
+                                         ingest_release_fn));
+
+  napi_value ingest_finish_fn;
+  NAPI_CALL(env, napi_create_function(env, "ingestFinish", NAPI_AUTO_LENGTH,
+                                      js_ingest_finish, NULL,
+                                      &ingest_finish_fn));
+  NAPI_CALL(env, napi_set_named_property(env, exports, "ingestFinish",
+                                         ingest_finish_fn));
+
+  napi_value ingest_cancel_fn;
+  NAPI_CALL(env, napi_create_function(env, "ingestCancel", NAPI_AUTO_LENGTH,
+                                      js_ingest_cancel, NULL,
+                                      &ingest_cancel_fn));
+  NAPI_CALL(env, napi_set_named_property(env, exports, "ingestCancel",
+                                         ingest_cancel_fn));
+
+  napi_value encode_manifest_fn;
+  NAPI_CALL(env,
+            napi_create_function(env, "encodeTileManifest", NAPI_AUTO_LENGTH,
+                                 js_encode_tile_manifest, NULL,
+                                 &encode_manifest_fn));
+  NAPI_CALL(env, napi_set_named_property(env, exports, "encodeTileManifest",
+                                         encode_manifest_fn));
+
+  napi_value decode_manifest_fn;
+  NAPI_CALL(env,
+            napi_create_function(env, "decodeTileManifest", NAPI_AUTO_LENGTH,
+                                 js_decode_tile_manifest, NULL,
+                                 &decode_manifest_fn));
+  NAPI_CALL(env, napi_set_named_property(env, exports, "decodeTileManifest",
+                                         decode_manifest_fn));
+
+  napi_value to_gps_fn;
+  NAPI_CALL(env, napi_create_function(env, "tlPxToGpsBatch", NAPI_AUTO_LENGTH,
+                                      js_tl_px_to_gps_batch, NULL,
+                                      &to_gps_fn));
+  NAPI_CALL(env,
+            napi_set_named_property(env, exports, "tlPxToGpsBatch", to_gps_fn));
+
+  napi_value to_tl_px_fn;
+  NAPI_CALL(env, napi_create_function(env, "gpsToTlPxBatch", NAPI_AUTO_LENGTH,
+                                      js_gps_to_tl_px_batch, NULL,
+                                      &to_tl_px_fn));
+  NAPI_CALL(env, napi_set_named_property(env, exports, "gpsToTlPxBatch",
+                                         to_tl_px_fn));
+
   NAPI_CALL(env, napi_add_env_cleanup_hook(env, addon_destroy, NULL));
   return exports;
 }
@@ -0,0 +1,643 @@
+// Builds the zoom levels below the base level of public/tiles, the native
+// replacement for build_parent_levels in scripts/vips.py: every parent tile
+// is the 2x2 reduction of its four children, down to min-z.
+//
+// Instead of finishing one level before starting the next, and so encoding
+// and decoding every tile once more per level, the pyramid is built in one
+// recursive pass per subtree. A node renders its four children in Z order
+// into one plane of its level, reduces each into its quadrant and writes
+// itself. A thread therefore holds one plane per level, and every base tile
+// is read and decoded exactly once.
+//
+// With --previous, the pyramid of the previous release is reused: only base
+// tiles that differ from it (or are listed in --changed) dirty their ancestor
+// chain, every other parent is hard linked from the previous release and
+// loaded from there when a dirty sibling needs it.
+//
+// Parents already in DIR, left by an interrupted run, are kept and loaded
+// instead of rebuilt, unless a child is newer than them or gone, as after the
+// base tiles were extracted again. Tiles are only ever written through a
+// temporary file and a rename, or linked, so none of them is partial.
+//
+// A finished pyramid is marked with DIR/.pyramid, holding the filter and
+// levels it was built with. --previous is only taken up when that marker
+// matches the current build, so parents averaged by another tool or filter
+// are never linked into this one.
+//
+// Tiles with the same bytes, transparent or solid areas mostly, are written
+// once. Later copies become hard links to the first, which tar stores as
+// link entries.
+#define _DEFAULT_SOURCE
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "palette.h"
+#include "thread_pool.h"
+#include "tile_hash.h"
+#include "tile_io.h"
+#include "tile_pmtiles.h"
+#include "tile_png.h"
+#include "tile_reduce.h"
+#include "tile_slab.h"
+
+// Subtrees rooted at this level are the units of work handed to threads,
+// 4^5 of them spread the uneven map density well over any thread count.
+#define SPLIT_Z 5
+#define MARKER ".pyramid"
+
+typedef struct {
+  tile_slab_t planes; // one per level in the recursion
+  tile_slab_t decode; // RGBA decode target in indexed mode
+  tile_buf_t buffer;  // compressed tile
+  tile_buf_t previous; // same tile of the previous release
+} worker_t;
+
+typedef struct {
+  const char *root;
+  uint32_t base_z;
+  uint32_t min_z;
+  uint32_t tile_size;
+  tile_reduce_mode_t mode;
+  bool indexed; // planes hold palette indices, tiles are written as such
+  uint32_t bpp;
+  int level;
+  tile_png_effort_t effort;
+  uint8_t **occupied; // [base_z + 1], 2^z x 2^z flags of nodes with tiles
+  const char *previous; // root of the previous release, or NULL
+  uint8_t **dirty;      // like occupied, nodes that changed since previous
+  worker_t *workers;
+  uint32_t z_job; // level of the nodes the current thread_pool_for runs
+  atomic_size_t written[32];
+  tile_hash_set_t hashes; // encoded tile -> first tile written with it
+  atomic_size_t failed;
+  atomic_size_t linked;
+  atomic_size_t duplicates;
+  atomic_size_t stale;
+} pyramid_t;
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s [--root DIR] [--base-z Z] [--min-z Z] [--threads N]\n"
+          "          [--filter nearest|box|premul|mode] [--level 0-9]\n"
+          "          [--effort fast|max] [--tile-size PX] [--no-simd]\n"
+          "          [--previous DIR [--changed FILE]] [--pack FILE]\n",
+          argv0);
+}
+
+// What goes into the marker of a pyramid built with these settings.
+static bool marker_text(const pyramid_t *p, const char *filter, char *out,
+                        size_t size) {
+  int n = snprintf(out, size,
+                   "wplace pyramid filter=%s base-z=%u min-z=%u "
+                   "tile-size=%u\n",
+                   filter, p->base_z, p->min_z, p->tile_size);
+  return n > 0 && (size_t)n < size;
+}
+
+static bool marker_path(const char *root, char *out, size_t size) {
+  int n = snprintf(out, size, "%s/" MARKER, root);
+  return n > 0 && (size_t)n < size;
+}
+
+// Whether dir holds a complete pyramid built the way this one is.
+static bool marker_matches(const char *dir, const char *text) {
+  char path[4096];
+  tile_buf_t b = {0};
+  bool same = marker_path(dir, path, sizeof(path)) && tile_io_read(path, &b) &&
+              b.len == strlen(text) && memcmp(b.data, text, b.len) == 0;
+  tile_buf_free(&b);
+  return same;
+}
+
+static bool is_occupied(const pyramid_t *p, uint32_t z, uint32_t x,
+                        uint32_t y) {
+  return p->occupied[z][((size_t)y << z) + x] != 0;
+}
+
+// Reads and decodes an existing tile into plane, converting it to palette
+// indices in indexed mode.
+static bool load_tile(pyramid_t *p, worker_t *w, const char *path,
+                      uint8_t *plane) {
+  if (!tile_io_read(path, &w->buffer))
+    return false;
+
+  uint8_t *rgba = plane;
+  int32_t decode_plane = -1;
+  if (p->indexed) {
+    decode_plane = tile_slab_borrow(&w->decode);
+    if (decode_plane < 0)
+      return false;
+    rgba = tile_slab_plane(&w->decode, (uint32_t)decode_plane);
+  }
+
+  uint32_t width, height;
+  bool ok = tile_png_decode_rgba(w->buffer.data, w->buffer.len, rgba,
+                                 w->decode.plane_size, &width, &height) &&
+            width == p->tile_size && height == p->tile_size;
+  if (!ok)
+    fprintf(stderr, "\nSkipping unreadable tile %s\n", path);
+  else if (p->indexed)
+    palette_rgba_to_indices(rgba, (size_t)width * height, plane);
+
+  if (decode_plane >= 0)
+    tile_slab_return(&w->decode, (uint32_t)decode_plane);
+  return ok;
+}
+
+// Links path to the tile first written with the same bytes. Fails if there
+// is none, it changed on disk or the link count of the file is exhausted.
+static bool link_duplicate(pyramid_t *p, worker_t *w, const char *path,
+                           const uint8_t *png, size_t png_len,
+                           uint64_t hash) {
+  tile_hash_entry_t first;
+  char first_path[4096];
+  return tile_hash_set_find(&p->hashes, hash, png_len, &first) &&
+         tile_io_path(first_path, sizeof(first_path), p->root, first.z,
+                      first.x, first.y) &&
+         tile_io_read(first_path, &w->buffer) && w->buffer.len == png_len &&
+         memcmp(w->buffer.data, png, png_len) == 0 &&
+         tile_io_link(first_path, path, NULL);
+}
+
+static void write_tile(pyramid_t *p, worker_t *w, uint32_t z, uint32_t x,
+                       uint32_t y, const char *path, const uint8_t *plane) {
+  uint8_t *png;
+  size_t png_len;
+  size_t stride = (size_t)p->tile_size * p->bpp;
+  bool ok = p->indexed
+                ? tile_png_encode_indexed(plane, p->tile_size, p->tile_size,
+                                          stride, wplace_palette, PALETTE_SIZE,
+                                          p->level, p->effort, &png, &png_len)
+                : tile_png_encode_rgba(plane, p->tile_size, p->tile_size,
+                                       stride, p->level, &png, &png_len);
+  if (ok) {
+    uint64_t hash = tile_hash64(png, png_len, 0);
+    if (link_duplicate(p, w, path, png, png_len, hash)) {
+      atomic_fetch_add(&p->duplicates, 1);
+    } else {
+      ok = tile_io_write(path, png, png_len);
+      // a failed link (say EMLINK) makes this copy the one to link to
+      tile_hash_entry_t e = {.hash = hash, .len = png_len, .z = z, .x = x,
+                             .y = y};
+      if (ok)
+        tile_hash_set_put(&p->hashes, &e);
+    }
+    free(png);
+  }
+  if (ok)
+    atomic_fetch_add(&p->written[z], 1);
+  else
+    atomic_fetch_add(&p->failed, 1);
+}
+
+// Renders tile (z, x, y) into plane and writes it if it is below the base
+// level. Tiles that already exist, the base level and parents kept from an
+// earlier run that stale_job found current, are loaded instead of rebuilt. Returns false if the tile has
+// no content, like vips.py a parent of four missing children is not written.
+static bool build_node(pyramid_t *p, worker_t *w, uint32_t z, uint32_t x,
+                       uint32_t y, uint8_t *plane) {
+  char path[4096];
+  if (!tile_io_path(path, sizeof(path), p->root, z, x, y))
+    return false;
+  if (z == p->base_z || tile_io_exists(path))
+    return load_tile(p, w, path, plane);
+
+  int32_t child_plane = tile_slab_borrow(&w->planes);
+  if (child_plane < 0) {
+    atomic_fetch_add(&p->failed, 1);
+    return false;
+  }
+  uint8_t *child = tile_slab_plane(&w->planes, (uint32_t)child_plane);
+  size_t stride = (size_t)p->tile_size * p->bpp;
+  uint32_t half = p->tile_size / 2;
+  bool any = false;
+
+  // same order as arrayjoin(across=2): top left, top right, bottom left,
+  // bottom right, which also makes the whole walk a Z order curve
+  for (uint32_t q = 0; q < 4; q++) {
+    uint32_t cx = x * 2 + (q & 1), cy = y * 2 + (q >> 1);
+    uint8_t *dst = plane + (size_t)(q >> 1) * half * stride +
+                   (size_t)(q & 1) * half * p->bpp;
+
+    if (is_occupied(p, z + 1, cx, cy) &&
+        build_node(p, w, z + 1, cx, cy, child)) {
+      if (p->indexed)
+        tile_reduce_indices(child, p->tile_size, p->tile_size, stride, dst,
+                            stride);
+      else
+        tile_reduce_rgba(child, p->tile_size, p->tile_size, stride, dst,
+                         stride, p->mode);
+      any = true;
+      continue;
+    }
+    for (uint32_t row = 0; row < half; row++)
+      memset(dst + row * stride, 0, (size_t)half * p->bpp);
+  }
+  tile_slab_return(&w->planes, (uint32_t)child_plane);
+
+  if (any)
+    write_tile(p, w, z, x, y, path, plane);
+  return any;
+}
+
+// item is the Morton index of a node of level z_job
+static void build_job(void *ctx, size_t item, uint32_t thread) {
+  pyramid_t *p = ctx;
+  worker_t *w = &p->workers[thread];
+  uint32_t x = 0, y = 0;
+  for (uint32_t bit = 0; bit < p->z_job; bit++) {
+    x |= (uint32_t)((item >> (bit * 2)) & 1) << bit;
+    y |= (uint32_t)((item >> (bit * 2 + 1)) & 1) << bit;
+  }
+  if (!is_occupied(p, p->z_job, x, y))
+    return;
+
+  char path[4096];
+  if (!tile_io_path(path, sizeof(path), p->root, p->z_job, x, y) ||
+      tile_io_exists(path))
+    return;
+
+  int32_t plane = tile_slab_borrow(&w->planes);
+  if (plane < 0) {
+    atomic_fetch_add(&p->failed, 1);
+    return;
+  }
+  build_node(p, w, p->z_job, x, y,
+             tile_slab_plane(&w->planes, (uint32_t)plane));
+  tile_slab_return(&w->planes, (uint32_t)plane);
+}
+
+static uint8_t **alloc_levels(uint32_t base_z) {
+  uint8_t **levels = calloc(base_z + 1, sizeof(uint8_t *));
+  for (uint32_t z = 0; levels && z <= base_z; z++) {
+    levels[z] = calloc((size_t)1 << (z * 2), 1);
+    if (!levels[z])
+      return NULL;
+  }
+  return levels;
+}
+
+static void free_levels(uint8_t **levels, uint32_t base_z) {
+  for (uint32_t z = 0; levels && z <= base_z; z++)
+    free(levels[z]);
+  free(levels);
+}
+
+// Sets the flag of every parent that has a flagged child, from base_z up to
+// min_z.
+static void mark_parents(uint8_t **levels, uint32_t base_z, uint32_t min_z) {
+  for (uint32_t z = base_z; z > min_z; z--) {
+    uint32_t dim = 1u << z;
+    for (uint32_t y = 0; y < dim; y++) {
+      for (uint32_t x = 0; x < dim; x++) {
+        if (levels[z][(size_t)y * dim + x])
+          levels[z - 1][(size_t)(y / 2) * (dim / 2) + x / 2] = 1;
+      }
+    }
+  }
+}
+
+// Finds the base tiles, marks their ancestors and creates the column
+// directories every level will write to.
+static bool scan(pyramid_t *p) {
+  p->occupied = alloc_levels(p->base_z);
+  if (!p->occupied)
+    return false;
+
+  size_t found =
+      tile_io_scan_level(p->root, p->base_z, p->occupied[p->base_z]);
+  fprintf(stderr, "Found %zu tiles at z=%u\n", found, p->base_z);
+  mark_parents(p->occupied, p->base_z, p->min_z);
+
+  for (uint32_t z = p->base_z; z > p->min_z; z--) {
+    uint32_t parent_dim = 1u << (z - 1);
+    for (uint32_t x = 0; x < parent_dim; x++) {
+      bool column = false;
+      for (uint32_t y = 0; y < parent_dim && !column; y++)
+        column = is_occupied(p, z - 1, x, y);
+
+      char path[4096];
+      if (column && (!tile_io_path(path, sizeof(path), p->root, z - 1, x, 0) ||
+                     !tile_io_mkdirs_for(path))) {
+        fprintf(stderr, "Failed to create directory for %s\n", path);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Flags a base tile as dirty unless it is byte for byte the same as in the
+// previous release.
+static void compare_job(void *ctx, size_t item, uint32_t thread) {
+  pyramid_t *p = ctx;
+  worker_t *w = &p->workers[thread];
+  uint32_t dim = 1u << p->base_z;
+  uint32_t x = (uint32_t)(item % dim), y = (uint32_t)(item / dim);
+  if (!p->occupied[p->base_z][item] || p->dirty[p->base_z][item])
+    return;
+
+  char path[4096], previous[4096];
+  bool same =
+      tile_io_path(path, sizeof(path), p->root, p->base_z, x, y) &&
+      tile_io_path(previous, sizeof(previous), p->previous, p->base_z, x, y) &&
+      tile_io_read(path, &w->buffer) && tile_io_read(previous, &w->previous) &&
+      w->buffer.len == w->previous.len &&
+      memcmp(w->buffer.data, w->previous.data, w->buffer.len) == 0;
+  if (!same)
+    p->dirty[p->base_z][item] = 1;
+}
+
+// Lines of "x/y" (or "x y", "x,y") naming changed base tiles.
+static bool read_changed(pyramid_t *p, const char *list) {
+  FILE *f = fopen(list, "r");
+  if (!f) {
+    fprintf(stderr, "Failed to open %s\n", list);
+    return false;
+  }
+
+  uint32_t dim = 1u << p->base_z;
+  size_t count = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), f)) {
+    unsigned x, y;
+    if (sscanf(line, "%u%*[ /,]%u", &x, &y) != 2 || x >= dim || y >= dim)
+      continue;
+    p->dirty[p->base_z][(size_t)y * dim + x] = 1;
+    count++;
+  }
+  fclose(f);
+  fprintf(stderr, "%zu changed tiles listed in %s\n", count, list);
+  return true;
+}
+
+// Finds the base tiles that changed since the previous release: tiles that
+// were added or removed, plus either the listed tiles or, without a list,
+// every tile whose bytes differ.
+static bool diff(pyramid_t *p, uint32_t threads, const char *changed) {
+  p->dirty = alloc_levels(p->base_z);
+  uint8_t *before = calloc((size_t)1 << (p->base_z * 2), 1);
+  if (!p->dirty || !before) {
+    free(before);
+    return false;
+  }
+
+  size_t count = (size_t)1 << (p->base_z * 2);
+  tile_io_scan_level(p->previous, p->base_z, before);
+  for (size_t i = 0; i < count; i++) {
+    if (before[i] != p->occupied[p->base_z][i])
+      p->dirty[p->base_z][i] = 1;
+  }
+  free(before);
+
+  if (changed) {
+    if (!read_changed(p, changed))
+      return false;
+  } else {
+    thread_pool_for(threads, count, compare_job, p);
+  }
+
+  size_t dirty = 0;
+  for (size_t i = 0; i < count; i++)
+    dirty += p->dirty[p->base_z][i];
+  fprintf(stderr, "%zu tiles at z=%u changed since %s\n", dirty, p->base_z,
+          p->previous);
+  mark_parents(p->dirty, p->base_z, p->min_z);
+  return true;
+}
+
+static bool newer(const struct timespec *a, const struct timespec *b) {
+  return a->tv_sec != b->tv_sec ? a->tv_sec > b->tv_sec
+                                : a->tv_nsec > b->tv_nsec;
+}
+
+// Removes a parent of level z_job left by an earlier run when one of its
+// children is newer than it or missing, so build_job rebuilds it. Runs from
+// the level above the base up, so a removed child makes its parent stale in
+// turn.
+static void stale_job(void *ctx, size_t item, uint32_t thread) {
+  (void)thread;
+  pyramid_t *p = ctx;
+  uint32_t z = p->z_job, dim = 1u << z;
+  uint32_t x = (uint32_t)(item % dim), y = (uint32_t)(item / dim);
+  char path[4096];
+  struct stat st;
+  if (!p->occupied[z][item] ||
+      !tile_io_path(path, sizeof(path), p->root, z, x, y) ||
+      stat(path, &st) != 0)
+    return;
+
+  for (uint32_t q = 0; q < 4; q++) {
+    uint32_t cx = x * 2 + (q & 1), cy = y * 2 + (q >> 1);
+    char child[4096];
+    struct stat cst;
+    if (!is_occupied(p, z + 1, cx, cy) ||
+        !tile_io_path(child, sizeof(child), p->root, z + 1, cx, cy))
+      continue;
+    if (stat(child, &cst) != 0 || newer(&cst.st_mtim, &st.st_mtim)) {
+      if (remove(path) == 0)
+        atomic_fetch_add(&p->stale, 1);
+      return;
+    }
+  }
+}
+
+// Hard links the clean parents of level z_job from the previous release and
+// removes stale copies of dirty ones, so build_job rebuilds exactly the
+// dirty chains.
+static void link_job(void *ctx, size_t item, uint32_t thread) {
+  pyramid_t *p = ctx;
+  uint32_t dim = 1u << p->z_job;
+  uint32_t x = (uint32_t)(item % dim), y = (uint32_t)(item / dim);
+  if (!p->occupied[p->z_job][item])
+    return;
+
+  char path[4096], previous[4096];
+  if (!tile_io_path(path, sizeof(path), p->root, p->z_job, x, y) ||
+      !tile_io_path(previous, sizeof(previous), p->previous, p->z_job, x, y))
+    return;
+
+  if (p->dirty[p->z_job][item])
+    remove(path);
+  else if (tile_io_exists(previous) &&
+           tile_io_link(previous, path, &p->workers[thread].buffer))
+    atomic_fetch_add(&p->linked, 1);
+}
+
+int main(int argc, char **argv) {
+  const char *root = "public/tiles";
+  uint32_t base_z = 11, min_z = 0, tile_size = 1000;
+  uint32_t threads = thread_pool_default_threads();
+  tile_reduce_mode_t mode = TILE_REDUCE_BOX;
+  bool indexed = false;
+  int level = 6;
+  tile_png_effort_t effort = TILE_PNG_FAST;
+  const char *previous = NULL, *changed = NULL, *pack = NULL;
+  const char *filter = "box";
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+    if (strcmp(arg, "--no-simd") == 0) {
+      tile_reduce_set_simd(false);
+      tile_png_set_simd(false);
+      continue;
+    }
+    if (!val) {
+      usage(argv[0]);
+      return 1;
+    }
+    i++;
+    if (strcmp(arg, "--root") == 0)
+      root = val;
+    else if (strcmp(arg, "--base-z") == 0)
+      base_z = (uint32_t)atoi(val);
+    else if (strcmp(arg, "--min-z") == 0)
+      min_z = (uint32_t)atoi(val);
+    else if (strcmp(arg, "--threads") == 0)
+      threads = (uint32_t)atoi(val);
+    else if (strcmp(arg, "--level") == 0)
+      level = atoi(val);
+    else if (strcmp(arg, "--tile-size") == 0)
+      tile_size = (uint32_t)atoi(val);
+    else if (strcmp(arg, "--effort") == 0 && strcmp(val, "fast") == 0)
+      effort = TILE_PNG_FAST;
+    else if (strcmp(arg, "--effort") == 0 && strcmp(val, "max") == 0)
+      effort = TILE_PNG_MAX;
+    else if (strcmp(arg, "--previous") == 0)
+      previous = val;
+    else if (strcmp(arg, "--changed") == 0)
+      changed = val;
+    else if (strcmp(arg, "--pack") == 0)
+      pack = val;
+    else if (strcmp(arg, "--filter") == 0 && strcmp(val, "mode") == 0) {
+      indexed = true;
+      filter = val;
+    } else if (strcmp(arg, "--filter") == 0 &&
+               tile_reduce_parse_mode(val, &mode)) {
+      filter = val;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (base_z == 0 || base_z > 14 || min_z >= base_z || tile_size == 0 ||
+      tile_size % 2 != 0 || threads == 0 || (changed && !previous)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  pyramid_t p = {.root = root, .base_z = base_z, .min_z = min_z,
+                 .tile_size = tile_size, .mode = mode, .indexed = indexed,
+                 .bpp = indexed ? 1 : 4, .level = level, .effort = effort,
+                 .previous = previous};
+  char marker[256], marker_file[4096];
+  if (!marker_text(&p, filter, marker, sizeof(marker)) ||
+      !marker_path(root, marker_file, sizeof(marker_file))) {
+    usage(argv[0]);
+    return 1;
+  }
+  // not complete until the marker is written again at the end
+  unlink(marker_file);
+  if (previous && !marker_matches(previous, marker)) {
+    fprintf(stderr,
+            "Not reusing %s, it has no %s from a pyramid built with the same "
+            "filter and levels, building every parent\n",
+            previous, MARKER);
+    previous = p.previous = NULL;
+    changed = NULL;
+  }
+  uint32_t split_z = base_z - 1 < SPLIT_Z ? base_z - 1 : SPLIT_Z;
+  if (split_z < min_z)
+    split_z = min_z;
+
+  // the recursion holds one plane per level it passes, planes are only
+  // allocated once borrowed
+  size_t plane_size = (size_t)tile_size * tile_size;
+  p.workers = calloc(threads, sizeof(worker_t));
+  bool ok = p.workers != NULL;
+  for (uint32_t t = 0; ok && t < threads; t++) {
+    ok = tile_slab_init(&p.workers[t].planes, plane_size * p.bpp,
+                        base_z - min_z + 1) &&
+         tile_slab_init(&p.workers[t].decode, plane_size * 4, 1);
+  }
+  ok = ok && tile_hash_set_init(&p.hashes);
+  if (!ok || !scan(&p)) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+
+  // before linking, whose links keep the older times of the previous release
+  for (uint32_t z = base_z; z-- > min_z;) {
+    p.z_job = z;
+    thread_pool_for(threads, (size_t)1 << (z * 2), stale_job, &p);
+  }
+  if (atomic_load(&p.stale))
+    fprintf(stderr, "Removed %zu parents older than their children\n",
+            atomic_load(&p.stale));
+
+  if (previous) {
+    if (!diff(&p, threads, changed))
+      return 1;
+    for (uint32_t z = min_z; z < base_z; z++) {
+      p.z_job = z;
+      thread_pool_for(threads, (size_t)1 << (z * 2), link_job, &p);
+    }
+    fprintf(stderr, "Linked %zu unchanged tiles from %s\n",
+            atomic_load(&p.linked), previous);
+  }
+
+  fprintf(stderr, "Building z=%u..%u from %s/%u on %u threads (%s)\n",
+          base_z - 1, min_z, root, base_z, threads,
+          indexed                     ? "mode filter, indexed"
+          : tile_reduce_simd_active() ? "avx2"
+                                      : "scalar");
+
+  // Subtrees below split_z in parallel, then the few levels above them,
+  // whose children are on disk by then.
+  for (int32_t z = (int32_t)split_z; z >= (int32_t)min_z; z--) {
+    p.z_job = (uint32_t)z;
+    thread_pool_for(threads, (size_t)1 << (z * 2), build_job, &p);
+  }
+
+  for (uint32_t z = base_z; z-- > min_z;)
+    fprintf(stderr, "Build z=%u: %zu tiles written\n", z,
+            atomic_load(&p.written[z]));
+  fprintf(stderr, "%zu tiles linked to an identical tile\n",
+          atomic_load(&p.duplicates));
+  size_t failed = atomic_load(&p.failed);
+  if (failed)
+    fprintf(stderr, "%zu tiles failed\n", failed);
+
+  if (!failed && !tile_io_write(marker_file, (const uint8_t *)marker,
+                                strlen(marker))) {
+    fprintf(stderr, "Failed to write %s\n", marker_file);
+    failed = 1;
+  }
+
+  if (pack && !failed) {
+    if (pmtiles_pack_dir(root, min_z, base_z, pack)) {
+      fprintf(stderr, "Packed z=%u..%u into %s\n", min_z, base_z, pack);
+    } else {
+      fprintf(stderr, "Failed to pack %s\n", pack);
+      failed = 1;
+    }
+  }
+
+  for (uint32_t t = 0; t < threads; t++) {
+    tile_slab_destroy(&p.workers[t].planes);
+    tile_slab_destroy(&p.workers[t].decode);
+    tile_buf_free(&p.workers[t].buffer);
+    tile_buf_free(&p.workers[t].previous);
+  }
+  tile_hash_set_destroy(&p.hashes);
+  free_levels(p.occupied, base_z);
+  free_levels(p.dirty, base_z);
+  free(p.workers);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,168 @@
+#include "quantize.h"
+#include "palette.h"
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define QUANTIZE_X86 1
+#endif
+
+// downscale.ts only knows the free colours, indices 1..31 of wplace_palette
+#define FREE_FIRST 1
+#define FREE_LAST 31
+
+// One entry per RGB555 cell of the alpha weighted colour. A cell maps to a
+// colour only if all eight of its corners are strictly nearest to it, which
+// (both being convex) means the whole cell is. Cells on a boundary are
+// AMBIGUOUS and resolved per pixel.
+#define AMBIGUOUS 0xFF
+#define LUT_SIZE (1u << 15)
+static uint32_t lut[LUT_SIZE];
+static uint32_t free_rgb[PALETTE_SIZE]; // colour as r | g << 8 | b << 16
+static pthread_once_t lut_once = PTHREAD_ONCE_INIT;
+static int g_simd = -1; // -1 = not probed yet
+
+void quantize_set_simd(bool enabled) {
+#ifdef QUANTIZE_X86
+  g_simd = enabled && __builtin_cpu_supports("avx2");
+#else
+  (void)enabled;
+  g_simd = 0;
+#endif
+}
+
+bool quantize_simd_active(void) {
+  if (g_simd < 0)
+    quantize_set_simd(true);
+  return g_simd == 1;
+}
+
+// Same as the loop in downscale.ts, the first of equally near colours wins.
+// Returns AMBIGUOUS if strict is set and another colour is as near.
+static uint8_t nearest(double r, double g, double b, bool strict) {
+  double best = -1, second = -1;
+  uint8_t best_index = FREE_FIRST;
+  for (uint32_t i = FREE_FIRST; i <= FREE_LAST; i++) {
+    const uint8_t *c = wplace_palette[i];
+    double dr = r - c[0], dg = g - c[1], db = b - c[2];
+    double d = dr * dr + dg * dg + db * db;
+    if (best < 0 || d < best) {
+      second = best;
+      best = d;
+      best_index = (uint8_t)i;
+    } else if (second < 0 || d < second) {
+      second = d;
+    }
+  }
+  return strict && second == best ? AMBIGUOUS : best_index;
+}
+
+static void build_lut(void) {
+  for (uint32_t i = FREE_FIRST; i <= FREE_LAST; i++) {
+    const uint8_t *c = wplace_palette[i];
+    free_rgb[i] = (uint32_t)c[0] | (uint32_t)c[1] << 8 | (uint32_t)c[2] << 16;
+  }
+
+  for (uint32_t key = 0; key < LUT_SIZE; key++) {
+    uint32_t cr = key >> 10, cg = (key >> 5) & 31, cb = key & 31;
+    uint8_t index = AMBIGUOUS;
+    for (uint32_t corner = 0; corner < 8; corner++) {
+      uint8_t n = nearest((cr + (corner & 1)) * 8.0,
+                          (cg + ((corner >> 1) & 1)) * 8.0,
+                          (cb + (corner >> 2)) * 8.0, true);
+      if (n == AMBIGUOUS || (corner && n != index)) {
+        index = AMBIGUOUS;
+        break;
+      }
+      index = n;
+    }
+    lut[key] = index;
+  }
+}
+
+static void quantize_pixel(uint8_t *px) {
+  uint32_t a = px[3];
+  uint32_t r = px[0] * a, g = px[1] * a, b = px[2] * a; // 256 x weighted
+
+  if (a < 100 && r < 20 * 256 && g < 20 * 256 && b < 20 * 256)
+    return;
+
+  uint32_t key = (r >> 11) << 10 | (g >> 11) << 5 | b >> 11;
+  uint8_t index = (uint8_t)lut[key];
+  if (index == AMBIGUOUS)
+    index = nearest(r / 256.0, g / 256.0, b / 256.0, false);
+
+  memcpy(px, wplace_palette[index], 3);
+  if (a <= 250)
+    px[3] = 255;
+}
+
+#ifdef QUANTIZE_X86
+
+// 8 pixels per step. Returns the number of pixels done, groups that hit an
+// ambiguous cell go through quantize_pixel.
+__attribute__((target("avx2"))) static size_t
+quantize_avx2(uint8_t *rgba, size_t count) {
+  const __m256i byte = _mm256_set1_epi32(0xFF);
+  const __m256i dark = _mm256_set1_epi32(20 * 256);
+  const __m256i alpha_min = _mm256_set1_epi32(100);
+  const __m256i alpha_keep = _mm256_set1_epi32(250);
+  const __m256i ambiguous = _mm256_set1_epi32(AMBIGUOUS);
+  size_t i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    __m256i px = _mm256_loadu_si256((const __m256i *)(rgba + i * 4));
+    __m256i a = _mm256_srli_epi32(px, 24);
+    __m256i r = _mm256_mullo_epi32(_mm256_and_si256(px, byte), a);
+    __m256i g = _mm256_mullo_epi32(
+        _mm256_and_si256(_mm256_srli_epi32(px, 8), byte), a);
+    __m256i b = _mm256_mullo_epi32(
+        _mm256_and_si256(_mm256_srli_epi32(px, 16), byte), a);
+
+    // a < 100 && r < 20 && g < 20 && b < 20, all as signed 32 bit compares
+    __m256i skip = _mm256_and_si256(
+        _mm256_and_si256(_mm256_cmpgt_epi32(alpha_min, a),
+                         _mm256_cmpgt_epi32(dark, r)),
+        _mm256_and_si256(_mm256_cmpgt_epi32(dark, g),
+                         _mm256_cmpgt_epi32(dark, b)));
+
+    __m256i key = _mm256_or_si256(
+        _mm256_or_si256(_mm256_slli_epi32(_mm256_srli_epi32(r, 11), 10),
+                        _mm256_slli_epi32(_mm256_srli_epi32(g, 11), 5)),
+        _mm256_srli_epi32(b, 11));
+    __m256i index = _mm256_i32gather_epi32((const int *)lut, key, 4);
+
+    __m256i unresolved =
+        _mm256_andnot_si256(skip, _mm256_cmpeq_epi32(index, ambiguous));
+    if (!_mm256_testz_si256(unresolved, unresolved)) {
+      for (size_t k = 0; k < 8; k++)
+        quantize_pixel(rgba + (i + k) * 4);
+      continue;
+    }
+
+    // skipped lanes may hold AMBIGUOUS, keep their gather in bounds
+    index = _mm256_andnot_si256(skip, index);
+    __m256i rgb = _mm256_i32gather_epi32((const int *)free_rgb, index, 4);
+    __m256i alpha =
+        _mm256_blendv_epi8(byte, a, _mm256_cmpgt_epi32(a, alpha_keep));
+    __m256i out = _mm256_or_si256(rgb, _mm256_slli_epi32(alpha, 24));
+    out = _mm256_blendv_epi8(out, px, skip);
+    _mm256_storeu_si256((__m256i *)(rgba + i * 4), out);
+  }
+  return i;
+}
+
+#endif
+
+void quantize_rgba(uint8_t *rgba, size_t count) {
+  pthread_once(&lut_once, build_lut);
+
+  size_t done = 0;
+#ifdef QUANTIZE_X86
+  if (quantize_simd_active())
+    done = quantize_avx2(rgba, count);
+#endif
+  for (size_t i = done; i < count; i++)
+    quantize_pixel(rgba + i * 4);
+}
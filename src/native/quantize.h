@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Uses the AVX2 kernel when the CPU has it, can be turned off to compare
+// against the scalar code.
+void quantize_set_simd(bool enabled);
+bool quantize_simd_active(void);
+
+// Maps RGBA pixels in place to the nearest free wplace colour, with the
+// rules of scripts/downscale.ts: colours are weighted by alpha / 256 before
+// the distance is taken, dark pixels with alpha below 100 are left alone and
+// partly transparent pixels become opaque.
+void quantize_rgba(uint8_t *rgba, size_t count);
@@ -0,0 +1,152 @@
+#define _DEFAULT_SOURCE
+#include "tar_ingest.h"
+#include "tile_hash.h"
+#include <stdlib.h>
+#include <string.h>
+
+static void clear_entry(tar_ingest_t *t, uint32_t slot) {
+  tar_ingest_entry_t *e = &t->entries[slot];
+  free(e->name);
+  free(e->link_name);
+  if (e->oversize)
+    free(e->data);
+  memset(e, 0, sizeof(*e));
+}
+
+static bool on_entry(void *ctx, const tar_entry_t *src) {
+  tar_ingest_t *t = ctx;
+  if ((src->type != TAR_FILE && src->type != TAR_LINK) ||
+      (src->type == TAR_FILE && !src->data)) {
+    t->skipped++;
+    return true;
+  }
+
+  pthread_mutex_lock(&t->lock);
+  while (t->credit_count == 0 && !t->cancelled)
+    pthread_cond_wait(&t->credit_returned, &t->lock);
+  if (t->cancelled) {
+    pthread_mutex_unlock(&t->lock);
+    return false;
+  }
+  uint32_t slot = t->credits[--t->credit_count];
+  pthread_mutex_unlock(&t->lock);
+
+  // the slot is ours until it is published below
+  tar_ingest_entry_t *e = &t->entries[slot];
+  e->type = src->type;
+  e->name = strdup(src->name);
+  e->link_name = src->type == TAR_LINK ? strdup(src->link_name) : NULL;
+  e->len = src->type == TAR_FILE ? (size_t)src->size : 0;
+  e->oversize = e->len > t->slot_size;
+  e->data = e->oversize ? malloc(e->len) : t->arena + slot * t->slot_size;
+  bool ok = e->name && e->data && (e->type != TAR_LINK || e->link_name);
+  if (ok && e->len)
+    memcpy(e->data, src->data, e->len);
+  // on the pushing thread, so consumers get content keys for free
+  if (ok && e->type == TAR_FILE)
+    tile_hash128(e->data, e->len, e->hash);
+
+  pthread_mutex_lock(&t->lock);
+  bool was_empty = t->ready_count == 0;
+  if (ok) {
+    t->ready[(t->ready_head + t->ready_count) % t->slots] = slot;
+    t->ready_count++;
+  } else {
+    clear_entry(t, slot);
+    t->credits[t->credit_count++] = slot;
+  }
+  pthread_mutex_unlock(&t->lock);
+
+  if (ok && was_empty && t->notify)
+    t->notify(t->notify_ctx);
+  return ok;
+}
+
+bool tar_ingest_init(tar_ingest_t *t, bool gzip, uint32_t slots,
+                     size_t slot_size, tar_ingest_notify_fn notify,
+                     void *notify_ctx) {
+  memset(t, 0, sizeof(*t));
+  if (slots == 0 || slot_size == 0)
+    return false;
+  t->slots = slots;
+  t->slot_size = slot_size;
+  t->notify = notify;
+  t->notify_ctx = notify_ctx;
+  t->arena = malloc(slots * slot_size);
+  t->entries = calloc(slots, sizeof(tar_ingest_entry_t));
+  t->credits = malloc(slots * sizeof(uint32_t));
+  t->ready = malloc(slots * sizeof(uint32_t));
+  if (!t->arena || !t->entries || !t->credits || !t->ready ||
+      !tar_stream_init(&t->stream, gzip, on_entry, t)) {
+    free(t->arena);
+    free(t->entries);
+    free(t->credits);
+    free(t->ready);
+    memset(t, 0, sizeof(*t));
+    return false;
+  }
+  // handed out from the end, so slot 0 goes first
+  for (uint32_t i = 0; i < slots; i++)
+    t->credits[i] = slots - 1 - i;
+  t->credit_count = slots;
+  pthread_mutex_init(&t->lock, NULL);
+  pthread_cond_init(&t->credit_returned, NULL);
+  return true;
+}
+
+void tar_ingest_destroy(tar_ingest_t *t) {
+  if (!t->entries)
+    return;
+  for (uint32_t i = 0; i < t->slots; i++)
+    clear_entry(t, i);
+  tar_stream_destroy(&t->stream);
+  pthread_mutex_destroy(&t->lock);
+  pthread_cond_destroy(&t->credit_returned);
+  free(t->arena);
+  free(t->entries);
+  free(t->credits);
+  free(t->ready);
+  memset(t, 0, sizeof(*t));
+}
+
+bool tar_ingest_push(tar_ingest_t *t, const uint8_t *data, size_t len) {
+  return tar_stream_push(&t->stream, data, len);
+}
+
+bool tar_ingest_finish(const tar_ingest_t *t) {
+  return !t->cancelled && tar_stream_finish(&t->stream);
+}
+
+void tar_ingest_cancel(tar_ingest_t *t) {
+  pthread_mutex_lock(&t->lock);
+  t->cancelled = true;
+  pthread_cond_broadcast(&t->credit_returned);
+  pthread_mutex_unlock(&t->lock);
+}
+
+uint32_t tar_ingest_take(tar_ingest_t *t, uint32_t *out, uint32_t max) {
+  pthread_mutex_lock(&t->lock);
+  uint32_t n = t->ready_count < max ? t->ready_count : max;
+  for (uint32_t i = 0; i < n; i++) {
+    out[i] = t->ready[(t->ready_head + i) % t->slots];
+    t->entries[out[i]].taken = true;
+  }
+  t->ready_head = (t->ready_head + n) % t->slots;
+  t->ready_count -= n;
+  pthread_mutex_unlock(&t->lock);
+  return n;
+}
+
+bool tar_ingest_release(tar_ingest_t *t, uint32_t slot) {
+  if (slot >= t->slots)
+    return false;
+  pthread_mutex_lock(&t->lock);
+  bool held = t->entries[slot].taken;
+  if (held) {
+    clear_entry(t, slot);
+    t->credits[t->credit_count++] = slot;
+    pthread_cond_signal(&t->credit_returned);
+  }
+  pthread_mutex_unlock(&t->lock);
+  return held;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tar_stream.h"
+
+// Hands the files and hard links of a streamed tar to a consumer through a
+// fixed ring of entry slots. A free slot is a credit: the producer needs one
+// for every entry and blocks in push while it has none, the consumer returns
+// it once the entry is dealt with. Memory is therefore bounded by
+// slots * slot_size, and the producer runs exactly as fast as the consumer.
+typedef struct {
+  tar_type_t type; // TAR_FILE or TAR_LINK
+  char *name, *link_name;
+  uint8_t *data; // the slot, or a separate buffer for larger entries
+  size_t len;
+  uint8_t hash[16]; // tile_hash128 of the data, files only
+  bool oversize;
+  bool taken;
+} tar_ingest_entry_t;
+
+typedef void (*tar_ingest_notify_fn)(void *ctx);
+
+typedef struct {
+  tar_stream_t stream;
+  uint8_t *arena; // slots * slot_size
+  size_t slot_size;
+  uint32_t slots;
+  tar_ingest_entry_t *entries; // per slot
+  uint32_t *credits;           // free slots
+  uint32_t credit_count;
+  uint32_t *ready; // filled slots not taken yet, in archive order
+  uint32_t ready_head, ready_count;
+  pthread_mutex_t lock;
+  pthread_cond_t credit_returned;
+  bool cancelled;
+  // called from the pushing thread when entries become ready to take
+  tar_ingest_notify_fn notify;
+  void *notify_ctx;
+  uint64_t skipped; // directories and other entry types
+} tar_ingest_t;
+
+bool tar_ingest_init(tar_ingest_t *t, bool gzip, uint32_t slots,
+                     size_t slot_size, tar_ingest_notify_fn notify,
+                     void *notify_ctx);
+void tar_ingest_destroy(tar_ingest_t *t);
+
+// Parses a chunk, waiting for credits as needed. Not thread safe against
+// itself, one producer only.
+bool tar_ingest_push(tar_ingest_t *t, const uint8_t *data, size_t len);
+bool tar_ingest_finish(const tar_ingest_t *t);
+// Makes a blocked push fail, for consumers that give up.
+void tar_ingest_cancel(tar_ingest_t *t);
+
+// Moves up to max ready slots to out. The entries stay valid until released.
+uint32_t tar_ingest_take(tar_ingest_t *t, uint32_t *out, uint32_t max);
+bool tar_ingest_release(tar_ingest_t *t, uint32_t slot);
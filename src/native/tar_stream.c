@@ -0,0 +1,249 @@
+#include "tar_stream.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define INFLATE_CHUNK (256 * 1024)
+
+uint64_t tar_header_size(const uint8_t *h) {
+  const uint8_t *f = h + 124;
+  uint64_t v = 0;
+  if (f[0] & 0x80) { // base-256 for sizes past 8 GiB
+    for (int i = 1; i < 12; i++)
+      v = v << 8 | f[i];
+    return v;
+  }
+  for (int i = 0; i < 12 && f[i]; i++)
+    if (f[i] >= '0' && f[i] <= '7')
+      v = v * 8 + (f[i] - '0');
+  return v;
+}
+
+static size_t copy_field(char *out, const uint8_t *field, size_t len) {
+  size_t n = 0;
+  while (n < len && field[n])
+    n++;
+  memcpy(out, field, n);
+  out[n] = '\0';
+  return n;
+}
+
+void tar_header_names(const uint8_t *h, const char *long_name,
+                      const char *long_link, char *name, char *link_name) {
+  if (long_name[0]) {
+    strcpy(name, long_name);
+  } else if (memcmp(h + 257, "ustar", 5) == 0 && h[345]) {
+    size_t n = copy_field(name, h + 345, 155);
+    name[n++] = '/';
+    copy_field(name + n, h, 100);
+  } else {
+    copy_field(name, h, 100);
+  }
+  if (long_link[0])
+    strcpy(link_name, long_link);
+  else
+    copy_field(link_name, h + 157, 100);
+}
+
+void tar_parse_pax(const uint8_t *p, uint64_t size, char *path,
+                   char *link_path) {
+  const uint8_t *end = p + size;
+  while (p < end) {
+    const uint8_t *rec = p;
+    uint64_t len = 0;
+    while (p < end && *p >= '0' && *p <= '9')
+      len = len * 10 + (*p++ - '0');
+    if (p >= end || *p != ' ' || len == 0 || len > (uint64_t)(end - rec))
+      return;
+    const char *kv = (const char *)p + 1, *rec_end = (const char *)rec + len;
+    size_t kv_len = (size_t)(rec_end - kv);
+    if (kv_len > 5 && memcmp(kv, "path=", 5) == 0 &&
+        kv_len - 6 < TAR_NAME_MAX) {
+      memcpy(path, kv + 5, kv_len - 6);
+      path[kv_len - 6] = '\0';
+    } else if (kv_len > 9 && memcmp(kv, "linkpath=", 9) == 0 &&
+               kv_len - 10 < TAR_NAME_MAX) {
+      memcpy(link_path, kv + 9, kv_len - 10);
+      link_path[kv_len - 10] = '\0';
+    }
+    p = rec + len;
+  }
+}
+
+bool tar_stream_init(tar_stream_t *s, bool gzip, tar_entry_fn fn, void *ctx) {
+  memset(s, 0, sizeof(*s));
+  s->gzip = gzip;
+  s->fn = fn;
+  s->ctx = ctx;
+  if (!gzip)
+    return true;
+  s->inflated = malloc(INFLATE_CHUNK);
+  // 32: accept gzip and zlib headers
+  if (!s->inflated || inflateInit2(&s->zs, 15 + 32) != Z_OK) {
+    free(s->inflated);
+    s->inflated = NULL;
+    return false;
+  }
+  return true;
+}
+
+void tar_stream_destroy(tar_stream_t *s) {
+  if (s->inflated) {
+    inflateEnd(&s->zs);
+    free(s->inflated);
+  }
+  tile_buf_free(&s->data);
+  memset(s, 0, sizeof(*s));
+}
+
+static bool finish_entry(tar_stream_t *s) {
+  const uint8_t *h = s->header;
+  const uint8_t *data = s->keep_data ? s->data.data : NULL;
+  uint64_t size = tar_header_size(h);
+  char type = (char)h[156];
+
+  // headers that describe the next entry
+  if (type == 'L' || type == 'K') {
+    char *dst = type == 'L' ? s->long_name : s->long_link;
+    size_t n = data && size < TAR_NAME_MAX ? (size_t)size : 0;
+    copy_field(dst, data ? data : (const uint8_t *)"", n);
+    return true;
+  }
+  if (type == 'x') {
+    if (data)
+      tar_parse_pax(data, size, s->long_name, s->long_link);
+    return true;
+  }
+  if (type == 'g')
+    return true;
+
+  tar_header_names(h, s->long_name, s->long_link, s->name, s->link_name);
+  s->long_name[0] = s->long_link[0] = '\0';
+
+  tar_entry_t e = {.name = s->name, .link_name = s->link_name,
+                   .data = data, .size = size};
+  switch (type) {
+  case '0':
+  case '\0':
+  case '7':
+    e.type = TAR_FILE;
+    break;
+  case '1':
+    e.type = TAR_LINK;
+    break;
+  case '5':
+    e.type = TAR_DIR;
+    break;
+  default:
+    e.type = TAR_OTHER;
+  }
+  return s->fn(s->ctx, &e);
+}
+
+static bool start_entry(tar_stream_t *s) {
+  bool zero = true;
+  for (size_t i = 0; i < TAR_BLOCK && zero; i++)
+    zero = s->header[i] == 0;
+  if (zero) {
+    s->state = TAR_END;
+    return true;
+  }
+
+  uint64_t size = tar_header_size(s->header);
+  s->remaining = size;
+  s->pad = (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK;
+  s->data.len = 0;
+  s->keep_data = size <= TAR_STREAM_MAX_DATA &&
+                 tile_buf_reserve(&s->data, size ? (size_t)size : 1);
+  s->state = TAR_DATA;
+  if (size > 0)
+    return true;
+  s->state = TAR_HEADER;
+  return finish_entry(s);
+}
+
+static bool parse(tar_stream_t *s, const uint8_t *p, size_t len) {
+  while (len > 0) {
+    size_t n = 0;
+    switch (s->state) {
+    case TAR_HEADER:
+      n = TAR_BLOCK - s->header_fill < len ? TAR_BLOCK - s->header_fill : len;
+      memcpy(s->header + s->header_fill, p, n);
+      s->header_fill += n;
+      if (s->header_fill == TAR_BLOCK) {
+        s->header_fill = 0;
+        if (!start_entry(s))
+          return false;
+      }
+      break;
+    case TAR_DATA:
+      n = s->remaining < len ? (size_t)s->remaining : len;
+      if (s->keep_data) {
+        memcpy(s->data.data + s->data.len, p, n);
+        s->data.len += n;
+      }
+      s->remaining -= n;
+      if (s->remaining == 0) {
+        s->state = s->pad ? TAR_PAD : TAR_HEADER;
+        if (!finish_entry(s))
+          return false;
+      }
+      break;
+    case TAR_PAD:
+      n = s->pad < len ? (size_t)s->pad : len;
+      s->pad -= n;
+      if (s->pad == 0)
+        s->state = TAR_HEADER;
+      break;
+    case TAR_END:
+      return true; // trailing zero blocks and padding
+    }
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool inflate_chunk(tar_stream_t *s, const uint8_t *data, uInt len) {
+  s->zs.next_in = (Bytef *)data;
+  s->zs.avail_in = len;
+  while (s->zs.avail_in > 0) {
+    if (s->gzip_end) {
+      // concatenated gzip members, as written by pigz -i or cat
+      if (inflateReset(&s->zs) != Z_OK)
+        return false;
+      s->gzip_end = false;
+    }
+    s->zs.next_out = s->inflated;
+    s->zs.avail_out = INFLATE_CHUNK;
+    int ret = inflate(&s->zs, Z_NO_FLUSH);
+    if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+      return false;
+    size_t produced = INFLATE_CHUNK - s->zs.avail_out;
+    if (!parse(s, s->inflated, produced))
+      return false;
+    s->gzip_end = ret == Z_STREAM_END;
+    if (ret == Z_BUF_ERROR && produced == 0)
+      break;
+  }
+  return true;
+}
+
+bool tar_stream_push(tar_stream_t *s, const uint8_t *data, size_t len) {
+  s->consumed += len;
+  if (!s->gzip)
+    return parse(s, data, len);
+  while (len > 0) {
+    uInt n = len < (1u << 30) ? (uInt)len : 1u << 30;
+    if (!inflate_chunk(s, data, n))
+      return false;
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool tar_stream_finish(const tar_stream_t *s) {
+  bool boundary = s->state == TAR_END ||
+                  (s->state == TAR_HEADER && s->header_fill == 0);
+  return boundary && (!s->gzip || s->gzip_end);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <zlib.h>
+
+#include "tile_io.h"
+
+#define TAR_BLOCK 512
+#define TAR_NAME_MAX 4096
+#define TAR_STREAM_MAX_DATA (256u << 20) // larger entries are passed without data
+
+// Header fields shared by the streaming parser and the indexed reader.
+uint64_t tar_header_size(const uint8_t *h);
+// Name and link name of a header, long_name and long_link override them when
+// set by a preceding GNU long name or pax header.
+void tar_header_names(const uint8_t *h, const char *long_name,
+                      const char *long_link, char *name, char *link_name);
+// Takes "path" and "linkpath" from a pax extended header.
+void tar_parse_pax(const uint8_t *p, uint64_t size, char *path,
+                   char *link_path);
+
+typedef enum { TAR_FILE, TAR_DIR, TAR_LINK, TAR_OTHER } tar_type_t;
+
+typedef struct {
+  tar_type_t type;
+  const char *name;
+  const char *link_name; // target of a TAR_LINK
+  const uint8_t *data;   // only valid during the callback, NULL if too large
+  uint64_t size;
+} tar_entry_t;
+
+typedef bool (*tar_entry_fn)(void *ctx, const tar_entry_t *e);
+
+// Parses a tar, optionally gzip compressed, from chunks of any size and calls
+// fn for every entry. Pushing stops at the first callback returning false.
+typedef struct {
+  bool gzip, gzip_end;
+  z_stream zs;
+  uint8_t *inflated; // inflate output, parsed as it is produced
+  tar_entry_fn fn;
+  void *ctx;
+  enum { TAR_HEADER, TAR_DATA, TAR_PAD, TAR_END } state;
+  uint8_t header[TAR_BLOCK];
+  size_t header_fill;
+  uint64_t remaining, pad;
+  tile_buf_t data;
+  bool keep_data;
+  char long_name[TAR_NAME_MAX], long_link[TAR_NAME_MAX];
+  char name[TAR_NAME_MAX], link_name[TAR_NAME_MAX];
+  uint64_t consumed; // compressed bytes pushed
+} tar_stream_t;
+
+bool tar_stream_init(tar_stream_t *s, bool gzip, tar_entry_fn fn, void *ctx);
+bool tar_stream_push(tar_stream_t *s, const uint8_t *data, size_t len);
+// True if the archive ended with its end marker, or at least on an entry
+// boundary, and the gzip stream was complete.
+bool tar_stream_finish(const tar_stream_t *s);
+void tar_stream_destroy(tar_stream_t *s);
@@ -0,0 +1,186 @@
+#define _DEFAULT_SOURCE
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mercator.h"
+
+// xorshift, deterministic across platforms
+static uint32_t rng_state = 2463534242u;
+static uint32_t rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+static double uniform(double lo, double hi) {
+  return lo + (hi - lo) * (rng() / 4294967296.0);
+}
+
+// tlPxToGps and gpsToTlPx of src/pumpkin/mercator.ts, through libm
+static void reference_gps(const double *q, uint32_t z, double scale,
+                          double *out) {
+  double n = pow(2, z);
+  double x = q[0] + q[2] / scale, y = q[1] + q[3] / scale;
+  out[0] = atan(sinh(M_PI * (1 - 2 * y / n))) * 180 / M_PI;
+  out[1] = (x / n) * 360 - 180;
+}
+
+// the unrounded position in pixels
+static void reference_px(const double *ll, uint32_t z, double scale,
+                         double *px) {
+  double n = pow(2, z);
+  double lat = fmax(-85.05112878, fmin(85.05112878, ll[0])) * M_PI / 180;
+  px[0] = n * (ll[1] + 180) / 360 * scale;
+  px[1] = n * (1 - log(tan(lat) + 1 / cos(lat)) / M_PI) / 2 * scale;
+}
+
+static int check_to_gps(uint32_t z, double scale, size_t count) {
+  double *in = malloc(count * 4 * sizeof(double));
+  double *out = malloc(count * 2 * sizeof(double));
+  double *scalar = malloc(count * 2 * sizeof(double));
+  double n = pow(2, z);
+  for (size_t i = 0; i < count; i++) {
+    in[i * 4] = floor(uniform(0, n));
+    in[i * 4 + 1] = floor(uniform(0, n));
+    in[i * 4 + 2] = floor(uniform(0, scale));
+    in[i * 4 + 3] = floor(uniform(0, scale));
+  }
+  // the corners of the world and the equator
+  double edges[][4] = {{0, 0, 0, 0}, {n - 1, n - 1, scale - 1, scale - 1},
+                       {0, n / 2, 0, 0}, {n / 2, n / 2 - 1, 0, scale - 1}};
+  for (size_t i = 0; i < 4 && z > 0; i++)
+    memcpy(in + i * 4, edges[i], sizeof(edges[i]));
+
+  mercator_set_simd(true);
+  mercator_tl_px_to_gps(in, count, z, scale, out);
+  mercator_set_simd(false);
+  mercator_tl_px_to_gps(in, count, z, scale, scalar);
+
+  double worst = 0;
+  for (size_t i = 0; i < count; i++) {
+    double ref[2];
+    reference_gps(in + i * 4, z, scale, ref);
+    worst = fmax(worst, fmax(fabs(out[i * 2] - ref[0]),
+                             fabs(out[i * 2 + 1] - ref[1])));
+  }
+  int failed = worst > 1e-12 ||
+               memcmp(out, scalar, count * 2 * sizeof(double)) != 0;
+  if (failed)
+    fprintf(stderr, "mercator z=%u: to gps off by %g degrees\n", z, worst);
+  free(in);
+  free(out);
+  free(scalar);
+  return failed;
+}
+
+static int check_to_tl_px(uint32_t z, double scale, size_t count) {
+  double *in = malloc(count * 2 * sizeof(double));
+  double *out = malloc(count * 4 * sizeof(double));
+  double *scalar = malloc(count * 4 * sizeof(double));
+  double *back = malloc(count * 2 * sizeof(double));
+  for (size_t i = 0; i < count; i++) {
+    // past the Mercator range too, which clamps
+    in[i * 2] = uniform(-90, 90);
+    in[i * 2 + 1] = uniform(-180, 180);
+  }
+  in[0] = 0;
+  in[1] = 0;
+
+  mercator_set_simd(true);
+  mercator_gps_to_tl_px(in, count, z, scale, out);
+  mercator_set_simd(false);
+  mercator_gps_to_tl_px(in, count, z, scale, scalar);
+
+  int failed = memcmp(out, scalar, count * 4 * sizeof(double)) != 0;
+  size_t wrong = 0;
+  for (size_t i = 0; i < count && !failed; i++) {
+    double px[2];
+    reference_px(in + i * 2, z, scale, px);
+    for (int k = 0; k < 2; k++) {
+      const double *q = out + i * 4;
+      double got = q[k] * scale + q[k + 2];
+      // a half pixel is a tie either way
+      double frac = px[k] - floor(px[k]);
+      if (fabs(frac - 0.5) > 1e-6 && got != floor(px[k] + 0.5))
+        wrong++;
+      if (q[k + 2] < 0 || q[k + 2] >= scale)
+        wrong++;
+    }
+  }
+
+  // and back to within half a pixel of where it was
+  mercator_set_simd(true);
+  mercator_tl_px_to_gps(out, count, z, scale, back);
+  double worst = 0;
+  for (size_t i = 0; i < count; i++) {
+    double px[2], again[2];
+    reference_px(in + i * 2, z, scale, px);
+    double ll[2] = {back[i * 2], back[i * 2 + 1]};
+    reference_px(ll, z, scale, again);
+    worst = fmax(worst, fmax(fabs(px[0] - again[0]), fabs(px[1] - again[1])));
+  }
+  if (failed || wrong || worst > 0.5 + 1e-6) {
+    fprintf(stderr,
+            "mercator z=%u: %zu pixels wrong, round trip off by %g pixels\n",
+            z, wrong, worst);
+    failed = 1;
+  }
+  free(in);
+  free(out);
+  free(scalar);
+  free(back);
+  return failed;
+}
+
+// NaN in either coordinate comes out as NaN, not clamped to a pole, in
+// every lane of a SIMD step and in the scalar tail alike.
+static int check_nan(void) {
+  enum { COUNT = 5 };
+  double to_gps[COUNT * 4], gps[COUNT * 2], to_px[COUNT * 2], px[COUNT * 4];
+  for (size_t i = 0; i < COUNT; i++) {
+    double q[4] = {1000, 1000, 10, 10}, ll[2] = {40, 10};
+    memcpy(to_gps + i * 4, q, sizeof(q));
+    memcpy(to_px + i * 2, ll, sizeof(ll));
+  }
+  to_gps[1 * 4 + 1] = NAN; // y, in the SIMD step
+  to_gps[4 * 4 + 3] = NAN; // y pixel, in the tail
+  to_px[1 * 2] = NAN;      // lat
+  to_px[4 * 2] = NAN;
+  int failed = 0;
+  for (int simd = 0; simd < 2; simd++) {
+    mercator_set_simd(simd);
+    mercator_tl_px_to_gps(to_gps, COUNT, 11, 1000, gps);
+    mercator_gps_to_tl_px(to_px, COUNT, 11, 1000, px);
+    for (size_t i = 0; i < COUNT; i++) {
+      bool want = i == 1 || i == 4;
+      failed |= !!isnan(gps[i * 2]) != want || isnan(gps[i * 2 + 1]);
+      failed |= !!isnan(px[i * 4 + 1]) != want;
+      failed |= !!isnan(px[i * 4 + 3]) != want;
+      failed |= isnan(px[i * 4]) || isnan(px[i * 4 + 2]);
+    }
+  }
+  if (failed)
+    fprintf(stderr, "mercator: NaN clamped instead of kept\n");
+  return failed;
+}
+
+int main(void) {
+  int failed = 0;
+  // odd counts, so the scalar tail runs too
+  failed |= check_to_gps(11, 1000, 1000003);
+  failed |= check_to_gps(0, 256, 5);
+  failed |= check_to_gps(18, 256, 10001);
+  failed |= check_to_tl_px(11, 1000, 1000003);
+  failed |= check_to_tl_px(3, 256, 7);
+  failed |= check_to_tl_px(20, 1, 10001);
+  failed |= check_nan();
+
+  mercator_set_simd(true);
+  printf("mercator: %s (%s kernel)\n", failed ? "FAILED" : "ok",
+         mercator_simd_active() ? "avx2" : "scalar");
+  return failed;
+}
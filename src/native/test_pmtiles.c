@@ -0,0 +1,151 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tile_pmtiles.h"
+
+static int check_ids(void) {
+  // from the PMTiles v3 specification
+  const uint32_t zxy[][4] = {{0, 0, 0, 0}, {1, 0, 0, 1}, {1, 0, 1, 2},
+                             {1, 1, 1, 3}, {1, 1, 0, 4}, {2, 0, 0, 5}};
+  int failed = 0;
+  for (size_t i = 0; i < sizeof(zxy) / sizeof(zxy[0]); i++) {
+    uint64_t id = pmtiles_tile_id(zxy[i][0], zxy[i][1], zxy[i][2]);
+    if (id != zxy[i][3]) {
+      fprintf(stderr, "tile id %u/%u/%u = %llu, expected %u\n", zxy[i][0],
+              zxy[i][1], zxy[i][2], (unsigned long long)id, zxy[i][3]);
+      failed = 1;
+    }
+  }
+
+  for (uint32_t z = 0; z <= 6 && !failed; z++) {
+    for (uint32_t x = 0; x < (1u << z); x++) {
+      for (uint32_t y = 0; y < (1u << z); y++) {
+        uint32_t rz, rx, ry;
+        pmtiles_tile_coords(pmtiles_tile_id(z, x, y), &rz, &rx, &ry);
+        if (rz != z || rx != x || ry != y) {
+          fprintf(stderr, "tile id of %u/%u/%u does not round trip\n", z, x,
+                  y);
+          return 1;
+        }
+      }
+    }
+  }
+  return failed;
+}
+
+static uint32_t mix(uint32_t x, uint32_t y) {
+  uint32_t h = x * 0x9E3779B1u ^ y * 0x85EBCA77u;
+  h ^= h >> 15;
+  h *= 0x2C1B3C6Du;
+  return h ^ h >> 13;
+}
+
+// Random-ish holes, so the directory does not compress into the root
+static bool is_present(uint32_t x, uint32_t y) {
+  return mix(x, y) % 5 != 0;
+}
+
+// Tile bytes for x/y at z=8: distinct per tile except for a stripe of
+// identical ones, which should collapse into runs.
+static size_t make_tile(uint32_t x, uint32_t y, uint8_t *out) {
+  size_t len = x < 16 ? 40 : 40 + (mix(y, x) >> 8) % 80;
+  uint32_t seed = x < 16 ? 0 : x * 256 + y;
+  for (size_t i = 0; i < len; i++)
+    out[i] = (uint8_t)((seed >> (i % 3 * 8)) + i);
+  return len;
+}
+
+static int check_archive(void) {
+  char path[] = "/tmp/test_pmtiles_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0)
+    return 1;
+  close(fd);
+
+  pmtiles_writer_t w;
+  if (!pmtiles_writer_init(&w, path))
+    return 1;
+
+  // z=8 in tile id order is enough entries to need leaf directories
+  const uint32_t z = 8;
+  uint8_t tile[128], back_tile[128];
+  int failed = 0;
+  for (uint64_t d = 0; d < (1u << (z * 2)) && !failed; d++) {
+    uint32_t tz, x, y;
+    pmtiles_tile_coords(pmtiles_tile_id(z, 0, 0) + d, &tz, &x, &y);
+    if (!is_present(x, y))
+      continue;
+    size_t len = make_tile(x, y, tile);
+    failed |= !pmtiles_add(&w, z, x, y, tile, len);
+  }
+  // out of order
+  failed |= pmtiles_add(&w, z, 0, 0, tile, 10);
+  failed |= !pmtiles_finish(&w, "{}");
+  pmtiles_writer_destroy(&w);
+
+  pmtiles_reader_t r;
+  if (failed || !pmtiles_open(&r, path)) {
+    fprintf(stderr, "pmtiles: writing the archive failed\n");
+    remove(path);
+    return 1;
+  }
+  if (r.header.leaf_length == 0 ||
+      r.header.tile_contents >= r.header.addressed_tiles) {
+    fprintf(stderr, "pmtiles: expected leaf directories and deduplication\n");
+    failed = 1;
+  }
+
+  tile_buf_t b = {0};
+  for (uint32_t x = 0; x < (1u << z) && !failed; x++) {
+    for (uint32_t y = 0; y < (1u << z); y++) {
+      bool present = is_present(x, y);
+      size_t len = make_tile(x, y, back_tile);
+      bool got = pmtiles_get(&r, z, x, y, &b);
+      if (got != present ||
+          (got && (b.len != len || memcmp(b.data, back_tile, len) != 0))) {
+        fprintf(stderr, "pmtiles: tile %u/%u/%u read back wrong\n", z, x, y);
+        failed = 1;
+        break;
+      }
+    }
+  }
+  failed |= pmtiles_get(&r, 7, 0, 0, &b) || pmtiles_get(&r, 9, 0, 0, &b) ||
+            pmtiles_get(&r, z, 1u << z, 0, &b);
+
+  // the level scan sees exactly the tiles that are there, through the leaves
+  uint8_t *occupied = calloc((size_t)1 << (z * 2), 1);
+  size_t expected = 0, marked = 0;
+  size_t found = occupied ? pmtiles_scan_level(&r, z, occupied) : 0;
+  for (uint32_t x = 0; occupied && x < (1u << z); x++) {
+    for (uint32_t y = 0; y < (1u << z); y++) {
+      expected += is_present(x, y);
+      marked += occupied[((size_t)y << z) + x];
+      if (occupied[((size_t)y << z) + x] != is_present(x, y))
+        failed = 1;
+    }
+  }
+  if (!occupied || found != expected || marked != expected ||
+      pmtiles_scan_level(&r, z - 1, occupied) != 0) {
+    fprintf(stderr, "pmtiles: level scan found %zu of %zu tiles\n", found,
+            expected);
+    failed = 1;
+  }
+  free(occupied);
+
+  tile_buf_free(&b);
+  pmtiles_close(&r);
+  remove(path);
+  return failed;
+}
+
+int main(void) {
+  int failed = 0;
+  failed |= check_ids();
+  failed |= check_archive();
+
+  printf("tile_pmtiles: %s\n", failed ? "FAILED" : "ok");
+  return failed;
+}
@@ -0,0 +1,103 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "palette.h"
+#include "quantize.h"
+
+// xorshift, deterministic across platforms
+static uint32_t rng_state = 2463534242u;
+static uint32_t rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+// the loop of scripts/downscale.ts, line by line
+static void reference(uint8_t *image, size_t count) {
+  for (size_t i = 0; i < count * 4; i += 4) {
+    double a = image[i + 3];
+    double r = image[i + 0] * a / 256;
+    double g = image[i + 1] * a / 256;
+    double b = image[i + 2] * a / 256;
+
+    if (a < 100 && r < 20 && g < 20 && b < 20)
+      continue;
+    if (a <= 250 && a > 0)
+      image[i + 3] = 255;
+
+    const uint8_t *closest = wplace_palette[1];
+    double min_distance = INFINITY;
+    for (int c = 1; c <= 31; c++) {
+      const uint8_t *color = wplace_palette[c];
+      double distance = sqrt(pow(r - color[0], 2) + pow(g - color[1], 2) +
+                             pow(b - color[2], 2));
+      if (distance < min_distance) {
+        min_distance = distance;
+        closest = color;
+      }
+    }
+    memcpy(image + i, closest, 3);
+  }
+}
+
+int main(void) {
+  // not a multiple of 8, so the scalar tail runs too
+  size_t count = 1000 * 1000 + 5;
+  uint8_t *src = malloc(count * 4);
+  uint8_t *expected = malloc(count * 4);
+  uint8_t *out = malloc(count * 4);
+
+  for (size_t i = 0; i < count; i++) {
+    uint32_t v = rng();
+    uint8_t *px = src + i * 4;
+    memcpy(px, &v, 4);
+    switch (rng() % 4) {
+    case 0: // palette colour, the common case
+      memcpy(px, wplace_palette[1 + rng() % 63], 3);
+      px[3] = 255;
+      break;
+    case 1: // transparent
+      px[3] = 0;
+      break;
+    case 2: // dark and faint
+      px[0] %= 40;
+      px[1] %= 40;
+      px[2] %= 40;
+      px[3] %= 120;
+      break;
+    }
+  }
+
+  memcpy(expected, src, count * 4);
+  reference(expected, count);
+
+  int failed = 0;
+  for (int simd = 0; simd <= 1; simd++) {
+    memcpy(out, src, count * 4);
+    quantize_set_simd(simd);
+    quantize_rgba(out, count);
+    for (size_t i = 0; i < count; i++) {
+      if (memcmp(out + i * 4, expected + i * 4, 4) == 0)
+        continue;
+      const uint8_t *s = src + i * 4, *o = out + i * 4, *e = expected + i * 4;
+      fprintf(stderr,
+              "%s: pixel %u,%u,%u,%u got %u,%u,%u,%u expected %u,%u,%u,%u\n",
+              simd ? "simd" : "scalar", s[0], s[1], s[2], s[3], o[0], o[1],
+              o[2], o[3], e[0], e[1], e[2], e[3]);
+      failed = 1;
+      break;
+    }
+  }
+
+  quantize_set_simd(true);
+  printf("quantize: %s (%s kernel)\n", failed ? "FAILED" : "ok",
+         quantize_simd_active() ? "avx2" : "scalar");
+  free(src);
+  free(expected);
+  free(out);
+  return failed;
+}
@@ -0,0 +1,181 @@
+#define _DEFAULT_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "tar_ingest.h"
+#include "tile_hash.h"
+
+#define FILES 3000
+#define SLOTS 3
+
+static void tar_header(tile_buf_t *b, const char *name, char type,
+                       size_t size, const char *link) {
+  tile_buf_reserve(b, b->len + 512);
+  char *h = (char *)b->data + b->len;
+  memset(h, 0, 512);
+  strncpy(h, name, 100);
+  snprintf(h + 124, 12, "%011o", (unsigned)size);
+  h[156] = type;
+  if (link)
+    strncpy(h + 157, link, 100);
+  memcpy(h + 257, "ustar", 6);
+  b->len += 512;
+}
+
+static void tar_file(tile_buf_t *b, const char *name, const char *data) {
+  size_t len = strlen(data), padded = (len + 511) / 512 * 512;
+  tar_header(b, name, '0', len, NULL);
+  tile_buf_reserve(b, b->len + padded);
+  memset(b->data + b->len, 0, padded);
+  memcpy(b->data + b->len, data, len);
+  b->len += padded;
+}
+
+static void file_data(int i, char *out, size_t size) {
+  // every 100th is larger than a slot
+  snprintf(out, size, i % 100 ? "t%d" : "tile number %d, larger than a slot",
+           i);
+}
+
+typedef struct {
+  tar_ingest_t ingest;
+  tile_buf_t gz;
+  bool pushed, finished;
+  bool notified; // entries became ready since the consumer last looked
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+} test_t;
+
+static void notify(void *ctx) {
+  test_t *t = ctx;
+  pthread_mutex_lock(&t->lock);
+  t->notified = true;
+  pthread_cond_signal(&t->ready);
+  pthread_mutex_unlock(&t->lock);
+}
+
+static void *produce(void *arg) {
+  test_t *t = arg;
+  bool ok = true;
+  for (size_t off = 0; ok && off < t->gz.len; off += 1000) {
+    size_t n = t->gz.len - off < 1000 ? t->gz.len - off : 1000;
+    ok = tar_ingest_push(&t->ingest, t->gz.data + off, n);
+  }
+  pthread_mutex_lock(&t->lock);
+  t->pushed = true;
+  t->finished = ok && tar_ingest_finish(&t->ingest);
+  pthread_cond_signal(&t->ready);
+  pthread_mutex_unlock(&t->lock);
+  return NULL;
+}
+
+static void make_archive(tile_buf_t *gz) {
+  tile_buf_t tar = {0};
+  tar_header(&tar, "rel/", '5', 0, NULL);
+  for (int i = 0; i < FILES; i++) {
+    char name[64], data[64];
+    snprintf(name, sizeof(name), "rel/%d/%d.png", i / 64, i % 64);
+    file_data(i, data, sizeof(data));
+    tar_file(&tar, name, data);
+  }
+  tar_header(&tar, "rel/x/0.png", '1', 0, "rel/0/0.png");
+  tile_buf_reserve(&tar, tar.len + 1024);
+  memset(tar.data + tar.len, 0, 1024);
+  tar.len += 1024;
+
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  deflateInit2(&zs, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+  size_t bound = deflateBound(&zs, (uLong)tar.len);
+  tile_buf_reserve(gz, bound);
+  zs.next_in = tar.data;
+  zs.avail_in = (uInt)tar.len;
+  zs.next_out = gz->data;
+  zs.avail_out = (uInt)bound;
+  deflate(&zs, Z_FINISH);
+  gz->len = zs.total_out;
+  deflateEnd(&zs);
+  tile_buf_free(&tar);
+}
+
+int main(void) {
+  test_t t = {0};
+  pthread_mutex_init(&t.lock, NULL);
+  pthread_cond_init(&t.ready, NULL);
+  make_archive(&t.gz);
+  if (!tar_ingest_init(&t.ingest, true, SLOTS, 16, notify, &t))
+    return 1;
+
+  pthread_t producer;
+  pthread_create(&producer, NULL, produce, &t);
+
+  // Takes whatever is ready and releases it in reverse order, the producer
+  // runs out of credits all the time with this few slots.
+  int failed = 0, next = 0;
+  bool link_seen = false;
+  for (;;) {
+    pthread_mutex_lock(&t.lock);
+    t.notified = false;
+    bool pushed = t.pushed;
+    pthread_mutex_unlock(&t.lock);
+
+    uint32_t slots[SLOTS];
+    uint32_t n = tar_ingest_take(&t.ingest, slots, SLOTS);
+    if (n == 0) {
+      if (pushed)
+        break; // the producer published everything before it finished
+      pthread_mutex_lock(&t.lock);
+      while (!t.notified && !t.pushed)
+        pthread_cond_wait(&t.ready, &t.lock);
+      pthread_mutex_unlock(&t.lock);
+      continue;
+    }
+
+    for (uint32_t i = 0; i < n && !failed; i++) {
+      const tar_ingest_entry_t *e = &t.ingest.entries[slots[i]];
+      char name[64], data[64];
+      uint8_t hash[16];
+      if (next < FILES) {
+        snprintf(name, sizeof(name), "rel/%d/%d.png", next / 64, next % 64);
+        file_data(next, data, sizeof(data));
+        tile_hash128(data, strlen(data), hash);
+        failed = e->type != TAR_FILE || strcmp(e->name, name) != 0 ||
+                 e->len != strlen(data) || memcmp(e->data, data, e->len) != 0 ||
+                 memcmp(e->hash, hash, sizeof(hash)) != 0;
+        next++;
+      } else {
+        failed = e->type != TAR_LINK || strcmp(e->link_name, "rel/0/0.png");
+        link_seen = true;
+      }
+      if (failed)
+        fprintf(stderr, "tar_ingest: entry %d wrong\n", next);
+    }
+    if (t.ingest.credit_count > SLOTS) {
+      fprintf(stderr, "tar_ingest: more credits than slots\n");
+      failed = 1;
+    }
+    for (uint32_t i = n; i-- > 0;)
+      failed |= !tar_ingest_release(&t.ingest, slots[i]);
+    failed |= tar_ingest_release(&t.ingest, slots[0]); // twice
+    if (failed) {
+      tar_ingest_cancel(&t.ingest);
+      break;
+    }
+  }
+
+  pthread_join(producer, NULL);
+  if (!failed && (!t.finished || next != FILES || !link_seen ||
+                  t.ingest.skipped != 1)) {
+    fprintf(stderr, "tar_ingest: %d of %d files, link %s\n", next, FILES,
+            link_seen ? "seen" : "missing");
+    failed = 1;
+  }
+  tar_ingest_destroy(&t.ingest);
+  tile_buf_free(&t.gz);
+
+  printf("tar_ingest: %s\n", failed ? "FAILED" : "ok");
+  return failed;
+}
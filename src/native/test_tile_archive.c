@@ -0,0 +1,151 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tile_archive.h"
+
+static void tar_header(FILE *f, const char *name, char type, size_t size,
+                       const char *link) {
+  char h[512] = {0};
+  strncpy(h, name, 100);
+  memcpy(h + 100, "0000644", 7);
+  snprintf(h + 124, 12, "%011o", (unsigned)size);
+  h[156] = type;
+  if (link)
+    strncpy(h + 157, link, 100);
+  memcpy(h + 257, "ustar", 6);
+  memcpy(h + 263, "00", 2);
+  memset(h + 148, ' ', 8);
+  unsigned sum = 0;
+  for (int i = 0; i < 512; i++)
+    sum += (unsigned char)h[i];
+  snprintf(h + 148, 8, "%06o", sum);
+  fwrite(h, 1, 512, f);
+}
+
+static void tar_data(FILE *f, const void *data, size_t size) {
+  static const char pad[512];
+  fwrite(data, 1, size, f);
+  fwrite(pad, 1, (512 - size % 512) % 512, f);
+}
+
+static void tar_file(FILE *f, const char *name, const char *data) {
+  tar_header(f, name, '0', strlen(data), NULL);
+  tar_data(f, data, strlen(data));
+}
+
+static int expect(const tile_archive_t *a, uint32_t z, uint32_t x, uint32_t y,
+                  const char *want) {
+  const uint8_t *data;
+  size_t len;
+  bool found = tile_archive_find(a, z, x, y, &data, &len);
+  if (!want && !found)
+    return 0;
+  if (want && found && len == strlen(want) && memcmp(data, want, len) == 0 &&
+      data >= a->base && data + len <= a->base + a->size)
+    return 0;
+  fprintf(stderr, "tile_archive: tile %u/%u/%u %s\n", z, x, y,
+          found ? "has the wrong bytes" : "not found");
+  return 1;
+}
+
+static int check_tar(const char *path) {
+  FILE *f = fopen(path, "wb");
+  if (!f)
+    return 1;
+  tar_header(f, "./3/", '5', 0, NULL);
+  tar_file(f, "./3/1/2.png", "first tile");
+  tar_file(f, "2025-08-09T10-00-00Z/5/6.png", "release tile");
+  char long_name[300];
+  memset(long_name, 'd', sizeof(long_name));
+  strcpy(long_name + 280, "/4/3/9.png");
+  tar_header(f, "././@LongLink", 'L', strlen(long_name) + 1, NULL);
+  tar_data(f, long_name, strlen(long_name) + 1);
+  tar_file(f, "truncated", "long name tile");
+  tar_header(f, "3/1/3.png", '1', 0, "./3/1/2.png");
+  tar_file(f, "3/notes.txt", "not a tile");
+  tar_file(f, "3/9/1.png", "out of range");
+  static const char end[1024];
+  fwrite(end, 1, sizeof(end), f);
+  fclose(f);
+
+  char idx[300];
+  snprintf(idx, sizeof(idx), "%s.idx", path);
+  remove(idx);
+
+  int failed = 0;
+  // the second open loads the index the first one stored
+  for (int pass = 0; pass < 2 && !failed; pass++) {
+    tile_archive_t a;
+    if (!tile_archive_open(&a, path, 11)) {
+      fprintf(stderr, "tile_archive: failed to open the tar\n");
+      return 1;
+    }
+    if ((a.built != NULL) != (pass == 0) || a.count != 4) {
+      fprintf(stderr, "tile_archive: index not %s\n",
+              pass ? "reused" : "built");
+      failed = 1;
+    }
+    failed |= expect(&a, 3, 1, 2, "first tile");
+    failed |= expect(&a, 3, 1, 3, "first tile");
+    failed |= expect(&a, 11, 5, 6, "release tile");
+    failed |= expect(&a, 4, 3, 9, "long name tile");
+    failed |= expect(&a, 3, 9, 1, NULL);
+    failed |= expect(&a, 3, 2, 1, NULL);
+    uint8_t occupied[64] = {0};
+    if (tile_archive_scan_level(&a, 3, occupied) != 2 || !occupied[2 * 8 + 1] ||
+        !occupied[3 * 8 + 1]) {
+      fprintf(stderr, "tile_archive: level scan wrong\n");
+      failed = 1;
+    }
+    tile_archive_close(&a);
+  }
+  remove(idx);
+  return failed;
+}
+
+static int check_pmtiles(const char *path) {
+  pmtiles_writer_t w;
+  if (!pmtiles_writer_init(&w, path))
+    return 1;
+  bool ok = pmtiles_add(&w, 1, 0, 0, (const uint8_t *)"a", 1) &&
+            pmtiles_add(&w, 1, 1, 0, (const uint8_t *)"bb", 2) &&
+            pmtiles_finish(&w, "{}");
+  pmtiles_writer_destroy(&w);
+
+  tile_archive_t a;
+  if (!ok || !tile_archive_open(&a, path, 11)) {
+    fprintf(stderr, "tile_archive: failed to open the PMTiles archive\n");
+    return 1;
+  }
+  int failed = !a.pmtiles;
+  failed |= expect(&a, 1, 0, 0, "a");
+  failed |= expect(&a, 1, 1, 0, "bb");
+  failed |= expect(&a, 1, 0, 1, NULL);
+  uint8_t occupied[4] = {0};
+  failed |= tile_archive_scan_level(&a, 1, occupied) != 2 || !occupied[0] ||
+            !occupied[1] || occupied[2] || occupied[3];
+  tile_archive_close(&a);
+  return failed;
+}
+
+int main(void) {
+  char dir[] = "/tmp/test_tile_archive_XXXXXX";
+  if (!mkdtemp(dir))
+    return 1;
+  char tar[256], pmtiles[256];
+  snprintf(tar, sizeof(tar), "%s/tiles.tar", dir);
+  snprintf(pmtiles, sizeof(pmtiles), "%s/tiles.pmtiles", dir);
+
+  int failed = 0;
+  failed |= check_tar(tar);
+  failed |= check_pmtiles(pmtiles);
+  remove(tar);
+  remove(pmtiles);
+  rmdir(dir);
+
+  printf("tile_archive: %s\n", failed ? "FAILED" : "ok");
+  return failed;
+}
@@ -0,0 +1,61 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "tile_arena.h"
+
+// Slots are aligned, disjoint, handed out low first and recycled.
+static int check_slots(void) {
+  tile_arena_t a = {0};
+  if (!tile_arena_init(&a, 4, 100))
+    return 1;
+  int failed = a.slot_size != 128;
+
+  int32_t slots[4];
+  for (int i = 0; i < 4; i++) {
+    slots[i] = tile_arena_acquire(&a);
+    failed |= slots[i] != i;
+    uint8_t *p = tile_arena_slot(&a, (uint32_t)i);
+    failed |= !p || (uintptr_t)p % TILE_ARENA_ALIGN != 0;
+    if (p)
+      memset(p, i + 1, a.slot_size);
+  }
+  for (int i = 0; i < 4 && !failed; i++)
+    failed |= tile_arena_slot(&a, (uint32_t)i)[a.slot_size - 1] != i + 1;
+  // all taken
+  failed |= tile_arena_acquire(&a) != -1;
+
+  // the slot released last comes back first, with its bytes untouched
+  failed |= !tile_arena_release(&a, 2) || !tile_arena_release(&a, 0);
+  failed |= tile_arena_acquire(&a) != 0 || tile_arena_acquire(&a) != 2;
+  failed |= tile_arena_slot(&a, 2)[0] != 3;
+  if (failed)
+    fprintf(stderr, "arena: slots wrong\n");
+  tile_arena_destroy(&a);
+  return failed;
+}
+
+// Out of range slots and releasing more than was acquired are refused.
+static int check_bounds(void) {
+  tile_arena_t a = {0};
+  int failed = tile_arena_init(&a, 0, 64) || tile_arena_init(&a, 2, 0);
+  if (!tile_arena_init(&a, 2, 64))
+    return 1;
+  failed |= tile_arena_release(&a, 0) || tile_arena_release(&a, 5);
+  failed |= tile_arena_slot(&a, 2) != NULL;
+  int32_t slot = tile_arena_acquire(&a);
+  failed |= slot < 0 || !tile_arena_release(&a, (uint32_t)slot) ||
+            a.free_count != 2;
+  // init again starts over
+  failed |= !tile_arena_init(&a, 3, 64) || a.free_count != 3;
+  if (failed)
+    fprintf(stderr, "arena: bounds not checked\n");
+  tile_arena_destroy(&a);
+  return failed;
+}
+
+int main(void) {
+  int failed = check_slots() | check_bounds();
+  printf("tile_arena: %s\n", failed ? "FAILED" : "ok");
+  return failed;
+}
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "tile_cache.h"
+
+// Room for about ten 1000 byte bodies.
+static int check_lru(void) {
+  tile_cache_t c;
+  static uint8_t body[1000];
+  if (!tile_cache_init(&c, 10 * (1000 + 128)))
+    return 1;
+
+  int failed = 0;
+  for (uint64_t key = 0; key < 5000 && !failed; key++) {
+    memset(body, (int)key, sizeof(body));
+    tile_cache_entry_t *e = tile_cache_put(&c, key, body, sizeof(body));
+    failed = !e;
+    if (e)
+      tile_cache_unpin(e);
+    // key 0 stays hot, so it is never the least recently used
+    e = tile_cache_get(&c, 0);
+    failed = failed || !e || e->data[999] != 0;
+    if (e)
+      tile_cache_unpin(e);
+  }
+  if (failed || c.bytes > c.limit || c.count < 5 || c.bucket_count < 1024) {
+    fprintf(stderr, "cache: %zu entries, %zu of %zu bytes\n", c.count,
+            c.bytes, c.limit);
+    failed = 1;
+  }
+  // the newest survive, the oldest went
+  tile_cache_entry_t *e = tile_cache_get(&c, 4999);
+  if (!e || e->len != 1000 || e->data[0] != (uint8_t)4999 ||
+      tile_cache_get(&c, 1)) {
+    fprintf(stderr, "cache: wrong entries kept\n");
+    failed = 1;
+  }
+  if (e)
+    tile_cache_unpin(e);
+
+  // replacing a key keeps one entry
+  size_t count = c.count;
+  e = tile_cache_put(&c, 4999, (const uint8_t *)"png", 3);
+  if (!e || c.count != count)
+    failed = 1;
+  if (e)
+    tile_cache_unpin(e);
+  e = tile_cache_get(&c, 4999);
+  if (!e || e->len != 3 || memcmp(e->data, "png", 3) != 0) {
+    fprintf(stderr, "cache: replaced entry wrong\n");
+    failed = 1;
+  }
+  if (e)
+    tile_cache_unpin(e);
+
+  // empty bodies are entries too, they cache the absence of a tile
+  e = tile_cache_put(&c, 7, NULL, 0);
+  if (e)
+    tile_cache_unpin(e);
+  e = tile_cache_get(&c, 7);
+  if (!e || e->len != 0)
+    failed = 1;
+  if (e)
+    tile_cache_unpin(e);
+
+  tile_cache_free(&c);
+  return failed;
+}
+
+// A pinned body outlives its eviction, an oversized one is never kept.
+static int check_pins(void) {
+  tile_cache_t c;
+  static uint8_t body[4000];
+  if (!tile_cache_init(&c, 5000))
+    return 1;
+  int failed = 0;
+  memset(body, 0xAB, sizeof(body));
+  tile_cache_entry_t *pinned = tile_cache_put(&c, 1, body, sizeof(body));
+  // pinned twice, as by two responses
+  if (pinned)
+    tile_cache_pin(pinned);
+  tile_cache_entry_t *e = tile_cache_put(&c, 2, body, sizeof(body));
+  if (!pinned || !e || pinned->cached || tile_cache_get(&c, 1) ||
+      pinned->data[3999] != 0xAB) {
+    fprintf(stderr, "cache: pinned entry lost\n");
+    failed = 1;
+  }
+  if (pinned) {
+    tile_cache_unpin(pinned);
+    failed |= pinned->data[0] != 0xAB;
+    tile_cache_unpin(pinned);
+  }
+  if (e)
+    tile_cache_unpin(e);
+
+  static uint8_t huge[6000];
+  e = tile_cache_put(&c, 3, huge, sizeof(huge));
+  if (!e || e->cached || c.count != 1 || !tile_cache_get(&c, 2)) {
+    fprintf(stderr, "cache: oversized entry evicted others\n");
+    failed = 1;
+  } else {
+    tile_cache_unpin(c.head);
+  }
+  if (e)
+    tile_cache_unpin(e);
+  tile_cache_free(&c);
+  return failed;
+}
+
+int main(void) {
+  int failed = check_lru() || check_pins();
+  printf("tile_cache: %s\n", failed ? "FAILED" : "ok");
+  return failed;
+}
@@ -0,0 +1,184 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tile_delta.h"
+
+// xorshift, deterministic across platforms
+static uint32_t rng_state = 88172645u;
+static uint32_t rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+// applying the patch must give the new plane back, and every pixel must
+// look up to its new index if it changed and to nothing otherwise
+static int check_round_trip(uint32_t size, uint32_t rate) {
+  size_t pixels = (size_t)size * size;
+  uint8_t *before = malloc(pixels), *after = malloc(pixels);
+  uint8_t *plane = malloc(pixels);
+  tile_buf_t patch = {0};
+  int failed = 0;
+
+  uint32_t want = 0;
+  for (size_t i = 0; i < pixels; i++) {
+    before[i] = after[i] = (uint8_t)(rng() % 64);
+    if (rate && rng() % rate == 0) {
+      after[i] = (uint8_t)(before[i] + 1 + rng() % 63) % 64;
+      want++;
+    }
+  }
+  if (rate && after[pixels - 1] == before[pixels - 1]) {
+    after[pixels - 1] = (uint8_t)(before[pixels - 1] + 1) % 64;
+    want++;
+  }
+
+  uint32_t changed;
+  memcpy(plane, before, pixels);
+  if (!tile_delta_encode(before, after, size, &patch, &changed) ||
+      changed != want ||
+      !tile_delta_apply(patch.data, patch.len, size, plane) ||
+      memcmp(plane, after, pixels) != 0) {
+    fprintf(stderr, "delta %u/%u: round trip failed, %u of %u changes\n",
+            size, rate, changed, want);
+    failed = 1;
+  }
+  for (uint32_t y = 0; y < size && !failed; y++) {
+    for (uint32_t x = 0; x < size; x++) {
+      size_t i = (size_t)y * size + x;
+      int got = tile_delta_lookup(patch.data, patch.len, size, x, y);
+      if (got != (before[i] == after[i] ? -1 : after[i])) {
+        fprintf(stderr, "delta %u/%u: lookup %u,%u gave %d\n", size, rate, x,
+                y, got);
+        failed = 1;
+        break;
+      }
+    }
+  }
+  // per 4x4 cell, when the size allows
+  uint32_t grid = size / 4;
+  uint32_t *cells = calloc((size_t)grid * grid + 1, sizeof(uint32_t));
+  if (!failed && size % 4 == 0) {
+    bool ok = tile_delta_count_cells(patch.data, patch.len, size, 4, cells);
+    for (uint32_t y = 0; ok && y < size; y++) {
+      for (uint32_t x = 0; x < size; x++) {
+        size_t i = (size_t)y * size + x;
+        cells[(y / 4) * grid + x / 4] -= before[i] != after[i];
+      }
+    }
+    for (size_t i = 0; ok && i < (size_t)grid * grid; i++)
+      ok = cells[i] == 0;
+    if (!ok) {
+      fprintf(stderr, "delta %u/%u: cell counts wrong\n", size, rate);
+      failed = 1;
+    }
+  }
+  free(cells);
+  // only changes cost space
+  if (!failed && patch.len > 1 + (size_t)want * 3 + (size_t)size * 6) {
+    fprintf(stderr, "delta %u/%u: %zu bytes for %u changes\n", size, rate,
+            patch.len, want);
+    failed = 1;
+  }
+
+  free(before);
+  free(after);
+  free(plane);
+  tile_buf_free(&patch);
+  return failed;
+}
+
+static int check_corrupt(void) {
+  uint8_t before[16 * 16] = {0}, after[16 * 16] = {0}, plane[16 * 16];
+  tile_buf_t patch = {0};
+  uint32_t changed;
+  after[5 * 16 + 3] = 7;
+  after[15 * 16 + 15] = 9;
+  if (!tile_delta_encode(before, after, 16, &patch, &changed) ||
+      changed != 2) {
+    tile_buf_free(&patch);
+    return 1;
+  }
+  int failed = 0;
+  // cut short or read as a smaller tile
+  if (tile_delta_apply(patch.data, patch.len - 1, 16, plane) ||
+      tile_delta_lookup(patch.data, patch.len - 1, 16, 3, 5) != -2 ||
+      tile_delta_apply(patch.data, patch.len, 8, plane) ||
+      tile_delta_lookup(patch.data, patch.len, 16, 3, 5) != 7 ||
+      tile_delta_lookup(patch.data, patch.len, 16, 4, 5) != -1) {
+    fprintf(stderr, "delta: corrupt patch accepted\n");
+    failed = 1;
+  }
+  tile_buf_reserve(&patch, patch.len + 1);
+  patch.data[patch.len] = 0;
+  if (tile_delta_apply(patch.data, patch.len + 1, 16, plane)) {
+    fprintf(stderr, "delta: trailing byte accepted\n");
+    failed = 1;
+  }
+  tile_buf_free(&patch);
+  return failed;
+}
+
+// Delta tiles apply to the plane they were made against and no other, and
+// unchanged tiles all have the same bytes.
+static int check_tiles(void) {
+  enum { SIZE = 64, PIXELS = SIZE * SIZE };
+  static uint8_t before[PIXELS], after[PIXELS], plane[PIXELS];
+  for (size_t i = 0; i < PIXELS; i++)
+    before[i] = after[i] = (uint8_t)(rng() % 64);
+  after[100] = (uint8_t)(before[100] + 1) % 64;
+  after[PIXELS - 1] = (uint8_t)(before[PIXELS - 1] + 1) % 64;
+
+  tile_buf_t tile = {0}, same[2] = {{0}, {0}};
+  uint32_t changed;
+  int failed = 0;
+  memcpy(plane, before, PIXELS);
+  if (!tile_delta_tile_encode(before, after, SIZE, &tile, &changed) ||
+      changed != 2 || tile.len != TILE_DELTA_TILE_HEADER + 1 + 4 + 6 ||
+      !tile_delta_tile_apply(tile.data, tile.len, SIZE, plane) ||
+      memcmp(plane, after, PIXELS) != 0) {
+    fprintf(stderr, "delta tile: round trip failed\n");
+    failed = 1;
+  }
+  // plane now holds after, which the tile was not made against
+  if (tile.len && (tile_delta_tile_apply(tile.data, tile.len, SIZE, plane) ||
+                   memcmp(plane, after, PIXELS) != 0 ||
+                   tile_delta_tile_apply(tile.data, tile.len, SIZE / 2,
+                                         plane))) {
+    fprintf(stderr, "delta tile: applied to the wrong plane\n");
+    failed = 1;
+  }
+
+  for (int i = 0; i < 2; i++) {
+    const uint8_t *p = i ? after : before;
+    if (!tile_delta_tile_encode(p, p, SIZE, &same[i], &changed) ||
+        changed != 0 || same[i].len != TILE_DELTA_TILE_HEADER ||
+        !tile_delta_tile_apply(same[i].data, same[i].len, SIZE, plane))
+      failed = 1;
+  }
+  if (failed || memcmp(same[0].data, same[1].data, same[0].len) != 0 ||
+      memcmp(plane, after, PIXELS) != 0) {
+    fprintf(stderr, "delta tile: unchanged tiles differ\n");
+    failed = 1;
+  }
+  tile_buf_free(&tile);
+  tile_buf_free(&same[0]);
+  tile_buf_free(&same[1]);
+  return failed;
+}
+
+int main(void) {
+  int failed = 0;
+  failed |= check_round_trip(1000, 5000);
+  failed |= check_round_trip(1000, 0);
+  failed |= check_round_trip(257, 2);
+  failed |= check_round_trip(1, 1);
+  failed |= check_corrupt();
+  failed |= check_tiles();
+
+  printf("tile_delta: %s\n", failed ? "FAILED" : "ok");
+  return failed;
+}
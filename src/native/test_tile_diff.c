@@ -0,0 +1,101 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tile_diff.h"
+
+// xorshift, deterministic across platforms
+static uint32_t rng_state = 2463534242u;
+static uint32_t rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+// the SIMD kernel must give exactly the scalar result, including the
+// columns left over at the end of a row and changes right at the edges
+static int check_simd_matches_scalar(uint32_t w, uint32_t h, uint32_t rate) {
+  size_t stride = w + 7, size = stride * h;
+  uint8_t *a = malloc(size), *b = malloc(size);
+  uint8_t *mask_scalar = malloc(size), *mask_simd = malloc(size);
+  int failed = 0;
+
+  for (size_t i = 0; i < size; i++) {
+    a[i] = b[i] = (uint8_t)(rng() % 64);
+    if (rate && rng() % rate == 0)
+      b[i] = (uint8_t)(a[i] + 1 + rng() % 63);
+  }
+  if (rate && w > 1) {
+    b[0] ^= 1;
+    b[(h - 1) * stride + w - 1] ^= 1;
+  }
+  memset(mask_scalar, 0xAA, size);
+  memset(mask_simd, 0xAA, size);
+
+  // reference: every pixel by itself
+  tile_diff_t want = {0};
+  for (uint32_t y = 0; y < h; y++) {
+    for (uint32_t x = 0; x < w; x++) {
+      if (a[y * stride + x] == b[y * stride + x])
+        continue;
+      if (!want.changed)
+        want = (tile_diff_t){0, x, y, x, y};
+      want.changed++;
+      want.min_x = x < want.min_x ? x : want.min_x;
+      want.max_x = x > want.max_x ? x : want.max_x;
+      want.max_y = y;
+    }
+  }
+
+  tile_diff_t scalar, simd;
+  tile_diff_set_simd(false);
+  tile_diff_planes(a, b, w, h, stride, mask_scalar, &scalar);
+  tile_diff_set_simd(true);
+  tile_diff_planes(a, b, w, h, stride, mask_simd, &simd);
+
+  if (memcmp(&scalar, &want, sizeof(want)) != 0 ||
+      memcmp(&simd, &want, sizeof(want)) != 0) {
+    fprintf(stderr,
+            "diff %ux%u: %u changed in %u..%u x %u..%u, expected %u in "
+            "%u..%u x %u..%u\n",
+            w, h, simd.changed, simd.min_x, simd.max_x, simd.min_y,
+            simd.max_y, want.changed, want.min_x, want.max_x, want.min_y,
+            want.max_y);
+    failed = 1;
+  }
+  for (uint32_t y = 0; y < h && !failed; y++) {
+    for (uint32_t x = 0; x < w; x++) {
+      size_t i = y * stride + x;
+      if (mask_scalar[i] != (a[i] != b[i]) || mask_simd[i] != mask_scalar[i]) {
+        fprintf(stderr, "diff %ux%u: mask wrong at %u,%u\n", w, h, x, y);
+        failed = 1;
+        break;
+      }
+    }
+    // the padding between rows is left alone
+    if (!failed && stride > w && mask_simd[y * stride + w] != 0xAA)
+      failed = 1;
+  }
+
+  free(a);
+  free(b);
+  free(mask_scalar);
+  free(mask_simd);
+  return failed;
+}
+
+int main(void) {
+  int failed = 0;
+  failed |= check_simd_matches_scalar(1000, 1000, 5000);
+  failed |= check_simd_matches_scalar(1000, 40, 3);
+  failed |= check_simd_matches_scalar(1000, 40, 0);
+  failed |= check_simd_matches_scalar(63, 17, 7);
+  failed |= check_simd_matches_scalar(32, 3, 2);
+  failed |= check_simd_matches_scalar(1, 5, 2);
+
+  printf("tile_diff: %s (%s kernel)\n", failed ? "FAILED" : "ok",
+         tile_diff_simd_active() ? "avx2" : "scalar");
+  return failed;
+}
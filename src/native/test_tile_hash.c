@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "tile_hash.h"
+
+static int check_vector(const char *input, uint64_t expected) {
+  uint64_t h = tile_hash64(input, strlen(input), 0);
+  if (h == expected)
+    return 0;
+  fprintf(stderr, "xxh64(\"%s\") = %016llx, expected %016llx\n", input,
+          (unsigned long long)h, (unsigned long long)expected);
+  return 1;
+}
+
+static int check_set(void) {
+  tile_hash_set_t set;
+  if (!tile_hash_set_init(&set))
+    return 1;
+
+  int failed = 0;
+  // enough entries to grow the table a few times
+  for (uint32_t i = 0; i < 5000; i++) {
+    tile_hash_entry_t e = {.hash = tile_hash64(&i, sizeof(i), 0),
+                           .len = 100 + i % 7, .z = 3, .x = i, .y = i * 2};
+    failed |= !tile_hash_set_put(&set, &e);
+  }
+  for (uint32_t i = 0; i < 5000; i++) {
+    tile_hash_entry_t found;
+    uint64_t hash = tile_hash64(&i, sizeof(i), 0);
+    if (!tile_hash_set_find(&set, hash, 100 + i % 7, &found) ||
+        found.x != i || found.y != i * 2 ||
+        tile_hash_set_find(&set, hash, 99, &found)) {
+      fprintf(stderr, "hash set: entry %u lost\n", i);
+      failed = 1;
+      break;
+    }
+  }
+
+  tile_hash_set_destroy(&set);
+  return failed;
+}
+
+int main(void) {
+  int failed = 0;
+  failed |= check_vector("", 0xEF46DB3751D8E999ull);
+  failed |= check_vector("a", 0xD24EC4F1A98C6E5Bull);
+  failed |= check_vector("abc", 0x44BC2CF5AD770999ull);
+  failed |= check_vector("Nobody inspects the spammish repetition",
+                         0xFBCEA83C8A378BF1ull);
+  failed |= check_set();
+
+  printf("tile_hash: %s\n", failed ? "FAILED" : "ok");
+  return failed;
+}
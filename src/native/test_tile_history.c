@@ -0,0 +1,330 @@
+#define _DEFAULT_SOURCE
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "palette.h"
+#include "tile_history.h"
+#include "tile_png.h"
+
+#define SIZE 64
+#define RELEASES 12
+#define PIXELS (SIZE * SIZE)
+
+// xorshift, deterministic across platforms
+static uint32_t rng_state = 521288629u;
+static uint32_t rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+// Three tiles painted over a dozen releases; every pixel's history must
+// match the planes it was ingested from, also after reopening the store.
+static uint8_t planes[RELEASES + 1][3][PIXELS];
+static const uint32_t tiles[3][2] = {{1023, 700}, {1024, 700}, {5, 2047}};
+
+static int check_history(const tile_history_t *h) {
+  tile_history_change_t changes[RELEASES + 1];
+  for (int t = 0; t < 3; t++) {
+    for (uint32_t p = 0; p < PIXELS; p++) {
+      tile_history_change_t want[RELEASES];
+      size_t n = 0;
+      for (int r = 1; r <= RELEASES; r++) {
+        if (planes[r][t][p] != planes[r - 1][t][p])
+          want[n++] = (tile_history_change_t){1000 * r, planes[r][t][p]};
+      }
+      size_t got = tile_history_pixel(h, tiles[t][0], tiles[t][1], p % SIZE,
+                                      p / SIZE, changes, RELEASES + 1);
+      if (got != n) {
+        fprintf(stderr, "history: pixel %u of tile %d has %zu changes, "
+                        "expected %zu\n",
+                p, t, got, n);
+        return 1;
+      }
+      for (size_t i = 0; i < n; i++) {
+        if (changes[i].time != want[i].time ||
+            changes[i].index != want[i].index) {
+          fprintf(stderr, "history: pixel %u of tile %d change %zu wrong\n",
+                  p, t, i);
+          return 1;
+        }
+      }
+    }
+  }
+  // outside any ingested tile
+  return tile_history_pixel(h, 3, 3, 0, 0, changes, 1) != 0;
+}
+
+// Every tile rebuilt at, between and before the releases, directly and
+// through a cache small enough to evict.
+static int check_planes(const tile_history_t *h) {
+  static uint8_t plane[PIXELS];
+  static const uint8_t empty[PIXELS];
+  tile_history_cache_t cache;
+  if (!tile_history_cache_init(&cache, h, 2))
+    return 1;
+  int failed = 0;
+  for (int pass = 0; pass < 2 && !failed; pass++) {
+    for (int r = 0; r <= RELEASES && !failed; r++) {
+      for (int t = 0; t < 3 && !failed; t++) {
+        int64_t times[2] = {1000 * r, 1000 * r + 500};
+        for (int i = 0; i < 2 && !failed; i++) {
+          const uint8_t *want = r ? planes[r][t] : empty;
+          bool ok = tile_history_plane(h, tiles[t][0], tiles[t][1], times[i],
+                                       plane) &&
+                    memcmp(plane, want, PIXELS) == 0 &&
+                    tile_history_cache_plane(&cache, tiles[t][0], tiles[t][1],
+                                             times[i], plane) &&
+                    memcmp(plane, want, PIXELS) == 0;
+          if (!ok) {
+            fprintf(stderr, "history: tile %d wrong at %lld\n", t,
+                    (long long)times[i]);
+            failed = 1;
+          }
+        }
+      }
+    }
+  }
+  // the second of every pair is the same state
+  if (!failed && cache.hits < cache.misses) {
+    fprintf(stderr, "history: %llu cache hits, %llu misses\n",
+            (unsigned long long)cache.hits, (unsigned long long)cache.misses);
+    failed = 1;
+  }
+  tile_history_cache_free(&cache);
+  return failed;
+}
+
+// A dozen larger tiles like the canvas: mostly transparent, with sprites of a
+// few colours. They appear at the first release, a few pixels change at the
+// second, and at the third one tile is wiped and another repainted.
+#define BIG 256
+#define BIG_TILES 12
+#define BIG_PIXELS (BIG * BIG)
+static uint8_t big[4][BIG_TILES][BIG_PIXELS];
+
+static void paint_sprites(uint8_t *plane) {
+  for (int s = 0; s < 8; s++) {
+    uint32_t w = 10 + rng() % 50, h = 10 + rng() % 50;
+    uint32_t x0 = rng() % (BIG - w), y0 = rng() % (BIG - h);
+    uint8_t colours[3];
+    for (int c = 0; c < 3; c++)
+      colours[c] = (uint8_t)(1 + rng() % (PALETTE_SIZE - 1));
+    for (uint32_t y = 0; y < h; y++)
+      for (uint32_t x = 0; x < w; x++)
+        plane[(y0 + y) * BIG + x0 + x] = colours[(x / 3 + y / 5) % 3];
+  }
+}
+
+// Bytes of the release as palette PNGs, what ingest reads.
+static size_t png_bytes(uint8_t (*planes)[BIG_PIXELS]) {
+  static const uint8_t empty[BIG_PIXELS];
+  size_t total = 0;
+  for (int t = 0; t < BIG_TILES; t++) {
+    uint8_t *png;
+    size_t len;
+    if (memcmp(planes[t], empty, BIG_PIXELS) == 0)
+      continue;
+    if (!tile_png_encode_indexed(planes[t], BIG, BIG, BIG, wplace_palette,
+                                 PALETTE_SIZE, 9, TILE_PNG_MAX, &png, &len))
+      return 0;
+    total += len;
+    free(png);
+  }
+  return total;
+}
+
+static int check_big(const tile_history_t *h) {
+  static uint8_t plane[BIG_PIXELS];
+  uint32_t cell = 16, grid = BIG / 16;
+  uint32_t got[16 * 16], want[16 * 16];
+  tile_history_change_t changes[4];
+  for (int t = 0; t < BIG_TILES; t++) {
+    for (int r = 1; r <= 3; r++) {
+      memset(got, 0, sizeof(got));
+      memset(want, 0, sizeof(want));
+      for (uint32_t p = 0; p < BIG_PIXELS; p++)
+        want[p / BIG / cell * grid + p % BIG / cell] +=
+            big[r][t][p] != big[r - 1][t][p];
+      if (!tile_history_plane(h, 100 + t, 200, 1000 * r, plane) ||
+          memcmp(plane, big[r][t], BIG_PIXELS) != 0 ||
+          !tile_history_count_cells(h, (size_t)r - 1, 100 + t, 200, cell,
+                                    got) ||
+          memcmp(got, want, sizeof(got)) != 0) {
+        fprintf(stderr, "history: big tile %d wrong at release %d\n", t, r);
+        return 1;
+      }
+    }
+    for (uint32_t p = t; p < BIG_PIXELS; p += 97) {
+      size_t n = 0, count = tile_history_pixel(h, 100 + t, 200, p % BIG,
+                                               p / BIG, changes, 4);
+      for (int r = 1; r <= 3; r++) {
+        if (big[r][t][p] == big[r - 1][t][p])
+          continue;
+        if (n >= count || changes[n].time != 1000 * r ||
+            changes[n].index != big[r][t][p])
+          count = SIZE_MAX;
+        n++;
+      }
+      if (count != n) {
+        fprintf(stderr, "history: pixel %u of big tile %d wrong\n", p, t);
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+// The store grows by about what the PNGs of a release take, not by 3 bytes
+// a pixel for every tile that appears or vanishes.
+static int check_size(const char *store) {
+  for (int t = 0; t < BIG_TILES; t++) {
+    paint_sprites(big[1][t]);
+    memcpy(big[2][t], big[1][t], BIG_PIXELS);
+    for (int i = 0; t % 2 && i < 40; i++)
+      big[2][t][rng() % BIG_PIXELS] = (uint8_t)(1 + rng() % 63);
+    memcpy(big[3][t], big[2][t], BIG_PIXELS);
+  }
+  memset(big[3][0], PALETTE_TRANSPARENT, BIG_PIXELS);
+  paint_sprites(big[3][1]);
+  size_t pngs = png_bytes(big[1]), sizes[4] = {0, 0, 0, 0};
+
+  tile_history_t h;
+  tile_buf_t scratch = {0};
+  int failed = !pngs || !tile_history_open(&h, store, BIG, true);
+  for (int r = 1; r <= 3 && !failed; r++) {
+    tile_history_batch_t b;
+    failed = !tile_history_begin(&h, 1000 * r, false, &b);
+    for (int t = 0; t < BIG_TILES && !failed; t++)
+      failed = !tile_history_add(&b, 100 + t, 200, big[r - 1][t], big[r][t],
+                                 &scratch);
+    failed = failed || !tile_history_commit(&b);
+    sizes[r] = h.data_len;
+  }
+  tile_buf_free(&scratch);
+  if (failed) {
+    fprintf(stderr, "history: ingest of the big tiles failed\n");
+  } else if (sizes[1] > pngs || sizes[2] - sizes[1] > 40 * 6 * BIG_TILES ||
+             sizes[3] - sizes[2] > pngs / 4) {
+    fprintf(stderr, "history: %zu, %zu and %zu bytes for releases of %zu "
+                    "bytes of PNG\n",
+            sizes[1], sizes[2] - sizes[1], sizes[3] - sizes[2], pngs);
+    failed = 1;
+  } else {
+    failed = check_big(&h);
+  }
+  tile_history_close(&h);
+
+  char path[96];
+  snprintf(path, sizeof(path), "%s/history.idx", store);
+  unlink(path);
+  snprintf(path, sizeof(path), "%s/history.dat", store);
+  unlink(path);
+  rmdir(store);
+  return failed;
+}
+
+int main(void) {
+  char dir[] = "/tmp/test_tile_history_XXXXXX";
+  if (!mkdtemp(dir))
+    return 1;
+  char store[64];
+  snprintf(store, sizeof(store), "%s/store", dir);
+
+  // release 0 is the empty canvas; tile 2 only appears at release 4
+  for (int r = 1; r <= RELEASES; r++) {
+    for (int t = 0; t < 3; t++) {
+      memcpy(planes[r][t], planes[r - 1][t], PIXELS);
+      if (t == 2 && r < 4)
+        continue;
+      uint32_t strokes = r == 1 ? PIXELS : 1 + rng() % 200;
+      for (uint32_t i = 0; i < strokes; i++)
+        planes[r][t][rng() % PIXELS] = (uint8_t)(rng() % 64);
+    }
+  }
+
+  tile_history_t h;
+  tile_buf_t scratch = {0};
+  int failed = 0;
+  if (!tile_history_open(&h, store, SIZE, true)) {
+    fprintf(stderr, "history: cannot create %s\n", store);
+    return 1;
+  }
+  // a keyframe at every fifth release
+  for (int r = 1; r <= RELEASES && !failed; r++) {
+    tile_history_batch_t b;
+    bool keyframe = r % 5 == 0;
+    failed = !tile_history_begin(&h, 1000 * r, keyframe, &b);
+    for (int t = 2; t >= 0 && !failed; t--) {
+      failed = !tile_history_add(&b, tiles[t][0], tiles[t][1],
+                                 planes[r - 1][t], planes[r][t], &scratch) ||
+               (keyframe && !tile_history_add_keyframe(&b, tiles[t][0],
+                                                       tiles[t][1],
+                                                       planes[r][t],
+                                                       &scratch));
+    }
+    failed = failed || !tile_history_commit(&b);
+    // a release cannot go back in time
+    if (!failed && (tile_history_begin(&h, 1000 * r, false, &b) ||
+                    h.release_count != (size_t)r ||
+                    h.keyframe_count != (size_t)r / 5 ||
+                    tile_history_since_keyframe(&h) != (size_t)r % 5))
+      failed = 1;
+  }
+  if (failed)
+    fprintf(stderr, "history: ingest failed\n");
+  failed = failed || check_history(&h) || check_planes(&h);
+  tile_history_close(&h);
+
+  // a block cut short by a crash is dropped
+  char path[96];
+  snprintf(path, sizeof(path), "%s/history.idx", store);
+  int fd = open(path, O_WRONLY | O_APPEND);
+  if (fd < 0 || write(fd, "torn block", 10) != 10)
+    failed = 1;
+  if (fd >= 0)
+    close(fd);
+
+  // reopened, with the tile size taken from the store
+  if (!failed && (!tile_history_open(&h, store, 0, false) ||
+                  h.tile_size != SIZE || h.release_count != RELEASES ||
+                  h.keyframe_count != RELEASES / 5 || check_history(&h) ||
+                  check_planes(&h))) {
+    fprintf(stderr, "history: reopened store differs\n");
+    failed = 1;
+  }
+  // and the next release goes where the torn block was
+  tile_history_batch_t b;
+  if (!failed && (!tile_history_begin(&h, 1000 * (RELEASES + 1), false, &b) ||
+                  !tile_history_commit(&b) ||
+                  h.release_count != RELEASES + 1 || check_history(&h))) {
+    fprintf(stderr, "history: ingest after a torn block failed\n");
+    failed = 1;
+  }
+  if (!failed) {
+    tile_history_close(&h);
+    failed = tile_history_open(&h, store, SIZE * 2, false);
+    if (failed)
+      fprintf(stderr, "history: opened with the wrong tile size\n");
+  }
+  tile_history_close(&h);
+  tile_buf_free(&scratch);
+
+  snprintf(path, sizeof(path), "%s/history.idx", store);
+  unlink(path);
+  snprintf(path, sizeof(path), "%s/history.dat", store);
+  unlink(path);
+  rmdir(store);
+
+  snprintf(store, sizeof(store), "%s/big", dir);
+  failed = failed || check_size(store);
+  rmdir(dir);
+
+  printf("tile_history: %s\n", failed ? "FAILED" : "ok");
+  return failed;
+}
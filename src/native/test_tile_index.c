@@ -0,0 +1,207 @@
+#define _DEFAULT_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tile_index.h"
+
+#define SIZE 64
+#define TILES 48
+#define PIXELS (SIZE * SIZE)
+
+// xorshift, deterministic across platforms
+static uint32_t rng_state = 88675123u;
+static uint32_t rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+static uint8_t planes[TILES][PIXELS];
+static uint32_t keys[TILES];
+
+// Mostly transparent tiles with a few sprites of a handful of colours, and
+// one shared sprite pasted into a dozen of them at every alignment.
+static void paint(void) {
+  uint8_t shared[12 * 12];
+  for (int i = 0; i < 12 * 12; i++)
+    shared[i] = (uint8_t)(1 + rng() % 3);
+  for (int t = 0; t < TILES; t++) {
+    keys[t] = (uint32_t)(1000 + t / 7) << 16 | (uint32_t)(500 + t % 7);
+    memset(planes[t], 0, PIXELS);
+    for (int s = 0; s < 5; s++) {
+      uint32_t w = 6 + rng() % 16, h = 6 + rng() % 16;
+      uint32_t x0 = rng() % (SIZE - w), y0 = rng() % (SIZE - h);
+      uint8_t colours[3];
+      for (int c = 0; c < 3; c++)
+        colours[c] = (uint8_t)(1 + rng() % 63);
+      bool solid = s == 0; // one colour, never indexed
+      for (uint32_t y = 0; y < h; y++)
+        for (uint32_t x = 0; x < w; x++)
+          planes[t][(y0 + y) * SIZE + x0 + x] =
+              solid ? colours[0] : colours[rng() % 3];
+    }
+    if (t < 12) {
+      uint32_t x0 = 4 + t % 4 + rng() % 40, y0 = 4 + t / 4 + rng() % 40;
+      for (uint32_t y = 0; y < 12; y++)
+        memcpy(planes[t] + (y0 + y) * SIZE + x0, shared + y * 12, 12);
+    }
+  }
+}
+
+// Whether the template is at some position of the tile, 0 matching anything.
+static bool contains(const uint8_t *plane, const uint8_t *tpl, uint32_t w,
+                     uint32_t h) {
+  for (uint32_t sy = 0; sy + h <= SIZE; sy++)
+    for (uint32_t sx = 0; sx + w <= SIZE; sx++) {
+      bool match = true;
+      for (uint32_t i = 0; match && i < w * h; i++) {
+        uint8_t want = tpl[i];
+        match = !want || plane[(sy + i / w) * SIZE + sx + i % w] == want;
+      }
+      if (match)
+        return true;
+    }
+  return false;
+}
+
+static bool listed(const uint32_t *tiles, size_t n, uint32_t key) {
+  for (size_t i = 0; i < n; i++)
+    if (tiles[i] == key)
+      return true;
+  return false;
+}
+
+static int check_postings(const tile_index_t *ix) {
+  uint32_t hashes[(SIZE / TILE_INDEX_BLOCK) * (SIZE / TILE_INDEX_BLOCK)];
+  uint32_t tiles[TILES];
+  for (int t = 0; t < TILES; t++) {
+    size_t n = tile_index_tile_hashes(planes[t], SIZE, hashes);
+    for (size_t i = 0; i < n; i++) {
+      const tile_index_entry_t *e = tile_index_lookup(ix, hashes[i]);
+      if (!e || e->count > TILES || !tile_index_postings(ix, e, tiles) ||
+          !listed(tiles, e->count, keys[t])) {
+        fprintf(stderr, "tile_index: tile %d missing from its postings\n", t);
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+static int check_queries(const tile_index_t *ix) {
+  uint8_t tpl[24 * 24];
+  size_t candidates = 0, queries = 0;
+  for (int q = 0; q < 400; q++) {
+    int t = (int)(rng() % TILES);
+    uint32_t w = 7 + rng() % 18, h = 7 + rng() % 18;
+    uint32_t x0 = rng() % (SIZE - w), y0 = rng() % (SIZE - h);
+    for (uint32_t i = 0; i < w * h; i++)
+      tpl[i] = planes[t][(y0 + i / w) * SIZE + x0 + i % w];
+    // a few pixels nobody cares about
+    for (int i = 0; i < 3; i++)
+      tpl[rng() % (w * h)] = 0;
+
+    uint32_t *tiles;
+    size_t n;
+    bool pruned;
+    if (!tile_index_candidates(ix, tpl, w, h, &tiles, &n, &pruned)) {
+      fprintf(stderr, "tile_index: query failed\n");
+      return 1;
+    }
+    for (int u = 0; u < TILES; u++) {
+      if (contains(planes[u], tpl, w, h) && !listed(tiles, n, keys[u])) {
+        fprintf(stderr, "tile_index: %ux%u template of tile %d not in %d\n",
+                w, h, t, u);
+        free(tiles);
+        return 1;
+      }
+    }
+    if (pruned) {
+      candidates += n;
+      queries++;
+    } else if (n != TILES) {
+      fprintf(stderr, "tile_index: unpruned query gave %zu tiles\n", n);
+      free(tiles);
+      return 1;
+    }
+    free(tiles);
+  }
+  // templates of random sprites are almost always in just their own tile
+  if (queries < 100 || candidates > queries * 3) {
+    fprintf(stderr, "tile_index: %zu candidates for %zu queries\n",
+            candidates, queries);
+    return 1;
+  }
+  return 0;
+}
+
+static int check_edge_cases(const tile_index_t *ix) {
+  uint8_t tpl[16 * 16];
+  uint32_t *tiles;
+  size_t n;
+  bool pruned;
+  int failed = 0;
+
+  // one colour says nothing, every tile is a candidate
+  memset(tpl, 7, sizeof(tpl));
+  failed |= !tile_index_candidates(ix, tpl, 16, 16, &tiles, &n, &pruned) ||
+            pruned || n != TILES;
+  free(tiles);
+
+  // too small to cover an aligned block at every alignment
+  failed |= !tile_index_candidates(ix, planes[0], 6, 6, &tiles, &n, &pruned) ||
+            pruned;
+  free(tiles);
+
+  // drawn nowhere
+  for (size_t i = 0; i < sizeof(tpl); i++)
+    tpl[i] = (uint8_t)(1 + rng() % 63);
+  failed |= !tile_index_candidates(ix, tpl, 16, 16, &tiles, &n, &pruned) ||
+            !pruned || n != 0;
+  free(tiles);
+
+  if (failed)
+    fprintf(stderr, "tile_index: edge cases failed\n");
+  return failed;
+}
+
+int main(void) {
+  paint();
+  char path[] = "/tmp/test_tile_index_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0)
+    return 1;
+  close(fd);
+
+  tile_index_writer_t w;
+  uint32_t hashes[(SIZE / TILE_INDEX_BLOCK) * (SIZE / TILE_INDEX_BLOCK)];
+  bool ok = tile_index_writer_init(&w, path, SIZE);
+  for (int t = 0; ok && t < TILES; t++) {
+    size_t n = tile_index_tile_hashes(planes[t], SIZE, hashes);
+    ok = tile_index_add(&w, keys[t], hashes, n);
+  }
+  // out of order
+  ok = ok && !tile_index_add(&w, keys[0], hashes, 0);
+  ok = ok && tile_index_finish(&w);
+  tile_index_writer_destroy(&w);
+
+  tile_index_t ix;
+  int failed = !ok || !tile_index_open(&ix, path) || ix.tile_size != SIZE ||
+               ix.tile_count != TILES;
+  if (failed) {
+    fprintf(stderr, "tile_index: could not write and open the index\n");
+  } else {
+    failed |= check_postings(&ix);
+    failed |= check_queries(&ix);
+    failed |= check_edge_cases(&ix);
+    tile_index_close(&ix);
+  }
+  unlink(path);
+
+  printf("tile_index: %s\n", failed ? "FAILED" : "ok");
+  return failed;
+}
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tile_hash.h"
+#include "tile_manifest.h"
+
+#define TILES 20000
+
+static int check_hash128(void) {
+  uint8_t a[16], b[16], c[16];
+  tile_hash128("tile", 4, a);
+  tile_hash128("tile", 4, b);
+  tile_hash128("tilf", 4, c);
+  // the first half is plain XXH64 with seed 0
+  uint64_t hi = 0;
+  for (int i = 0; i < 8; i++)
+    hi = hi << 8 | a[i];
+  if (memcmp(a, b, 16) != 0 || memcmp(a, c, 16) == 0 ||
+      hi != tile_hash64("tile", 4, 0) || memcmp(a, a + 8, 8) == 0) {
+    fprintf(stderr, "hash128: unexpected hashes\n");
+    return 1;
+  }
+  return 0;
+}
+
+static int check_round_trip(void) {
+  uint32_t *zxy = malloc(TILES * 3 * sizeof(uint32_t));
+  uint8_t *hashes = malloc(TILES * 16);
+  if (!zxy || !hashes)
+    return 1;
+
+  // a z11 block in reverse order with few distinct contents, then its last
+  // tile again with new content
+  for (uint32_t i = 0; i < TILES; i++) {
+    uint32_t n = i == TILES - 1 ? 0 : TILES - 2 - i;
+    zxy[i * 3] = 11;
+    zxy[i * 3 + 1] = 1000 + n % 200;
+    zxy[i * 3 + 2] = 500 + n / 200;
+    uint32_t content = i == TILES - 1 ? 99999 : n % 37;
+    tile_hash128(&content, sizeof(content), hashes + i * 16);
+  }
+
+  tile_manifest_t m, back;
+  tile_buf_t buf = {0};
+  int failed = 0;
+  if (!tile_manifest_build(&m, zxy, hashes, TILES) ||
+      !tile_manifest_encode(&m, &buf) ||
+      !tile_manifest_decode(&back, buf.data, buf.len)) {
+    fprintf(stderr, "manifest: build or round trip failed\n");
+    free(zxy);
+    free(hashes);
+    return 1;
+  }
+
+  if (back.count != TILES - 1 || back.hash_count != 38) {
+    fprintf(stderr, "manifest: %zu tiles, %zu hashes\n", back.count,
+            back.hash_count);
+    failed = 1;
+  }
+  // the hashes dominate, the rest is about three bytes a tile
+  if (buf.len > 8 + 38 * 16 + (TILES - 1) * 3) {
+    fprintf(stderr, "manifest: %zu bytes\n", buf.len);
+    failed = 1;
+  }
+  for (uint32_t i = 0; i + 1 < TILES && !failed; i++) {
+    const uint8_t *h =
+        tile_manifest_find(&back, 11, zxy[i * 3 + 1], zxy[i * 3 + 2]);
+    const uint8_t *want = hashes + (i == TILES - 2 ? TILES - 1 : i) * 16;
+    if (!h || memcmp(h, want, 16) != 0) {
+      fprintf(stderr, "manifest: tile %u has the wrong hash\n", i);
+      failed = 1;
+    }
+  }
+  if (tile_manifest_find(&back, 11, 999, 500) ||
+      tile_manifest_find(&back, 10, 1000, 500) ||
+      tile_manifest_find(&back, 40, 0, 0)) {
+    fprintf(stderr, "manifest: found a missing tile\n");
+    failed = 1;
+  }
+
+  // every truncation is rejected
+  for (size_t len = 0; len < buf.len && !failed; len += 1 + len / 8) {
+    tile_manifest_t bad;
+    if (tile_manifest_decode(&bad, buf.data, len)) {
+      fprintf(stderr, "manifest: accepted %zu of %zu bytes\n", len, buf.len);
+      tile_manifest_free(&bad);
+      failed = 1;
+    }
+  }
+
+  uint32_t outside[3] = {2, 4, 0};
+  tile_manifest_t bad;
+  if (tile_manifest_build(&bad, outside, hashes, 1)) {
+    fprintf(stderr, "manifest: accepted a tile outside its level\n");
+    tile_manifest_free(&bad);
+    failed = 1;
+  }
+
+  tile_manifest_free(&m);
+  tile_manifest_free(&back);
+  tile_buf_free(&buf);
+  free(zxy);
+  free(hashes);
+  return failed;
+}
+
+int main(void) {
+  int failed = 0;
+  failed |= check_hash128();
+  failed |= check_round_trip();
+
+  printf("tile_manifest: %s\n", failed ? "FAILED" : "ok");
+  return failed;
+}
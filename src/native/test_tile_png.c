@@ -0,0 +1,211 @@
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "palette.h"
+#include "tile_png.h"
+
+static uint8_t *read_file(const char *path, size_t *len) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    fprintf(stderr, "Failed to open: %s\n", path);
+    return NULL;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  uint8_t *data = malloc(size);
+  if (data && fread(data, 1, size, f) != (size_t)size) {
+    free(data);
+    data = NULL;
+  }
+  fclose(f);
+  *len = (size_t)size;
+  return data;
+}
+
+// decodes the file with tile_png and stb_image and compares the RGBA output
+static int check_decode(const char *path) {
+  size_t len;
+  uint8_t *png = read_file(path, &len);
+  if (!png)
+    return 1;
+
+  int sw, sh, sc;
+  uint8_t *expected = stbi_load_from_memory(png, (int)len, &sw, &sh, &sc, 4);
+  if (!expected) {
+    fprintf(stderr, "stb_image failed to decode: %s\n", path);
+    free(png);
+    return 1;
+  }
+
+  size_t size = (size_t)sw * sh * 4;
+  uint8_t *out = malloc(size);
+  uint32_t w = 0, h = 0;
+  int failed = 0;
+
+  if (!tile_png_decode_rgba(png, len, out, size, &w, &h)) {
+    fprintf(stderr, "tile_png_decode_rgba() failed: %s\n", path);
+    failed = 1;
+  } else if (w != (uint32_t)sw || h != (uint32_t)sh ||
+             memcmp(out, expected, size) != 0) {
+    fprintf(stderr, "Decoded pixels differ from stb_image: %s\n", path);
+    failed = 1;
+  } else if (tile_png_decode_rgba(png, len, out, size - 1, NULL, NULL)) {
+    fprintf(stderr, "Decoding into a too small plane succeeded: %s\n", path);
+    failed = 1;
+  } else {
+    printf("Decoded %s: %ux%u\n", path, w, h);
+  }
+
+  free(out);
+  stbi_image_free(expected);
+  free(png);
+  return failed;
+}
+
+// encodes the decoded file again and checks the round trip is lossless
+static int check_round_trip(const char *path) {
+  size_t len;
+  uint8_t *png = read_file(path, &len);
+  if (!png)
+    return 1;
+
+  png_info_t info;
+  if (!tile_png_info(png, len, &info)) {
+    free(png);
+    return 1;
+  }
+
+  size_t size = (size_t)info.width * info.height * 4;
+  uint8_t *pixels = malloc(size);
+  uint8_t *again = malloc(size);
+  uint8_t *encoded = NULL;
+  size_t encoded_len = 0;
+  int failed = 1;
+
+  if (tile_png_decode_rgba(png, len, pixels, size, NULL, NULL) &&
+      tile_png_encode_rgba(pixels, info.width, info.height,
+                           (size_t)info.width * 4, 6, &encoded,
+                           &encoded_len) &&
+      tile_png_decode_rgba(encoded, encoded_len, again, size, NULL, NULL) &&
+      memcmp(pixels, again, size) == 0) {
+    printf("Round trip %s: %zu bytes\n", path, encoded_len);
+    failed = 0;
+  } else {
+    fprintf(stderr, "Round trip failed: %s\n", path);
+  }
+
+  free(encoded);
+  free(again);
+  free(pixels);
+  free(png);
+  return failed;
+}
+
+// palette indices -> indexed PNG -> RGBA must give the palette colours back
+static int check_indexed_round_trip(const char *path,
+                                    tile_png_effort_t effort) {
+  size_t len;
+  uint8_t *png = read_file(path, &len);
+  if (!png)
+    return 1;
+
+  png_info_t info;
+  if (!tile_png_info(png, len, &info)) {
+    free(png);
+    return 1;
+  }
+
+  size_t count = (size_t)info.width * info.height;
+  uint8_t *pixels = malloc(count * 4);
+  uint8_t *expected = malloc(count * 4);
+  uint8_t *indices = malloc(count);
+  uint8_t *encoded = NULL;
+  size_t encoded_len = 0;
+  int failed = 1;
+
+  if (tile_png_decode_rgba(png, len, pixels, count * 4, NULL, NULL)) {
+    palette_rgba_to_indices(pixels, count, indices);
+    palette_indices_to_rgba(indices, count, expected);
+    if (tile_png_encode_indexed(indices, info.width, info.height, info.width,
+                                wplace_palette, PALETTE_SIZE, 6, effort,
+                                &encoded, &encoded_len) &&
+        tile_png_decode_rgba(encoded, encoded_len, pixels, count * 4, NULL,
+                             NULL) &&
+        memcmp(pixels, expected, count * 4) == 0) {
+      printf("Indexed round trip %s (%s): %zu bytes\n", path,
+             effort == TILE_PNG_MAX ? "max" : "fast", encoded_len);
+      failed = 0;
+    }
+  }
+  if (failed)
+    fprintf(stderr, "Indexed round trip failed: %s\n", path);
+
+  free(encoded);
+  free(indices);
+  free(expected);
+  free(pixels);
+  free(png);
+  return failed;
+}
+
+// the AVX2 filter selection must produce the same bytes as the scalar one
+static int check_simd_matches_scalar(const char *path) {
+  size_t len;
+  uint8_t *png = read_file(path, &len);
+  if (!png)
+    return 1;
+
+  png_info_t info;
+  if (!tile_png_info(png, len, &info)) {
+    free(png);
+    return 1;
+  }
+
+  size_t size = (size_t)info.width * info.height * 4;
+  uint8_t *pixels = malloc(size);
+  uint8_t *scalar = NULL, *simd = NULL;
+  size_t scalar_len = 0, simd_len = 0;
+  int failed = 1;
+
+  if (tile_png_decode_rgba(png, len, pixels, size, NULL, NULL)) {
+    tile_png_set_simd(false);
+    bool ok = tile_png_encode_rgba(pixels, info.width, info.height,
+                                   (size_t)info.width * 4, 6, &scalar,
+                                   &scalar_len);
+    tile_png_set_simd(true);
+    ok = ok && tile_png_encode_rgba(pixels, info.width, info.height,
+                                    (size_t)info.width * 4, 6, &simd,
+                                    &simd_len);
+    failed = !ok || scalar_len != simd_len ||
+             memcmp(scalar, simd, scalar_len) != 0;
+  }
+  if (failed)
+    fprintf(stderr, "SIMD encode differs from scalar: %s\n", path);
+
+  free(simd);
+  free(scalar);
+  free(pixels);
+  free(png);
+  return failed;
+}
+
+int main(void) {
+  int failed = 0;
+  failed |= check_decode("../pumpkin/pumpkin.png");
+  failed |= check_decode("../pumpkin/search.png");
+  failed |= check_decode("../../public/favicon.png");
+  failed |= check_round_trip("../pumpkin/search.png");
+  failed |= check_round_trip("../../public/favicon.png");
+  failed |= check_indexed_round_trip("../pumpkin/pumpkin.png", TILE_PNG_FAST);
+  failed |= check_indexed_round_trip("../pumpkin/search.png", TILE_PNG_FAST);
+  failed |= check_indexed_round_trip("../pumpkin/search.png", TILE_PNG_MAX);
+  failed |= check_simd_matches_scalar("../pumpkin/search.png");
+  failed |= check_simd_matches_scalar("../../public/favicon.png");
+  return failed;
+}
@@ -0,0 +1,139 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tile_reduce.h"
+
+static const char *mode_names[] = {"nearest", "box", "premul"};
+
+// xorshift, deterministic across platforms
+static uint32_t rng_state = 2463534242u;
+static uint32_t rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+// the SIMD kernels must produce exactly the scalar result, including the
+// columns left over at the end of a row
+static int check_simd_matches_scalar(uint32_t w, uint32_t h) {
+  size_t size = (size_t)w * h * 4;
+  size_t out_size = (size_t)(w / 2) * (h / 2) * 4;
+  uint8_t *src = malloc(size);
+  uint8_t *scalar = malloc(out_size);
+  uint8_t *simd = malloc(out_size);
+  int failed = 0;
+
+  for (size_t i = 0; i < size; i++) {
+    src[i] = (uint8_t)rng();
+    // plenty of fully transparent and fully opaque pixels
+    if (i % 4 == 3 && src[i] < 64)
+      src[i] = 0;
+    else if (i % 4 == 3 && src[i] > 192)
+      src[i] = 255;
+  }
+
+  for (int m = TILE_REDUCE_NEAREST; m <= TILE_REDUCE_BOX_PREMUL; m++) {
+    tile_reduce_set_simd(false);
+    tile_reduce_rgba(src, w, h, (size_t)w * 4, scalar, (size_t)(w / 2) * 4, m);
+    tile_reduce_set_simd(true);
+    tile_reduce_rgba(src, w, h, (size_t)w * 4, simd, (size_t)(w / 2) * 4, m);
+
+    if (memcmp(scalar, simd, out_size) != 0) {
+      fprintf(stderr, "%s: SIMD result differs from scalar (%ux%u)\n",
+              mode_names[m], w, h);
+      failed = 1;
+    }
+  }
+
+  // palette indices from a handful of colours, so blocks tie and repeat
+  for (size_t i = 0; i < (size_t)w * h; i++)
+    src[i] = rng() % 3 ? (uint8_t)(rng() % 4) : (uint8_t)(rng() % 64);
+  tile_reduce_set_simd(false);
+  tile_reduce_indices(src, w, h, w, scalar, w / 2);
+  tile_reduce_set_simd(true);
+  tile_reduce_indices(src, w, h, w, simd, w / 2);
+  if (memcmp(scalar, simd, (size_t)(w / 2) * (h / 2)) != 0) {
+    fprintf(stderr, "mode: SIMD result differs from scalar (%ux%u)\n", w, h);
+    failed = 1;
+  }
+
+  free(src);
+  free(scalar);
+  free(simd);
+  return failed;
+}
+
+static int check_values(void) {
+  // 2x2 image: opaque red, transparent, transparent, half transparent blue
+  const uint8_t src[16] = {255, 0, 0, 255, 0, 0, 0, 0,
+                           0,   0, 0, 0,   0, 0, 255, 128};
+  const uint8_t expected[3][4] = {
+      {255, 0, 0, 255},  // nearest: top left
+      {64, 0, 64, 96},   // box: plain channel average
+      {170, 0, 85, 96},  // premul: colour weighted by alpha
+  };
+  int failed = 0;
+
+  for (int m = TILE_REDUCE_NEAREST; m <= TILE_REDUCE_BOX_PREMUL; m++) {
+    uint8_t out[4];
+    tile_reduce_rgba(src, 2, 2, 8, out, 4, m);
+    if (memcmp(out, expected[m], 4) != 0) {
+      fprintf(stderr, "%s: got %u,%u,%u,%u\n", mode_names[m], out[0], out[1],
+              out[2], out[3]);
+      failed = 1;
+    }
+  }
+  return failed;
+}
+
+static int check_mode_filter(void) {
+  // one 2x2 block per case, top left, top right, bottom left, bottom right
+  static const uint8_t blocks[][5] = {
+      {5, 5, 7, 7, 5},  // tie: earliest pixel wins
+      {0, 7, 7, 9, 7},  // majority
+      {0, 0, 0, 9, 0},  // three transparent pixels
+      {0, 0, 9, 12, 9}, // two transparent pixels keep the stroke
+      {3, 3, 3, 3, 3},
+  };
+  int failed = 0;
+
+  for (size_t i = 0; i < sizeof(blocks) / sizeof(blocks[0]); i++) {
+    uint8_t out;
+    tile_reduce_indices(blocks[i], 2, 2, 2, &out, 1);
+    if (out != blocks[i][4]) {
+      fprintf(stderr, "mode: block %zu got %u, expected %u\n", i, out,
+              blocks[i][4]);
+      failed = 1;
+    }
+  }
+  return failed;
+}
+
+static int check_sum(void) {
+  // 4x2 counts into the right half of a 4x1 row, the last block saturating
+  const uint32_t src[8] = {1, 2, 7, UINT32_MAX - 5, 3, 4, 0, 9};
+  uint32_t out[4] = {11, 11, 11, 11};
+  tile_reduce_sum_u32(src, 4, 2, 4, out + 2, 4);
+  if (out[0] != 11 || out[1] != 11 || out[2] != 10 || out[3] != UINT32_MAX) {
+    fprintf(stderr, "sum: got %u,%u,%u,%u\n", out[0], out[1], out[2],
+            out[3]);
+    return 1;
+  }
+  return 0;
+}
+
+int main(void) {
+  int failed = check_values();
+  failed |= check_mode_filter();
+  failed |= check_sum();
+  failed |= check_simd_matches_scalar(1000, 1000);
+  failed |= check_simd_matches_scalar(38, 6);
+
+  tile_reduce_set_simd(true);
+  printf("tile_reduce: %s (%s kernels)\n", failed ? "FAILED" : "ok",
+         tile_reduce_simd_active() ? "avx2" : "scalar");
+  return failed;
+}
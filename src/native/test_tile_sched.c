@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "tile_sched.h"
+
+#define W 4
+#define H 3
+
+// Three sweeps over a 4x3 grid, then the order the next one visits in.
+static int check_order(void) {
+  tile_stat_t stats[W * H];
+  memset(stats, 0, sizeof(stats));
+  for (uint32_t i = 0; i < 3; i++) {
+    sched_record(&stats[0 * W + 0], 7, 0, false);       // static, empty
+    sched_record(&stats[2 * W + 3], 100 + i, 0, false); // changes each time
+    sched_record(&stats[0 * W + 2], 9, 255, false);     // static, dense
+    sched_record(&stats[2 * W + 0], 11, 0, i == 1);     // matched once
+  }
+
+  uint32_t order[W * H];
+  if (!sched_build_order(stats, W, H, order))
+    return 1;
+  // the match, the active tile, the dense one, the neighbours of the match
+  // in row-major order, the existing static tile, then the rest in
+  // row-major order
+  static const uint32_t want[W * H] = {8, 11, 2, 4, 5, 9, 0, 1, 3, 6, 7, 10};
+  if (memcmp(order, want, sizeof(want)) != 0) {
+    fprintf(stderr, "sched: order");
+    for (uint32_t i = 0; i < W * H; i++)
+      fprintf(stderr, " %u", order[i]);
+    fprintf(stderr, "\n");
+    return 1;
+  }
+  return 0;
+}
+
+// A tile that keeps changing outranks a dense static one, and its changes
+// decay once it stops.
+static int check_decay(void) {
+  tile_stat_t active = {0}, dense = {0};
+  for (uint32_t i = 0; i < 20; i++) {
+    sched_record(&active, 1 + i, 0, false);
+    sched_record(&dense, 1, 255, false);
+  }
+  int failed = active.changes != 255 || dense.changes != 0 ||
+               active.sweeps != 20 ||
+               sched_score(&active, 1, 1, 0, 0) <=
+                   sched_score(&dense, 1, 1, 0, 0);
+  // quarters rounded down stop at 3
+  for (uint32_t i = 0; i < 20; i++)
+    sched_record(&active, 1, 0, false);
+  failed |= active.changes > 3;
+  if (failed)
+    fprintf(stderr, "sched: changes %u after going quiet\n", active.changes);
+  return failed;
+}
+
+static int check_signals(void) {
+  uint8_t rgba[100 * 4];
+  memset(rgba, 0, sizeof(rgba));
+  int failed = sched_density(rgba, 10, 10) != 0;
+  // one painted pixel is never empty
+  rgba[3] = 255;
+  failed |= sched_density(rgba, 10, 10) != 3;
+  memset(rgba, 255, sizeof(rgba));
+  failed |= sched_density(rgba, 10, 10) != 255;
+  // 0 means the tile was 404
+  failed |= sched_hash(NULL, 0) == 0 ||
+            sched_hash((const uint8_t *)"png", 3) ==
+                sched_hash((const uint8_t *)"pnh", 3);
+  if (failed)
+    fprintf(stderr, "sched: density or hash wrong\n");
+  return failed;
+}
+
+int main(void) {
+  int failed = check_order() | check_decay() | check_signals();
+  printf("tile_sched: %s\n", failed ? "FAILED" : "ok");
+  return failed;
+}
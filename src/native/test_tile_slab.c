@@ -0,0 +1,68 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "tile_slab.h"
+
+// Planes are aligned, allocated only when every existing one is borrowed and
+// recycled after that.
+static int check_pool(void) {
+  tile_slab_t s = {0};
+  if (!tile_slab_init(&s, 1000, 3))
+    return 1;
+  int failed = s.plane_size != 1024 || s.allocated != 0;
+
+  int32_t a = tile_slab_borrow(&s), b = tile_slab_borrow(&s);
+  failed |= a != 0 || b != 1 || s.allocated != 2 || s.in_use != 2;
+  for (int32_t p = 0; p < 2 && !failed; p++) {
+    uint8_t *plane = tile_slab_plane(&s, (uint32_t)p);
+    failed |= !plane || (uintptr_t)plane % TILE_SLAB_ALIGN != 0;
+    if (plane)
+      memset(plane, p + 1, s.plane_size);
+  }
+
+  // a returned plane is borrowed again before a new one is allocated
+  failed |= !tile_slab_return(&s, (uint32_t)a);
+  uint8_t *before = tile_slab_plane(&s, 0);
+  failed |= tile_slab_borrow(&s) != 0 || s.allocated != 2 ||
+            tile_slab_plane(&s, 0) != before;
+  failed |= tile_slab_plane(&s, 1)[s.plane_size - 1] != 2;
+
+  // up to max_planes, then borrowing fails until one comes back
+  failed |= tile_slab_borrow(&s) != 2 || tile_slab_borrow(&s) != -1;
+  failed |= s.allocated != 3 || s.in_use != 3 || s.high_water != 3;
+  failed |= !tile_slab_return(&s, 1) || tile_slab_borrow(&s) != 1;
+  failed |= !tile_slab_return(&s, 0) || !tile_slab_return(&s, 1) ||
+            !tile_slab_return(&s, 2);
+  failed |= s.in_use != 0 || s.high_water != 3 || s.free_count != 3;
+  if (failed)
+    fprintf(stderr, "slab: %u allocated, %u in use, %u at most\n",
+            s.allocated, s.in_use, s.high_water);
+  tile_slab_destroy(&s);
+  return failed;
+}
+
+// Planes never allocated and returns with nothing borrowed are refused.
+static int check_bounds(void) {
+  tile_slab_t s = {0};
+  int failed = tile_slab_init(&s, 0, 2) || tile_slab_init(&s, 64, 0);
+  if (!tile_slab_init(&s, 64, 2))
+    return 1;
+  failed |= tile_slab_plane(&s, 0) != NULL || tile_slab_return(&s, 0);
+  int32_t p = tile_slab_borrow(&s);
+  failed |= p != 0 || tile_slab_return(&s, 1) ||
+            !tile_slab_return(&s, 0) || tile_slab_return(&s, 0);
+  // init again frees the planes and starts over
+  failed |= !tile_slab_init(&s, 64, 4) || s.allocated != 0 ||
+            s.high_water != 0;
+  if (failed)
+    fprintf(stderr, "slab: bounds not checked\n");
+  tile_slab_destroy(&s);
+  return failed;
+}
+
+int main(void) {
+  int failed = check_pool() | check_bounds();
+  printf("tile_slab: %s\n", failed ? "FAILED" : "ok");
+  return failed;
+}
@@ -0,0 +1,162 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "tile_io.h"
+#include "tile_untar.h"
+
+static void tar_header(tile_buf_t *b, const char *name, char type,
+                       size_t size, const char *link) {
+  tile_buf_reserve(b, b->len + 512);
+  char *h = (char *)b->data + b->len;
+  memset(h, 0, 512);
+  strncpy(h, name, 100);
+  snprintf(h + 124, 12, "%011o", (unsigned)size);
+  h[156] = type;
+  if (link)
+    strncpy(h + 157, link, 100);
+  memcpy(h + 257, "ustar", 6);
+  b->len += 512;
+}
+
+static void tar_file(tile_buf_t *b, const char *name, const char *data) {
+  size_t len = strlen(data), padded = (len + 511) / 512 * 512;
+  tar_header(b, name, '0', len, NULL);
+  tile_buf_reserve(b, b->len + padded);
+  memset(b->data + b->len, 0, padded);
+  memcpy(b->data + b->len, data, len);
+  b->len += padded;
+}
+
+static void tar_end(tile_buf_t *b) {
+  tile_buf_reserve(b, b->len + 1024);
+  memset(b->data + b->len, 0, 1024);
+  b->len += 1024;
+}
+
+// gzip member of data[from, to) appended to out
+static void gzip_member(const tile_buf_t *in, size_t from, size_t to,
+                        tile_buf_t *out) {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  deflateInit2(&zs, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+  size_t bound = deflateBound(&zs, (uLong)(to - from));
+  tile_buf_reserve(out, out->len + bound);
+  zs.next_in = in->data + from;
+  zs.avail_in = (uInt)(to - from);
+  zs.next_out = out->data + out->len;
+  zs.avail_out = (uInt)bound;
+  deflate(&zs, Z_FINISH);
+  out->len += zs.total_out;
+  deflateEnd(&zs);
+}
+
+static int expect_file(const char *dir, const char *name, const char *want) {
+  char path[512];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  tile_buf_t b = {0};
+  bool ok = tile_io_read(path, &b) && b.len == strlen(want) &&
+            memcmp(b.data, want, b.len) == 0;
+  tile_buf_free(&b);
+  if (!ok)
+    fprintf(stderr, "tile_untar: %s not extracted\n", name);
+  return !ok;
+}
+
+static int check_extract(const char *dir) {
+  tile_buf_t tar = {0}, gz = {0};
+  tar_header(&tar, "./rel/", '5', 0, NULL);
+  tar_file(&tar, "./rel/1/2.png", "tile one two");
+  tar_file(&tar, "rel/1/3.png", "tile one three");
+  tar_header(&tar, "rel/4/2.png", '1', 0, "./rel/1/2.png");
+  size_t split = tar.len; // second gzip member from here on
+  tar_file(&tar, "../escape.png", "outside");
+  tar_header(&tar, "rel/link", '2', 0, "/etc/passwd");
+  for (int i = 0; i < 2000; i++) {
+    char name[64], data[64];
+    snprintf(name, sizeof(name), "rel/many/%d.png", i);
+    snprintf(data, sizeof(data), "tile %d", i);
+    tar_file(&tar, name, data);
+  }
+  tar_end(&tar);
+  gzip_member(&tar, 0, split, &gz);
+  gzip_member(&tar, split, tar.len, &gz);
+
+  tile_untar_t *u = tile_untar_create(dir, true, 4);
+  if (!u)
+    return 1;
+  // odd sized chunks, so headers and data straddle pushes
+  bool ok = true;
+  for (size_t off = 0, step = 1; ok && off < gz.len; off += step, step += 37) {
+    size_t n = gz.len - off < step ? gz.len - off : step;
+    ok = tile_untar_push(u, gz.data + off, n);
+  }
+  tile_untar_stats_t stats;
+  ok = tile_untar_finish(u, &stats) && ok;
+  tile_untar_destroy(u);
+
+  int failed = !ok;
+  if (stats.files != 2002 || stats.links != 1 || stats.dirs != 1 ||
+      stats.skipped != 2) {
+    fprintf(stderr,
+            "tile_untar: %llu files, %llu links, %llu dirs, %llu skipped\n",
+            (unsigned long long)stats.files, (unsigned long long)stats.links,
+            (unsigned long long)stats.dirs, (unsigned long long)stats.skipped);
+    failed = 1;
+  }
+  failed |= expect_file(dir, "rel/1/2.png", "tile one two");
+  failed |= expect_file(dir, "rel/1/3.png", "tile one three");
+  failed |= expect_file(dir, "rel/4/2.png", "tile one two");
+  failed |= expect_file(dir, "rel/many/1999.png", "tile 1999");
+
+  char escape[512];
+  snprintf(escape, sizeof(escape), "%s/../escape.png", dir);
+  if (tile_io_exists(escape)) {
+    fprintf(stderr, "tile_untar: wrote outside the output directory\n");
+    remove(escape);
+    failed = 1;
+  }
+
+  // a truncated archive is reported
+  u = tile_untar_create(dir, true, 2);
+  tile_untar_push(u, gz.data, gz.len / 2);
+  if (tile_untar_finish(u, NULL)) {
+    fprintf(stderr, "tile_untar: truncated archive not detected\n");
+    failed = 1;
+  }
+  tile_untar_destroy(u);
+
+  // an aborted one takes no more and never finishes
+  u = tile_untar_create(dir, true, 2);
+  tile_untar_push(u, gz.data, gz.len / 2);
+  tile_untar_abort(u);
+  if (tile_untar_push(u, gz.data + gz.len / 2, gz.len - gz.len / 2) ||
+      tile_untar_finish(u, NULL)) {
+    fprintf(stderr, "tile_untar: aborted extraction went on\n");
+    failed = 1;
+  }
+  tile_untar_destroy(u);
+
+  tile_buf_free(&tar);
+  tile_buf_free(&gz);
+  return failed;
+}
+
+int main(void) {
+  char dir[] = "/tmp/test_tile_untar_XXXXXX";
+  if (!mkdtemp(dir))
+    return 1;
+  int failed = check_extract(dir);
+
+  char cmd[128];
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+  if (system(cmd) != 0)
+    failed = 1;
+
+  printf("tile_untar: %s\n", failed ? "FAILED" : "ok");
+  return failed;
+}
@@ -0,0 +1,71 @@
+#define _DEFAULT_SOURCE
+#include "thread_pool.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct {
+  thread_pool_fn fn;
+  void *ctx;
+  size_t count;
+  atomic_size_t next;
+} pool_job_t;
+
+typedef struct {
+  pool_job_t *job;
+  uint32_t thread;
+} pool_worker_t;
+
+uint32_t thread_pool_default_threads(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (uint32_t)n : 1;
+}
+
+static void *pool_worker(void *arg) {
+  pool_worker_t *w = arg;
+  pool_job_t *job = w->job;
+  size_t item;
+  while ((item = atomic_fetch_add(&job->next, 1)) < job->count)
+    job->fn(job->ctx, item, w->thread);
+  return NULL;
+}
+
+bool thread_pool_for(uint32_t threads, size_t count, thread_pool_fn fn,
+                     void *ctx) {
+  if (!fn)
+    return false;
+  if (threads == 0)
+    threads = 1;
+  if (threads > count)
+    threads = count ? (uint32_t)count : 1;
+
+  pool_job_t job = {.fn = fn, .ctx = ctx, .count = count};
+  atomic_init(&job.next, 0);
+
+  pthread_t *ids = malloc(sizeof(pthread_t) * threads);
+  pool_worker_t *workers = malloc(sizeof(pool_worker_t) * threads);
+  if (!ids || !workers) {
+    free(ids);
+    free(workers);
+    return false;
+  }
+
+  // the calling thread is worker 0
+  uint32_t started = 1;
+  for (uint32_t i = 0; i < threads; i++)
+    workers[i] = (pool_worker_t){.job = &job, .thread = i};
+  for (; started < threads; started++) {
+    if (pthread_create(&ids[started], NULL, pool_worker, &workers[started]))
+      break;
+  }
+
+  pool_worker(&workers[0]);
+
+  for (uint32_t i = 1; i < started; i++)
+    pthread_join(ids[i], NULL);
+
+  free(ids);
+  free(workers);
+  return true;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Called once per item, thread is 0..threads-1 and identifies per-thread
+// scratch state such as a tile slab.
+typedef void (*thread_pool_fn)(void *ctx, size_t item, uint32_t thread);
+
+uint32_t thread_pool_default_threads(void);
+
+// Runs fn for every item in [0, count) on `threads` threads and returns once
+// all items are done. Items are handed out in order through an atomic
+// counter, so neighbouring items usually run at about the same time.
+bool thread_pool_for(uint32_t threads, size_t count, thread_pool_fn fn,
+                     void *ctx);
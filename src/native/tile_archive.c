@@ -0,0 +1,355 @@
+#define _DEFAULT_SOURCE
+#include "tile_archive.h"
+#include "tar_stream.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define INDEX_MAGIC "WPTIDX01"
+
+typedef struct {
+  char magic[8];
+  uint64_t archive_size;
+  int64_t archive_mtime;
+  uint64_t count;
+} index_header_t;
+
+// a hard link entry, resolved once all regular entries are known
+typedef struct {
+  uint32_t z, x, y;
+  uint32_t tz, tx, ty;
+} tar_link_t;
+
+static int compare_entries(const void *pa, const void *pb) {
+  const tile_archive_entry_t *a = pa, *b = pb;
+  if (a->z != b->z)
+    return a->z < b->z ? -1 : 1;
+  if (a->x != b->x)
+    return a->x < b->x ? -1 : 1;
+  if (a->y != b->y)
+    return a->y < b->y ? -1 : 1;
+  if (a->offset != b->offset)
+    return a->offset < b->offset ? -1 : 1;
+  return 0;
+}
+
+static const tile_archive_entry_t *lookup(const tile_archive_entry_t *e,
+                                          size_t n, uint32_t z, uint32_t x,
+                                          uint32_t y) {
+  size_t lo = 0, hi = n;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    const tile_archive_entry_t *m = &e[mid];
+    if (m->z < z || (m->z == z && (m->x < x || (m->x == x && m->y < y))))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo < n && e[lo].z == z && e[lo].x == x && e[lo].y == y ? &e[lo]
+                                                                 : NULL;
+}
+
+static bool grow(void **items, size_t *cap, size_t need, size_t size) {
+  if (need <= *cap)
+    return true;
+  size_t next = *cap ? *cap * 2 : 1024;
+  void *p = realloc(*items, next * size);
+  if (!p)
+    return false;
+  *items = p;
+  *cap = next;
+  return true;
+}
+
+static bool parse_number(const char *s, const char *end, uint32_t *out) {
+  if (s == end || end - s > 9)
+    return false;
+  uint32_t v = 0;
+  for (; s < end; s++) {
+    if (*s < '0' || *s > '9')
+      return false;
+    v = v * 10 + (uint32_t)(*s - '0');
+  }
+  *out = v;
+  return true;
+}
+
+// start of the path component ending at end
+static const char *component(const char *name, const char *end) {
+  const char *s = end;
+  while (s > name && s[-1] != '/')
+    s--;
+  return s;
+}
+
+static bool parse_tile_name(const char *name, uint32_t default_z, uint32_t *z,
+                            uint32_t *x, uint32_t *y) {
+  size_t len = strlen(name);
+  if (len < 5 || memcmp(name + len - 4, ".png", 4) != 0)
+    return false;
+
+  const char *y_end = name + len - 4, *y_start = component(name, y_end);
+  if (y_start == name || !parse_number(y_start, y_end, y))
+    return false;
+  const char *x_end = y_start - 1, *x_start = component(name, x_end);
+  if (!parse_number(x_start, x_end, x))
+    return false;
+  *z = default_z;
+  if (x_start > name) {
+    const char *z_end = x_start - 1;
+    parse_number(component(name, z_end), z_end, z);
+  }
+  return *z < 32 && *x >> *z == 0 && *y >> *z == 0;
+}
+
+static bool build_index(tile_archive_t *a, uint32_t default_z) {
+  tile_archive_entry_t *entries = NULL;
+  tar_link_t *links = NULL;
+  size_t count = 0, cap = 0, link_count = 0, link_cap = 0;
+  char name[TAR_NAME_MAX], link_name[TAR_NAME_MAX];
+  char long_name[TAR_NAME_MAX] = "", long_link[TAR_NAME_MAX] = "";
+  bool ok = true;
+
+  for (uint64_t off = 0; ok && off + TAR_BLOCK <= a->size;) {
+    const uint8_t *h = a->base + off;
+    if (h[0] == 0)
+      break; // end of archive
+    uint64_t size = tar_header_size(h), data = off + TAR_BLOCK;
+    if (size > a->size - data) {
+      ok = false;
+      break;
+    }
+    off = data + (size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+
+    char type = (char)h[156];
+    if (type == 'L' || type == 'K') { // GNU long names
+      char *dst = type == 'L' ? long_name : long_link;
+      size_t n = size < TAR_NAME_MAX ? strnlen((const char *)a->base + data,
+                                               (size_t)size)
+                                     : 0;
+      memcpy(dst, a->base + data, n);
+      dst[n] = '\0';
+      continue;
+    }
+    if (type == 'x') {
+      tar_parse_pax(a->base + data, size, long_name, long_link);
+      continue;
+    }
+
+    tar_header_names(h, long_name, long_link, name, link_name);
+    long_name[0] = long_link[0] = '\0';
+
+    uint32_t z, x, y;
+    if ((type != '0' && type != '\0' && type != '7' && type != '1') ||
+        !parse_tile_name(name, default_z, &z, &x, &y))
+      continue;
+
+    if (type == '1') {
+      tar_link_t l = {.z = z, .x = x, .y = y};
+      if (parse_tile_name(link_name, default_z, &l.tz, &l.tx, &l.ty)) {
+        ok = grow((void **)&links, &link_cap, link_count + 1, sizeof(l));
+        if (ok)
+          links[link_count++] = l;
+      }
+    } else if (size <= UINT32_MAX) {
+      ok = grow((void **)&entries, &cap, count + 1, sizeof(*entries));
+      if (ok)
+        entries[count++] = (tile_archive_entry_t){
+            .z = z, .x = x, .y = y, .length = (uint32_t)size, .offset = data};
+    }
+  }
+
+  if (ok) {
+    qsort(entries, count, sizeof(*entries), compare_entries);
+    // a tile appended again later replaces the earlier one, as with tar -x
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+      if (kept && entries[kept - 1].z == entries[i].z &&
+          entries[kept - 1].x == entries[i].x &&
+          entries[kept - 1].y == entries[i].y)
+        kept--;
+      entries[kept++] = entries[i];
+    }
+    count = kept;
+
+    size_t regular = count;
+    for (size_t i = 0; ok && i < link_count; i++) {
+      const tar_link_t *l = &links[i];
+      const tile_archive_entry_t *t =
+          lookup(entries, regular, l->tz, l->tx, l->ty);
+      if (!t || lookup(entries, regular, l->z, l->x, l->y))
+        continue;
+      tile_archive_entry_t e = *t;
+      ok = grow((void **)&entries, &cap, count + 1, sizeof(*entries));
+      if (ok) {
+        e.z = l->z;
+        e.x = l->x;
+        e.y = l->y;
+        entries[count++] = e;
+      }
+    }
+    qsort(entries, count, sizeof(*entries), compare_entries);
+  }
+
+  free(links);
+  if (!ok) {
+    free(entries);
+    return false;
+  }
+  a->built = entries;
+  a->entries = entries;
+  a->count = count;
+  return true;
+}
+
+static bool index_path(char *out, size_t size, const char *path) {
+  int n = snprintf(out, size, "%s.idx", path);
+  return n > 0 && (size_t)n < size;
+}
+
+static bool load_index(tile_archive_t *a, const char *path,
+                       const struct stat *st) {
+  char idx[4096];
+  if (!index_path(idx, sizeof(idx), path))
+    return false;
+  int fd = open(idx, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  struct stat ist;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &ist) == 0 && (size_t)ist.st_size >= sizeof(index_header_t))
+    map = mmap(NULL, (size_t)ist.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return false;
+
+  const index_header_t *h = map;
+  size_t size = (size_t)ist.st_size;
+  if (memcmp(h->magic, INDEX_MAGIC, 8) != 0 ||
+      h->archive_size != (uint64_t)st->st_size ||
+      h->archive_mtime != (int64_t)st->st_mtime ||
+      h->count > (size - sizeof(*h)) / sizeof(tile_archive_entry_t) ||
+      size != sizeof(*h) + h->count * sizeof(tile_archive_entry_t)) {
+    munmap(map, size);
+    return false;
+  }
+  a->index_map = map;
+  a->index_size = size;
+  a->entries = (const tile_archive_entry_t *)(h + 1);
+  a->count = h->count;
+  return true;
+}
+
+static bool write_index(const tile_archive_t *a, const char *path,
+                        const struct stat *st) {
+  char idx[4096], tmp[4200];
+  if (!index_path(idx, sizeof(idx), path))
+    return false;
+  snprintf(tmp, sizeof(tmp), "%s.tmp", idx);
+
+  index_header_t h = {.archive_size = (uint64_t)st->st_size,
+                      .archive_mtime = (int64_t)st->st_mtime,
+                      .count = a->count};
+  memcpy(h.magic, INDEX_MAGIC, 8);
+  FILE *f = fopen(tmp, "wb");
+  if (!f)
+    return false;
+  bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+            fwrite(a->entries, sizeof(*a->entries), a->count, f) == a->count;
+  ok = fclose(f) == 0 && ok;
+  ok = ok && rename(tmp, idx) == 0;
+  if (!ok)
+    remove(tmp);
+  return ok;
+}
+
+bool tile_archive_open(tile_archive_t *a, const char *path,
+                       uint32_t default_z) {
+  memset(a, 0, sizeof(*a));
+  a->reader.fd = -1;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return false;
+  }
+
+  // Read-only, so the mapping is backed by the page cache alone and does not
+  // count against the commit limit however large the archive is.
+  void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return false;
+  a->base = map;
+  a->size = (size_t)st.st_size;
+
+  bool ok;
+  if (a->size >= PMTILES_HEADER_SIZE && memcmp(a->base, "PMTiles", 7) == 0) {
+    a->pmtiles = true;
+    ok = pmtiles_open(&a->reader, path);
+  } else {
+    // the index is a cache, failing to store it only costs the next open
+    ok = load_index(a, path, &st) || build_index(a, default_z);
+    a->index_unsaved = ok && a->built && !write_index(a, path, &st);
+  }
+  if (!ok) {
+    tile_archive_close(a);
+    return false;
+  }
+  madvise((void *)a->base, a->size, MADV_RANDOM);
+  return true;
+}
+
+void tile_archive_close(tile_archive_t *a) {
+  if (a->base)
+    munmap((void *)a->base, a->size);
+  if (a->index_map)
+    munmap(a->index_map, a->index_size);
+  if (a->pmtiles)
+    pmtiles_close(&a->reader);
+  free(a->built);
+  memset(a, 0, sizeof(*a));
+  a->reader.fd = -1;
+}
+
+bool tile_archive_find(const tile_archive_t *a, uint32_t z, uint32_t x,
+                       uint32_t y, const uint8_t **data, size_t *len) {
+  uint64_t offset;
+  uint32_t length;
+  if (a->pmtiles) {
+    if (!pmtiles_find(&a->reader, z, x, y, &offset, &length))
+      return false;
+  } else {
+    const tile_archive_entry_t *e = lookup(a->entries, a->count, z, x, y);
+    if (!e)
+      return false;
+    offset = e->offset;
+    length = e->length;
+  }
+  if (offset > a->size || length > a->size - offset)
+    return false;
+  *data = a->base + offset;
+  *len = length;
+  return true;
+}
+
+size_t tile_archive_scan_level(const tile_archive_t *a, uint32_t z,
+                               uint8_t *occupied) {
+  if (a->pmtiles)
+    return pmtiles_scan_level(&a->reader, z, occupied);
+  size_t found = 0;
+  for (size_t i = 0; i < a->count; i++) {
+    const tile_archive_entry_t *e = &a->entries[i];
+    if (e->z == z && e->x >> z == 0 && e->y >> z == 0) {
+      occupied[((size_t)e->y << z) + e->x] = 1;
+      found++;
+    }
+  }
+  return found;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tile_pmtiles.h"
+
+// Random access to the tiles of a release without extracting it. The archive
+// is mapped into memory and tiles are returned as pointers into the mapping.
+//
+// An uncompressed tar is indexed once by walking its headers. The index is
+// kept next to the archive in <path>.idx and reused as long as the archive
+// has the same size and mtime. A PMTiles archive brings its own directory.
+
+typedef struct {
+  uint32_t z, x, y;
+  uint32_t length;
+  uint64_t offset;
+} tile_archive_entry_t;
+
+typedef struct {
+  const uint8_t *base; // the archive, mapped read-only
+  size_t size;
+  bool pmtiles;
+  pmtiles_reader_t reader;
+  const tile_archive_entry_t *entries; // sorted by z, x, y
+  size_t count;
+  void *index_map; // <path>.idx when loaded from disk
+  size_t index_size;
+  tile_archive_entry_t *built; // the index when built by this open
+  bool index_unsaved; // built, but <path>.idx could not be written
+} tile_archive_t;
+
+// Tar entries named .../<z>/<x>/<y>.png are indexed at z, entries named
+// <dir>/<x>/<y>.png, as in the releases, at default_z.
+bool tile_archive_open(tile_archive_t *a, const char *path, uint32_t default_z);
+void tile_archive_close(tile_archive_t *a);
+
+// Points data at the bytes of a tile inside the mapping. Returns false if
+// the archive has no such tile.
+bool tile_archive_find(const tile_archive_t *a, uint32_t z, uint32_t x,
+                       uint32_t y, const uint8_t **data, size_t *len);
+
+// Marks occupied[y * 2^z + x] for every tile of level z, like
+// tile_io_scan_level for an extracted release. Returns the number of tiles.
+size_t tile_archive_scan_level(const tile_archive_t *a, uint32_t z,
+                               uint8_t *occupied);
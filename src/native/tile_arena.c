@@ -0,0 +1,57 @@
+#include "tile_arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+void tile_arena_destroy(tile_arena_t *a) {
+  if (!a)
+    return;
+  free(a->base);
+  free(a->free_slots);
+  memset(a, 0, sizeof(*a));
+}
+
+bool tile_arena_init(tile_arena_t *a, uint32_t slot_count, size_t slot_size) {
+  if (!a || slot_count == 0 || slot_size == 0)
+    return false;
+
+  tile_arena_destroy(a);
+
+  slot_size = (slot_size + TILE_ARENA_ALIGN - 1) &
+              ~(size_t)(TILE_ARENA_ALIGN - 1);
+
+  a->base = aligned_alloc(TILE_ARENA_ALIGN, slot_size * slot_count);
+  a->free_slots = malloc(sizeof(uint32_t) * slot_count);
+  if (!a->base || !a->free_slots) {
+    tile_arena_destroy(a);
+    return false;
+  }
+
+  a->slot_size = slot_size;
+  a->slot_count = slot_count;
+
+  // hand out low slots first, they are the ones most likely still cached
+  for (uint32_t i = 0; i < slot_count; i++)
+    a->free_slots[i] = slot_count - 1 - i;
+  a->free_count = slot_count;
+
+  return true;
+}
+
+int32_t tile_arena_acquire(tile_arena_t *a) {
+  if (!a || a->free_count == 0)
+    return -1;
+  return (int32_t)a->free_slots[--a->free_count];
+}
+
+bool tile_arena_release(tile_arena_t *a, uint32_t slot) {
+  if (!a || slot >= a->slot_count || a->free_count >= a->slot_count)
+    return false;
+  a->free_slots[a->free_count++] = slot;
+  return true;
+}
+
+uint8_t *tile_arena_slot(const tile_arena_t *a, uint32_t slot) {
+  if (!a || !a->base || slot >= a->slot_count)
+    return NULL;
+  return a->base + (size_t)slot * a->slot_size;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TILE_ARENA_ALIGN 64
+
+// Fixed pool of equally sized, cache line aligned slots carved out of one
+// allocation. Compressed tile bodies are streamed into a slot and decoded
+// from it in place, so a tile never needs a fresh heap buffer.
+typedef struct {
+  uint8_t *base;
+  size_t slot_size; // rounded up to TILE_ARENA_ALIGN
+  uint32_t slot_count;
+  uint32_t *free_slots; // stack of free slot indices
+  uint32_t free_count;
+} tile_arena_t;
+
+bool tile_arena_init(tile_arena_t *a, uint32_t slot_count, size_t slot_size);
+void tile_arena_destroy(tile_arena_t *a);
+int32_t tile_arena_acquire(tile_arena_t *a);
+bool tile_arena_release(tile_arena_t *a, uint32_t slot);
+uint8_t *tile_arena_slot(const tile_arena_t *a, uint32_t slot);
@@ -0,0 +1,149 @@
+#include "tile_cache.h"
+#include <stdlib.h>
+#include <string.h>
+
+// fixed per entry cost counted against the limit besides the body
+#define ENTRY_OVERHEAD (sizeof(tile_cache_entry_t) + sizeof(void *))
+
+static size_t bucket_of(const tile_cache_t *c, uint64_t key) {
+  key ^= key >> 33;
+  key *= 0xFF51AFD7ED558CCDull;
+  key ^= key >> 33;
+  return (size_t)key & (c->bucket_count - 1);
+}
+
+bool tile_cache_init(tile_cache_t *c, size_t limit) {
+  memset(c, 0, sizeof(*c));
+  c->limit = limit;
+  c->bucket_count = 1024;
+  c->buckets = calloc(c->bucket_count, sizeof(*c->buckets));
+  return c->buckets != NULL;
+}
+
+void tile_cache_free(tile_cache_t *c) {
+  for (tile_cache_entry_t *e = c->head, *next; e; e = next) {
+    next = e->next;
+    free(e);
+  }
+  free(c->buckets);
+  memset(c, 0, sizeof(*c));
+}
+
+static void unlink_lru(tile_cache_t *c, tile_cache_entry_t *e) {
+  if (e->prev)
+    e->prev->next = e->next;
+  else
+    c->head = e->next;
+  if (e->next)
+    e->next->prev = e->prev;
+  else
+    c->tail = e->prev;
+  e->prev = e->next = NULL;
+}
+
+static void push_front(tile_cache_t *c, tile_cache_entry_t *e) {
+  e->prev = NULL;
+  e->next = c->head;
+  if (c->head)
+    c->head->prev = e;
+  else
+    c->tail = e;
+  c->head = e;
+}
+
+// Takes e out of the table and the list, freeing it unless pinned.
+static void drop(tile_cache_t *c, tile_cache_entry_t *e) {
+  tile_cache_entry_t **at = &c->buckets[bucket_of(c, e->key)];
+  while (*at != e)
+    at = &(*at)->chain;
+  *at = e->chain;
+  unlink_lru(c, e);
+  c->count--;
+  c->bytes -= e->len + ENTRY_OVERHEAD;
+  e->cached = false;
+  if (!e->pins)
+    free(e);
+}
+
+// Doubles the buckets once there is more than one entry per bucket, or
+// keeps the old ones if that fails.
+static void grow(tile_cache_t *c) {
+  size_t count = c->bucket_count * 2;
+  tile_cache_entry_t **buckets = calloc(count, sizeof(*buckets));
+  if (!buckets)
+    return;
+  tile_cache_entry_t **old = c->buckets;
+  size_t old_count = c->bucket_count;
+  c->buckets = buckets;
+  c->bucket_count = count;
+  for (size_t i = 0; i < old_count; i++) {
+    for (tile_cache_entry_t *e = old[i], *next; e; e = next) {
+      next = e->chain;
+      size_t b = bucket_of(c, e->key);
+      e->chain = buckets[b];
+      buckets[b] = e;
+    }
+  }
+  free(old);
+}
+
+tile_cache_entry_t *tile_cache_get(tile_cache_t *c, uint64_t key) {
+  for (tile_cache_entry_t *e = c->buckets[bucket_of(c, key)]; e;
+       e = e->chain) {
+    if (e->key != key)
+      continue;
+    if (c->head != e) {
+      unlink_lru(c, e);
+      push_front(c, e);
+    }
+    e->pins++;
+    c->hits++;
+    return e;
+  }
+  c->misses++;
+  return NULL;
+}
+
+tile_cache_entry_t *tile_cache_put(tile_cache_t *c, uint64_t key,
+                                   const uint8_t *data, size_t len) {
+  tile_cache_entry_t *e = malloc(sizeof(*e) + len);
+  if (!e)
+    return NULL;
+  memset(e, 0, sizeof(*e));
+  e->key = key;
+  e->pins = 1;
+  e->len = len;
+  if (len)
+    memcpy(e->data, data, len);
+
+  for (tile_cache_entry_t *old = c->buckets[bucket_of(c, key)]; old;
+       old = old->chain) {
+    if (old->key == key) {
+      drop(c, old);
+      break;
+    }
+  }
+  if (len + ENTRY_OVERHEAD > c->limit)
+    return e;
+  while (c->tail && c->bytes + len + ENTRY_OVERHEAD > c->limit) {
+    drop(c, c->tail);
+    c->evictions++;
+  }
+  if (c->count >= c->bucket_count)
+    grow(c);
+  size_t b = bucket_of(c, key);
+  e->chain = c->buckets[b];
+  c->buckets[b] = e;
+  e->cached = true;
+  push_front(c, e);
+  c->count++;
+  c->bytes += len + ENTRY_OVERHEAD;
+  return e;
+}
+
+void tile_cache_pin(tile_cache_entry_t *e) { e->pins++; }
+
+void tile_cache_unpin(tile_cache_entry_t *e) {
+  if (--e->pins == 0 && !e->cached)
+    free(e);
+}
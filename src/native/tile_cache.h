@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Byte bounded LRU cache of tile bodies for the tile server. Entries are
+// handed out pinned, so a response still being written keeps its body alive
+// after the entry was evicted; the memory of evicted entries is released
+// with the last pin. Not thread safe: threads sharing a cache hold one lock
+// around every call, pinning and unpinning included.
+typedef struct tile_cache_entry {
+  uint64_t key;
+  uint32_t pins;
+  bool cached;                          // still in the table
+  struct tile_cache_entry *prev, *next; // most recently used first
+  struct tile_cache_entry *chain;       // next in the bucket
+  size_t len;
+  uint8_t data[];
+} tile_cache_entry_t;
+
+typedef struct {
+  tile_cache_entry_t **buckets;
+  size_t bucket_count; // power of two
+  tile_cache_entry_t *head, *tail;
+  size_t count, bytes, limit;
+  uint64_t hits, misses, evictions;
+} tile_cache_t;
+
+bool tile_cache_init(tile_cache_t *c, size_t limit);
+void tile_cache_free(tile_cache_t *c);
+
+// The pinned entry for key, NULL on a miss.
+tile_cache_entry_t *tile_cache_get(tile_cache_t *c, uint64_t key);
+
+// Copies len bytes in as the entry for key, replacing any older one, and
+// evicts the least recently used entries beyond the limit. Returns the new
+// entry pinned, or NULL without memory. An entry larger than the whole
+// cache is returned but not kept.
+tile_cache_entry_t *tile_cache_put(tile_cache_t *c, uint64_t key,
+                                   const uint8_t *data, size_t len);
+
+void tile_cache_pin(tile_cache_entry_t *e);
+void tile_cache_unpin(tile_cache_entry_t *e);
@@ -0,0 +1,266 @@
+#include "tile_delta.h"
+#include <string.h>
+
+static void put_varint(tile_buf_t *b, uint64_t v) {
+  do {
+    uint8_t byte = v & 0x7F;
+    v >>= 7;
+    b->data[b->len++] = byte | (v ? 0x80 : 0);
+  } while (v);
+}
+
+static bool get_varint(const uint8_t **p, const uint8_t *end, uint64_t *v) {
+  *v = 0;
+  for (int shift = 0; shift < 64 && *p < end; shift += 7) {
+    uint8_t byte = *(*p)++;
+    *v |= (uint64_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+static uint32_t row_changes(const uint8_t *a, const uint8_t *b,
+                            uint32_t size) {
+  uint32_t n = 0;
+  if (memcmp(a, b, size) == 0)
+    return 0;
+  for (uint32_t x = 0; x < size; x++)
+    n += a[x] != b[x];
+  return n;
+}
+
+bool tile_delta_encode(const uint8_t *before, const uint8_t *after,
+                       uint32_t size, tile_buf_t *out, uint32_t *changed) {
+  if (size == 0 || size > 0xFFFF)
+    return false;
+
+  // rows with changes and the total, to size the buffer once
+  uint32_t rows = 0, total = 0;
+  for (uint32_t y = 0; y < size; y++) {
+    uint32_t n = row_changes(before + (size_t)y * size,
+                             after + (size_t)y * size, size);
+    rows += n != 0;
+    total += n;
+  }
+  *changed = total;
+  if (!tile_buf_reserve(out, out->len + 5 + (size_t)rows * 10 +
+                                 (size_t)total * 3))
+    return false;
+
+  put_varint(out, rows);
+  uint32_t next = 0;
+  for (uint32_t y = 0; y < size && rows; y++) {
+    uint32_t n = row_changes(before + (size_t)y * size,
+                             after + (size_t)y * size, size);
+    if (!n)
+      continue;
+    put_varint(out, y - next);
+    put_varint(out, n);
+    next = y + 1;
+  }
+
+  uint8_t *cols = out->data + out->len, *indices = cols + (size_t)total * 2;
+  for (size_t i = 0, y = 0; y < size && i < total; y++) {
+    const uint8_t *a = before + y * size, *b = after + y * size;
+    if (memcmp(a, b, size) == 0)
+      continue;
+    for (uint32_t x = 0; x < size; x++) {
+      if (a[x] == b[x])
+        continue;
+      cols[i * 2] = x & 0xFF;
+      cols[i * 2 + 1] = x >> 8;
+      indices[i++] = b[x];
+    }
+  }
+  out->len += (size_t)total * 3;
+  return true;
+}
+
+typedef struct {
+  const uint8_t *rows; // the row headers, after the row count
+  uint64_t row_count;
+  uint64_t total;
+  const uint8_t *cols, *indices;
+} patch_t;
+
+// Walks the row headers once for the total number of changes, and with it
+// where the columns start.
+static bool parse(const uint8_t *patch, size_t len, uint32_t size,
+                  patch_t *p) {
+  const uint8_t *at = patch, *end = patch + len;
+  uint64_t y = 0;
+  if (!get_varint(&at, end, &p->row_count) || p->row_count > size)
+    return false;
+  p->rows = at;
+  p->total = 0;
+  for (uint64_t r = 0; r < p->row_count; r++) {
+    uint64_t delta, n;
+    if (!get_varint(&at, end, &delta) || !get_varint(&at, end, &n) ||
+        n == 0 || n > size)
+      return false;
+    y += delta + 1;
+    if (y > size)
+      return false;
+    p->total += n;
+  }
+  if ((size_t)(end - at) != p->total * 3)
+    return false;
+  p->cols = at;
+  p->indices = at + p->total * 2;
+  return true;
+}
+
+static uint32_t col_at(const patch_t *p, uint64_t i) {
+  return p->cols[i * 2] | (uint32_t)p->cols[i * 2 + 1] << 8;
+}
+
+bool tile_delta_apply(const uint8_t *patch, size_t len, uint32_t size,
+                      uint8_t *plane) {
+  patch_t p;
+  if (!parse(patch, len, size, &p))
+    return false;
+  const uint8_t *at = p.rows, *end = p.cols;
+  uint64_t i = 0, next = 0;
+  for (uint64_t r = 0; r < p.row_count; r++) {
+    uint64_t delta, n;
+    get_varint(&at, end, &delta);
+    get_varint(&at, end, &n);
+    uint8_t *row = plane + (next + delta) * size;
+    next += delta + 1;
+    for (uint64_t k = i + n; i < k; i++) {
+      uint32_t x = col_at(&p, i);
+      if (x >= size)
+        return false;
+      row[x] = p.indices[i];
+    }
+  }
+  return true;
+}
+
+int tile_delta_lookup(const uint8_t *patch, size_t len, uint32_t size,
+                      uint32_t x, uint32_t y) {
+  patch_t p;
+  if (!parse(patch, len, size, &p))
+    return -2;
+  const uint8_t *at = p.rows, *end = p.cols;
+  uint64_t before = 0, next = 0;
+  for (uint64_t r = 0; r < p.row_count; r++) {
+    uint64_t delta, n;
+    get_varint(&at, end, &delta);
+    get_varint(&at, end, &n);
+    uint64_t row = next + delta;
+    next = row + 1;
+    if (row > y)
+      return -1;
+    if (row < y) {
+      before += n;
+      continue;
+    }
+    // the columns of a row ascend
+    uint64_t lo = before, hi = before + n;
+    while (lo < hi) {
+      uint64_t mid = lo + (hi - lo) / 2;
+      uint32_t col = col_at(&p, mid);
+      if (col == x)
+        return p.indices[mid];
+      if (col < x)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    return -1;
+  }
+  return -1;
+}
+
+bool tile_delta_count_cells(const uint8_t *patch, size_t len, uint32_t size,
+                            uint32_t cell, uint32_t *counts) {
+  patch_t p;
+  if (!cell || size % cell || !parse(patch, len, size, &p))
+    return false;
+  uint32_t grid = size / cell;
+  const uint8_t *at = p.rows, *end = p.cols;
+  uint64_t i = 0, next = 0;
+  for (uint64_t r = 0; r < p.row_count; r++) {
+    uint64_t delta, n;
+    get_varint(&at, end, &delta);
+    get_varint(&at, end, &n);
+    uint32_t *row = counts + (size_t)((next + delta) / cell) * grid;
+    next += delta + 1;
+    for (uint64_t k = i + n; i < k; i++) {
+      uint32_t x = col_at(&p, i);
+      if (x >= size)
+        return false;
+      row[x / cell]++;
+    }
+  }
+  return true;
+}
+
+uint32_t tile_delta_hash(const uint8_t *plane, size_t pixels) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < pixels; i++)
+    h = (h ^ plane[i]) * 16777619u;
+  return h;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+  for (int i = 0; i < 4; i++)
+    p[i] = (uint8_t)(v >> (i * 8));
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+  return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+bool tile_delta_tile_encode(const uint8_t *before, const uint8_t *after,
+                            uint32_t size, tile_buf_t *out,
+                            uint32_t *changed) {
+  if (size == 0 || size > 0xFFFF ||
+      !tile_buf_reserve(out, out->len + TILE_DELTA_TILE_HEADER))
+    return false;
+  size_t at = out->len;
+  uint8_t *h = out->data + at;
+  memset(h, 0, TILE_DELTA_TILE_HEADER);
+  memcpy(h, "WPDT", 4);
+  h[4] = 1;
+  h[6] = size & 0xFF;
+  h[7] = (uint8_t)(size >> 8);
+  out->len += TILE_DELTA_TILE_HEADER;
+
+  size_t pixels = (size_t)size * size;
+  if (memcmp(before, after, pixels) == 0) {
+    out->data[at + 5] = TILE_DELTA_UNCHANGED;
+    *changed = 0;
+    return true;
+  }
+  if (!tile_delta_encode(before, after, size, out, changed)) {
+    out->len = at;
+    return false;
+  }
+  // the patch may have moved the buffer
+  put_u32(out->data + at + 8, tile_delta_hash(before, pixels));
+  put_u32(out->data + at + 12, tile_delta_hash(after, pixels));
+  return true;
+}
+
+bool tile_delta_tile_apply(const uint8_t *tile, size_t len, uint32_t size,
+                           uint8_t *plane) {
+  if (len < TILE_DELTA_TILE_HEADER || memcmp(tile, "WPDT", 4) != 0 ||
+      tile[4] != 1 || (tile[6] | (uint32_t)tile[7] << 8) != size)
+    return false;
+  if (tile[5] & TILE_DELTA_UNCHANGED)
+    return len == TILE_DELTA_TILE_HEADER;
+
+  size_t pixels = (size_t)size * size;
+  const uint8_t *patch = tile + TILE_DELTA_TILE_HEADER;
+  size_t patch_len = len - TILE_DELTA_TILE_HEADER;
+  patch_t p;
+  if (!parse(patch, patch_len, size, &p) ||
+      tile_delta_hash(plane, pixels) != get_u32(tile + 8) ||
+      !tile_delta_apply(patch, patch_len, size, plane))
+    return false;
+  return tile_delta_hash(plane, pixels) == get_u32(tile + 12);
+}
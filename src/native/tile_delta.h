@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tile_io.h"
+
+// Patch of the pixels that changed between two palette planes of a
+// size x size tile, stored column by column:
+//   varint number of rows with changes,
+//   per such row a varint row delta (from the previous such row + 1, or 0)
+//   and a varint number of changes,
+//   the column of every change, u16 little endian, ascending per row,
+//   the palette index of every change, one byte each.
+// The columns being fixed width, one pixel is found without decoding the
+// rest of the patch.
+
+// Appends the patch turning before into after to out and sets changed to the
+// number of pixels in it. Tiles up to 65535 pixels wide.
+bool tile_delta_encode(const uint8_t *before, const uint8_t *after,
+                       uint32_t size, tile_buf_t *out, uint32_t *changed);
+
+// Applies a patch to plane in place, false if it is corrupt.
+bool tile_delta_apply(const uint8_t *patch, size_t len, uint32_t size,
+                      uint8_t *plane);
+
+// The palette index the patch gives pixel x,y, -1 if it leaves the pixel
+// alone and -2 if the patch is corrupt.
+int tile_delta_lookup(const uint8_t *patch, size_t len, uint32_t size,
+                      uint32_t x, uint32_t y);
+
+// Adds one to counts[(y / cell) * (size / cell) + x / cell] for every pixel
+// x,y the patch changes, false if it is corrupt. cell divides size.
+bool tile_delta_count_cells(const uint8_t *patch, size_t len, uint32_t size,
+                            uint32_t cell, uint32_t *counts);
+
+// Delta tile: the patch of one z/x/y from one release to the next, as served
+// to viewers that already hold the tile of the earlier release:
+//   "WPDT", u8 version 1, u8 flags, u16 tile size,
+//   u32 hash of the plane the patch applies to,
+//   u32 hash of the plane it yields,
+//   the patch.
+// All little endian. A tile that did not change is only the header, with
+// TILE_DELTA_UNCHANGED set and both hashes 0, so it is the same bytes for
+// every such tile of a size. A missing tile is a transparent plane.
+#define TILE_DELTA_TILE_HEADER 16
+#define TILE_DELTA_UNCHANGED 1
+
+// FNV-1a of a palette plane, what delta tiles check planes with.
+uint32_t tile_delta_hash(const uint8_t *plane, size_t pixels);
+
+// Appends the delta tile turning before into after to out and sets changed
+// to the number of pixels that differ.
+bool tile_delta_tile_encode(const uint8_t *before, const uint8_t *after,
+                            uint32_t size, tile_buf_t *out,
+                            uint32_t *changed);
+
+// Applies a delta tile to plane in place. False if it is for another tile
+// size or made against a different plane, both leaving plane as it was, and
+// false if it is corrupt or the result does not hash as it should.
+bool tile_delta_tile_apply(const uint8_t *tile, size_t len, uint32_t size,
+                           uint8_t *plane);
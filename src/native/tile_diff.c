@@ -0,0 +1,105 @@
+#include "tile_diff.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TILE_DIFF_X86 1
+#endif
+
+static int g_simd = -1; // -1 = not probed yet
+
+void tile_diff_set_simd(bool enabled) {
+#ifdef TILE_DIFF_X86
+  g_simd = enabled && __builtin_cpu_supports("avx2");
+#else
+  (void)enabled;
+  g_simd = 0;
+#endif
+}
+
+bool tile_diff_simd_active(void) {
+  if (g_simd < 0)
+    tile_diff_set_simd(true);
+  return g_simd == 1;
+}
+
+// Changed pixels of one row from column from on. first and last are the
+// outermost changed columns, first stays -1 while there is none.
+typedef struct {
+  uint32_t changed;
+  int64_t first, last;
+} row_diff_t;
+
+static void diff_row(const uint8_t *a, const uint8_t *b, uint8_t *mask,
+                     uint32_t from, uint32_t width, row_diff_t *r) {
+  for (uint32_t x = from; x < width; x++) {
+    bool changed = a[x] != b[x];
+    if (mask)
+      mask[x] = changed;
+    if (changed) {
+      r->changed++;
+      if (r->first < 0)
+        r->first = x;
+      r->last = x;
+    }
+  }
+}
+
+#ifdef TILE_DIFF_X86
+
+// 32 pixels per step, most steps of an unchanged area end after the compare
+__attribute__((target("avx2"))) static uint32_t
+diff_row_avx2(const uint8_t *a, const uint8_t *b, uint8_t *mask,
+              uint32_t width, row_diff_t *r) {
+  const __m256i one = _mm256_set1_epi8(1);
+  uint32_t x = 0;
+  for (; x + 32 <= width; x += 32) {
+    __m256i eq =
+        _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(a + x)),
+                          _mm256_loadu_si256((const __m256i *)(b + x)));
+    uint32_t bits = ~(uint32_t)_mm256_movemask_epi8(eq);
+    if (mask)
+      _mm256_storeu_si256((__m256i *)(mask + x), _mm256_andnot_si256(eq, one));
+    if (bits) {
+      r->changed += (uint32_t)__builtin_popcount(bits);
+      if (r->first < 0)
+        r->first = x + (uint32_t)__builtin_ctz(bits);
+      r->last = x + 31 - (uint32_t)__builtin_clz(bits);
+    }
+  }
+  return x;
+}
+
+#endif
+
+void tile_diff_planes(const uint8_t *a, const uint8_t *b, uint32_t width,
+                      uint32_t height, size_t stride, uint8_t *mask,
+                      tile_diff_t *out) {
+  bool simd = tile_diff_simd_active();
+  *out = (tile_diff_t){0};
+  for (uint32_t y = 0; y < height; y++) {
+    const uint8_t *ra = a + y * stride, *rb = b + y * stride;
+    uint8_t *rm = mask ? mask + y * stride : NULL;
+    row_diff_t r = {0, -1, -1};
+    uint32_t done = 0;
+#ifdef TILE_DIFF_X86
+    if (simd)
+      done = diff_row_avx2(ra, rb, rm, width, &r);
+#endif
+    diff_row(ra, rb, rm, done, width, &r);
+    if (!r.changed)
+      continue;
+
+    if (!out->changed) {
+      out->min_y = y;
+      out->min_x = (uint32_t)r.first;
+      out->max_x = (uint32_t)r.last;
+    }
+    if ((uint32_t)r.first < out->min_x)
+      out->min_x = (uint32_t)r.first;
+    if ((uint32_t)r.last > out->max_x)
+      out->max_x = (uint32_t)r.last;
+    out->max_y = y;
+    out->changed += r.changed;
+  }
+  (void)simd;
+}
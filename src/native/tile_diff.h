@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// What changed in a tile between two releases, compared on palette indices
+// so that encoder differences do not count.
+typedef struct {
+  uint32_t changed; // pixels with a different index
+  // inclusive bounding box of the changed pixels, only valid if changed
+  uint32_t min_x, min_y, max_x, max_y;
+} tile_diff_t;
+
+// Compares two width x height planes of palette indices, rows stride bytes
+// apart. mask, if not NULL and laid out the same, gets 1 for every changed
+// pixel and 0 for every other.
+void tile_diff_planes(const uint8_t *a, const uint8_t *b, uint32_t width,
+                      uint32_t height, size_t stride, uint8_t *mask,
+                      tile_diff_t *out);
+
+// Uses the AVX2 kernel when the CPU has it, can be turned off to compare
+// against the scalar code.
+void tile_diff_set_simd(bool enabled);
+bool tile_diff_simd_active(void);
@@ -0,0 +1,153 @@
+#include "tile_hash.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define P1 0x9E3779B185EBCA87ull
+#define P2 0xC2B2AE3D27D4EB4Full
+#define P3 0x165667B19E3779F9ull
+#define P4 0x85EBCA77C2B2AE63ull
+#define P5 0x27D4EB2F165667C5ull
+
+static uint64_t rotl(uint64_t v, int r) { return (v << r) | (v >> (64 - r)); }
+
+// little endian reads, whatever the host byte order
+static uint64_t read_u64(const uint8_t *p) {
+  uint64_t v = 0;
+  for (int i = 7; i >= 0; i--)
+    v = v << 8 | p[i];
+  return v;
+}
+
+static uint32_t read_u32(const uint8_t *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+static uint64_t round64(uint64_t acc, uint64_t input) {
+  acc += input * P2;
+  return rotl(acc, 31) * P1;
+}
+
+static uint64_t merge(uint64_t acc, uint64_t v) {
+  acc ^= round64(0, v);
+  return acc * P1 + P4;
+}
+
+uint64_t tile_hash64(const void *data, size_t len, uint64_t seed) {
+  const uint8_t *p = data, *end = p + len;
+  uint64_t h;
+
+  if (len >= 32) {
+    uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+    for (; p + 32 <= end; p += 32) {
+      v1 = round64(v1, read_u64(p));
+      v2 = round64(v2, read_u64(p + 8));
+      v3 = round64(v3, read_u64(p + 16));
+      v4 = round64(v4, read_u64(p + 24));
+    }
+    h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    h = merge(h, v1);
+    h = merge(h, v2);
+    h = merge(h, v3);
+    h = merge(h, v4);
+  } else {
+    h = seed + P5;
+  }
+  h += (uint64_t)len;
+
+  for (; p + 8 <= end; p += 8)
+    h = rotl(h ^ round64(0, read_u64(p)), 27) * P1 + P4;
+  if (p + 4 <= end) {
+    h = rotl(h ^ (uint64_t)read_u32(p) * P1, 23) * P2 + P3;
+    p += 4;
+  }
+  for (; p < end; p++)
+    h = rotl(h ^ *p * P5, 11) * P1;
+
+  h ^= h >> 33;
+  h *= P2;
+  h ^= h >> 29;
+  h *= P3;
+  h ^= h >> 32;
+  return h;
+}
+
+void tile_hash128(const void *data, size_t len, uint8_t out[16]) {
+  uint64_t hi = tile_hash64(data, len, 0), lo = tile_hash64(data, len, P1);
+  for (int i = 0; i < 8; i++) {
+    out[i] = (uint8_t)(hi >> (56 - i * 8));
+    out[8 + i] = (uint8_t)(lo >> (56 - i * 8));
+  }
+}
+
+bool tile_hash_set_init(tile_hash_set_t *s) {
+  memset(s, 0, sizeof(*s));
+  s->capacity = 1024;
+  s->entries = calloc(s->capacity, sizeof(tile_hash_entry_t));
+  if (!s->entries)
+    return false;
+  pthread_mutex_init(&s->lock, NULL);
+  return true;
+}
+
+void tile_hash_set_destroy(tile_hash_set_t *s) {
+  if (!s->entries)
+    return;
+  pthread_mutex_destroy(&s->lock);
+  free(s->entries);
+  memset(s, 0, sizeof(*s));
+}
+
+static tile_hash_entry_t *slot_for(tile_hash_entry_t *entries,
+                                   size_t capacity, uint64_t hash,
+                                   uint64_t len) {
+  size_t i = (size_t)hash & (capacity - 1);
+  while (entries[i].len && (entries[i].hash != hash || entries[i].len != len))
+    i = (i + 1) & (capacity - 1);
+  return &entries[i];
+}
+
+bool tile_hash_set_find(tile_hash_set_t *s, uint64_t hash, uint64_t len,
+                        tile_hash_entry_t *found) {
+  pthread_mutex_lock(&s->lock);
+  tile_hash_entry_t *e = slot_for(s->entries, s->capacity, hash, len);
+  bool ok = e->len != 0;
+  if (ok)
+    *found = *e;
+  pthread_mutex_unlock(&s->lock);
+  return ok;
+}
+
+// keeps the table at most half full
+static bool grow(tile_hash_set_t *s) {
+  size_t capacity = s->capacity * 2;
+  tile_hash_entry_t *entries = calloc(capacity, sizeof(tile_hash_entry_t));
+  if (!entries)
+    return false;
+  for (size_t i = 0; i < s->capacity; i++) {
+    const tile_hash_entry_t *e = &s->entries[i];
+    if (e->len)
+      *slot_for(entries, capacity, e->hash, e->len) = *e;
+  }
+  free(s->entries);
+  s->entries = entries;
+  s->capacity = capacity;
+  return true;
+}
+
+bool tile_hash_set_put(tile_hash_set_t *s, const tile_hash_entry_t *entry) {
+  if (entry->len == 0)
+    return false;
+
+  pthread_mutex_lock(&s->lock);
+  bool ok = (s->count + 1) * 2 <= s->capacity || grow(s);
+  if (ok) {
+    tile_hash_entry_t *e =
+        slot_for(s->entries, s->capacity, entry->hash, entry->len);
+    if (!e->len)
+      s->count++;
+    *e = *entry;
+  }
+  pthread_mutex_unlock(&s->lock);
+  return ok;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// XXH64 of data, identical to the reference implementation.
+uint64_t tile_hash64(const void *data, size_t len, uint64_t seed);
+
+// Content key of blobs shared by every release, where 64 bits would collide
+// somewhere among billions of tiles: XXH64 with two seeds, big endian.
+void tile_hash128(const void *data, size_t len, uint8_t out[16]);
+
+// Content hash -> first tile written with that content, shared by all
+// writer threads. The tile is known by its coordinates on disk or by its
+// offset in a packed archive.
+typedef struct {
+  uint64_t hash;
+  uint64_t len;
+  uint32_t z, x, y;
+  uint64_t offset;
+} tile_hash_entry_t;
+
+typedef struct {
+  pthread_mutex_t lock;
+  tile_hash_entry_t *entries; // open addressing, len 0 marks a free slot
+  size_t capacity;            // power of two
+  size_t count;
+} tile_hash_set_t;
+
+bool tile_hash_set_init(tile_hash_set_t *s);
+void tile_hash_set_destroy(tile_hash_set_t *s);
+
+// Copies the entry for hash and len into found and returns true if there is
+// one.
+bool tile_hash_set_find(tile_hash_set_t *s, uint64_t hash, uint64_t len,
+                        tile_hash_entry_t *found);
+
+// Adds or replaces the entry for entry->hash and entry->len.
+bool tile_hash_set_put(tile_hash_set_t *s, const tile_hash_entry_t *entry);
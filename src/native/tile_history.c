@@ -0,0 +1,612 @@
+#define _DEFAULT_SOURCE
+#include "tile_history.h"
+#include "palette.h"
+#include "tile_delta.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define MAGIC "WPHIST01"
+
+typedef struct {
+  char magic[8];
+  uint32_t tile_size;
+  uint32_t reserved;
+} header_t;
+
+typedef struct {
+  int64_t time;
+  uint32_t count;
+  uint32_t flags;
+} block_t;
+
+static bool write_all(int fd, const void *data, size_t len, uint64_t offset) {
+  const uint8_t *p = data;
+  while (len) {
+    ssize_t n = pwrite(fd, p, len, (off_t)offset);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= (size_t)n;
+    offset += (uint64_t)n;
+  }
+  return true;
+}
+
+static void unmap(tile_history_t *h) {
+  if (h->index)
+    munmap(h->index, h->index_len);
+  if (h->data)
+    munmap(h->data, h->data_len);
+  free(h->releases);
+  free(h->keyframes);
+  h->index = h->data = NULL;
+  h->index_len = h->data_len = 0;
+  h->releases = h->keyframes = NULL;
+  h->release_count = h->keyframe_count = 0;
+}
+
+static bool push_release(tile_history_release_t **list, size_t *count,
+                         tile_history_release_t r) {
+  // 64 entries at first, doubled whenever full
+  if (!*count || (*count >= 64 && !(*count & (*count - 1)))) {
+    void *grown = realloc(*list, (*count ? *count * 2 : 64) * sizeof(r));
+    if (!grown)
+      return false;
+    *list = grown;
+  }
+  (*list)[(*count)++] = r;
+  return true;
+}
+
+static bool map_file(int fd, uint8_t **map, size_t *len) {
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+    return false;
+  *len = (size_t)st.st_size;
+  if (!*len)
+    return true;
+  void *m = mmap(NULL, *len, PROT_READ, MAP_SHARED, fd, 0);
+  if (m == MAP_FAILED) {
+    *map = NULL;
+    *len = 0;
+    return false;
+  }
+  *map = m;
+  return true;
+}
+
+// Maps both files and lists the releases. A block cut short by a crash ends
+// the list and is overwritten by the next commit.
+static bool remap(tile_history_t *h) {
+  unmap(h);
+  if (!map_file(h->index_fd, &h->index, &h->index_len) ||
+      !map_file(h->data_fd, &h->data, &h->data_len) ||
+      h->index_len < sizeof(header_t))
+    return false;
+
+  for (size_t at = sizeof(header_t);
+       at + sizeof(block_t) <= h->index_len;) {
+    const block_t *b = (const block_t *)(h->index + at);
+    size_t end = at + sizeof(block_t) +
+                 (size_t)b->count * sizeof(tile_history_entry_t);
+    bool keyframe = b->flags & TILE_HISTORY_KEYFRAME;
+    // a keyframe follows its release, releases go forward in time
+    int64_t last = h->release_count
+                       ? h->releases[h->release_count - 1].time
+                       : INT64_MIN;
+    bool in_order =
+        keyframe ? h->release_count && b->time == last &&
+                       (!h->keyframe_count ||
+                        h->keyframes[h->keyframe_count - 1].time < last)
+                 : b->time > last;
+    if (end > h->index_len || !in_order)
+      break;
+    tile_history_release_t r = {
+        b->time,
+        (const tile_history_entry_t *)(h->index + at + sizeof(block_t)),
+        b->count};
+    if (!(keyframe ? push_release(&h->keyframes, &h->keyframe_count, r)
+                   : push_release(&h->releases, &h->release_count, r)))
+      return false;
+    at = end;
+  }
+  return true;
+}
+
+// Where the next block goes: after the last complete one.
+static size_t index_end(const tile_history_t *h) {
+  if (!h->release_count)
+    return sizeof(header_t);
+  const tile_history_release_t *r = &h->releases[h->release_count - 1];
+  const tile_history_release_t *k =
+      h->keyframe_count ? &h->keyframes[h->keyframe_count - 1] : NULL;
+  if (k && k->time == r->time)
+    r = k;
+  return (size_t)((const uint8_t *)(r->entries + r->count) - h->index);
+}
+
+bool tile_history_open(tile_history_t *h, const char *dir, uint32_t tile_size,
+                       bool create) {
+  char path[4096];
+  memset(h, 0, sizeof(*h));
+  h->index_fd = h->data_fd = -1;
+  int flags = O_RDWR | (create ? O_CREAT : 0);
+  if (create && mkdir(dir, 0755) != 0 && errno != EEXIST)
+    return false;
+
+  snprintf(path, sizeof(path), "%s/history.idx", dir);
+  h->index_fd = open(path, flags, 0644);
+  snprintf(path, sizeof(path), "%s/history.dat", dir);
+  h->data_fd = open(path, flags, 0644);
+  if (h->index_fd < 0 || h->data_fd < 0)
+    goto fail;
+
+  header_t header;
+  struct stat st;
+  if (fstat(h->index_fd, &st) != 0)
+    goto fail;
+  if (st.st_size == 0 && create) {
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAGIC, 8);
+    header.tile_size = tile_size;
+    if (!tile_size || !write_all(h->index_fd, &header, sizeof(header), 0))
+      goto fail;
+  } else if (pread(h->index_fd, &header, sizeof(header), 0) !=
+                 (ssize_t)sizeof(header) ||
+             memcmp(header.magic, MAGIC, 8) != 0 || header.tile_size == 0 ||
+             (tile_size && header.tile_size != tile_size)) {
+    goto fail;
+  }
+  h->tile_size = header.tile_size;
+  if (remap(h))
+    return true;
+
+fail:
+  tile_history_close(h);
+  return false;
+}
+
+void tile_history_close(tile_history_t *h) {
+  unmap(h);
+  if (h->index_fd >= 0)
+    close(h->index_fd);
+  if (h->data_fd >= 0)
+    close(h->data_fd);
+  h->index_fd = h->data_fd = -1;
+}
+
+const tile_history_entry_t *
+tile_history_find(const tile_history_release_t *r, uint32_t tile) {
+  size_t lo = 0, hi = r->count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (r->entries[mid].tile == tile)
+      return &r->entries[mid];
+    if (r->entries[mid].tile < tile)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return NULL;
+}
+
+static size_t entry_len(const tile_history_entry_t *e) {
+  return e->length & ~TILE_HISTORY_PLANE;
+}
+
+static bool in_data(const tile_history_t *h, const tile_history_entry_t *e) {
+  return e->offset <= h->data_len && entry_len(e) <= h->data_len - e->offset;
+}
+
+// Inflates a plane or keyframe entry into plane.
+static bool inflate_plane(const tile_history_t *h,
+                          const tile_history_entry_t *e, uint8_t *plane) {
+  uLongf len = (uLongf)h->tile_size * h->tile_size;
+  return in_data(h, e) &&
+         uncompress(plane, &len, h->data + e->offset, entry_len(e)) == Z_OK &&
+         len == (uLongf)h->tile_size * h->tile_size;
+}
+
+// The byte at offset of a zlib stream, inflating only up to it. -2 if the
+// stream is corrupt or shorter.
+static int inflated_byte(const uint8_t *data, size_t len, size_t offset) {
+  uint8_t buf[16384];
+  z_stream z = {.next_in = (Bytef *)data, .avail_in = (uInt)len};
+  if (inflateInit(&z) != Z_OK)
+    return -2;
+  int byte = -2, ret = Z_OK;
+  while (ret == Z_OK) {
+    z.next_out = buf;
+    z.avail_out = sizeof(buf);
+    ret = inflate(&z, Z_NO_FLUSH);
+    if (ret != Z_OK && ret != Z_STREAM_END)
+      break;
+    size_t start = z.total_out - (sizeof(buf) - z.avail_out);
+    if (z.total_out > offset) {
+      byte = buf[offset - start];
+      break;
+    }
+  }
+  inflateEnd(&z);
+  return byte;
+}
+
+size_t tile_history_pixel(const tile_history_t *h, uint32_t x, uint32_t y,
+                          uint32_t px, uint32_t py, tile_history_change_t *out,
+                          size_t max) {
+  size_t n = 0;
+  int current = PALETTE_TRANSPARENT;
+  if (x > 0xFFFF || y > 0xFFFF || px >= h->tile_size || py >= h->tile_size)
+    return 0;
+  for (size_t i = 0; i < h->release_count; i++) {
+    const tile_history_entry_t *e =
+        tile_history_find(&h->releases[i], x << 16 | y);
+    if (!e)
+      continue;
+    if (!in_data(h, e))
+      return SIZE_MAX;
+    int index = e->length & TILE_HISTORY_PLANE
+                    ? inflated_byte(h->data + e->offset, entry_len(e),
+                                    (size_t)py * h->tile_size + px)
+                    : tile_delta_lookup(h->data + e->offset, e->length,
+                                        h->tile_size, px, py);
+    if (index == -2)
+      return SIZE_MAX;
+    // a plane has every pixel, changed or not
+    if (index < 0 || index == current)
+      continue;
+    current = index;
+    if (n < max)
+      out[n] = (tile_history_change_t){h->releases[i].time, (uint8_t)index};
+    n++;
+  }
+  return n;
+}
+
+// Number of releases at or before time.
+static size_t releases_until(const tile_history_t *h, int64_t time) {
+  size_t lo = 0, hi = h->release_count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (h->releases[mid].time <= time)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// The newest keyframe of the first state releases, NULL if there is none.
+static const tile_history_release_t *keyframe_for(const tile_history_t *h,
+                                                  size_t state) {
+  if (!state)
+    return NULL;
+  int64_t time = h->releases[state - 1].time;
+  size_t lo = 0, hi = h->keyframe_count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (h->keyframes[mid].time <= time)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo ? &h->keyframes[lo - 1] : NULL;
+}
+
+// The plane of a tile at a keyframe, transparent if it was not in it.
+static bool load_keyframe(const tile_history_t *h,
+                          const tile_history_release_t *k, uint32_t tile,
+                          uint8_t *plane) {
+  const tile_history_entry_t *e = k ? tile_history_find(k, tile) : NULL;
+  if (!e) {
+    memset(plane, PALETTE_TRANSPARENT, (size_t)h->tile_size * h->tile_size);
+    return true;
+  }
+  return inflate_plane(h, e, plane);
+}
+
+// Applies the patches of releases from..to-1 to a plane of state from.
+static bool replay(const tile_history_t *h, uint32_t tile, size_t from,
+                   size_t to, uint8_t *plane) {
+  for (size_t i = from; i < to; i++) {
+    const tile_history_entry_t *e = tile_history_find(&h->releases[i], tile);
+    if (!e)
+      continue;
+    bool ok = e->length & TILE_HISTORY_PLANE
+                  ? inflate_plane(h, e, plane)
+                  : in_data(h, e) && tile_delta_apply(h->data + e->offset,
+                                                      e->length, h->tile_size,
+                                                      plane);
+    if (!ok)
+      return false;
+  }
+  return true;
+}
+
+// Rebuilds a tile after the first state releases.
+static bool plane_at(const tile_history_t *h, uint32_t tile, size_t state,
+                     uint8_t *plane) {
+  const tile_history_release_t *k = keyframe_for(h, state);
+  size_t from = k ? releases_until(h, k->time) : 0;
+  return load_keyframe(h, k, tile, plane) &&
+         replay(h, tile, from, state, plane);
+}
+
+bool tile_history_plane(const tile_history_t *h, uint32_t x, uint32_t y,
+                        int64_t time, uint8_t *plane) {
+  if (x > 0xFFFF || y > 0xFFFF)
+    return false;
+  return plane_at(h, x << 16 | y, releases_until(h, time), plane);
+}
+
+bool tile_history_count_cells(const tile_history_t *h, size_t i, uint32_t x,
+                              uint32_t y, uint32_t cell, uint32_t *counts) {
+  if (x > 0xFFFF || y > 0xFFFF || i >= h->release_count)
+    return false;
+  uint32_t tile = x << 16 | y;
+  const tile_history_entry_t *e = tile_history_find(&h->releases[i], tile);
+  if (!e)
+    return true;
+  if (!in_data(h, e))
+    return false;
+  if (!(e->length & TILE_HISTORY_PLANE))
+    return tile_delta_count_cells(h->data + e->offset, e->length,
+                                  h->tile_size, cell, counts);
+
+  // a plane only has what the tile became, the changes are what differs
+  // from the tile before
+  size_t size = h->tile_size, pixels = size * size;
+  uint8_t *before = malloc(pixels * 2), *after = before + pixels;
+  bool ok = before && plane_at(h, tile, i, before) &&
+            inflate_plane(h, e, after);
+  for (size_t p = 0; ok && p < pixels; p++)
+    counts[p / size / cell * (size / cell) + p % size / cell] +=
+        before[p] != after[p];
+  free(before);
+  return ok;
+}
+
+size_t tile_history_since_keyframe(const tile_history_t *h) {
+  const tile_history_release_t *k = keyframe_for(h, h->release_count);
+  return h->release_count - (k ? releases_until(h, k->time) : 0);
+}
+
+bool tile_history_begin(tile_history_t *h, int64_t time, bool keyframe,
+                        tile_history_batch_t *b) {
+  struct stat st;
+  memset(b, 0, sizeof(*b));
+  if (h->release_count && time <= h->releases[h->release_count - 1].time)
+    return false;
+  if (fstat(h->data_fd, &st) != 0)
+    return false;
+  b->h = h;
+  b->time = time;
+  b->keyframe = keyframe;
+  b->end = (uint64_t)st.st_size;
+  pthread_mutex_init(&b->lock, NULL);
+  return true;
+}
+
+static void fail(tile_history_batch_t *b) {
+  pthread_mutex_lock(&b->lock);
+  b->failed = true;
+  pthread_mutex_unlock(&b->lock);
+}
+
+static bool push_entry(tile_history_entry_t **list, size_t *count,
+                       size_t *cap, tile_history_entry_t e) {
+  if (*count == *cap) {
+    size_t grown_cap = *cap ? *cap * 2 : 1024;
+    void *grown = realloc(*list, grown_cap * sizeof(e));
+    if (!grown)
+      return false;
+    *list = grown;
+    *cap = grown_cap;
+  }
+  (*list)[(*count)++] = e;
+  return true;
+}
+
+// Reserves room for the bytes in scratch and an entry pointing at them, and
+// writes them outside the lock.
+static bool append(tile_history_batch_t *b, bool keyframe, uint32_t flags,
+                   uint32_t x, uint32_t y, const tile_buf_t *scratch) {
+  pthread_mutex_lock(&b->lock);
+  uint64_t offset = b->end;
+  tile_history_entry_t e = {x << 16 | y, (uint32_t)scratch->len | flags,
+                            offset};
+  bool ok = !b->failed &&
+            (keyframe ? push_entry(&b->keys, &b->key_count, &b->key_cap, e)
+                      : push_entry(&b->entries, &b->count, &b->cap, e));
+  if (ok)
+    b->end += scratch->len;
+  b->failed |= !ok;
+  pthread_mutex_unlock(&b->lock);
+
+  if (ok && !write_all(b->h->data_fd, scratch->data, scratch->len, offset)) {
+    fail(b);
+    ok = false;
+  }
+  return ok;
+}
+
+bool tile_history_add(tile_history_batch_t *b, uint32_t x, uint32_t y,
+                      const uint8_t *before, const uint8_t *after,
+                      tile_buf_t *scratch) {
+  size_t pixels = (size_t)b->h->tile_size * b->h->tile_size;
+  uint32_t changed, flags = 0;
+  scratch->len = 0;
+  if (x > 0xFFFF || y > 0xFFFF ||
+      !tile_delta_encode(before, after, b->h->tile_size, scratch, &changed)) {
+    fail(b);
+    return false;
+  }
+  if (!changed)
+    return true;
+
+  // deflate does no better than about 1032:1, below that the patch wins
+  size_t patch = scratch->len;
+  if (patch > pixels / 1032) {
+    uLongf len = compressBound(pixels);
+    if (!tile_buf_reserve(scratch, patch + len) ||
+        compress2(scratch->data + patch, &len, after, pixels, 6) != Z_OK) {
+      fail(b);
+      return false;
+    }
+    if (len < patch) {
+      memmove(scratch->data, scratch->data + patch, len);
+      scratch->len = len;
+      flags = TILE_HISTORY_PLANE;
+    }
+  }
+  return append(b, false, flags, x, y, scratch);
+}
+
+bool tile_history_add_keyframe(tile_history_batch_t *b, uint32_t x,
+                               uint32_t y, const uint8_t *plane,
+                               tile_buf_t *scratch) {
+  size_t pixels = (size_t)b->h->tile_size * b->h->tile_size;
+  uLongf len = compressBound(pixels);
+  if (!b->keyframe || x > 0xFFFF || y > 0xFFFF ||
+      !tile_buf_reserve(scratch, len) ||
+      compress2(scratch->data, &len, plane, pixels, 6) != Z_OK) {
+    fail(b);
+    return false;
+  }
+  scratch->len = len;
+  return append(b, true, 0, x, y, scratch);
+}
+
+static int cmp_entry(const void *a, const void *b) {
+  uint32_t x = ((const tile_history_entry_t *)a)->tile;
+  uint32_t y = ((const tile_history_entry_t *)b)->tile;
+  return x < y ? -1 : x > y;
+}
+
+static bool write_block(int fd, size_t *at, int64_t time, uint32_t flags,
+                        tile_history_entry_t *entries, size_t count) {
+  block_t block = {time, (uint32_t)count, flags};
+  size_t len = count * sizeof(tile_history_entry_t);
+  qsort(entries, count, sizeof(*entries), cmp_entry);
+  bool ok = write_all(fd, &block, sizeof(block), *at) &&
+            (!len || write_all(fd, entries, len, *at + sizeof(block)));
+  *at += sizeof(block) + len;
+  return ok;
+}
+
+bool tile_history_commit(tile_history_batch_t *b) {
+  tile_history_t *h = b->h;
+  if (b->failed) {
+    tile_history_abort(b);
+    return false;
+  }
+  size_t at = index_end(h);
+  bool ok =
+      fdatasync(h->data_fd) == 0 &&
+      write_block(h->index_fd, &at, b->time, 0, b->entries, b->count) &&
+      (!b->keyframe || write_block(h->index_fd, &at, b->time,
+                                   TILE_HISTORY_KEYFRAME, b->keys,
+                                   b->key_count)) &&
+      ftruncate(h->index_fd, (off_t)at) == 0 && fdatasync(h->index_fd) == 0;
+  tile_history_abort(b);
+  return remap(h) && ok;
+}
+
+void tile_history_abort(tile_history_batch_t *b) {
+  free(b->entries);
+  free(b->keys);
+  b->entries = b->keys = NULL;
+  b->count = b->cap = b->key_count = b->key_cap = 0;
+  pthread_mutex_destroy(&b->lock);
+}
+
+bool tile_history_cache_init(tile_history_cache_t *c, const tile_history_t *h,
+                             size_t capacity) {
+  memset(c, 0, sizeof(*c));
+  c->h = h;
+  c->capacity = capacity;
+  c->slots = calloc(capacity ? capacity : 1, sizeof(tile_history_slot_t));
+  if (!c->slots)
+    return false;
+  pthread_mutex_init(&c->lock, NULL);
+  return true;
+}
+
+void tile_history_cache_free(tile_history_cache_t *c) {
+  if (!c->slots)
+    return;
+  for (size_t i = 0; i < c->capacity; i++)
+    free(c->slots[i].plane);
+  free(c->slots);
+  c->slots = NULL;
+  pthread_mutex_destroy(&c->lock);
+}
+
+bool tile_history_cache_plane(tile_history_cache_t *c, uint32_t x, uint32_t y,
+                              int64_t time, uint8_t *plane) {
+  const tile_history_t *h = c->h;
+  size_t pixels = (size_t)h->tile_size * h->tile_size;
+  if (x > 0xFFFF || y > 0xFFFF)
+    return false;
+  uint32_t tile = x << 16 | y;
+  size_t state = releases_until(h, time);
+  const tile_history_release_t *k = keyframe_for(h, state);
+  size_t from = k ? releases_until(h, k->time) : 0;
+
+  // the exact state, or the latest cached one between the keyframe and it
+  pthread_mutex_lock(&c->lock);
+  tile_history_slot_t *base = NULL;
+  for (size_t i = 0; i < c->capacity; i++) {
+    tile_history_slot_t *s = &c->slots[i];
+    if (s->used && s->tile == tile && s->state >= from && s->state <= state &&
+        (!base || s->state > base->state))
+      base = s;
+  }
+  if (base) {
+    base->used = ++c->clock;
+    from = base->state;
+    memcpy(plane, base->plane, pixels);
+  }
+  if (base && from == state) {
+    c->hits++;
+    pthread_mutex_unlock(&c->lock);
+    return true;
+  }
+  c->misses++;
+  pthread_mutex_unlock(&c->lock);
+
+  if (!(base || load_keyframe(h, k, tile, plane)) ||
+      !replay(h, tile, from, state, plane))
+    return false;
+
+  // into a free slot or over the least recently used one
+  pthread_mutex_lock(&c->lock);
+  tile_history_slot_t *victim = NULL;
+  for (size_t i = 0; i < c->capacity; i++) {
+    tile_history_slot_t *s = &c->slots[i];
+    if (s->used && s->tile == tile && s->state == state) {
+      victim = NULL; // cached by another thread meanwhile
+      break;
+    }
+    if (!victim || s->used < victim->used)
+      victim = s;
+  }
+  if (victim && !victim->plane)
+    victim->plane = malloc(pixels);
+  if (victim && victim->plane) {
+    memcpy(victim->plane, plane, pixels);
+    *victim = (tile_history_slot_t){tile, (uint32_t)state, ++c->clock,
+                                    victim->plane};
+  }
+  pthread_mutex_unlock(&c->lock);
+  return true;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tile_io.h"
+
+// Pixel change history of the base tiles across releases, ingested in
+// order. Each release appends a tile_delta patch per tile that changed to
+// STORE/history.dat, then a block indexing them, sorted by tile, to
+// STORE/history.idx:
+//   header: "WPHIST01", u32 tile size, u32 reserved
+//   block:  i64 time, u32 patch count, u32 flags, the patch entries
+// Both files are mapped, so answering the history of one pixel is a binary
+// search and one patch lookup per release. A release is only visible once
+// its index block is written, after its patches are on disk.
+//
+// Every so often a release is followed by a keyframe block, flagged
+// TILE_HISTORY_KEYFRAME, holding the whole plane of each of its tiles, zlib
+// compressed. A tile is rebuilt at any time from the newest keyframe before
+// it and the patches since, so the cost of going back in time is bounded by
+// the keyframe interval.
+//
+// A patch costs 3 bytes a changed pixel, so a tile appearing, vanishing or
+// repainted wholesale is stored as its whole plane after the release
+// instead, zlib compressed like a keyframe, whenever that is smaller. Its
+// entry has TILE_HISTORY_PLANE set in the length.
+
+#define TILE_HISTORY_KEYFRAME 1
+#define TILE_HISTORY_PLANE 0x80000000u
+
+typedef struct {
+  uint32_t tile;   // x << 16 | y
+  uint32_t length; // of the patch, with TILE_HISTORY_PLANE for a plane
+  uint64_t offset; // in history.dat
+} tile_history_entry_t;
+
+typedef struct {
+  int64_t time; // ms since the epoch
+  const tile_history_entry_t *entries;
+  uint32_t count;
+} tile_history_release_t;
+
+typedef struct {
+  int index_fd, data_fd;
+  uint8_t *index, *data; // mapped
+  size_t index_len, data_len;
+  uint32_t tile_size;
+  tile_history_release_t *releases; // oldest first
+  size_t release_count;
+  tile_history_release_t *keyframes; // oldest first
+  size_t keyframe_count;
+} tile_history_t;
+
+typedef struct {
+  int64_t time;
+  uint8_t index; // palette index the pixel changed to
+} tile_history_change_t;
+
+// Opens the store in dir, creating it for tile_size tiles if create is set.
+// An existing store must have the same tile size.
+bool tile_history_open(tile_history_t *h, const char *dir, uint32_t tile_size,
+                       bool create);
+void tile_history_close(tile_history_t *h);
+
+// The changes of pixel px,py of tile x,y, oldest first, up to max of them
+// into out. Before its first change a pixel is transparent. Returns the
+// number of changes, SIZE_MAX if a patch is corrupt.
+size_t tile_history_pixel(const tile_history_t *h, uint32_t x, uint32_t y,
+                          uint32_t px, uint32_t py, tile_history_change_t *out,
+                          size_t max);
+
+// The entry of tile x << 16 | y in a release or keyframe, NULL if it has
+// none.
+const tile_history_entry_t *
+tile_history_find(const tile_history_release_t *r, uint32_t tile);
+
+// Adds one to counts[(py / cell) * (size / cell) + px / cell] for every
+// pixel px,py of tile x,y that changed at release i, like
+// tile_delta_count_cells. False if the store is corrupt.
+bool tile_history_count_cells(const tile_history_t *h, size_t i, uint32_t x,
+                              uint32_t y, uint32_t cell, uint32_t *counts);
+
+// Rebuilds the plane of tile x,y as it was at time, transparent before the
+// first release. False if the store is corrupt.
+bool tile_history_plane(const tile_history_t *h, uint32_t x, uint32_t y,
+                        int64_t time, uint8_t *plane);
+
+// Releases after the newest keyframe.
+size_t tile_history_since_keyframe(const tile_history_t *h);
+
+// Ingest of one release, adding tiles from any number of threads.
+typedef struct {
+  tile_history_t *h;
+  int64_t time;
+  bool keyframe;
+  pthread_mutex_t lock;
+  tile_history_entry_t *entries, *keys;
+  size_t count, cap, key_count, key_cap;
+  uint64_t end; // of the data written so far
+  bool failed;
+} tile_history_batch_t;
+
+// Fails unless time is after the newest release in the store. With
+// keyframe set, the release gets a keyframe and every tile of it must be
+// passed to tile_history_add_keyframe.
+bool tile_history_begin(tile_history_t *h, int64_t time, bool keyframe,
+                        tile_history_batch_t *b);
+
+// Records the pixels of tile x,y that differ between the previous release
+// and this one, as a patch or as the plane after, whichever is smaller,
+// through scratch. Tiles without changes add nothing.
+bool tile_history_add(tile_history_batch_t *b, uint32_t x, uint32_t y,
+                      const uint8_t *before, const uint8_t *after,
+                      tile_buf_t *scratch);
+bool tile_history_add_keyframe(tile_history_batch_t *b, uint32_t x,
+                               uint32_t y, const uint8_t *plane,
+                               tile_buf_t *scratch);
+
+// Makes the release visible, or drops it if any add failed.
+bool tile_history_commit(tile_history_batch_t *b);
+void tile_history_abort(tile_history_batch_t *b);
+
+// Recently rebuilt planes, shared by threads. A miss starts from the
+// closest cached earlier state of the tile when there is one since the
+// keyframe, so stepping forward through time replays one patch at a time.
+typedef struct {
+  uint32_t tile;
+  uint32_t state; // releases applied
+  uint64_t used;  // cache clock at the last hit, 0 for a free slot
+  uint8_t *plane;
+} tile_history_slot_t;
+
+typedef struct {
+  const tile_history_t *h;
+  pthread_mutex_t lock;
+  tile_history_slot_t *slots; // least recently used evicted, by scan
+  size_t capacity;
+  uint64_t clock;
+  uint64_t hits, misses;
+} tile_history_cache_t;
+
+bool tile_history_cache_init(tile_history_cache_t *c, const tile_history_t *h,
+                             size_t capacity);
+void tile_history_cache_free(tile_history_cache_t *c);
+
+// Copies the plane of tile x,y at time to plane, like tile_history_plane.
+bool tile_history_cache_plane(tile_history_cache_t *c, uint32_t x, uint32_t y,
+                              int64_t time, uint8_t *plane);
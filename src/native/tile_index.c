@@ -0,0 +1,427 @@
+#define _DEFAULT_SOURCE
+#include "tile_index.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAGIC "WPBIDX01"
+#define BUCKETS 65536
+#define MAX_LISTS 8 // rarest posting lists intersected per alignment
+
+typedef struct {
+  char magic[8];
+  uint32_t tile_size;
+  uint32_t tile_count;
+  uint64_t hash_count;
+  uint64_t table_offset;
+} header_t;
+
+static const uint64_t ONES = 0x0101010101010101ull;
+
+static void load_block(const uint8_t *p, size_t stride, uint64_t *lo,
+                       uint64_t *hi) {
+  uint32_t r[4];
+  for (int i = 0; i < 4; i++)
+    memcpy(&r[i], p + i * stride, 4);
+  *lo = (uint64_t)r[0] | (uint64_t)r[1] << 32;
+  *hi = (uint64_t)r[2] | (uint64_t)r[3] << 32;
+}
+
+// Not one colour and no transparent pixel.
+static bool informative(uint64_t lo, uint64_t hi) {
+  uint64_t zero = ((lo - ONES) & ~lo) | ((hi - ONES) & ~hi);
+  if (zero & ONES << 7)
+    return false;
+  uint64_t same = (lo & 0xFF) * ONES;
+  return lo != same || hi != same;
+}
+
+static uint32_t block_hash(uint64_t lo, uint64_t hi) {
+  uint64_t h = lo * 0x9E3779B97F4A7C15ull ^ (hi + 0x632BE59BD9B4E019ull);
+  h *= 0xBF58476D1CE4E5B9ull;
+  h ^= h >> 31;
+  h *= 0x94D049BB133111EBull;
+  return (uint32_t)(h >> 32);
+}
+
+static int cmp_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+static int cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static size_t sort_unique(uint32_t *v, size_t n) {
+  if (!n)
+    return 0;
+  qsort(v, n, sizeof(*v), cmp_u32);
+  size_t w = 1;
+  for (size_t i = 1; i < n; i++)
+    if (v[i] != v[w - 1])
+      v[w++] = v[i];
+  return w;
+}
+
+size_t tile_index_tile_hashes(const uint8_t *plane, uint32_t size,
+                              uint32_t *out) {
+  size_t n = 0;
+  for (uint32_t y = 0; y + TILE_INDEX_BLOCK <= size; y += TILE_INDEX_BLOCK)
+    for (uint32_t x = 0; x + TILE_INDEX_BLOCK <= size; x += TILE_INDEX_BLOCK) {
+      uint64_t lo, hi;
+      load_block(plane + (size_t)y * size + x, size, &lo, &hi);
+      if (informative(lo, hi))
+        out[n++] = block_hash(lo, hi);
+    }
+  return sort_unique(out, n);
+}
+
+bool tile_index_writer_init(tile_index_writer_t *w, const char *path,
+                            uint32_t tile_size) {
+  memset(w, 0, sizeof(*w));
+  w->tile_size = tile_size;
+  w->out = fopen(path, "wb");
+  if (!w->out)
+    return false;
+  char part[4096];
+  for (int i = 0; i <= TILE_INDEX_PARTS; i++) {
+    snprintf(part, sizeof(part), "%s.part%03d", path, i);
+    FILE **f = i < TILE_INDEX_PARTS ? &w->parts[i] : &w->table;
+    *f = fopen(part, "w+b");
+    // gone from the directory at once, so nothing is left behind on a crash
+    if (!*f || unlink(part) != 0) {
+      tile_index_writer_destroy(w);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool tile_index_add(tile_index_writer_t *w, uint32_t tile,
+                    const uint32_t *hashes, size_t count) {
+  if (w->tile_count && tile <= w->tiles[w->tile_count - 1])
+    return false;
+  if (w->tile_count == w->tile_cap) {
+    size_t cap = w->tile_cap ? w->tile_cap * 2 : 4096;
+    uint32_t *grown = realloc(w->tiles, cap * sizeof(*grown));
+    if (!grown)
+      return false;
+    w->tiles = grown;
+    w->tile_cap = cap;
+  }
+  w->tiles[w->tile_count++] = tile;
+  for (size_t i = 0; i < count; i++) {
+    uint64_t pair = (uint64_t)hashes[i] << 32 | tile;
+    if (fwrite(&pair, sizeof(pair), 1, w->parts[hashes[i] >> 24]) != 1)
+      return false;
+  }
+  w->pairs += count;
+  return true;
+}
+
+static size_t put_varint(uint8_t *out, uint32_t v) {
+  size_t n = 0;
+  while (v >= 0x80) {
+    out[n++] = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  out[n++] = (uint8_t)v;
+  return n;
+}
+
+// Sorts one part and appends the postings of its hashes to the output, their
+// table entries to table.
+static bool write_part(tile_index_writer_t *w, FILE *part, FILE *table,
+                       uint64_t *buckets, uint64_t *offset,
+                       uint64_t *hash_count) {
+  if (fseeko(part, 0, SEEK_END) != 0)
+    return false;
+  size_t n = (size_t)ftello(part) / sizeof(uint64_t);
+  if (!n)
+    return true;
+  uint64_t *pairs = malloc(n * sizeof(*pairs));
+  // a varint per tile, 5 bytes at most
+  uint8_t *postings = malloc(n * 5);
+  bool ok = pairs && postings && fseeko(part, 0, SEEK_SET) == 0 &&
+            fread(pairs, sizeof(*pairs), n, part) == n;
+  if (ok)
+    qsort(pairs, n, sizeof(*pairs), cmp_u64);
+
+  for (size_t i = 0; ok && i < n;) {
+    uint32_t hash = (uint32_t)(pairs[i] >> 32), last = 0;
+    tile_index_entry_t e = {hash, 0, *offset};
+    size_t len = 0;
+    for (; i < n && (uint32_t)(pairs[i] >> 32) == hash; i++) {
+      uint32_t tile = (uint32_t)pairs[i];
+      if (e.count && tile == last)
+        continue;
+      len += put_varint(postings + len, e.count ? tile - last : tile);
+      last = tile;
+      e.count++;
+    }
+    ok = fwrite(postings, 1, len, w->out) == len &&
+         fwrite(&e, sizeof(e), 1, table) == 1;
+    *offset += len;
+    buckets[(hash >> 16) + 1]++;
+    (*hash_count)++;
+  }
+  free(pairs);
+  free(postings);
+  return ok;
+}
+
+bool tile_index_finish(tile_index_writer_t *w) {
+  header_t h = {{0}, w->tile_size, (uint32_t)w->tile_count, 0, 0};
+  memcpy(h.magic, MAGIC, 8);
+  uint64_t *buckets = calloc(BUCKETS + 1, sizeof(uint64_t));
+  FILE *table = w->table;
+  uint64_t offset = sizeof(h);
+  bool ok = buckets && w->tile_count <= UINT32_MAX &&
+            fwrite(&h, sizeof(h), 1, w->out) == 1;
+
+  for (int i = 0; ok && i < TILE_INDEX_PARTS; i++) {
+    ok = write_part(w, w->parts[i], table, buckets, &offset, &h.hash_count);
+    fclose(w->parts[i]);
+    w->parts[i] = NULL;
+  }
+
+  // the table is read in place, so it starts 8 byte aligned
+  static const uint8_t zeros[8];
+  size_t pad = (size_t)(-offset & 7);
+  ok = ok && fwrite(zeros, 1, pad, w->out) == pad;
+  h.table_offset = offset + pad;
+
+  uint8_t copy[1 << 16];
+  ok = ok && fseeko(table, 0, SEEK_SET) == 0;
+  for (size_t n; ok && (n = fread(copy, 1, sizeof(copy), table)) > 0;)
+    ok = fwrite(copy, 1, n, w->out) == n;
+  for (size_t i = 0; i < BUCKETS; i++)
+    buckets[i + 1] += buckets[i];
+  ok = ok && !ferror(table) &&
+       fwrite(buckets, sizeof(uint64_t), BUCKETS + 1, w->out) ==
+           BUCKETS + 1 &&
+       fwrite(w->tiles, sizeof(uint32_t), w->tile_count, w->out) ==
+           w->tile_count &&
+       fseeko(w->out, 0, SEEK_SET) == 0 &&
+       fwrite(&h, sizeof(h), 1, w->out) == 1;
+
+  ok = fclose(w->out) == 0 && ok;
+  w->out = NULL;
+  fclose(table);
+  w->table = NULL;
+  free(buckets);
+  return ok;
+}
+
+void tile_index_writer_destroy(tile_index_writer_t *w) {
+  if (w->out)
+    fclose(w->out);
+  for (int i = 0; i < TILE_INDEX_PARTS; i++)
+    if (w->parts[i])
+      fclose(w->parts[i]);
+  if (w->table)
+    fclose(w->table);
+  free(w->tiles);
+  memset(w, 0, sizeof(*w));
+}
+
+bool tile_index_open(tile_index_t *ix, const char *path) {
+  memset(ix, 0, sizeof(*ix));
+  ix->fd = open(path, O_RDONLY);
+  struct stat st;
+  if (ix->fd < 0 || fstat(ix->fd, &st) != 0 ||
+      (size_t)st.st_size < sizeof(header_t)) {
+    tile_index_close(ix);
+    return false;
+  }
+  ix->len = (size_t)st.st_size;
+  void *m = mmap(NULL, ix->len, PROT_READ, MAP_SHARED, ix->fd, 0);
+  if (m == MAP_FAILED) {
+    tile_index_close(ix);
+    return false;
+  }
+  ix->map = m;
+
+  header_t h;
+  memcpy(&h, ix->map, sizeof(h));
+  uint64_t table_len = h.hash_count * sizeof(tile_index_entry_t);
+  if (memcmp(h.magic, MAGIC, 8) != 0 || h.table_offset % 8 ||
+      h.table_offset < sizeof(h) || h.hash_count > UINT32_MAX + 1ull ||
+      h.table_offset + table_len + (BUCKETS + 1) * sizeof(uint64_t) +
+              (uint64_t)h.tile_count * sizeof(uint32_t) !=
+          ix->len) {
+    tile_index_close(ix);
+    return false;
+  }
+  ix->tile_size = h.tile_size;
+  ix->hash_count = h.hash_count;
+  ix->tile_count = h.tile_count;
+  ix->table = (const tile_index_entry_t *)(ix->map + h.table_offset);
+  ix->buckets = (const uint64_t *)(ix->map + h.table_offset + table_len);
+  ix->tiles = (const uint32_t *)(ix->buckets + BUCKETS + 1);
+  return true;
+}
+
+void tile_index_close(tile_index_t *ix) {
+  if (ix->map)
+    munmap(ix->map, ix->len);
+  if (ix->fd >= 0)
+    close(ix->fd);
+  memset(ix, 0, sizeof(*ix));
+  ix->fd = -1;
+}
+
+const tile_index_entry_t *tile_index_lookup(const tile_index_t *ix,
+                                            uint32_t hash) {
+  uint64_t lo = ix->buckets[hash >> 16], hi = ix->buckets[(hash >> 16) + 1];
+  if (hi > ix->hash_count)
+    return NULL;
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if (ix->table[mid].hash < hash)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo < ix->hash_count && ix->table[lo].hash == hash ? &ix->table[lo]
+                                                            : NULL;
+}
+
+bool tile_index_postings(const tile_index_t *ix, const tile_index_entry_t *e,
+                         uint32_t *out) {
+  size_t end = (size_t)((const uint8_t *)ix->table - ix->map);
+  size_t at = (size_t)e->offset;
+  uint32_t tile = 0;
+  for (uint32_t i = 0; i < e->count; i++) {
+    uint32_t v = 0;
+    for (int shift = 0;; shift += 7) {
+      if (at >= end || shift > 28)
+        return false;
+      uint8_t byte = ix->map[at++];
+      v |= (uint32_t)(byte & 0x7F) << shift;
+      if (!(byte & 0x80))
+        break;
+    }
+    tile = i ? tile + v : v;
+    out[i] = tile;
+  }
+  return true;
+}
+
+static int cmp_entry_count(const void *a, const void *b) {
+  uint32_t x = (*(const tile_index_entry_t *const *)a)->count;
+  uint32_t y = (*(const tile_index_entry_t *const *)b)->count;
+  return (x > y) - (x < y);
+}
+
+// Tiles on every list of the template's blocks at one alignment, appended to
+// out. lists holds the entries, rarest first.
+static bool intersect(const tile_index_t *ix, const tile_index_entry_t **lists,
+                      size_t n, uint32_t *scratch, uint32_t **out,
+                      size_t *count, size_t *cap) {
+  size_t have = lists[0]->count;
+  if (*count + have > *cap) {
+    size_t grown_cap = (*count + have) * 2;
+    uint32_t *grown = realloc(*out, grown_cap * sizeof(*grown));
+    if (!grown)
+      return false;
+    *out = grown;
+    *cap = grown_cap;
+  }
+  uint32_t *acc = *out + *count;
+  if (!tile_index_postings(ix, lists[0], acc))
+    return false;
+  for (size_t l = 1; l < n && l < MAX_LISTS && have; l++) {
+    if (!tile_index_postings(ix, lists[l], scratch))
+      return false;
+    size_t kept = 0;
+    for (size_t i = 0, j = 0; i < have && j < lists[l]->count;) {
+      if (acc[i] < scratch[j])
+        i++;
+      else if (acc[i] > scratch[j])
+        j++;
+      else {
+        acc[kept++] = acc[i++];
+        j++;
+      }
+    }
+    have = kept;
+  }
+  *count += have;
+  return true;
+}
+
+bool tile_index_candidates(const tile_index_t *ix, const uint8_t *indices,
+                           uint32_t width, uint32_t height, uint32_t **tiles,
+                           size_t *count, bool *pruned) {
+  *tiles = NULL;
+  *count = 0;
+  *pruned = true;
+  size_t max_blocks =
+      (size_t)(width / TILE_INDEX_BLOCK) * (height / TILE_INDEX_BLOCK);
+  const tile_index_entry_t **lists =
+      malloc((max_blocks ? max_blocks : 1) * sizeof(*lists));
+  uint32_t *out = NULL, *scratch = NULL;
+  size_t n_out = 0, cap = 0;
+  bool ok = lists != NULL, every_tile = false;
+
+  for (uint32_t a = 0; ok && !every_tile && a < 16; a++) {
+    uint32_t ox = a % TILE_INDEX_BLOCK, oy = a / TILE_INDEX_BLOCK;
+    size_t n = 0, usable = 0;
+    bool missing = false;
+    for (uint32_t y = oy; !missing && y + TILE_INDEX_BLOCK <= height;
+         y += TILE_INDEX_BLOCK)
+      for (uint32_t x = ox; !missing && x + TILE_INDEX_BLOCK <= width;
+           x += TILE_INDEX_BLOCK) {
+        uint64_t lo, hi;
+        load_block(indices + (size_t)y * width + x, width, &lo, &hi);
+        if (!informative(lo, hi))
+          continue;
+        usable++;
+        const tile_index_entry_t *e = tile_index_lookup(ix, block_hash(lo, hi));
+        if (!e)
+          missing = true; // in no tile, so not at this alignment
+        else
+          lists[n++] = e;
+      }
+    if (!usable) {
+      every_tile = true;
+      break;
+    }
+    if (missing)
+      continue;
+    qsort(lists, n, sizeof(*lists), cmp_entry_count);
+    uint32_t longest = 0;
+    for (size_t l = 1; l < n && l < MAX_LISTS; l++)
+      longest = lists[l]->count > longest ? lists[l]->count : longest;
+    free(scratch);
+    scratch = malloc((longest ? longest : 1) * sizeof(*scratch));
+    ok = scratch && intersect(ix, lists, n, scratch, &out, &n_out, &cap);
+  }
+
+  if (ok && every_tile) {
+    free(out);
+    out = malloc((ix->tile_count ? ix->tile_count : 1) * sizeof(*out));
+    ok = out != NULL;
+    if (ok)
+      memcpy(out, ix->tiles, ix->tile_count * sizeof(*out));
+    n_out = ix->tile_count;
+    *pruned = false;
+  } else if (ok) {
+    n_out = sort_unique(out, n_out);
+  }
+  free(lists);
+  free(scratch);
+  if (!ok) {
+    free(out);
+    return false;
+  }
+  *tiles = out;
+  *count = n_out;
+  return true;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Inverted index from the 4x4 blocks of palette indices in the base tiles of
+// a release to the tiles holding them, for finding a template among
+// millions of tiles without decoding each one. Blocks are taken on the
+// aligned grid, every 4 pixels, and only when they are informative: blocks
+// of a single colour or touching a transparent pixel are left out, they
+// would list most of the map. A template of at least 7x7 opaque pixels
+// covers an aligned block wherever it sits, so a query intersects the
+// posting lists of the template's blocks for each of the 16 alignments and
+// the union is every tile the template can be in. Hashes collide, so the
+// candidates still have to be verified, with pumpkin_find.
+//
+// The file is mapped as is, little endian:
+//   header:   "WPBIDX01", u32 tile size, u32 tile count, u64 hash count,
+//             u64 table offset
+//   postings: per hash, the tiles holding it as ascending x << 16 | y,
+//             varint deltas
+//   table:    hash count entries {u32 hash, u32 tiles, u64 postings offset}
+//             ascending by hash
+//   buckets:  65537 u64, the table entries of hashes h with h >> 16 == i
+//             are [buckets[i], buckets[i + 1])
+//   tiles:    tile count u32 x << 16 | y, ascending, every tile indexed
+
+#define TILE_INDEX_BLOCK 4
+#define TILE_INDEX_PARTS 256
+
+typedef struct {
+  uint32_t hash;
+  uint32_t count;  // tiles holding the block
+  uint64_t offset; // of its postings
+} tile_index_entry_t;
+
+// Hashes of the informative aligned blocks of a size x size palette plane,
+// sorted and without duplicates. out must hold (size / 4)^2 hashes.
+size_t tile_index_tile_hashes(const uint8_t *plane, uint32_t size,
+                              uint32_t *out);
+
+// Writes an index. (hash, tile) pairs are spread over TILE_INDEX_PARTS
+// unlinked scratch files next to the output by the top hash bits, so
+// finishing sorts one part at a time and the memory needed is about 1/256
+// of the pairs, not all of them.
+typedef struct {
+  FILE *out;
+  FILE *parts[TILE_INDEX_PARTS];
+  FILE *table; // entries until the postings are all written
+  uint32_t tile_size;
+  uint32_t *tiles;
+  size_t tile_count, tile_cap;
+  uint64_t pairs;
+} tile_index_writer_t;
+
+bool tile_index_writer_init(tile_index_writer_t *w, const char *path,
+                            uint32_t tile_size);
+// Tiles go in ascending x << 16 | y, once each, with the hashes of
+// tile_index_tile_hashes.
+bool tile_index_add(tile_index_writer_t *w, uint32_t tile,
+                    const uint32_t *hashes, size_t count);
+bool tile_index_finish(tile_index_writer_t *w);
+void tile_index_writer_destroy(tile_index_writer_t *w);
+
+typedef struct {
+  int fd;
+  uint8_t *map;
+  size_t len;
+  uint32_t tile_size;
+  const uint32_t *tiles;
+  uint32_t tile_count;
+  const tile_index_entry_t *table;
+  uint64_t hash_count;
+  const uint64_t *buckets;
+} tile_index_t;
+
+bool tile_index_open(tile_index_t *ix, const char *path);
+void tile_index_close(tile_index_t *ix);
+
+// The entry of hash, NULL if no tile has a block with it.
+const tile_index_entry_t *tile_index_lookup(const tile_index_t *ix,
+                                            uint32_t hash);
+
+// Decodes the postings of e to e->count tile keys.
+bool tile_index_postings(const tile_index_t *ix, const tile_index_entry_t *e,
+                         uint32_t *out);
+
+// The tiles a width x height template of palette indices can be in, index 0
+// matching any pixel, as a malloc'd ascending list. When some alignment of
+// the template covers no informative block, nothing can be ruled out and
+// the list is every tile of the index, with *pruned false.
+bool tile_index_candidates(const tile_index_t *ix, const uint8_t *indices,
+                           uint32_t width, uint32_t height, uint32_t **tiles,
+                           size_t *count, bool *pruned);
@@ -0,0 +1,150 @@
+#define _DEFAULT_SOURCE
+#include "tile_io.h"
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+void tile_buf_free(tile_buf_t *b) {
+  if (!b)
+    return;
+  free(b->data);
+  memset(b, 0, sizeof(*b));
+}
+
+bool tile_buf_reserve(tile_buf_t *b, size_t cap) {
+  if (cap <= b->cap)
+    return true;
+  uint8_t *data = realloc(b->data, cap);
+  if (!data)
+    return false;
+  b->data = data;
+  b->cap = cap;
+  return true;
+}
+
+bool tile_io_path(char *out, size_t size, const char *root, uint32_t z,
+                  uint32_t x, uint32_t y) {
+  int n = snprintf(out, size, "%s/%u/%u/%u.png", root, z, x, y);
+  return n > 0 && (size_t)n < size;
+}
+
+bool tile_io_exists(const char *path) { return access(path, F_OK) == 0; }
+
+bool tile_io_read(const char *path, tile_buf_t *b) {
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return false;
+
+  bool ok = false;
+  struct stat st;
+  if (fstat(fileno(f), &st) == 0 && tile_buf_reserve(b, (size_t)st.st_size)) {
+    b->len = fread(b->data, 1, (size_t)st.st_size, f);
+    ok = b->len == (size_t)st.st_size;
+  }
+  fclose(f);
+  return ok;
+}
+
+bool tile_io_write(const char *path, const uint8_t *data, size_t len) {
+  char tmp[4096];
+  int n = snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  if (n <= 0 || (size_t)n >= sizeof(tmp))
+    return false;
+
+  FILE *f = fopen(tmp, "wb");
+  if (!f)
+    return false;
+  bool ok = fwrite(data, 1, len, f) == len;
+  ok = fclose(f) == 0 && ok;
+  if (ok)
+    ok = rename(tmp, path) == 0;
+  if (!ok)
+    unlink(tmp);
+  return ok;
+}
+
+bool tile_io_link(const char *from, const char *to, tile_buf_t *b) {
+  if (link(from, to) == 0)
+    return true;
+  if (errno == EEXIST || !b)
+    return false;
+  // another file system or one without hard links
+  return tile_io_read(from, b) && tile_io_write(to, b->data, b->len);
+}
+
+bool tile_io_mkdirs_for(const char *path) {
+  char dir[4096];
+  size_t len = strlen(path);
+  if (len >= sizeof(dir))
+    return false;
+  memcpy(dir, path, len + 1);
+
+  char *slash = strrchr(dir, '/');
+  if (!slash || slash == dir)
+    return true;
+  *slash = '\0';
+
+  for (char *p = dir + 1; *p; p++) {
+    if (*p != '/')
+      continue;
+    *p = '\0';
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+      return false;
+    *p = '/';
+  }
+  return mkdir(dir, 0755) == 0 || errno == EEXIST;
+}
+
+// Parses a decimal directory or file name below dim, "<n>" or "<n>.png".
+static bool parse_coord(const char *name, const char *suffix, uint32_t dim,
+                        uint32_t *out) {
+  char *end;
+  errno = 0;
+  unsigned long v = strtoul(name, &end, 10);
+  if (end == name || errno || strcmp(end, suffix) != 0 || v >= dim)
+    return false;
+  *out = (uint32_t)v;
+  return true;
+}
+
+size_t tile_io_scan_level(const char *root, uint32_t z, uint8_t *occupied) {
+  uint32_t dim = 1u << z;
+  char path[4096];
+  int n = snprintf(path, sizeof(path), "%s/%u", root, z);
+  if (n <= 0 || (size_t)n >= sizeof(path))
+    return 0;
+
+  DIR *level = opendir(path);
+  if (!level)
+    return 0;
+
+  size_t found = 0;
+  struct dirent *col;
+  while ((col = readdir(level))) {
+    uint32_t x;
+    if (!parse_coord(col->d_name, "", dim, &x))
+      continue;
+    n = snprintf(path, sizeof(path), "%s/%u/%u", root, z, x);
+    if (n <= 0 || (size_t)n >= sizeof(path))
+      continue;
+
+    DIR *column = opendir(path);
+    if (!column)
+      continue;
+    struct dirent *ent;
+    while ((ent = readdir(column))) {
+      uint32_t y;
+      if (!parse_coord(ent->d_name, ".png", dim, &y))
+        continue;
+      occupied[(size_t)y * dim + x] = 1;
+      found++;
+    }
+    closedir(column);
+  }
+  closedir(level);
+  return found;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Growable byte buffer reused across reads so a worker thread does not
+// allocate per tile.
+typedef struct {
+  uint8_t *data;
+  size_t len;
+  size_t cap;
+} tile_buf_t;
+
+void tile_buf_free(tile_buf_t *b);
+bool tile_buf_reserve(tile_buf_t *b, size_t cap);
+
+// <root>/<z>/<x>/<y>.png, the layout of public/tiles
+bool tile_io_path(char *out, size_t size, const char *root, uint32_t z,
+                  uint32_t x, uint32_t y);
+bool tile_io_exists(const char *path);
+
+// Returns false if the file does not exist or cannot be read.
+bool tile_io_read(const char *path, tile_buf_t *b);
+
+// Writes through a temporary file and rename, so a crashed run never leaves
+// a truncated tile behind that later runs would skip as done.
+bool tile_io_write(const char *path, const uint8_t *data, size_t len);
+
+// Hard links from to to, copying through b where links are not possible
+// unless b is NULL. Fails if to already exists.
+bool tile_io_link(const char *from, const char *to, tile_buf_t *b);
+
+// mkdir -p of the directory containing path
+bool tile_io_mkdirs_for(const char *path);
+
+// Marks occupied[y * 2^z + x] for every <root>/<z>/<x>/<y>.png by listing
+// the level's directories, which is far cheaper than probing every
+// coordinate. Returns the number of tiles found.
+size_t tile_io_scan_level(const char *root, uint32_t z, uint8_t *occupied);
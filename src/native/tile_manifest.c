@@ -0,0 +1,182 @@
+#include "tile_manifest.h"
+#include "tile_pmtiles.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MAGIC "WPTMAN01"
+#define MAGIC_LEN 8
+
+static bool put_varint(tile_buf_t *b, uint64_t v) {
+  if (!tile_buf_reserve(b, b->len + 10))
+    return false;
+  do {
+    uint8_t byte = v & 0x7F;
+    v >>= 7;
+    b->data[b->len++] = byte | (v ? 0x80 : 0);
+  } while (v);
+  return true;
+}
+
+static bool get_varint(const uint8_t **p, const uint8_t *end, uint64_t *v) {
+  *v = 0;
+  for (int shift = 0; shift < 64 && *p < end; shift += 7) {
+    uint8_t byte = *(*p)++;
+    *v |= (uint64_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+typedef struct {
+  uint64_t tile_id;
+  size_t pos; // in the input, later inputs win
+} input_ref_t;
+
+typedef struct {
+  uint8_t hash[TILE_MANIFEST_HASH];
+  size_t tile;
+} hash_ref_t;
+
+static int cmp_input(const void *a, const void *b) {
+  const input_ref_t *x = a, *y = b;
+  if (x->tile_id != y->tile_id)
+    return x->tile_id < y->tile_id ? -1 : 1;
+  return x->pos < y->pos ? -1 : x->pos > y->pos;
+}
+
+static int cmp_hash(const void *a, const void *b) {
+  return memcmp(((const hash_ref_t *)a)->hash, ((const hash_ref_t *)b)->hash,
+                TILE_MANIFEST_HASH);
+}
+
+bool tile_manifest_build(tile_manifest_t *m, const uint32_t *zxy,
+                         const uint8_t *hashes, size_t count) {
+  memset(m, 0, sizeof(*m));
+  input_ref_t *refs = malloc((count ? count : 1) * sizeof(input_ref_t));
+  hash_ref_t *by_hash = malloc((count ? count : 1) * sizeof(hash_ref_t));
+  m->tiles = malloc((count ? count : 1) * sizeof(tile_manifest_tile_t));
+  m->hashes = malloc((count ? count : 1) * TILE_MANIFEST_HASH);
+  bool ok = refs && by_hash && m->tiles && m->hashes;
+
+  for (size_t i = 0; ok && i < count; i++) {
+    ok = zxy[i * 3] < 32 && zxy[i * 3 + 1] >> zxy[i * 3] == 0 &&
+         zxy[i * 3 + 2] >> zxy[i * 3] == 0;
+    refs[i] = (input_ref_t){
+        pmtiles_tile_id(zxy[i * 3], zxy[i * 3 + 1], zxy[i * 3 + 2]), i};
+  }
+  if (ok)
+    qsort(refs, count, sizeof(input_ref_t), cmp_input);
+
+  for (size_t i = 0; ok && i < count; i++) {
+    if (i + 1 < count && refs[i + 1].tile_id == refs[i].tile_id)
+      continue;
+    memcpy(by_hash[m->count].hash, hashes + refs[i].pos * TILE_MANIFEST_HASH,
+           TILE_MANIFEST_HASH);
+    by_hash[m->count].tile = m->count;
+    m->tiles[m->count++].tile_id = refs[i].tile_id;
+  }
+
+  if (ok) {
+    qsort(by_hash, m->count, sizeof(hash_ref_t), cmp_hash);
+    for (size_t i = 0; i < m->count; i++) {
+      if (i == 0 || cmp_hash(&by_hash[i - 1], &by_hash[i]) != 0)
+        memcpy(m->hashes + m->hash_count++ * TILE_MANIFEST_HASH,
+               by_hash[i].hash, TILE_MANIFEST_HASH);
+      m->tiles[by_hash[i].tile].hash = (uint32_t)(m->hash_count - 1);
+    }
+  }
+
+  free(refs);
+  free(by_hash);
+  if (!ok)
+    tile_manifest_free(m);
+  return ok;
+}
+
+bool tile_manifest_encode(const tile_manifest_t *m, tile_buf_t *out) {
+  out->len = 0;
+  size_t hash_bytes = m->hash_count * TILE_MANIFEST_HASH;
+  bool ok = tile_buf_reserve(out, MAGIC_LEN + hash_bytes + 20);
+  if (ok) {
+    memcpy(out->data, MAGIC, MAGIC_LEN);
+    out->len = MAGIC_LEN;
+  }
+  ok = ok && put_varint(out, m->count) && put_varint(out, m->hash_count) &&
+       tile_buf_reserve(out, out->len + hash_bytes);
+  if (ok) {
+    memcpy(out->data + out->len, m->hashes, hash_bytes);
+    out->len += hash_bytes;
+  }
+  for (size_t i = 0; ok && i < m->count; i++)
+    ok = put_varint(out, m->tiles[i].tile_id - (i ? m->tiles[i - 1].tile_id
+                                                  : 0));
+  for (size_t i = 0; ok && i < m->count; i++)
+    ok = put_varint(out, m->tiles[i].hash);
+  return ok;
+}
+
+bool tile_manifest_decode(tile_manifest_t *m, const uint8_t *data,
+                          size_t len) {
+  memset(m, 0, sizeof(*m));
+  const uint8_t *p = data + MAGIC_LEN, *end = data + len;
+  uint64_t count, hash_count, v;
+  if (len < MAGIC_LEN || memcmp(data, MAGIC, MAGIC_LEN) != 0 ||
+      !get_varint(&p, end, &count) || !get_varint(&p, end, &hash_count) ||
+      hash_count > (uint64_t)(end - p) / TILE_MANIFEST_HASH ||
+      count > (uint64_t)(end - p) / 2 || hash_count > UINT32_MAX)
+    return false;
+
+  m->tiles = malloc((count ? count : 1) * sizeof(tile_manifest_tile_t));
+  m->hashes = malloc(hash_count ? hash_count * TILE_MANIFEST_HASH : 1);
+  if (!m->tiles || !m->hashes) {
+    tile_manifest_free(m);
+    return false;
+  }
+  memcpy(m->hashes, p, hash_count * TILE_MANIFEST_HASH);
+  p += hash_count * TILE_MANIFEST_HASH;
+  m->count = count;
+  m->hash_count = hash_count;
+
+  bool ok = true;
+  uint64_t id = 0;
+  for (size_t i = 0; ok && i < count; i++) {
+    // ascending, so every delta but the first is at least one
+    ok = get_varint(&p, end, &v) && (v || i == 0) && id + v >= id;
+    id += v;
+    m->tiles[i].tile_id = id;
+  }
+  for (size_t i = 0; ok && i < count; i++) {
+    ok = get_varint(&p, end, &v) && v < hash_count;
+    m->tiles[i].hash = (uint32_t)v;
+  }
+  if (!ok || p != end) {
+    tile_manifest_free(m);
+    return false;
+  }
+  return true;
+}
+
+void tile_manifest_free(tile_manifest_t *m) {
+  free(m->tiles);
+  free(m->hashes);
+  memset(m, 0, sizeof(*m));
+}
+
+const uint8_t *tile_manifest_find(const tile_manifest_t *m, uint32_t z,
+                                  uint32_t x, uint32_t y) {
+  if (z >= 32 || x >> z || y >> z)
+    return NULL;
+  uint64_t id = pmtiles_tile_id(z, x, y);
+  size_t lo = 0, hi = m->count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (m->tiles[mid].tile_id < id)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == m->count || m->tiles[lo].tile_id != id)
+    return NULL;
+  return m->hashes + (size_t)m->tiles[lo].hash * TILE_MANIFEST_HASH;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tile_io.h"
+
+// Per release map of z/x/y to the content hash of the tile, for a tile store
+// where blobs are keyed by hash and shared by all releases. Serialised as
+//   "WPTMAN01", varint tile count, varint hash count,
+//   the distinct hashes, 16 bytes each, ascending,
+//   the PMTiles tile id deltas of all tiles, ascending, as varints,
+//   the index of each tile's hash, as varints.
+// A release with duplicate tiles stores each of their hashes once.
+
+#define TILE_MANIFEST_HASH 16
+
+typedef struct {
+  uint64_t tile_id;
+  uint32_t hash; // index into hashes
+} tile_manifest_tile_t;
+
+typedef struct {
+  tile_manifest_tile_t *tiles; // ascending tile id
+  size_t count;
+  uint8_t *hashes; // hash_count * TILE_MANIFEST_HASH, ascending
+  size_t hash_count;
+} tile_manifest_t;
+
+// From count tiles given as z, x, y triples and their hashes. A tile given
+// twice keeps its last hash, like a tar extracted over itself.
+bool tile_manifest_build(tile_manifest_t *m, const uint32_t *zxy,
+                         const uint8_t *hashes, size_t count);
+bool tile_manifest_encode(const tile_manifest_t *m, tile_buf_t *out);
+bool tile_manifest_decode(tile_manifest_t *m, const uint8_t *data,
+                          size_t len);
+void tile_manifest_free(tile_manifest_t *m);
+
+// The hash of a tile, NULL if the release does not have it.
+const uint8_t *tile_manifest_find(const tile_manifest_t *m, uint32_t z,
+                                  uint32_t x, uint32_t y);
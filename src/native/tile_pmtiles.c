@@ -0,0 +1,625 @@
+#define _DEFAULT_SOURCE
+#include "tile_pmtiles.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define COMPRESSION_NONE 1
+#define COMPRESSION_GZIP 2
+#define LEAF_SIZE 4096 // entries per leaf directory to start with
+#define MAX_DEPTH 4    // root and leaf directories followed per lookup
+
+static void rotate(uint64_t n, uint64_t *x, uint64_t *y, uint64_t rx,
+                   uint64_t ry) {
+  if (ry)
+    return;
+  if (rx) {
+    *x = n - 1 - *x;
+    *y = n - 1 - *y;
+  }
+  uint64_t t = *x;
+  *x = *y;
+  *y = t;
+}
+
+// number of tiles on all levels above z
+static uint64_t level_start(uint32_t z) {
+  return (((uint64_t)1 << (z * 2)) - 1) / 3;
+}
+
+uint64_t pmtiles_tile_id(uint32_t z, uint32_t x, uint32_t y) {
+  uint64_t n = (uint64_t)1 << z, tx = x, ty = y, d = 0;
+  for (uint64_t s = n / 2; s > 0; s /= 2) {
+    uint64_t rx = (tx & s) != 0, ry = (ty & s) != 0;
+    d += s * s * ((3 * rx) ^ ry);
+    rotate(n, &tx, &ty, rx, ry);
+  }
+  return level_start(z) + d;
+}
+
+void pmtiles_tile_coords(uint64_t tile_id, uint32_t *z, uint32_t *x,
+                         uint32_t *y) {
+  uint32_t level = 0;
+  while (level < 31 && level_start(level + 1) <= tile_id)
+    level++;
+
+  uint64_t t = tile_id - level_start(level), tx = 0, ty = 0;
+  for (uint64_t s = 1; s < ((uint64_t)1 << level); s *= 2) {
+    uint64_t rx = 1 & (t / 2), ry = 1 & (t ^ rx);
+    rotate(s, &tx, &ty, rx, ry);
+    tx += s * rx;
+    ty += s * ry;
+    t /= 4;
+  }
+  *z = level;
+  *x = (uint32_t)tx;
+  *y = (uint32_t)ty;
+}
+
+// Directory encoding: entry count, then tile id deltas, run lengths,
+// lengths and offsets as columns of varints. An offset directly following
+// the previous entry is stored as 0, any other as offset + 1.
+
+static bool put_varint(tile_buf_t *b, uint64_t v) {
+  if (!tile_buf_reserve(b, b->len + 10))
+    return false;
+  do {
+    uint8_t byte = v & 0x7F;
+    v >>= 7;
+    b->data[b->len++] = byte | (v ? 0x80 : 0);
+  } while (v);
+  return true;
+}
+
+static bool get_varint(const uint8_t **p, const uint8_t *end, uint64_t *v) {
+  *v = 0;
+  for (int shift = 0; shift < 64 && *p < end; shift += 7) {
+    uint8_t byte = *(*p)++;
+    *v |= (uint64_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+static bool serialize_dir(const pmtiles_entry_t *e, size_t n, tile_buf_t *b) {
+  b->len = 0;
+  bool ok = put_varint(b, n);
+  for (size_t i = 0; ok && i < n; i++)
+    ok = put_varint(b, e[i].tile_id - (i ? e[i - 1].tile_id : 0));
+  for (size_t i = 0; ok && i < n; i++)
+    ok = put_varint(b, e[i].run_length);
+  for (size_t i = 0; ok && i < n; i++)
+    ok = put_varint(b, e[i].length);
+  for (size_t i = 0; ok && i < n; i++) {
+    bool follows = i && e[i].offset == e[i - 1].offset + e[i - 1].length;
+    ok = put_varint(b, follows ? 0 : e[i].offset + 1);
+  }
+  return ok;
+}
+
+static bool parse_dir(const uint8_t *p, size_t len, pmtiles_entry_t **out,
+                      size_t *out_count) {
+  const uint8_t *end = p + len;
+  uint64_t n, v;
+  // every entry takes at least four bytes
+  if (!get_varint(&p, end, &n) || n > len)
+    return false;
+  pmtiles_entry_t *e = calloc(n ? n : 1, sizeof(pmtiles_entry_t));
+  if (!e)
+    return false;
+
+  bool ok = true;
+  uint64_t id = 0;
+  for (size_t i = 0; ok && i < n; i++) {
+    ok = get_varint(&p, end, &v);
+    id += v;
+    e[i].tile_id = id;
+  }
+  for (size_t i = 0; ok && i < n; i++) {
+    ok = get_varint(&p, end, &v) && v <= UINT32_MAX;
+    e[i].run_length = (uint32_t)v;
+  }
+  for (size_t i = 0; ok && i < n; i++) {
+    ok = get_varint(&p, end, &v) && v <= UINT32_MAX;
+    e[i].length = (uint32_t)v;
+  }
+  for (size_t i = 0; ok && i < n; i++) {
+    ok = get_varint(&p, end, &v) && (v || i);
+    e[i].offset = v ? v - 1 : e[i - 1].offset + e[i - 1].length;
+  }
+
+  if (!ok) {
+    free(e);
+    return false;
+  }
+  *out = e;
+  *out_count = n;
+  return true;
+}
+
+static bool gzip(const uint8_t *in, size_t len, tile_buf_t *out) {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  if (deflateInit2(&zs, 9, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) !=
+      Z_OK)
+    return false;
+  size_t bound = deflateBound(&zs, (uLong)len);
+  bool ok = tile_buf_reserve(out, bound);
+  if (ok) {
+    zs.next_in = (Bytef *)in;
+    zs.avail_in = (uInt)len;
+    zs.next_out = out->data;
+    zs.avail_out = (uInt)bound;
+    ok = deflate(&zs, Z_FINISH) == Z_STREAM_END;
+    out->len = zs.total_out;
+  }
+  deflateEnd(&zs);
+  return ok;
+}
+
+static bool gunzip(const uint8_t *in, size_t len, tile_buf_t *out) {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  if (inflateInit2(&zs, 15 + 16) != Z_OK)
+    return false;
+  zs.next_in = (Bytef *)in;
+  zs.avail_in = (uInt)len;
+  out->len = 0;
+
+  int ret = Z_OK;
+  while (ret == Z_OK) {
+    if (!tile_buf_reserve(out, out->cap ? out->cap * 2 : len * 4 + 1024))
+      break;
+    zs.next_out = out->data + out->len;
+    zs.avail_out = (uInt)(out->cap - out->len);
+    ret = inflate(&zs, Z_NO_FLUSH);
+    out->len = zs.total_out;
+  }
+  inflateEnd(&zs);
+  return ret == Z_STREAM_END;
+}
+
+static void put_u64(uint8_t *p, uint64_t v) {
+  for (int i = 0; i < 8; i++)
+    p[i] = (uint8_t)(v >> (i * 8));
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+  uint64_t v = 0;
+  for (int i = 7; i >= 0; i--)
+    v = v << 8 | p[i];
+  return v;
+}
+
+static void put_i32(uint8_t *p, int32_t v) {
+  for (int i = 0; i < 4; i++)
+    p[i] = (uint8_t)((uint32_t)v >> (i * 8));
+}
+
+static void write_header(const pmtiles_header_t *h, uint8_t *p) {
+  memcpy(p, "PMTiles", 7);
+  p[7] = 3;
+  const uint64_t fields[11] = {
+      h->root_offset,     h->root_length,     h->metadata_offset,
+      h->metadata_length, h->leaf_offset,     h->leaf_length,
+      h->data_offset,     h->data_length,     h->addressed_tiles,
+      h->tile_entries,    h->tile_contents};
+  for (int i = 0; i < 11; i++)
+    put_u64(p + 8 + i * 8, fields[i]);
+  p[96] = h->clustered;
+  p[97] = h->internal_compression;
+  p[98] = h->tile_compression;
+  p[99] = h->tile_type;
+  p[100] = h->min_zoom;
+  p[101] = h->max_zoom;
+  put_i32(p + 102, h->min_lon_e7);
+  put_i32(p + 106, h->min_lat_e7);
+  put_i32(p + 110, h->max_lon_e7);
+  put_i32(p + 114, h->max_lat_e7);
+  p[118] = h->center_zoom;
+  put_i32(p + 119, h->center_lon_e7);
+  put_i32(p + 123, h->center_lat_e7);
+}
+
+static int32_t get_i32(const uint8_t *p) {
+  return (int32_t)((uint32_t)p[0] | (uint32_t)p[1] << 8 |
+                   (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+}
+
+static bool read_header(const uint8_t *p, pmtiles_header_t *h) {
+  if (memcmp(p, "PMTiles", 7) != 0 || p[7] != 3)
+    return false;
+  uint64_t *fields[11] = {
+      &h->root_offset,     &h->root_length,     &h->metadata_offset,
+      &h->metadata_length, &h->leaf_offset,     &h->leaf_length,
+      &h->data_offset,     &h->data_length,     &h->addressed_tiles,
+      &h->tile_entries,    &h->tile_contents};
+  for (int i = 0; i < 11; i++)
+    *fields[i] = get_u64(p + 8 + i * 8);
+  h->clustered = p[96];
+  h->internal_compression = p[97];
+  h->tile_compression = p[98];
+  h->tile_type = p[99];
+  h->min_zoom = p[100];
+  h->max_zoom = p[101];
+  h->min_lon_e7 = get_i32(p + 102);
+  h->min_lat_e7 = get_i32(p + 106);
+  h->max_lon_e7 = get_i32(p + 110);
+  h->max_lat_e7 = get_i32(p + 114);
+  h->center_zoom = p[118];
+  h->center_lon_e7 = get_i32(p + 119);
+  h->center_lat_e7 = get_i32(p + 123);
+  return true;
+}
+
+bool pmtiles_writer_init(pmtiles_writer_t *w, const char *path) {
+  memset(w, 0, sizeof(*w));
+  size_t len = strlen(path);
+  w->path = malloc(len + 5);
+  if (!w->path || !tile_hash_set_init(&w->contents)) {
+    free(w->path);
+    return false;
+  }
+  memcpy(w->path, path, len);
+  memcpy(w->path + len, ".tmp", 5);
+
+  // the header and root directory go in front of the tile data once the
+  // directory is known
+  w->data = fopen(w->path, "w+b");
+  if (!w->data || fseek(w->data, PMTILES_ROOT_MAX, SEEK_SET) != 0) {
+    pmtiles_writer_destroy(w);
+    return false;
+  }
+  w->min_zoom = UINT8_MAX;
+  w->tile_type = PMTILES_TYPE_PNG;
+  return true;
+}
+
+void pmtiles_writer_destroy(pmtiles_writer_t *w) {
+  if (w->data) {
+    fclose(w->data);
+    remove(w->path);
+  }
+  free(w->path);
+  free(w->entries);
+  tile_hash_set_destroy(&w->contents);
+  memset(w, 0, sizeof(*w));
+}
+
+bool pmtiles_add(pmtiles_writer_t *w, uint32_t z, uint32_t x, uint32_t y,
+                 const uint8_t *tile, size_t len) {
+  uint64_t id = pmtiles_tile_id(z, x, y);
+  pmtiles_entry_t *last = w->count ? &w->entries[w->count - 1] : NULL;
+  if (len == 0 || len > UINT32_MAX ||
+      (last && id < last->tile_id + last->run_length))
+    return false;
+
+  uint64_t hash = tile_hash64(tile, len, 0);
+  tile_hash_entry_t found;
+  uint64_t offset;
+  if (tile_hash_set_find(&w->contents, hash, len, &found)) {
+    offset = found.offset;
+  } else {
+    offset = w->data_length;
+    tile_hash_entry_t e = {.hash = hash, .len = len, .offset = offset};
+    if (fwrite(tile, 1, len, w->data) != len ||
+        !tile_hash_set_put(&w->contents, &e))
+      return false;
+    w->data_length += len;
+  }
+
+  w->addressed++;
+  if (z < w->min_zoom)
+    w->min_zoom = (uint8_t)z;
+  if (z > w->max_zoom)
+    w->max_zoom = (uint8_t)z;
+
+  if (last && last->offset == offset && last->length == len &&
+      last->tile_id + last->run_length == id && last->run_length < UINT32_MAX) {
+    last->run_length++;
+    return true;
+  }
+
+  if (w->count == w->capacity) {
+    size_t capacity = w->capacity ? w->capacity * 2 : 4096;
+    pmtiles_entry_t *e = realloc(w->entries, capacity * sizeof(*e));
+    if (!e)
+      return false;
+    w->entries = e;
+    w->capacity = capacity;
+  }
+  w->entries[w->count++] =
+      (pmtiles_entry_t){.tile_id = id, .offset = offset,
+                        .length = (uint32_t)len, .run_length = 1};
+  return true;
+}
+
+// Compressed root directory that fits into the first PMTILES_ROOT_MAX bytes,
+// with leaf directories if all entries do not fit into the root.
+static bool build_dirs(const pmtiles_writer_t *w, tile_buf_t *root,
+                       tile_buf_t *leaves) {
+  tile_buf_t raw = {0}, packed = {0};
+  bool ok = serialize_dir(w->entries, w->count, &raw) &&
+            gzip(raw.data, raw.len, root);
+  leaves->len = 0;
+
+  for (size_t leaf_size = LEAF_SIZE;
+       ok && PMTILES_HEADER_SIZE + root->len > PMTILES_ROOT_MAX;
+       leaf_size *= 2) {
+    size_t leaf_count = (w->count + leaf_size - 1) / leaf_size;
+    pmtiles_entry_t *index = calloc(leaf_count, sizeof(pmtiles_entry_t));
+    ok = index != NULL;
+    leaves->len = 0;
+
+    for (size_t i = 0; ok && i < leaf_count; i++) {
+      size_t first = i * leaf_size;
+      size_t n = w->count - first < leaf_size ? w->count - first : leaf_size;
+      ok = serialize_dir(w->entries + first, n, &raw) &&
+           gzip(raw.data, raw.len, &packed) &&
+           tile_buf_reserve(leaves, leaves->len + packed.len);
+      if (!ok)
+        break;
+      index[i] = (pmtiles_entry_t){.tile_id = w->entries[first].tile_id,
+                                   .offset = leaves->len,
+                                   .length = (uint32_t)packed.len};
+      memcpy(leaves->data + leaves->len, packed.data, packed.len);
+      leaves->len += packed.len;
+    }
+
+    ok = ok && serialize_dir(index, leaf_count, &raw) &&
+         gzip(raw.data, raw.len, root);
+    free(index);
+  }
+
+  tile_buf_free(&raw);
+  tile_buf_free(&packed);
+  return ok;
+}
+
+bool pmtiles_finish(pmtiles_writer_t *w, const char *metadata) {
+  tile_buf_t root = {0}, leaves = {0}, meta = {0};
+  bool ok = w->count > 0 && build_dirs(w, &root, &leaves) &&
+            gzip((const uint8_t *)metadata, strlen(metadata), &meta);
+
+  pmtiles_header_t h = {
+      .root_offset = PMTILES_HEADER_SIZE,
+      .root_length = root.len,
+      .data_offset = PMTILES_ROOT_MAX,
+      .data_length = w->data_length,
+      .leaf_offset = PMTILES_ROOT_MAX + w->data_length,
+      .leaf_length = leaves.len,
+      .metadata_offset = PMTILES_ROOT_MAX + w->data_length + leaves.len,
+      .metadata_length = meta.len,
+      .addressed_tiles = w->addressed,
+      .tile_entries = w->count,
+      .tile_contents = w->contents.count,
+      .clustered = 1,
+      .internal_compression = COMPRESSION_GZIP,
+      .tile_compression = COMPRESSION_NONE,
+      .tile_type = w->tile_type,
+      .min_zoom = w->min_zoom,
+      .max_zoom = w->max_zoom,
+      // web mercator bounds
+      .min_lon_e7 = -1800000000,
+      .min_lat_e7 = -850511287,
+      .max_lon_e7 = 1800000000,
+      .max_lat_e7 = 850511287,
+      .center_zoom = w->min_zoom,
+  };
+  uint8_t head[PMTILES_HEADER_SIZE];
+  write_header(&h, head);
+
+  ok = ok && fwrite(leaves.data, 1, leaves.len, w->data) == leaves.len &&
+       fwrite(meta.data, 1, meta.len, w->data) == meta.len &&
+       fseek(w->data, 0, SEEK_SET) == 0 &&
+       fwrite(head, 1, sizeof(head), w->data) == sizeof(head) &&
+       fwrite(root.data, 1, root.len, w->data) == root.len;
+  ok = fclose(w->data) == 0 && ok;
+  w->data = NULL;
+
+  // drop the .tmp suffix
+  char *final = strndup(w->path, strlen(w->path) - 4);
+  ok = ok && final && rename(w->path, final) == 0;
+  if (!ok)
+    remove(w->path);
+  free(final);
+
+  tile_buf_free(&root);
+  tile_buf_free(&leaves);
+  tile_buf_free(&meta);
+  return ok;
+}
+
+bool pmtiles_pack_dir(const char *root, uint32_t min_z, uint32_t max_z,
+                      const char *path) {
+  pmtiles_writer_t w;
+  if (max_z > 15 || !pmtiles_writer_init(&w, path))
+    return false;
+
+  bool ok = true;
+  tile_buf_t tile = {0};
+  char tile_path[4096];
+  for (uint32_t z = min_z; ok && z <= max_z; z++) {
+    uint64_t count = (uint64_t)1 << (z * 2);
+    uint8_t *occupied = calloc(count, 1);
+    if (!occupied) {
+      ok = false;
+      break;
+    }
+    size_t left = tile_io_scan_level(root, z, occupied);
+
+    // walk the level in tile id order
+    for (uint64_t d = 0; ok && left > 0 && d < count; d++) {
+      uint32_t tz, x, y;
+      pmtiles_tile_coords(level_start(z) + d, &tz, &x, &y);
+      if (!occupied[((size_t)y << z) + x])
+        continue;
+      left--;
+      ok = tile_io_path(tile_path, sizeof(tile_path), root, z, x, y) &&
+           tile_io_read(tile_path, &tile) &&
+           pmtiles_add(&w, z, x, y, tile.data, tile.len);
+    }
+    free(occupied);
+  }
+
+  ok = ok && pmtiles_finish(&w, "{\"name\":\"wplace\",\"format\":\"png\"}");
+  tile_buf_free(&tile);
+  pmtiles_writer_destroy(&w);
+  return ok;
+}
+
+static bool read_at(int fd, uint64_t offset, uint64_t len, tile_buf_t *b) {
+  if (!tile_buf_reserve(b, len))
+    return false;
+  b->len = 0;
+  while (b->len < len) {
+    ssize_t n = pread(fd, b->data + b->len, len - b->len,
+                      (off_t)(offset + b->len));
+    if (n <= 0)
+      return false;
+    b->len += (size_t)n;
+  }
+  return true;
+}
+
+bool pmtiles_open(pmtiles_reader_t *r, const char *path) {
+  memset(r, 0, sizeof(*r));
+  r->fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (r->fd < 0)
+    return false;
+
+  tile_buf_t head = {0}, raw = {0};
+  bool ok = read_at(r->fd, 0, PMTILES_HEADER_SIZE, &head) &&
+            read_header(head.data, &r->header) &&
+            r->header.internal_compression == COMPRESSION_GZIP &&
+            read_at(r->fd, r->header.root_offset, r->header.root_length,
+                    &head) &&
+            gunzip(head.data, head.len, &raw) &&
+            parse_dir(raw.data, raw.len, &r->root, &r->root_count);
+  tile_buf_free(&head);
+  tile_buf_free(&raw);
+  if (!ok)
+    pmtiles_close(r);
+  return ok;
+}
+
+void pmtiles_close(pmtiles_reader_t *r) {
+  if (r->fd >= 0)
+    close(r->fd);
+  free(r->root);
+  memset(r, 0, sizeof(*r));
+  r->fd = -1;
+}
+
+// last entry with a tile id not above id
+static const pmtiles_entry_t *search(const pmtiles_entry_t *e, size_t n,
+                                     uint64_t id) {
+  size_t lo = 0, hi = n;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (e[mid].tile_id <= id)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo ? &e[lo - 1] : NULL;
+}
+
+bool pmtiles_find(const pmtiles_reader_t *r, uint32_t z, uint32_t x,
+                  uint32_t y, uint64_t *offset, uint32_t *length) {
+  if (z > 31 || x >> z || y >> z)
+    return false;
+  uint64_t id = pmtiles_tile_id(z, x, y);
+  const pmtiles_entry_t *dir = r->root;
+  size_t count = r->root_count;
+  pmtiles_entry_t *leaf = NULL;
+  tile_buf_t packed = {0}, raw = {0};
+  bool found = false;
+
+  for (int depth = 0; depth < MAX_DEPTH; depth++) {
+    const pmtiles_entry_t *e = search(dir, count, id);
+    if (!e)
+      break;
+    if (e->run_length > 0) {
+      if (id < e->tile_id + e->run_length) {
+        *offset = r->header.data_offset + e->offset;
+        *length = e->length;
+        found = true;
+      }
+      break;
+    }
+
+    pmtiles_entry_t *next;
+    size_t next_count;
+    if (!read_at(r->fd, r->header.leaf_offset + e->offset, e->length,
+                 &packed) ||
+        !gunzip(packed.data, packed.len, &raw) ||
+        !parse_dir(raw.data, raw.len, &next, &next_count))
+      break;
+    free(leaf);
+    leaf = next;
+    dir = leaf;
+    count = next_count;
+  }
+
+  free(leaf);
+  tile_buf_free(&packed);
+  tile_buf_free(&raw);
+  return found;
+}
+
+bool pmtiles_get(const pmtiles_reader_t *r, uint32_t z, uint32_t x,
+                 uint32_t y, tile_buf_t *out) {
+  uint64_t offset;
+  uint32_t length;
+  return pmtiles_find(r, z, x, y, &offset, &length) &&
+         read_at(r->fd, offset, length, out);
+}
+
+static size_t scan_dir(const pmtiles_reader_t *r, const pmtiles_entry_t *e,
+                       size_t n, uint32_t z, uint8_t *occupied, int depth) {
+  uint64_t first = level_start(z), end = level_start(z + 1);
+  tile_buf_t packed = {0}, raw = {0};
+  size_t found = 0;
+
+  for (size_t i = 0; i < n; i++) {
+    if (e[i].run_length == 0) {
+      // a leaf holds the ids up to the next entry
+      uint64_t leaf_end = i + 1 < n ? e[i + 1].tile_id : UINT64_MAX;
+      pmtiles_entry_t *leaf;
+      size_t count;
+      if (depth + 1 < MAX_DEPTH && leaf_end > first && e[i].tile_id < end &&
+          read_at(r->fd, r->header.leaf_offset + e[i].offset, e[i].length,
+                  &packed) &&
+          gunzip(packed.data, packed.len, &raw) &&
+          parse_dir(raw.data, raw.len, &leaf, &count)) {
+        found += scan_dir(r, leaf, count, z, occupied, depth + 1);
+        free(leaf);
+      }
+      continue;
+    }
+
+    uint64_t from = e[i].tile_id > first ? e[i].tile_id : first;
+    uint64_t to = e[i].tile_id + e[i].run_length;
+    for (uint64_t id = from; id < to && id < end; id++) {
+      uint32_t tz, x, y;
+      pmtiles_tile_coords(id, &tz, &x, &y);
+      occupied[((size_t)y << z) + x] = 1;
+      found++;
+    }
+  }
+
+  tile_buf_free(&packed);
+  tile_buf_free(&raw);
+  return found;
+}
+
+size_t pmtiles_scan_level(const pmtiles_reader_t *r, uint32_t z,
+                          uint8_t *occupied) {
+  if (z > 31)
+    return 0;
+  return scan_dir(r, r->root, r->root_count, z, occupied, 0);
+}
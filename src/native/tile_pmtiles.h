@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "tile_hash.h"
+#include "tile_io.h"
+
+// PMTiles v3 archives: every tile of a pyramid in one file, addressed by a
+// Hilbert curve tile id through a gzip compressed directory, so any z/x/y is
+// found with the header, at most one leaf directory and one range read.
+
+#define PMTILES_HEADER_SIZE 127
+#define PMTILES_ROOT_MAX 16384 // header and root directory, first range read
+#define PMTILES_TYPE_UNKNOWN 0
+#define PMTILES_TYPE_PNG 2
+
+typedef struct {
+  uint64_t root_offset, root_length;
+  uint64_t metadata_offset, metadata_length;
+  uint64_t leaf_offset, leaf_length;
+  uint64_t data_offset, data_length;
+  uint64_t addressed_tiles, tile_entries, tile_contents;
+  uint8_t clustered;
+  uint8_t internal_compression;
+  uint8_t tile_compression;
+  uint8_t tile_type;
+  uint8_t min_zoom, max_zoom;
+  int32_t min_lon_e7, min_lat_e7, max_lon_e7, max_lat_e7;
+  uint8_t center_zoom;
+  int32_t center_lon_e7, center_lat_e7;
+} pmtiles_header_t;
+
+typedef struct {
+  uint64_t tile_id;
+  uint64_t offset; // in the tile data, or in the leaf directories
+  uint32_t length;
+  uint32_t run_length; // 0 marks a leaf directory
+} pmtiles_entry_t;
+
+uint64_t pmtiles_tile_id(uint32_t z, uint32_t x, uint32_t y);
+void pmtiles_tile_coords(uint64_t tile_id, uint32_t *z, uint32_t *x,
+                         uint32_t *y);
+
+// Tiles must be added in ascending tile id order, which keeps the tile data
+// clustered. A tile with the same bytes as an earlier one is stored once, a
+// run of consecutive ids with the same bytes becomes one directory entry.
+typedef struct {
+  FILE *data; // tile data, appended to the archive by pmtiles_finish
+  char *path;
+  pmtiles_entry_t *entries;
+  size_t count, capacity;
+  uint64_t data_length;
+  uint64_t addressed;
+  uint8_t min_zoom, max_zoom;
+  uint8_t tile_type; // PMTILES_TYPE_PNG unless changed before finishing
+  tile_hash_set_t contents;
+} pmtiles_writer_t;
+
+bool pmtiles_writer_init(pmtiles_writer_t *w, const char *path);
+bool pmtiles_add(pmtiles_writer_t *w, uint32_t z, uint32_t x, uint32_t y,
+                 const uint8_t *tile, size_t len);
+// Writes directories and metadata (a JSON object) and closes the archive.
+bool pmtiles_finish(pmtiles_writer_t *w, const char *metadata);
+// Releases the writer, removing the archive unless it was finished.
+void pmtiles_writer_destroy(pmtiles_writer_t *w);
+
+// Every <root>/<z>/<x>/<y>.png of min_z..max_z into one archive.
+bool pmtiles_pack_dir(const char *root, uint32_t min_z, uint32_t max_z,
+                      const char *path);
+
+// Lookups only use pread, a reader can be shared between threads.
+typedef struct {
+  int fd;
+  pmtiles_header_t header;
+  pmtiles_entry_t *root;
+  size_t root_count;
+} pmtiles_reader_t;
+
+bool pmtiles_open(pmtiles_reader_t *r, const char *path);
+void pmtiles_close(pmtiles_reader_t *r);
+
+// Finds the bytes of a tile. Returns false if the archive has no such tile.
+bool pmtiles_find(const pmtiles_reader_t *r, uint32_t z, uint32_t x,
+                  uint32_t y, uint64_t *offset, uint32_t *length);
+// Reads a tile into out.
+bool pmtiles_get(const pmtiles_reader_t *r, uint32_t z, uint32_t x,
+                 uint32_t y, tile_buf_t *out);
+// Marks occupied[y * 2^z + x] for every tile of level z, walking the leaf
+// directories that cover the level once. Returns the number of tiles found.
+size_t pmtiles_scan_level(const pmtiles_reader_t *r, uint32_t z,
+                          uint8_t *occupied);
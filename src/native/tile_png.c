@@ -0,0 +1,706 @@
+#include "tile_png.h"
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TILE_PNG_X86 1
+#endif
+
+static const uint8_t png_signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+
+static int g_simd = -1; // -1 = not probed yet
+
+void tile_png_set_simd(bool enabled) {
+#ifdef TILE_PNG_X86
+  g_simd = enabled && __builtin_cpu_supports("avx2");
+#else
+  (void)enabled;
+  g_simd = 0;
+#endif
+}
+
+bool tile_png_simd_active(void) {
+  if (g_simd < 0)
+    tile_png_set_simd(true);
+  return g_simd == 1;
+}
+
+typedef struct {
+  uint8_t palette[256][4];
+  bool has_key;     // tRNS colour key for grey / RGB images
+  uint16_t key[3];  // compared against the raw samples
+} png_ctx_t;
+
+static uint32_t read_u32(const uint8_t *p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 |
+         p[3];
+}
+
+static uint32_t png_channels(uint8_t color_type) {
+  switch (color_type) {
+  case 0: // grey
+  case 3: // palette
+    return 1;
+  case 4: // grey + alpha
+    return 2;
+  case 2: // RGB
+    return 3;
+  case 6: // RGBA
+    return 4;
+  default:
+    return 0;
+  }
+}
+
+static bool valid_depth(uint8_t color_type, uint8_t depth) {
+  switch (color_type) {
+  case 0:
+    return depth == 1 || depth == 2 || depth == 4 || depth == 8 || depth == 16;
+  case 3:
+    return depth == 1 || depth == 2 || depth == 4 || depth == 8;
+  default:
+    return depth == 8 || depth == 16;
+  }
+}
+
+bool tile_png_info(const uint8_t *png, size_t len, png_info_t *info) {
+  if (!png || !info || len < sizeof(png_signature) + 25)
+    return false;
+  if (memcmp(png, png_signature, sizeof(png_signature)) != 0)
+    return false;
+
+  const uint8_t *ihdr = png + sizeof(png_signature);
+  if (read_u32(ihdr) != 13 || memcmp(ihdr + 4, "IHDR", 4) != 0)
+    return false;
+
+  info->width = read_u32(ihdr + 8);
+  info->height = read_u32(ihdr + 12);
+  info->bit_depth = ihdr[16];
+  info->color_type = ihdr[17];
+  info->interlace = ihdr[20];
+
+  return info->width > 0 && info->height > 0 &&
+         png_channels(info->color_type) != 0 &&
+         valid_depth(info->color_type, info->bit_depth);
+}
+
+static uint8_t paeth(uint8_t a, uint8_t b, uint8_t c) {
+  int p = (int)a + b - c;
+  int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+  if (pa <= pb && pa <= pc)
+    return a;
+  return pb <= pc ? b : c;
+}
+
+static bool unfilter(uint8_t filter, uint8_t *row, const uint8_t *prev,
+                     size_t stride, size_t bpp) {
+  switch (filter) {
+  case 0:
+    return true;
+  case 1:
+    for (size_t i = bpp; i < stride; i++)
+      row[i] += row[i - bpp];
+    return true;
+  case 2:
+    for (size_t i = 0; i < stride; i++)
+      row[i] += prev[i];
+    return true;
+  case 3:
+    for (size_t i = 0; i < stride; i++) {
+      uint8_t left = i >= bpp ? row[i - bpp] : 0;
+      row[i] += (uint8_t)(((unsigned)left + prev[i]) >> 1);
+    }
+    return true;
+  case 4:
+    for (size_t i = 0; i < stride; i++) {
+      uint8_t left = i >= bpp ? row[i - bpp] : 0;
+      uint8_t up_left = i >= bpp ? prev[i - bpp] : 0;
+      row[i] += paeth(left, prev[i], up_left);
+    }
+    return true;
+  default:
+    return false;
+  }
+}
+
+static uint16_t sample_at(const uint8_t *row, uint8_t depth, size_t index) {
+  switch (depth) {
+  case 16:
+    return (uint16_t)(row[index * 2] << 8 | row[index * 2 + 1]);
+  case 8:
+    return row[index];
+  default: {
+    size_t bit = index * depth;
+    uint8_t shift = (uint8_t)(8 - depth - (bit & 7));
+    return (row[bit >> 3] >> shift) & ((1u << depth) - 1);
+  }
+  }
+}
+
+// scales a raw sample of the given depth to 8 bits
+static uint8_t to_u8(uint16_t v, uint8_t depth) {
+  switch (depth) {
+  case 16:
+    return (uint8_t)(v >> 8);
+  case 8:
+    return (uint8_t)v;
+  default:
+    return (uint8_t)(v * 255 / ((1u << depth) - 1));
+  }
+}
+
+static void expand_row(const png_info_t *info, const png_ctx_t *ctx,
+                       const uint8_t *row, uint8_t *dst) {
+  uint8_t depth = info->bit_depth;
+
+  for (uint32_t x = 0; x < info->width; x++, dst += 4) {
+    switch (info->color_type) {
+    case 3:
+      memcpy(dst, ctx->palette[sample_at(row, depth, x)], 4);
+      break;
+    case 0: {
+      uint16_t g = sample_at(row, depth, x);
+      dst[0] = dst[1] = dst[2] = to_u8(g, depth);
+      dst[3] = ctx->has_key && g == ctx->key[0] ? 0 : 255;
+      break;
+    }
+    case 4:
+      dst[0] = dst[1] = dst[2] = to_u8(sample_at(row, depth, x * 2), depth);
+      dst[3] = to_u8(sample_at(row, depth, x * 2 + 1), depth);
+      break;
+    case 2: {
+      uint16_t r = sample_at(row, depth, x * 3);
+      uint16_t g = sample_at(row, depth, x * 3 + 1);
+      uint16_t b = sample_at(row, depth, x * 3 + 2);
+      dst[0] = to_u8(r, depth);
+      dst[1] = to_u8(g, depth);
+      dst[2] = to_u8(b, depth);
+      dst[3] = ctx->has_key && r == ctx->key[0] && g == ctx->key[1] &&
+                       b == ctx->key[2]
+                   ? 0
+                   : 255;
+      break;
+    }
+    case 6:
+      for (int c = 0; c < 4; c++)
+        dst[c] = to_u8(sample_at(row, depth, x * 4 + c), depth);
+      break;
+    }
+  }
+}
+
+static void read_trns(const png_info_t *info, png_ctx_t *ctx,
+                      const uint8_t *data, uint32_t len) {
+  if (info->color_type == 3) {
+    for (uint32_t i = 0; i < len && i < 256; i++)
+      ctx->palette[i][3] = data[i];
+  } else if (info->color_type == 0 && len >= 2) {
+    ctx->has_key = true;
+    ctx->key[0] = (uint16_t)(data[0] << 8 | data[1]);
+  } else if (info->color_type == 2 && len >= 6) {
+    ctx->has_key = true;
+    for (int c = 0; c < 3; c++)
+      ctx->key[c] = (uint16_t)(data[c * 2] << 8 | data[c * 2 + 1]);
+  }
+}
+
+bool tile_png_decode_rgba(const uint8_t *png, size_t len, uint8_t *out,
+                          size_t out_size, uint32_t *out_width,
+                          uint32_t *out_height) {
+  png_info_t info;
+  if (!out || !tile_png_info(png, len, &info) || info.interlace != 0)
+    return false;
+  if ((size_t)info.width * info.height * 4 > out_size)
+    return false;
+
+  size_t bits = (size_t)png_channels(info.color_type) * info.bit_depth;
+  size_t stride = ((size_t)info.width * bits + 7) / 8;
+  size_t bpp = (bits + 7) / 8;
+
+  png_ctx_t ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  for (int i = 0; i < 256; i++)
+    ctx.palette[i][3] = 255;
+
+  // [filter byte | scanline] for the current and the previous row
+  uint8_t *rows = calloc(2, stride + 1);
+  if (!rows)
+    return false;
+  uint8_t *cur = rows, *prev = rows + stride + 1;
+
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  if (inflateInit(&zs) != Z_OK) {
+    free(rows);
+    return false;
+  }
+
+  bool ok = true;
+  uint32_t y = 0;
+  size_t filled = 0;
+  size_t pos = sizeof(png_signature);
+
+  while (ok && pos + 12 <= len) {
+    uint32_t chunk_len = read_u32(png + pos);
+    const uint8_t *type = png + pos + 4;
+    const uint8_t *data = png + pos + 8;
+    if (chunk_len > len - pos - 12) {
+      ok = false;
+      break;
+    }
+
+    if (memcmp(type, "PLTE", 4) == 0) {
+      for (uint32_t i = 0; i < chunk_len / 3 && i < 256; i++)
+        memcpy(ctx.palette[i], data + i * 3, 3);
+    } else if (memcmp(type, "tRNS", 4) == 0) {
+      read_trns(&info, &ctx, data, chunk_len);
+    } else if (memcmp(type, "IDAT", 4) == 0) {
+      zs.next_in = (Bytef *)data;
+      zs.avail_in = chunk_len;
+
+      while (y < info.height) {
+        zs.next_out = cur + filled;
+        zs.avail_out = (uInt)(stride + 1 - filled);
+
+        int ret = inflate(&zs, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END) {
+          ok = ret == Z_BUF_ERROR;
+          break;
+        }
+
+        filled = stride + 1 - zs.avail_out;
+        if (filled == stride + 1) {
+          if (!unfilter(cur[0], cur + 1, prev + 1, stride, bpp)) {
+            ok = false;
+            break;
+          }
+          expand_row(&info, &ctx, cur + 1,
+                     out + (size_t)y * info.width * 4);
+
+          uint8_t *tmp = prev;
+          prev = cur;
+          cur = tmp;
+          filled = 0;
+          y++;
+        }
+
+        if (ret == Z_STREAM_END)
+          break;
+        // all input consumed and nothing left pending, wait for the next IDAT
+        if (zs.avail_in == 0 && zs.avail_out != 0)
+          break;
+      }
+    } else if (memcmp(type, "IEND", 4) == 0) {
+      break;
+    }
+
+    pos += 12 + (size_t)chunk_len;
+  }
+
+  inflateEnd(&zs);
+  free(rows);
+
+  if (!ok || y != info.height)
+    return false;
+
+  if (out_width)
+    *out_width = info.width;
+  if (out_height)
+    *out_height = info.height;
+  return true;
+}
+
+// Output buffer of the encoder, grows as chunks are appended.
+typedef struct {
+  uint8_t *data;
+  size_t len;
+  size_t cap;
+} png_buf_t;
+
+#define PNG_IDAT_SIZE (64 * 1024)
+
+static bool buf_reserve(png_buf_t *b, size_t extra) {
+  if (b->len + extra <= b->cap)
+    return true;
+  size_t cap = b->cap ? b->cap : 4096;
+  while (cap < b->len + extra)
+    cap *= 2;
+  uint8_t *data = realloc(b->data, cap);
+  if (!data)
+    return false;
+  b->data = data;
+  b->cap = cap;
+  return true;
+}
+
+static void write_u32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)(v >> 24);
+  p[1] = (uint8_t)(v >> 16);
+  p[2] = (uint8_t)(v >> 8);
+  p[3] = (uint8_t)v;
+}
+
+static bool buf_chunk(png_buf_t *b, const char *type, const uint8_t *data,
+                      uint32_t len) {
+  if (!buf_reserve(b, (size_t)len + 12))
+    return false;
+  uint8_t *p = b->data + b->len;
+  write_u32(p, len);
+  memcpy(p + 4, type, 4);
+  if (len)
+    memcpy(p + 8, data, len);
+  uint32_t crc = (uint32_t)crc32(0, p + 4, len + 4);
+  write_u32(p + 8 + len, crc);
+  b->len += (size_t)len + 12;
+  return true;
+}
+
+// Residuals of all five filters for row[from..to) go to
+// scratch[f * stride + i], their sums of absolute (signed) values are added
+// to sums[f].
+static void filter_span(const uint8_t *row, const uint8_t *prev, size_t from,
+                        size_t to, size_t stride, size_t bpp,
+                        uint8_t *scratch, uint64_t sums[5]) {
+  for (size_t i = from; i < to; i++) {
+    uint8_t left = i >= bpp ? row[i - bpp] : 0;
+    uint8_t up = prev[i];
+    uint8_t up_left = i >= bpp ? prev[i - bpp] : 0;
+    uint8_t pred[5] = {0, left, up, (uint8_t)(((unsigned)left + up) >> 1),
+                       paeth(left, up, up_left)};
+    for (int f = 0; f < 5; f++) {
+      uint8_t r = (uint8_t)(row[i] - pred[f]);
+      scratch[(size_t)f * stride + i] = r;
+      sums[f] += (uint64_t)abs((int8_t)r);
+    }
+  }
+}
+
+#ifdef TILE_PNG_X86
+
+__attribute__((target("avx2"))) static inline __m256i
+paeth_epi16_avx2(__m256i a, __m256i b, __m256i c) {
+  __m256i pa = _mm256_abs_epi16(_mm256_sub_epi16(b, c));
+  __m256i pb = _mm256_abs_epi16(_mm256_sub_epi16(a, c));
+  __m256i pc = _mm256_abs_epi16(
+      _mm256_add_epi16(_mm256_sub_epi16(b, c), _mm256_sub_epi16(a, c)));
+  // a if pa <= pb && pa <= pc, else b if pb <= pc, else c
+  __m256i not_a =
+      _mm256_or_si256(_mm256_cmpgt_epi16(pa, pb), _mm256_cmpgt_epi16(pa, pc));
+  __m256i b_or_c = _mm256_blendv_epi8(b, c, _mm256_cmpgt_epi16(pb, pc));
+  return _mm256_blendv_epi8(a, b_or_c, not_a);
+}
+
+// 32 bytes per step from i = from on, i must be >= bpp. Returns where the
+// scalar loop has to continue.
+__attribute__((target("avx2"))) static size_t
+filter_span_avx2(const uint8_t *row, const uint8_t *prev, size_t from,
+                 size_t to, size_t stride, size_t bpp, uint8_t *scratch,
+                 uint64_t sums[5]) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i one = _mm256_set1_epi8(1);
+  __m256i acc[5] = {zero, zero, zero, zero, zero};
+  size_t i = from;
+
+  for (; i + 32 <= to; i += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(row + i));
+    __m256i a = _mm256_loadu_si256((const __m256i *)(row + i - bpp));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(prev + i));
+    __m256i c = _mm256_loadu_si256((const __m256i *)(prev + i - bpp));
+
+    // avg_epu8 rounds up, the PNG average filter rounds down
+    __m256i avg = _mm256_sub_epi8(
+        _mm256_avg_epu8(a, b), _mm256_and_si256(_mm256_xor_si256(a, b), one));
+    __m256i pae = _mm256_packus_epi16(
+        paeth_epi16_avx2(_mm256_unpacklo_epi8(a, zero),
+                         _mm256_unpacklo_epi8(b, zero),
+                         _mm256_unpacklo_epi8(c, zero)),
+        paeth_epi16_avx2(_mm256_unpackhi_epi8(a, zero),
+                         _mm256_unpackhi_epi8(b, zero),
+                         _mm256_unpackhi_epi8(c, zero)));
+
+    __m256i res[5] = {x, _mm256_sub_epi8(x, a), _mm256_sub_epi8(x, b),
+                      _mm256_sub_epi8(x, avg), _mm256_sub_epi8(x, pae)};
+    for (int f = 0; f < 5; f++) {
+      _mm256_storeu_si256((__m256i *)(scratch + (size_t)f * stride + i),
+                          res[f]);
+      acc[f] = _mm256_add_epi64(
+          acc[f], _mm256_sad_epu8(_mm256_abs_epi8(res[f]), zero));
+    }
+  }
+
+  for (int f = 0; f < 5; f++) {
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, acc[f]);
+    sums[f] += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  }
+  return i;
+}
+
+#endif
+
+// Filters row into out[1..stride] with the filter that has the smallest sum
+// of absolute (signed) residuals, the heuristic libpng uses. prev is a row of
+// zeros for the first row.
+static void filter_row(const uint8_t *row, const uint8_t *prev, size_t stride,
+                       size_t bpp, uint8_t *scratch, uint8_t *out) {
+  uint64_t sums[5] = {0, 0, 0, 0, 0};
+  size_t done = bpp < stride ? bpp : stride;
+  filter_span(row, prev, 0, done, stride, bpp, scratch, sums);
+#ifdef TILE_PNG_X86
+  if (tile_png_simd_active())
+    done = filter_span_avx2(row, prev, done, stride, stride, bpp, scratch,
+                            sums);
+#endif
+  filter_span(row, prev, done, stride, stride, bpp, scratch, sums);
+
+  int best = 0;
+  for (int f = 1; f < 5; f++) {
+    if (sums[f] < sums[best])
+      best = f;
+  }
+  out[0] = (uint8_t)best;
+  memcpy(out + 1, scratch + (size_t)best * stride, stride);
+}
+
+typedef struct {
+  uint8_t color_type;
+  uint8_t bit_depth;
+  uint32_t bits_per_pixel;
+  const uint8_t (*palette)[4]; // colour type 3 only
+  uint32_t palette_len;
+  int level;
+  int strategy;  // zlib deflate strategy
+  bool adaptive; // per row filter selection, filter none otherwise
+} png_format_t;
+
+// Shared by both encoders. Rows of pixels are stride bytes apart and already
+// packed at the format's bit depth. The palette is written as PLTE and, if
+// any entry is not opaque, tRNS.
+static bool encode_png(const uint8_t *pixels, uint32_t width, uint32_t height,
+                       size_t stride, const png_format_t *f, uint8_t **out,
+                       size_t *out_len) {
+  if (!pixels || !out || !out_len || width == 0 || height == 0)
+    return false;
+
+  size_t row_len = ((size_t)width * f->bits_per_pixel + 7) / 8;
+  size_t bpp = f->bits_per_pixel >= 8 ? f->bits_per_pixel / 8 : 1;
+  png_buf_t b = {0};
+  uint8_t *scratch = calloc(1, row_len * 7 + 1 + PNG_IDAT_SIZE);
+  if (!scratch || !buf_reserve(&b, sizeof(png_signature) + 25)) {
+    free(scratch);
+    free(b.data);
+    return false;
+  }
+  uint8_t *zero_row = scratch + row_len * 5;
+  uint8_t *filtered = zero_row + row_len;
+  uint8_t *zbuf = filtered + row_len + 1;
+
+  memcpy(b.data, png_signature, sizeof(png_signature));
+  b.len = sizeof(png_signature);
+
+  uint8_t ihdr[13];
+  write_u32(ihdr, width);
+  write_u32(ihdr + 4, height);
+  ihdr[8] = f->bit_depth;
+  ihdr[9] = f->color_type;
+  ihdr[10] = 0; // deflate
+  ihdr[11] = 0; // adaptive filtering
+  ihdr[12] = 0; // no interlace
+
+  bool ok = buf_chunk(&b, "IHDR", ihdr, sizeof(ihdr));
+
+  if (ok && f->color_type == 3) {
+    uint8_t plte[256 * 3], trns[256];
+    uint32_t trns_len = 0;
+    for (uint32_t i = 0; i < f->palette_len; i++) {
+      memcpy(plte + i * 3, f->palette[i], 3);
+      trns[i] = f->palette[i][3];
+      if (trns[i] != 255)
+        trns_len = i + 1;
+    }
+    ok = buf_chunk(&b, "PLTE", plte, f->palette_len * 3) &&
+         (!trns_len || buf_chunk(&b, "tRNS", trns, trns_len));
+  }
+
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  ok = ok && deflateInit2(&zs, f->level, Z_DEFLATED, 15, 8, f->strategy) ==
+                 Z_OK;
+
+  zs.next_out = zbuf;
+  zs.avail_out = PNG_IDAT_SIZE;
+
+  for (uint32_t y = 0; ok && y <= height; y++) {
+    int flush = Z_FINISH;
+    if (y < height) {
+      const uint8_t *row = pixels + (size_t)y * stride;
+      if (f->adaptive) {
+        filter_row(row, y ? row - stride : zero_row, row_len, bpp, scratch,
+                   filtered);
+      } else {
+        filtered[0] = 0;
+        memcpy(filtered + 1, row, row_len);
+      }
+      zs.next_in = filtered;
+      zs.avail_in = (uInt)(row_len + 1);
+      flush = Z_NO_FLUSH;
+    }
+
+    int ret;
+    do {
+      ret = deflate(&zs, flush);
+      if (ret == Z_STREAM_ERROR) {
+        ok = false;
+        break;
+      }
+      if (zs.avail_out == 0 || (flush == Z_FINISH && ret == Z_STREAM_END)) {
+        uint32_t n = PNG_IDAT_SIZE - zs.avail_out;
+        if (n && !buf_chunk(&b, "IDAT", zbuf, n)) {
+          ok = false;
+          break;
+        }
+        zs.next_out = zbuf;
+        zs.avail_out = PNG_IDAT_SIZE;
+      }
+    } while (zs.avail_in > 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+  }
+
+  deflateEnd(&zs);
+  free(scratch);
+
+  if (!ok || !buf_chunk(&b, "IEND", NULL, 0)) {
+    free(b.data);
+    return false;
+  }
+
+  *out = b.data;
+  *out_len = b.len;
+  return true;
+}
+
+bool tile_png_encode_rgba(const uint8_t *rgba, uint32_t width, uint32_t height,
+                          size_t stride, int level, uint8_t **out,
+                          size_t *out_len) {
+  const png_format_t f = {.color_type = 6, .bit_depth = 8,
+                          .bits_per_pixel = 32, .level = level,
+                          .strategy = Z_DEFAULT_STRATEGY, .adaptive = true};
+  return encode_png(rgba, width, height, stride, &f, out, out_len);
+}
+
+// Packs a row of local palette indices at depth bits per pixel, leftmost
+// pixel in the high bits as PNG wants it.
+static void pack_row(const uint8_t *indices, uint32_t width,
+                     const uint8_t *local, uint8_t depth, uint8_t *out) {
+  if (depth == 8) {
+    for (uint32_t x = 0; x < width; x++)
+      out[x] = local[indices[x]];
+    return;
+  }
+  uint32_t per_byte = 8 / depth;
+  for (uint32_t x = 0; x < width; x += per_byte) {
+    uint8_t byte = 0;
+    for (uint32_t k = 0; k < per_byte; k++) {
+      uint8_t v = x + k < width ? local[indices[x + k]] : 0;
+      byte |= (uint8_t)(v << (8 - depth * (k + 1)));
+    }
+    out[x / per_byte] = byte;
+  }
+}
+
+// Local palette order: transparent entries first, so tRNS stays one byte,
+// then the most frequent colours.
+static bool ranks_before(const uint8_t (*palette)[4], const uint64_t *counts,
+                         uint8_t a, uint8_t b) {
+  bool clear_a = palette[a][3] != 255, clear_b = palette[b][3] != 255;
+  if (clear_a != clear_b)
+    return clear_a;
+  if (counts[a] != counts[b])
+    return counts[a] > counts[b];
+  return a < b;
+}
+
+bool tile_png_encode_indexed(const uint8_t *indices, uint32_t width,
+                             uint32_t height, size_t stride,
+                             const uint8_t (*palette)[4], uint32_t palette_len,
+                             int level, tile_png_effort_t effort,
+                             uint8_t **out, size_t *out_len) {
+  if (!indices || !palette || palette_len == 0 || palette_len > 256 ||
+      width == 0 || height == 0)
+    return false;
+
+  // Only the entries the tile uses go into PLTE, so tiles with few colours
+  // are packed at 1, 2 or 4 bits per pixel.
+  uint64_t counts[256] = {0};
+  for (uint32_t y = 0; y < height; y++) {
+    const uint8_t *row = indices + (size_t)y * stride;
+    for (uint32_t x = 0; x < width; x++)
+      counts[row[x]]++;
+  }
+
+  uint8_t order[256];
+  uint32_t used = 0;
+  for (uint32_t i = 0; i < 256; i++) {
+    if (!counts[i])
+      continue;
+    if (i >= palette_len)
+      return false;
+    uint32_t j = used++;
+    for (; j > 0 && ranks_before(palette, counts, (uint8_t)i, order[j - 1]);
+         j--)
+      order[j] = order[j - 1];
+    order[j] = (uint8_t)i;
+  }
+
+  uint8_t local[256] = {0};
+  uint8_t local_palette[256][4];
+  for (uint32_t i = 0; i < used; i++) {
+    local[order[i]] = (uint8_t)i;
+    memcpy(local_palette[i], palette[order[i]], 4);
+  }
+
+  uint8_t depth = used <= 2 ? 1 : used <= 4 ? 2 : used <= 16 ? 4 : 8;
+  size_t row_len = ((size_t)width * depth + 7) / 8;
+  uint8_t *packed = malloc(row_len * height);
+  if (!packed)
+    return false;
+  for (uint32_t y = 0; y < height; y++)
+    pack_row(indices + (size_t)y * stride, width, local, depth,
+             packed + (size_t)y * row_len);
+
+  png_format_t f = {.color_type = 3, .bit_depth = depth,
+                    .bits_per_pixel = depth, .palette = local_palette,
+                    .palette_len = used, .level = level,
+                    .strategy = Z_DEFAULT_STRATEGY, .adaptive = false};
+  bool ok;
+  if (effort == TILE_PNG_FAST) {
+    ok = encode_png(packed, width, height, row_len, &f, out, out_len);
+  } else {
+    // Palette data usually compresses best unfiltered, but large flat areas
+    // next to dithering sometimes do better with per row filters: try both
+    // with both deflate strategies and keep the smallest.
+    ok = false;
+    f.level = 9;
+    for (int variant = 0; variant < 4; variant++) {
+      f.adaptive = variant & 1;
+      f.strategy = variant & 2 ? Z_FILTERED : Z_DEFAULT_STRATEGY;
+      uint8_t *png;
+      size_t png_len;
+      if (!encode_png(packed, width, height, row_len, &f, &png, &png_len))
+        continue;
+      if (ok && png_len >= *out_len) {
+        free(png);
+        continue;
+      }
+      if (ok)
+        free(*out);
+      *out = png;
+      *out_len = png_len;
+      ok = true;
+    }
+  }
+
+  free(packed);
+  return ok;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+  uint32_t width;
+  uint32_t height;
+  uint8_t bit_depth;
+  uint8_t color_type;
+  uint8_t interlace;
+} png_info_t;
+
+bool tile_png_info(const uint8_t *png, size_t len, png_info_t *info);
+
+// Decodes a non-interlaced PNG of any colour type into 8-bit RGBA written to
+// out, which must hold width * height * 4 bytes. Only two scanlines are
+// buffered besides out, so decoding into a recycled plane allocates nothing
+// proportional to the image.
+bool tile_png_decode_rgba(const uint8_t *png, size_t len, uint8_t *out,
+                          size_t out_size, uint32_t *out_width,
+                          uint32_t *out_height);
+
+// Filter selection of the encoders uses AVX2 when the CPU has it, can be
+// turned off to compare against the scalar code.
+void tile_png_set_simd(bool enabled);
+bool tile_png_simd_active(void);
+
+// Encodes 8-bit RGBA pixels, rows stride bytes apart, as a PNG. The result is
+// malloc'd and owned by the caller. level is the zlib compression level.
+bool tile_png_encode_rgba(const uint8_t *rgba, uint32_t width, uint32_t height,
+                          size_t stride, int level, uint8_t **out,
+                          size_t *out_len);
+
+typedef enum {
+  TILE_PNG_FAST, // one deflate pass at the given level, no filtering
+  TILE_PNG_MAX,  // level 9, filter and strategy variants, smallest wins
+} tile_png_effort_t;
+
+// Encodes one byte palette indices as a palette PNG. palette holds
+// palette_len RGBA entries; only the entries the image uses are written, so
+// images of up to 2, 4 or 16 colours are stored at 1, 2 or 4 bits per pixel.
+bool tile_png_encode_indexed(const uint8_t *indices, uint32_t width,
+                             uint32_t height, size_t stride,
+                             const uint8_t (*palette)[4], uint32_t palette_len,
+                             int level, tile_png_effort_t effort,
+                             uint8_t **out, size_t *out_len);
@@ -0,0 +1,345 @@
+#include "tile_reduce.h"
+#include "palette.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TILE_REDUCE_X86 1
+#endif
+
+static int g_simd = -1; // -1 = not probed yet
+
+bool tile_reduce_parse_mode(const char *name, tile_reduce_mode_t *mode) {
+  if (strcmp(name, "nearest") == 0)
+    *mode = TILE_REDUCE_NEAREST;
+  else if (strcmp(name, "box") == 0)
+    *mode = TILE_REDUCE_BOX;
+  else if (strcmp(name, "premul") == 0)
+    *mode = TILE_REDUCE_BOX_PREMUL;
+  else
+    return false;
+  return true;
+}
+
+void tile_reduce_set_simd(bool enabled) {
+#ifdef TILE_REDUCE_X86
+  g_simd = enabled && __builtin_cpu_supports("avx2");
+#else
+  (void)enabled;
+  g_simd = 0;
+#endif
+}
+
+bool tile_reduce_simd_active(void) {
+  if (g_simd < 0)
+    tile_reduce_set_simd(true);
+  return g_simd == 1;
+}
+
+// Scalar kernels, one output row from the two source rows r0 and r1. They
+// also finish the columns the SIMD kernels leave over.
+
+static void nearest_row(const uint8_t *r0, uint8_t *dst, uint32_t from,
+                        uint32_t out_w) {
+  for (uint32_t x = from; x < out_w; x++)
+    memcpy(dst + x * 4, r0 + x * 8, 4);
+}
+
+static void box_row(const uint8_t *r0, const uint8_t *r1, uint8_t *dst,
+                    uint32_t from, uint32_t out_w) {
+  for (uint32_t x = from; x < out_w; x++) {
+    const uint8_t *a = r0 + x * 8, *b = r1 + x * 8;
+    for (int c = 0; c < 4; c++)
+      dst[x * 4 + c] = (uint8_t)((a[c] + a[c + 4] + b[c] + b[c + 4] + 2) >> 2);
+  }
+}
+
+static void premul_row(const uint8_t *r0, const uint8_t *r1, uint8_t *dst,
+                       uint32_t from, uint32_t out_w) {
+  for (uint32_t x = from; x < out_w; x++) {
+    const uint8_t *px[4] = {r0 + x * 8, r0 + x * 8 + 4, r1 + x * 8,
+                            r1 + x * 8 + 4};
+    uint32_t sum_a = 0, sum[3] = {0, 0, 0};
+    for (int i = 0; i < 4; i++) {
+      sum_a += px[i][3];
+      for (int c = 0; c < 3; c++)
+        sum[c] += (uint32_t)px[i][c] * px[i][3];
+    }
+
+    uint8_t *out = dst + x * 4;
+    for (int c = 0; c < 3; c++)
+      out[c] = sum_a ? (uint8_t)((sum[c] + sum_a / 2) / sum_a) : 0;
+    out[3] = (uint8_t)((sum_a + 2) >> 2);
+  }
+}
+
+#ifdef TILE_REDUCE_X86
+
+__attribute__((target("avx2"))) static uint32_t
+nearest_row_avx2(const uint8_t *r0, uint8_t *dst, uint32_t out_w) {
+  const __m256i even = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+  uint32_t x = 0;
+  for (; x + 4 <= out_w; x += 4) {
+    __m256i px = _mm256_loadu_si256((const __m256i *)(r0 + x * 8));
+    px = _mm256_permutevar8x32_epi32(px, even);
+    _mm_storeu_si128((__m128i *)(dst + x * 4), _mm256_castsi256_si128(px));
+  }
+  return x;
+}
+
+// 8 source pixels of both rows -> 4 output pixels. Vertical sums are formed
+// in 16 bit lanes, then the even and odd pixels (one qword each) are added.
+__attribute__((target("avx2"))) static uint32_t
+box_row_avx2(const uint8_t *r0, const uint8_t *r1, uint8_t *dst,
+             uint32_t out_w) {
+  const __m256i two = _mm256_set1_epi16(2);
+  uint32_t x = 0;
+  for (; x + 4 <= out_w; x += 4) {
+    const uint8_t *a = r0 + x * 8, *b = r1 + x * 8;
+    __m256i lo = _mm256_add_epi16(
+        _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)a)),
+        _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)b)));
+    __m256i hi = _mm256_add_epi16(
+        _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(a + 16))),
+        _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(b + 16))));
+
+    lo = _mm256_add_epi16(_mm256_permute4x64_epi64(lo, 0x88),
+                          _mm256_permute4x64_epi64(lo, 0xDD));
+    hi = _mm256_add_epi16(_mm256_permute4x64_epi64(hi, 0x88),
+                          _mm256_permute4x64_epi64(hi, 0xDD));
+
+    __m256i sum = _mm256_permute2x128_si256(lo, hi, 0x20);
+    sum = _mm256_srli_epi16(_mm256_add_epi16(sum, two), 2);
+
+    __m256i packed = _mm256_packus_epi16(sum, sum);
+    packed = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+    _mm_storeu_si128((__m128i *)(dst + x * 4), _mm256_castsi256_si128(packed));
+  }
+  return x;
+}
+
+// Sums of one output pixel from the two 32 bit pixel lanes of top and
+// bottom: colour channels premultiplied, alpha as is.
+__attribute__((target("avx2"))) static inline __m128i
+premul_sum_avx2(__m256i top, __m256i bottom) {
+  __m256i at = _mm256_shuffle_epi32(top, 0xFF);
+  __m256i ab = _mm256_shuffle_epi32(bottom, 0xFF);
+  top = _mm256_blend_epi32(_mm256_mullo_epi32(top, at), top, 0x88);
+  bottom = _mm256_blend_epi32(_mm256_mullo_epi32(bottom, ab), bottom, 0x88);
+  __m256i v = _mm256_add_epi32(top, bottom);
+  return _mm_add_epi32(_mm256_castsi256_si128(v),
+                       _mm256_extracti128_si256(v, 1));
+}
+
+__attribute__((target("avx2"))) static inline __m128i
+premul_resolve_avx2(__m128i sum) {
+  __m128i sum_a = _mm_shuffle_epi32(sum, 0xFF);
+  // (sum + sum_a / 2) / sum_a, exact in float for these magnitudes
+  __m128 num = _mm_cvtepi32_ps(_mm_add_epi32(sum, _mm_srli_epi32(sum_a, 1)));
+  __m128i rgb = _mm_cvttps_epi32(_mm_div_ps(num, _mm_cvtepi32_ps(sum_a)));
+  rgb = _mm_andnot_si128(_mm_cmpeq_epi32(sum_a, _mm_setzero_si128()), rgb);
+  __m128i a = _mm_srli_epi32(_mm_add_epi32(sum, _mm_set1_epi32(2)), 2);
+  return _mm_blend_epi32(rgb, a, 0x8);
+}
+
+__attribute__((target("avx2"))) static uint32_t
+premul_row_avx2(const uint8_t *r0, const uint8_t *r1, uint8_t *dst,
+                uint32_t out_w) {
+  uint32_t x = 0;
+  for (; x + 2 <= out_w; x += 2) {
+    const uint8_t *a = r0 + x * 8, *b = r1 + x * 8;
+    __m256i a01 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)a));
+    __m256i a23 =
+        _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(a + 8)));
+    __m256i b01 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)b));
+    __m256i b23 =
+        _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(b + 8)));
+
+    __m128i p0 = premul_resolve_avx2(premul_sum_avx2(a01, b01));
+    __m128i p1 = premul_resolve_avx2(premul_sum_avx2(a23, b23));
+
+    __m128i packed = _mm_packus_epi32(p0, p1);
+    packed = _mm_packus_epi16(packed, packed);
+    _mm_storel_epi64((__m128i *)(dst + x * 4), packed);
+  }
+  return x;
+}
+
+#endif
+
+void tile_reduce_rgba(const uint8_t *src, uint32_t src_w, uint32_t src_h,
+                      size_t src_stride, uint8_t *dst, size_t dst_stride,
+                      tile_reduce_mode_t mode) {
+  uint32_t out_w = src_w / 2, out_h = src_h / 2;
+  bool simd = tile_reduce_simd_active();
+
+  for (uint32_t y = 0; y < out_h; y++) {
+    const uint8_t *r0 = src + (size_t)y * 2 * src_stride;
+    const uint8_t *r1 = r0 + src_stride;
+    uint8_t *out = dst + (size_t)y * dst_stride;
+    uint32_t done = 0;
+
+    switch (mode) {
+    case TILE_REDUCE_NEAREST:
+#ifdef TILE_REDUCE_X86
+      if (simd)
+        done = nearest_row_avx2(r0, out, out_w);
+#endif
+      nearest_row(r0, out, done, out_w);
+      break;
+    case TILE_REDUCE_BOX:
+#ifdef TILE_REDUCE_X86
+      if (simd)
+        done = box_row_avx2(r0, r1, out, out_w);
+#endif
+      box_row(r0, r1, out, done, out_w);
+      break;
+    case TILE_REDUCE_BOX_PREMUL:
+#ifdef TILE_REDUCE_X86
+      if (simd)
+        done = premul_row_avx2(r0, r1, out, out_w);
+#endif
+      premul_row(r0, r1, out, done, out_w);
+      break;
+    }
+  }
+  (void)simd;
+}
+
+static uint8_t mode_of(const uint8_t v[4]) {
+  if (v[0] == v[1] && v[0] == v[2] && v[0] == v[3])
+    return v[0];
+
+  int transparent = (v[0] == PALETTE_TRANSPARENT) +
+                    (v[1] == PALETTE_TRANSPARENT) +
+                    (v[2] == PALETTE_TRANSPARENT) +
+                    (v[3] == PALETTE_TRANSPARENT);
+  if (transparent >= 3)
+    return PALETTE_TRANSPARENT;
+
+  int best_count = 0;
+  uint8_t best = PALETTE_TRANSPARENT;
+  for (int i = 0; i < 4; i++) {
+    if (v[i] == PALETTE_TRANSPARENT)
+      continue;
+    int count = (v[i] == v[0]) + (v[i] == v[1]) + (v[i] == v[2]) +
+                (v[i] == v[3]);
+    if (count > best_count) {
+      best_count = count;
+      best = v[i];
+    }
+  }
+  return best;
+}
+
+#ifdef TILE_REDUCE_X86
+
+// Even and odd bytes of 64 source bytes, 32 each, in order.
+__attribute__((target("avx2"))) static inline void
+split_pairs_avx2(const uint8_t *row, __m256i *even, __m256i *odd) {
+  const __m256i low = _mm256_set1_epi16(0xFF);
+  __m256i a = _mm256_loadu_si256((const __m256i *)row);
+  __m256i b = _mm256_loadu_si256((const __m256i *)(row + 32));
+  *even = _mm256_permute4x64_epi64(
+      _mm256_packus_epi16(_mm256_and_si256(a, low), _mm256_and_si256(b, low)),
+      _MM_SHUFFLE(3, 1, 2, 0));
+  *odd = _mm256_permute4x64_epi64(
+      _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8)),
+      _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+// mode_of for 32 blocks at once: every pixel counts the pixels equal to it,
+// transparent ones count 0, and a later pixel only wins with a higher count,
+// so ties keep going to the earliest as in the scalar kernel.
+__attribute__((target("avx2"))) static uint32_t
+mode_row_avx2(const uint8_t *r0, const uint8_t *r1, uint8_t *dst,
+              uint32_t out_w) {
+  const __m256i zero = _mm256_setzero_si256(), one = _mm256_set1_epi8(1);
+  const __m256i two = _mm256_set1_epi8(2);
+  uint32_t x = 0;
+  for (; x + 32 <= out_w; x += 32) {
+    __m256i a, b, c, d;
+    split_pairs_avx2(r0 + x * 2, &a, &b);
+    split_pairs_avx2(r1 + x * 2, &c, &d);
+    // equality masks are -1, so subtracting them counts
+    __m256i ab = _mm256_cmpeq_epi8(a, b), ac = _mm256_cmpeq_epi8(a, c);
+    __m256i ad = _mm256_cmpeq_epi8(a, d), bc = _mm256_cmpeq_epi8(b, c);
+    __m256i bd = _mm256_cmpeq_epi8(b, d), cd = _mm256_cmpeq_epi8(c, d);
+    __m256i za = _mm256_cmpeq_epi8(a, zero), zb = _mm256_cmpeq_epi8(b, zero);
+    __m256i zc = _mm256_cmpeq_epi8(c, zero), zd = _mm256_cmpeq_epi8(d, zero);
+    __m256i na = _mm256_sub_epi8(_mm256_sub_epi8(one, ab),
+                                 _mm256_add_epi8(ac, ad));
+    __m256i nb = _mm256_sub_epi8(_mm256_sub_epi8(one, ab),
+                                 _mm256_add_epi8(bc, bd));
+    __m256i nc = _mm256_sub_epi8(_mm256_sub_epi8(one, ac),
+                                 _mm256_add_epi8(bc, cd));
+    __m256i nd = _mm256_sub_epi8(_mm256_sub_epi8(one, ad),
+                                 _mm256_add_epi8(bd, cd));
+    na = _mm256_andnot_si256(za, na);
+    nb = _mm256_andnot_si256(zb, nb);
+    nc = _mm256_andnot_si256(zc, nc);
+    nd = _mm256_andnot_si256(zd, nd);
+
+    __m256i best = a, count = na, wins;
+    wins = _mm256_cmpgt_epi8(nb, count);
+    best = _mm256_blendv_epi8(best, b, wins);
+    count = _mm256_max_epi8(count, nb);
+    wins = _mm256_cmpgt_epi8(nc, count);
+    best = _mm256_blendv_epi8(best, c, wins);
+    count = _mm256_max_epi8(count, nc);
+    wins = _mm256_cmpgt_epi8(nd, count);
+    best = _mm256_blendv_epi8(best, d, wins);
+
+    // three or four transparent pixels leave the block transparent
+    __m256i transparent = _mm256_sub_epi8(
+        zero, _mm256_add_epi8(_mm256_add_epi8(za, zb), _mm256_add_epi8(zc, zd)));
+    best = _mm256_andnot_si256(_mm256_cmpgt_epi8(transparent, two), best);
+    _mm256_storeu_si256((__m256i *)(dst + x), best);
+  }
+  return x;
+}
+
+#endif
+
+void tile_reduce_indices(const uint8_t *src, uint32_t src_w, uint32_t src_h,
+                         size_t src_stride, uint8_t *dst, size_t dst_stride) {
+  uint32_t out_w = src_w / 2, out_h = src_h / 2;
+  bool simd = tile_reduce_simd_active();
+
+  for (uint32_t y = 0; y < out_h; y++) {
+    const uint8_t *r0 = src + (size_t)y * 2 * src_stride;
+    const uint8_t *r1 = r0 + src_stride;
+    uint8_t *out = dst + (size_t)y * dst_stride;
+    uint32_t done = 0;
+#ifdef TILE_REDUCE_X86
+    if (simd)
+      done = mode_row_avx2(r0, r1, out, out_w);
+#endif
+
+    for (uint32_t x = done; x < out_w; x++) {
+      const uint8_t v[4] = {r0[x * 2], r0[x * 2 + 1], r1[x * 2],
+                            r1[x * 2 + 1]};
+      out[x] = mode_of(v);
+    }
+  }
+  (void)simd;
+}
+
+static uint32_t add_sat(uint32_t a, uint32_t b) {
+  return a + b < a ? UINT32_MAX : a + b;
+}
+
+void tile_reduce_sum_u32(const uint32_t *src, uint32_t src_w, uint32_t src_h,
+                         size_t src_stride, uint32_t *dst, size_t dst_stride) {
+  uint32_t out_w = src_w / 2, out_h = src_h / 2;
+
+  for (uint32_t y = 0; y < out_h; y++) {
+    const uint32_t *r0 = src + (size_t)y * 2 * src_stride;
+    const uint32_t *r1 = r0 + src_stride;
+    uint32_t *out = dst + (size_t)y * dst_stride;
+
+    for (uint32_t x = 0; x < out_w; x++)
+      out[x] = add_sat(add_sat(r0[x * 2], r0[x * 2 + 1]),
+                       add_sat(r1[x * 2], r1[x * 2 + 1]));
+  }
+}
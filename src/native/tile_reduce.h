@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+  TILE_REDUCE_NEAREST,    // top left pixel of every 2x2 block
+  TILE_REDUCE_BOX,        // per channel average, same as vips shrink(2, 2)
+  TILE_REDUCE_BOX_PREMUL, // average weighted by alpha, no dark fringes
+} tile_reduce_mode_t;
+
+bool tile_reduce_parse_mode(const char *name, tile_reduce_mode_t *mode);
+
+// Uses the AVX2 kernels when the CPU has them, can be turned off to compare
+// against the scalar kernels.
+void tile_reduce_set_simd(bool enabled);
+bool tile_reduce_simd_active(void);
+
+// Halves an RGBA image of src_w x src_h pixels (both even). The
+// src_w / 2 x src_h / 2 result is written to dst, whose rows are dst_stride
+// bytes apart, so four children can be reduced into the quadrants of one
+// parent plane.
+void tile_reduce_rgba(const uint8_t *src, uint32_t src_w, uint32_t src_h,
+                      size_t src_stride, uint8_t *dst, size_t dst_stride,
+                      tile_reduce_mode_t mode);
+
+// Halves a plane of palette indices (one byte per pixel) by keeping the most
+// frequent index of every 2x2 block, so parents only contain palette colours.
+// Ties go to the earliest pixel in top left, top right, bottom left, bottom
+// right order. Transparent (index 0) only wins when at least three of the
+// four pixels are transparent, so thin strokes survive the reduction.
+// Runs 32 blocks at a time with AVX2 when active.
+void tile_reduce_indices(const uint8_t *src, uint32_t src_w, uint32_t src_h,
+                         size_t src_stride, uint8_t *dst, size_t dst_stride);
+
+// Halves a grid of counts by summing every 2x2 block, saturating at
+// UINT32_MAX, so every level of a pyramid of counts has the same total.
+// Strides are in elements.
+void tile_reduce_sum_u32(const uint32_t *src, uint32_t src_w, uint32_t src_h,
+                         size_t src_stride, uint32_t *dst, size_t dst_stride);
@@ -0,0 +1,116 @@
+#include "tile_sched.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Weights of the individual signals, chosen so a tile that changes every sweep
+// always outranks a dense but static one, and a tile that produced a match
+// before outranks everything except the most active tiles.
+#define SCORE_CHANGE 128
+#define SCORE_DENSITY 32
+#define SCORE_MATCH 16384
+#define SCORE_NEIGHBOUR_MATCH 4096
+
+uint32_t sched_hash(const uint8_t *data, size_t len) {
+  // FNV-1a, only used to detect "same body as last sweep"
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    h ^= data[i];
+    h *= 16777619u;
+  }
+  // 0 is reserved for "tile did not exist"
+  return h ? h : 1;
+}
+
+uint8_t sched_density(const uint8_t *rgba, uint32_t width, uint32_t height) {
+  size_t total = (size_t)width * height;
+  if (!rgba || total == 0)
+    return 0;
+
+  size_t painted = 0;
+  for (size_t i = 0; i < total; i++)
+    painted += rgba[i * 4 + 3] != 0;
+
+  // round up so a single painted pixel is never reported as empty
+  return (uint8_t)((painted * 255 + total - 1) / total);
+}
+
+void sched_record(tile_stat_t *s, uint32_t hash, uint8_t density,
+                  bool matched) {
+  bool changed = s->sweeps > 0 && hash != s->hash;
+
+  // exponential decay by 1/4 per sweep, a change adds 64
+  uint32_t changes = s->changes - (s->changes >> 2) + (changed ? 64 : 0);
+  s->changes = changes > 255 ? 255 : (uint8_t)changes;
+
+  s->hash = hash;
+  s->density = density;
+  if (matched && s->matches < 255)
+    s->matches++;
+  if (s->sweeps < 255)
+    s->sweeps++;
+}
+
+uint16_t sched_score(const tile_stat_t *stats, uint32_t width, uint32_t height,
+                     uint32_t x, uint32_t y) {
+  const tile_stat_t *s = &stats[(size_t)y * width + x];
+
+  uint32_t score = (uint32_t)s->changes * SCORE_CHANGE +
+                   (uint32_t)s->density * SCORE_DENSITY +
+                   (uint32_t)s->matches * SCORE_MATCH;
+
+  // pumpkins are placed in clusters, so a match also raises the neighbours
+  for (int dy = -1; dy <= 1; dy++) {
+    for (int dx = -1; dx <= 1; dx++) {
+      int64_t nx = (int64_t)x + dx, ny = (int64_t)y + dy;
+      if ((dx == 0 && dy == 0) || nx < 0 || ny < 0 || nx >= width ||
+          ny >= height)
+        continue;
+      if (stats[(size_t)ny * width + nx].matches)
+        score += SCORE_NEIGHBOUR_MATCH;
+    }
+  }
+
+  // existing tiles first when everything else is equal
+  if (s->hash)
+    score += 1;
+
+  return score > UINT16_MAX ? UINT16_MAX : (uint16_t)score;
+}
+
+bool sched_build_order(const tile_stat_t *stats, uint32_t width,
+                       uint32_t height, uint32_t *order) {
+  if (!stats || !order || width == 0 || height == 0)
+    return false;
+
+  size_t count = (size_t)width * height;
+  uint16_t *scores = malloc(sizeof(uint16_t) * count);
+  uint32_t *buckets = calloc(UINT16_MAX + 1, sizeof(uint32_t));
+  if (!scores || !buckets) {
+    free(scores);
+    free(buckets);
+    return false;
+  }
+
+  for (uint32_t y = 0; y < height; y++) {
+    for (uint32_t x = 0; x < width; x++) {
+      uint16_t score = sched_score(stats, width, height, x, y);
+      scores[(size_t)y * width + x] = score;
+      buckets[score]++;
+    }
+  }
+
+  // counting sort, highest score first; stable so ties keep row-major order
+  uint32_t offset = 0;
+  for (int32_t score = UINT16_MAX; score >= 0; score--) {
+    uint32_t n = buckets[score];
+    buckets[score] = offset;
+    offset += n;
+  }
+
+  for (size_t i = 0; i < count; i++)
+    order[buckets[scores[i]]++] = (uint32_t)i;
+
+  free(scores);
+  free(buckets);
+  return true;
+}
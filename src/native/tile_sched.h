@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Per-tile statistics carried from one sweep to the next. The array of these
+// lives in a SharedArrayBuffer so every worker can update the tiles it pops
+// without going through the master.
+typedef struct {
+  uint32_t hash;    // hash of the last fetched PNG body, 0 if the tile was 404
+  uint8_t changes;  // decaying average of "body changed since last sweep"
+  uint8_t density;  // painted pixels / total pixels, scaled to 0..255
+  uint8_t matches;  // saturating count of sweeps that matched on this tile
+  uint8_t sweeps;   // saturating count of sweeps that visited this tile
+} tile_stat_t;
+
+uint32_t sched_hash(const uint8_t *data, size_t len);
+uint8_t sched_density(const uint8_t *rgba, uint32_t width, uint32_t height);
+void sched_record(tile_stat_t *s, uint32_t hash, uint8_t density, bool matched);
+uint16_t sched_score(const tile_stat_t *stats, uint32_t width, uint32_t height,
+                     uint32_t x, uint32_t y);
+bool sched_build_order(const tile_stat_t *stats, uint32_t width,
+                       uint32_t height, uint32_t *order);
@@ -0,0 +1,71 @@
+#include "tile_slab.h"
+#include <stdlib.h>
+#include <string.h>
+
+void tile_slab_destroy(tile_slab_t *s) {
+  if (!s)
+    return;
+  if (s->planes) {
+    for (uint32_t i = 0; i < s->allocated; i++)
+      free(s->planes[i]);
+  }
+  free(s->planes);
+  free(s->free_planes);
+  memset(s, 0, sizeof(*s));
+}
+
+bool tile_slab_init(tile_slab_t *s, size_t plane_size, uint32_t max_planes) {
+  if (!s || plane_size == 0 || max_planes == 0)
+    return false;
+
+  tile_slab_destroy(s);
+
+  s->planes = calloc(max_planes, sizeof(uint8_t *));
+  s->free_planes = malloc(sizeof(uint32_t) * max_planes);
+  if (!s->planes || !s->free_planes) {
+    tile_slab_destroy(s);
+    return false;
+  }
+
+  s->plane_size = (plane_size + TILE_SLAB_ALIGN - 1) &
+                  ~(size_t)(TILE_SLAB_ALIGN - 1);
+  s->max_planes = max_planes;
+  return true;
+}
+
+int32_t tile_slab_borrow(tile_slab_t *s) {
+  if (!s || !s->planes)
+    return -1;
+
+  uint32_t plane;
+  if (s->free_count > 0) {
+    plane = s->free_planes[--s->free_count];
+  } else if (s->allocated < s->max_planes) {
+    // only grow when every existing plane is borrowed
+    uint8_t *mem = aligned_alloc(TILE_SLAB_ALIGN, s->plane_size);
+    if (!mem)
+      return -1;
+    plane = s->allocated++;
+    s->planes[plane] = mem;
+  } else {
+    return -1;
+  }
+
+  if (++s->in_use > s->high_water)
+    s->high_water = s->in_use;
+  return (int32_t)plane;
+}
+
+bool tile_slab_return(tile_slab_t *s, uint32_t plane) {
+  if (!s || plane >= s->allocated || s->in_use == 0)
+    return false;
+  s->free_planes[s->free_count++] = plane;
+  s->in_use--;
+  return true;
+}
+
+uint8_t *tile_slab_plane(const tile_slab_t *s, uint32_t plane) {
+  if (!s || plane >= s->allocated)
+    return NULL;
+  return s->planes[plane];
+}
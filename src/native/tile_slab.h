@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TILE_SLAB_ALIGN 64
+
+// Pool of fixed size, cache line aligned planes for decoded tiles. Planes are
+// allocated on first use and recycled afterwards, never more than max_planes,
+// so the memory a thread spends on decoded tiles is bounded by
+// max_planes * plane_size. Not thread safe, every thread owns its own pool.
+typedef struct {
+  size_t plane_size; // rounded up to TILE_SLAB_ALIGN
+  uint32_t max_planes;
+  uint8_t **planes;      // [max_planes], NULL until first borrowed
+  uint32_t *free_planes; // stack of plane indices ready to be borrowed
+  uint32_t free_count;
+  uint32_t allocated;  // planes[0..allocated) exist
+  uint32_t in_use;     // currently borrowed
+  uint32_t high_water; // maximum of in_use since init
+} tile_slab_t;
+
+bool tile_slab_init(tile_slab_t *s, size_t plane_size, uint32_t max_planes);
+void tile_slab_destroy(tile_slab_t *s);
+int32_t tile_slab_borrow(tile_slab_t *s);
+bool tile_slab_return(tile_slab_t *s, uint32_t plane);
+uint8_t *tile_slab_plane(const tile_slab_t *s, uint32_t plane);
@@ -0,0 +1,51 @@
+#include "tile_source.h"
+#include "palette.h"
+#include "tile_png.h"
+#include <sys/stat.h>
+
+bool tile_source_open(tile_source_t *s, const char *path, uint32_t default_z) {
+  struct stat st;
+  s->path = path;
+  s->is_archive = false;
+  if (stat(path, &st) != 0)
+    return false;
+  s->is_archive = !S_ISDIR(st.st_mode);
+  return !s->is_archive || tile_archive_open(&s->archive, path, default_z);
+}
+
+void tile_source_close(tile_source_t *s) {
+  if (s->is_archive)
+    tile_archive_close(&s->archive);
+  s->is_archive = false;
+}
+
+size_t tile_source_scan_level(const tile_source_t *s, uint32_t z,
+                              uint8_t *occupied) {
+  return s->is_archive ? tile_archive_scan_level(&s->archive, z, occupied)
+                       : tile_io_scan_level(s->path, z, occupied);
+}
+
+bool tile_source_read(const tile_source_t *s, uint32_t z, uint32_t x,
+                      uint32_t y, tile_buf_t *buf, const uint8_t **data,
+                      size_t *len) {
+  if (s->is_archive)
+    return tile_archive_find(&s->archive, z, x, y, data, len);
+  char path[4096];
+  if (!tile_io_path(path, sizeof(path), s->path, z, x, y) ||
+      !tile_io_read(path, buf))
+    return false;
+  *data = buf->data;
+  *len = buf->len;
+  return true;
+}
+
+bool tile_source_decode_plane(const uint8_t *png, size_t len, uint32_t size,
+                              uint8_t *rgba, uint8_t *plane) {
+  size_t pixels = (size_t)size * size;
+  uint32_t width, height;
+  if (!tile_png_decode_rgba(png, len, rgba, pixels * 4, &width, &height) ||
+      width != size || height != size)
+    return false;
+  palette_rgba_to_indices(rgba, pixels, plane);
+  return true;
+}
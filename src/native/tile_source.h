@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tile_archive.h"
+#include "tile_io.h"
+
+// A release as the native tools take it: an extracted tile directory
+// (<root>/<z>/<x>/<y>.png), a release tar or a PMTiles archive, the latter
+// read in place.
+typedef struct {
+  const char *path;
+  bool is_archive;
+  tile_archive_t archive;
+} tile_source_t;
+
+// Tar entries named <dir>/<x>/<y>.png are taken to be at default_z.
+bool tile_source_open(tile_source_t *s, const char *path, uint32_t default_z);
+void tile_source_close(tile_source_t *s);
+
+// Marks occupied[y * 2^z + x] for every tile of level z.
+size_t tile_source_scan_level(const tile_source_t *s, uint32_t z,
+                              uint8_t *occupied);
+
+// Points data at the tile, read into buf for a directory and into the
+// mapping for an archive. Returns false if the release has no such tile.
+bool tile_source_read(const tile_source_t *s, uint32_t z, uint32_t x,
+                      uint32_t y, tile_buf_t *buf, const uint8_t **data,
+                      size_t *len);
+
+// Decodes a size x size tile to palette indices, through rgba which must
+// hold size * size * 4 bytes.
+bool tile_source_decode_plane(const uint8_t *png, size_t len, uint32_t size,
+                              uint8_t *rgba, uint8_t *plane);
@@ -0,0 +1,323 @@
+#define _DEFAULT_SOURCE
+#include "tile_untar.h"
+#include "tar_stream.h"
+#include "tile_io.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define QUEUE_DEPTH 256 // files waiting per writer
+
+typedef struct {
+  char *path;
+  char *link_from; // hard link to this path instead of writing data
+  uint8_t *data;
+  size_t len;
+} write_job_t;
+
+typedef struct {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty, not_full;
+  write_job_t jobs[QUEUE_DEPTH];
+  size_t head, count;
+  bool done;
+  char last_dir[4096]; // directory created last, most tiles share it
+  tile_buf_t copy;     // for links where hard links are not possible
+  tile_untar_t *u;
+} writer_t;
+
+struct tile_untar {
+  tar_stream_t stream;
+  char *out_dir;
+  writer_t *writers;
+  uint32_t writer_count, started;
+  bool corrupt;
+  atomic_bool aborted;
+  atomic_uint_fast64_t files, links, dirs, bytes, skipped, failed;
+};
+
+// Relative name without leading "./", or NULL if it would leave out_dir.
+static const char *safe_name(const char *name) {
+  while (name[0] == '.' && name[1] == '/')
+    name += 2;
+  if (name[0] == '\0' || name[0] == '/')
+    return NULL;
+  for (const char *p = name; *p;) {
+    if (p[0] == '.' && p[1] == '.' && (p[2] == '/' || p[2] == '\0'))
+      return NULL;
+    const char *slash = strchr(p, '/');
+    if (!slash)
+      break;
+    p = slash + 1;
+  }
+  return name;
+}
+
+static char *join(const tile_untar_t *u, const char *name) {
+  size_t a = strlen(u->out_dir), b = strlen(name);
+  char *path = malloc(a + b + 2);
+  if (!path)
+    return NULL;
+  memcpy(path, u->out_dir, a);
+  path[a] = '/';
+  memcpy(path + a + 1, name, b + 1);
+  // directory entries end in a slash
+  while (b > 0 && path[a + b] == '/')
+    path[a + b--] = '\0';
+  return path;
+}
+
+static bool ensure_dir(writer_t *w, const char *path) {
+  const char *slash = strrchr(path, '/');
+  size_t len = slash ? (size_t)(slash - path) : 0;
+  if (len < sizeof(w->last_dir) && strncmp(w->last_dir, path, len) == 0 &&
+      w->last_dir[len] == '\0')
+    return true;
+  if (!tile_io_mkdirs_for(path))
+    return false;
+  if (len < sizeof(w->last_dir)) {
+    memcpy(w->last_dir, path, len);
+    w->last_dir[len] = '\0';
+  }
+  return true;
+}
+
+static bool write_file(const char *path, const uint8_t *data, size_t len) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return false;
+  bool ok = true;
+  while (ok && len > 0) {
+    ssize_t n = write(fd, data, len);
+    ok = n > 0;
+    if (ok) {
+      data += n;
+      len -= (size_t)n;
+    }
+  }
+  return close(fd) == 0 && ok;
+}
+
+static void run_job(writer_t *w, write_job_t *job) {
+  tile_untar_t *u = w->u;
+  bool ok = ensure_dir(w, job->path);
+  if (ok && job->link_from) {
+    // like tar -x, an existing file is replaced
+    if (unlink(job->path) != 0 && errno != ENOENT)
+      ok = false;
+    ok = ok && tile_io_link(job->link_from, job->path, &w->copy);
+    if (ok)
+      atomic_fetch_add(&u->links, 1);
+  } else if (ok) {
+    ok = write_file(job->path, job->data, job->len);
+    if (ok) {
+      atomic_fetch_add(&u->files, 1);
+      atomic_fetch_add(&u->bytes, job->len);
+    }
+  }
+  if (!ok)
+    atomic_fetch_add(&u->failed, 1);
+  free(job->path);
+  free(job->link_from);
+  free(job->data);
+}
+
+static void *writer_main(void *arg) {
+  writer_t *w = arg;
+  for (;;) {
+    pthread_mutex_lock(&w->lock);
+    while (w->count == 0 && !w->done)
+      pthread_cond_wait(&w->not_empty, &w->lock);
+    if (w->count == 0) {
+      pthread_mutex_unlock(&w->lock);
+      return NULL;
+    }
+    write_job_t job = w->jobs[w->head];
+    w->head = (w->head + 1) % QUEUE_DEPTH;
+    w->count--;
+    pthread_cond_signal(&w->not_full);
+    pthread_mutex_unlock(&w->lock);
+    if (atomic_load(&w->u->aborted)) {
+      free(job.path);
+      free(job.link_from);
+      free(job.data);
+      continue;
+    }
+    run_job(w, &job);
+  }
+}
+
+// False once the extraction is aborted, the job is dropped then.
+static bool enqueue(writer_t *w, write_job_t *job) {
+  pthread_mutex_lock(&w->lock);
+  while (w->count == QUEUE_DEPTH && !atomic_load(&w->u->aborted))
+    pthread_cond_wait(&w->not_full, &w->lock);
+  bool ok = !atomic_load(&w->u->aborted);
+  if (ok) {
+    w->jobs[(w->head + w->count) % QUEUE_DEPTH] = *job;
+    w->count++;
+    pthread_cond_signal(&w->not_empty);
+  }
+  pthread_mutex_unlock(&w->lock);
+  if (!ok) {
+    free(job->path);
+    free(job->link_from);
+    free(job->data);
+  }
+  return ok;
+}
+
+// FNV-1a. A link goes to the writer of its target, which then has
+// written the target before it gets to the link.
+static writer_t *writer_for(tile_untar_t *u, const char *path) {
+  uint32_t h = 2166136261u;
+  for (; *path; path++)
+    h = (h ^ (uint8_t)*path) * 16777619u;
+  return &u->writers[h % u->writer_count];
+}
+
+static bool on_entry(void *ctx, const tar_entry_t *e) {
+  tile_untar_t *u = ctx;
+  const char *name = safe_name(e->name);
+  const char *target = e->type == TAR_LINK ? safe_name(e->link_name) : NULL;
+  if (!name || e->type == TAR_OTHER || (e->type == TAR_LINK && !target) ||
+      (e->type == TAR_FILE && !e->data)) {
+    atomic_fetch_add(&u->skipped, 1);
+    return true;
+  }
+
+  write_job_t job = {.path = join(u, name)};
+  if (!job.path)
+    return false;
+
+  if (e->type == TAR_DIR) {
+    bool ok = tile_io_mkdirs_for(job.path) &&
+              (mkdir(job.path, 0755) == 0 || errno == EEXIST);
+    atomic_fetch_add(ok ? &u->dirs : &u->failed, 1);
+    free(job.path);
+    return true;
+  }
+
+  if (e->type == TAR_LINK) {
+    job.link_from = join(u, target);
+    if (!job.link_from) {
+      free(job.path);
+      return false;
+    }
+    return enqueue(writer_for(u, job.link_from), &job);
+  }
+
+  job.len = (size_t)e->size;
+  job.data = malloc(job.len ? job.len : 1);
+  if (!job.data) {
+    free(job.path);
+    return false;
+  }
+  memcpy(job.data, e->data, job.len);
+  return enqueue(writer_for(u, job.path), &job);
+}
+
+tile_untar_t *tile_untar_create(const char *out_dir, bool gzip,
+                                uint32_t writers) {
+  if (writers == 0)
+    writers = 1;
+  tile_untar_t *u = calloc(1, sizeof(*u));
+  if (!u)
+    return NULL;
+  u->out_dir = strdup(out_dir);
+  u->writers = calloc(writers, sizeof(writer_t));
+  u->writer_count = writers;
+  if (!u->out_dir || !u->writers ||
+      !tar_stream_init(&u->stream, gzip, on_entry, u)) {
+    free(u->out_dir);
+    free(u->writers);
+    free(u);
+    return NULL;
+  }
+
+  for (uint32_t i = 0; i < writers; i++) {
+    writer_t *w = &u->writers[i];
+    w->u = u;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->not_empty, NULL);
+    pthread_cond_init(&w->not_full, NULL);
+    if (pthread_create(&w->thread, NULL, writer_main, w) != 0)
+      break;
+    u->started++;
+  }
+  u->writer_count = u->started;
+  if (u->started == 0) {
+    tile_untar_destroy(u);
+    return NULL;
+  }
+  return u;
+}
+
+bool tile_untar_push(tile_untar_t *u, const uint8_t *data, size_t len) {
+  if (!u->corrupt &&
+      (atomic_load(&u->aborted) || !tar_stream_push(&u->stream, data, len)))
+    u->corrupt = true;
+  return !u->corrupt;
+}
+
+void tile_untar_abort(tile_untar_t *u) {
+  atomic_store(&u->aborted, true);
+  for (uint32_t i = 0; i < u->writer_count; i++) {
+    writer_t *w = &u->writers[i];
+    pthread_mutex_lock(&w->lock);
+    pthread_cond_broadcast(&w->not_full);
+    pthread_mutex_unlock(&w->lock);
+  }
+}
+
+// Lets the writers drain their queues and exit.
+static void stop_writers(tile_untar_t *u) {
+  for (uint32_t i = 0; i < u->started; i++) {
+    writer_t *w = &u->writers[i];
+    pthread_mutex_lock(&w->lock);
+    w->done = true;
+    pthread_cond_signal(&w->not_empty);
+    pthread_mutex_unlock(&w->lock);
+  }
+  for (uint32_t i = 0; i < u->started; i++)
+    pthread_join(u->writers[i].thread, NULL);
+  u->started = 0;
+}
+
+bool tile_untar_finish(tile_untar_t *u, tile_untar_stats_t *stats) {
+  stop_writers(u);
+  if (stats)
+    *stats = (tile_untar_stats_t){.files = atomic_load(&u->files),
+                                  .links = atomic_load(&u->links),
+                                  .dirs = atomic_load(&u->dirs),
+                                  .bytes = atomic_load(&u->bytes),
+                                  .skipped = atomic_load(&u->skipped),
+                                  .failed = atomic_load(&u->failed)};
+  return !u->corrupt && !atomic_load(&u->aborted) &&
+         tar_stream_finish(&u->stream) &&
+         atomic_load(&u->failed) == 0;
+}
+
+void tile_untar_destroy(tile_untar_t *u) {
+  if (!u)
+    return;
+  stop_writers(u);
+  for (uint32_t i = 0; i < u->writer_count; i++) {
+    writer_t *w = &u->writers[i];
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->not_empty);
+    pthread_cond_destroy(&w->not_full);
+    tile_buf_free(&w->copy);
+  }
+  tar_stream_destroy(&u->stream);
+  free(u->writers);
+  free(u->out_dir);
+  free(u);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Extracts a tar.gz as it arrives. Chunks are inflated and parsed on the
+// pushing thread, files are written by a few writer threads so the many
+// small creates and writes overlap with inflating. Every writer has a
+// bounded queue, a push blocks while the writer it needs is full, which
+// bounds memory and slows the producer down to the disk.
+typedef struct tile_untar tile_untar_t;
+
+typedef struct {
+  uint64_t files, links, dirs;
+  uint64_t bytes;   // file bytes written
+  uint64_t skipped; // entries not extracted: unsafe names, special files
+  uint64_t failed;  // files or links that could not be written
+} tile_untar_stats_t;
+
+// Writes below out_dir, which must exist.
+tile_untar_t *tile_untar_create(const char *out_dir, bool gzip,
+                                uint32_t writers);
+// Returns false once the stream is corrupt, later pushes keep failing.
+bool tile_untar_push(tile_untar_t *u, const uint8_t *data, size_t len);
+// Stops an extraction that will not be finished, from any thread: a push
+// blocked on a full writer returns, and later pushes and finish fail. Files
+// queued but not written yet are dropped.
+void tile_untar_abort(tile_untar_t *u);
+// Waits for the writers. Returns true if the archive was complete and every
+// entry was written.
+bool tile_untar_finish(tile_untar_t *u, tile_untar_stats_t *stats);
+void tile_untar_destroy(tile_untar_t *u);
@@ -0,0 +1,276 @@
+// Reports what changed between two releases at one zoom level, by default
+// the z=11 base tiles.
+//
+//   tilediff [--z Z] [--threads N] [--tile-size PX] [--masks DIR]
+//            [--no-simd] A B > changes.txt
+//
+// A and B are extracted tile directories (<root>/<z>/<x>/<y>.png), release
+// tars or PMTiles archives, which are read in place. Both are walked in
+// parallel over the union of their tiles. Tiles with identical bytes are
+// settled without decoding, the others are decoded to palette planes and
+// compared pixel by pixel.
+//
+// Every tile that differs is printed as
+//   x y status pixels min_x min_y max_x max_y
+// with status changed, added or removed and the inclusive bounding box of
+// the changed pixels, so the list can be passed to pyramid --changed as is.
+// With --masks, a two colour PNG marking the changed pixels is written to
+// DIR/<z>/<x>/<y>.png for each of them.
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "palette.h"
+#include "thread_pool.h"
+#include "tile_diff.h"
+#include "tile_io.h"
+#include "tile_png.h"
+#include "tile_source.h"
+
+typedef enum {
+  SAME_BYTES,
+  SAME_PIXELS, // re-encoded, or transparent where the other has no tile
+  CHANGED,
+  ADDED,
+  REMOVED,
+  FAILED, // unreadable tile or mask not written
+  STATUS_COUNT
+} status_t;
+
+static const char *status_names[] = {"same",  "same",    "changed",
+                                     "added", "removed", "failed"};
+
+typedef struct {
+  tile_buf_t buf[2];
+  uint8_t *rgba;
+  uint8_t *plane[2];
+  uint8_t *mask;
+} worker_t;
+
+typedef struct {
+  tile_source_t src[2];
+  uint32_t z, tile_size;
+  const char *masks;
+  uint32_t *tiles; // x << 16 | y of every tile in either release
+  size_t count;
+  tile_diff_t *diffs; // per tile
+  uint8_t *status;    // per tile
+  worker_t *workers;
+} job_t;
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s [--z Z] [--threads N] [--tile-size PX] [--masks DIR]\n"
+          "          [--no-simd] A B\n",
+          argv0);
+}
+
+static bool write_mask(const job_t *j, worker_t *w, uint32_t x, uint32_t y) {
+  static const uint8_t colors[2][4] = {{0, 0, 0, 0}, {255, 0, 0, 255}};
+  char path[4096];
+  uint8_t *png;
+  size_t png_len;
+  if (!tile_io_path(path, sizeof(path), j->masks, j->z, x, y) ||
+      !tile_io_mkdirs_for(path) ||
+      !tile_png_encode_indexed(w->mask, j->tile_size, j->tile_size,
+                               j->tile_size, colors, 2, 6, TILE_PNG_FAST,
+                               &png, &png_len))
+    return false;
+  bool ok = tile_io_write(path, png, png_len);
+  free(png);
+  return ok;
+}
+
+static void diff_job(void *ctx, size_t item, uint32_t thread) {
+  job_t *j = ctx;
+  worker_t *w = &j->workers[thread];
+  uint32_t x = j->tiles[item] >> 16, y = j->tiles[item] & 0xFFFF;
+  size_t pixels = (size_t)j->tile_size * j->tile_size;
+
+  const uint8_t *data[2] = {NULL, NULL};
+  size_t len[2] = {0, 0};
+  bool has[2];
+  for (int i = 0; i < 2; i++)
+    has[i] = tile_source_read(&j->src[i], j->z, x, y, &w->buf[i], &data[i],
+                              &len[i]);
+
+  if (has[0] && has[1] && len[0] == len[1] &&
+      memcmp(data[0], data[1], len[0]) == 0) {
+    j->status[item] = SAME_BYTES;
+    return;
+  }
+
+  // a missing tile is transparent
+  for (int i = 0; i < 2; i++) {
+    if (!has[i]) {
+      memset(w->plane[i], PALETTE_TRANSPARENT, pixels);
+    } else if (!tile_source_decode_plane(data[i], len[i], j->tile_size,
+                                         w->rgba, w->plane[i])) {
+      fprintf(stderr, "\nSkipping unreadable tile %u/%u/%u of %s\n", j->z, x,
+              y, j->src[i].path);
+      j->status[item] = FAILED;
+      return;
+    }
+  }
+
+  tile_diff_t *d = &j->diffs[item];
+  tile_diff_planes(w->plane[0], w->plane[1], j->tile_size, j->tile_size,
+                   j->tile_size, j->masks ? w->mask : NULL, d);
+  if (!d->changed)
+    j->status[item] = SAME_PIXELS;
+  else if (j->masks && !write_mask(j, w, x, y))
+    j->status[item] = FAILED;
+  else
+    j->status[item] = !has[0] ? ADDED : !has[1] ? REMOVED : CHANGED;
+}
+
+// Every tile of either release, x major like the tar and directory order.
+static bool collect_tiles(job_t *j) {
+  size_t dim = (size_t)1 << j->z;
+  uint8_t *occupied[2] = {calloc(dim * dim, 1), calloc(dim * dim, 1)};
+  bool ok = occupied[0] && occupied[1];
+  for (int i = 0; ok && i < 2; i++) {
+    size_t found = tile_source_scan_level(&j->src[i], j->z, occupied[i]);
+    fprintf(stderr, "Found %zu tiles at z=%u in %s\n", found, j->z,
+            j->src[i].path);
+  }
+
+  for (size_t i = 0; ok && i < dim * dim; i++)
+    j->count += occupied[0][i] | occupied[1][i];
+  j->tiles = ok ? malloc((j->count ? j->count : 1) * sizeof(uint32_t)) : NULL;
+  j->diffs = ok ? calloc(j->count ? j->count : 1, sizeof(tile_diff_t)) : NULL;
+  j->status = ok ? calloc(j->count ? j->count : 1, 1) : NULL;
+  ok = j->tiles && j->diffs && j->status;
+
+  size_t n = 0;
+  for (size_t x = 0; ok && x < dim; x++) {
+    for (size_t y = 0; y < dim; y++) {
+      if (occupied[0][y * dim + x] | occupied[1][y * dim + x])
+        j->tiles[n++] = (uint32_t)(x << 16 | y);
+    }
+  }
+  free(occupied[0]);
+  free(occupied[1]);
+  return ok;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+  uint32_t z = 11, tile_size = 1000;
+  uint32_t threads = thread_pool_default_threads();
+  const char *masks = NULL, *paths[2] = {NULL, NULL};
+  int npaths = 0;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+    if (strcmp(arg, "--no-simd") == 0) {
+      tile_diff_set_simd(false);
+      continue;
+    }
+    if (strncmp(arg, "--", 2) != 0 && npaths < 2) {
+      paths[npaths++] = arg;
+      continue;
+    }
+    if (!val) {
+      usage(argv[0]);
+      return 1;
+    }
+    i++;
+    if (strcmp(arg, "--z") == 0)
+      z = (uint32_t)atoi(val);
+    else if (strcmp(arg, "--threads") == 0)
+      threads = (uint32_t)atoi(val);
+    else if (strcmp(arg, "--tile-size") == 0)
+      tile_size = (uint32_t)atoi(val);
+    else if (strcmp(arg, "--masks") == 0)
+      masks = val;
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (npaths != 2 || z > 14 || tile_size == 0 || threads == 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  job_t j = {.z = z, .tile_size = tile_size, .masks = masks};
+  for (int i = 0; i < 2; i++) {
+    if (!tile_source_open(&j.src[i], paths[i], z)) {
+      fprintf(stderr, "Failed to open %s\n", paths[i]);
+      if (i)
+        tile_source_close(&j.src[0]);
+      return 1;
+    }
+  }
+
+  double start = now();
+  size_t pixels = (size_t)tile_size * tile_size;
+  j.workers = calloc(threads, sizeof(worker_t));
+  bool ok = j.workers != NULL;
+  for (uint32_t t = 0; ok && t < threads; t++) {
+    worker_t *w = &j.workers[t];
+    w->rgba = malloc(pixels * 4);
+    w->plane[0] = malloc(pixels);
+    w->plane[1] = malloc(pixels);
+    w->mask = malloc(pixels);
+    ok = w->rgba && w->plane[0] && w->plane[1] && w->mask;
+  }
+  ok = ok && collect_tiles(&j);
+  if (!ok) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+
+  fprintf(stderr, "Comparing %zu tiles on %u threads (%s kernel)\n", j.count,
+          threads, tile_diff_simd_active() ? "avx2" : "scalar");
+  thread_pool_for(threads, j.count, diff_job, &j);
+
+  size_t totals[STATUS_COUNT] = {0};
+  uint64_t changed_pixels = 0;
+  for (size_t i = 0; i < j.count; i++) {
+    const tile_diff_t *d = &j.diffs[i];
+    totals[j.status[i]]++;
+    if (j.status[i] < CHANGED || j.status[i] == FAILED)
+      continue;
+    changed_pixels += d->changed;
+    printf("%u %u %s %u %u %u %u %u\n", j.tiles[i] >> 16, j.tiles[i] & 0xFFFF,
+           status_names[j.status[i]], d->changed, d->min_x, d->min_y,
+           d->max_x, d->max_y);
+  }
+
+  fprintf(stderr,
+          "%zu tiles in %.1fs: %zu identical, %zu re-encoded, %zu changed, "
+          "%zu added, %zu removed, %llu pixels changed\n",
+          j.count, now() - start, totals[SAME_BYTES], totals[SAME_PIXELS],
+          totals[CHANGED], totals[ADDED], totals[REMOVED],
+          (unsigned long long)changed_pixels);
+  if (totals[FAILED])
+    fprintf(stderr, "%zu tiles failed\n", totals[FAILED]);
+
+  for (uint32_t t = 0; t < threads; t++) {
+    worker_t *w = &j.workers[t];
+    tile_buf_free(&w->buf[0]);
+    tile_buf_free(&w->buf[1]);
+    free(w->rgba);
+    free(w->plane[0]);
+    free(w->plane[1]);
+    free(w->mask);
+  }
+  free(j.workers);
+  free(j.tiles);
+  free(j.diffs);
+  free(j.status);
+  tile_source_close(&j.src[0]);
+  tile_source_close(&j.src[1]);
+  return totals[FAILED] ? 1 : 0;
+}
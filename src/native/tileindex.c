@@ -0,0 +1,352 @@
+// Finds where a template was drawn in a release, through an index of the
+// 4x4 palette blocks of its base tiles (tile_index.h):
+//
+//   tileindex build [--threads N] [--tile-size PX] --out FILE RELEASE
+//   tileindex find [--threads N] [--scan] --index FILE TEMPLATE RELEASE
+//
+// RELEASE is a tile directory, release tar or PMTiles archive. build decodes
+// every z=11 tile once and writes the index, find looks up the template's
+// blocks, intersects the tiles listing them and only decodes those to check
+// them with pumpkin_find, instead of all of them. --scan checks every tile
+// of the index, for comparison.
+//
+// TEMPLATE is a PNG whose opaque pixels have to match, taken as their
+// palette colours. Every match is printed as
+//   x y px py
+// the tile and the pixel of the template's first opaque pixel in it, as
+// pumpkin_find reports it. Only matches within one tile are found.
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "palette.h"
+#include "pumpkin_core.h"
+#include "thread_pool.h"
+#include "tile_index.h"
+#include "tile_io.h"
+#include "tile_png.h"
+#include "tile_source.h"
+
+#define BASE_Z 11
+#define BATCH 256 // tiles hashed in parallel, then added in order
+
+typedef struct {
+  tile_buf_t buf;
+  uint8_t *rgba;
+  uint8_t *plane;
+} worker_t;
+
+typedef struct {
+  tile_source_t src;
+  uint32_t tile_size;
+  worker_t *workers;
+  const uint32_t *tiles; // x << 16 | y
+  // build
+  uint32_t *hashes[BATCH];
+  size_t hash_count[BATCH];
+  // find
+  const pumpkin_t *template;
+  uint32_t *found; // px << 16 | py
+  uint8_t *status;
+} job_t;
+
+enum { MISS, HIT, FAILED };
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s build [--threads N] [--tile-size PX] --out FILE RELEASE\n"
+          "       %s find [--threads N] [--scan] --index FILE TEMPLATE "
+          "RELEASE\n",
+          argv0, argv0);
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Reads and decodes a tile of the release into the worker's plane.
+static int load_tile(job_t *j, worker_t *w, uint32_t tile) {
+  uint32_t x = tile >> 16, y = tile & 0xFFFF;
+  const uint8_t *data;
+  size_t len;
+  if (!tile_source_read(&j->src, BASE_Z, x, y, &w->buf, &data, &len))
+    return MISS;
+  if (!tile_source_decode_plane(data, len, j->tile_size, w->rgba, w->plane)) {
+    fprintf(stderr, "\nSkipping unreadable tile %u/%u of %s\n", x, y,
+            j->src.path);
+    return FAILED;
+  }
+  return HIT;
+}
+
+static void hash_job(void *ctx, size_t item, uint32_t thread) {
+  job_t *j = ctx;
+  worker_t *w = &j->workers[thread];
+  j->hash_count[item] = 0;
+  if (load_tile(j, w, j->tiles[item]) == HIT)
+    j->hash_count[item] =
+        tile_index_tile_hashes(w->plane, j->tile_size, j->hashes[item]);
+}
+
+static void find_job(void *ctx, size_t item, uint32_t thread) {
+  job_t *j = ctx;
+  worker_t *w = &j->workers[thread];
+  int status = load_tile(j, w, j->tiles[item]);
+  uint32_t px, py;
+  // in palette colours, as the template
+  if (status == HIT) {
+    size_t pixels = (size_t)j->tile_size * j->tile_size;
+    palette_indices_to_rgba(w->plane, pixels, w->rgba);
+    status = pumpkin_find(j->template, w->rgba, j->tile_size, j->tile_size, 4,
+                          &px, &py)
+                 ? HIT
+                 : MISS;
+  }
+  j->status[item] = (uint8_t)status;
+  j->found[item] = status == HIT ? px << 16 | py : 0;
+}
+
+static bool init_workers(job_t *j, uint32_t threads) {
+  size_t pixels = (size_t)j->tile_size * j->tile_size;
+  j->workers = calloc(threads, sizeof(worker_t));
+  bool ok = j->workers != NULL;
+  for (uint32_t t = 0; ok && t < threads; t++) {
+    j->workers[t].rgba = malloc(pixels * 4);
+    j->workers[t].plane = malloc(pixels);
+    ok = j->workers[t].rgba && j->workers[t].plane;
+  }
+  return ok;
+}
+
+static void free_workers(job_t *j, uint32_t threads) {
+  for (uint32_t t = 0; j->workers && t < threads; t++) {
+    tile_buf_free(&j->workers[t].buf);
+    free(j->workers[t].rgba);
+    free(j->workers[t].plane);
+  }
+  free(j->workers);
+}
+
+static bool build(job_t *j, uint32_t threads, const char *out) {
+  size_t dim = (size_t)1 << BASE_Z;
+  uint8_t *occupied = calloc(dim * dim, 1);
+  size_t blocks = (size_t)(j->tile_size / TILE_INDEX_BLOCK) *
+                  (j->tile_size / TILE_INDEX_BLOCK);
+  bool ok = occupied && init_workers(j, threads);
+  for (size_t i = 0; ok && i < BATCH; i++)
+    ok = (j->hashes[i] = malloc(blocks * sizeof(uint32_t))) != NULL;
+
+  tile_index_writer_t w;
+  if (!ok)
+    fprintf(stderr, "Out of memory\n");
+  else if (!tile_index_writer_init(&w, out, j->tile_size))
+    fprintf(stderr, "Cannot create %s\n", out);
+  if (!ok || !w.out) {
+    for (size_t i = 0; i < BATCH; i++)
+      free(j->hashes[i]);
+    free(occupied);
+    return false;
+  }
+  double start = now();
+  size_t found = tile_source_scan_level(&j->src, BASE_Z, occupied);
+  size_t done = 0;
+  uint32_t batch[BATCH];
+  j->tiles = batch;
+  // x << 16 | y order, as the index lists tiles
+  for (size_t d = 0; ok && d < dim * dim;) {
+    size_t n = 0;
+    for (; d < dim * dim && n < BATCH; d++) {
+      size_t x = d / dim, y = d % dim;
+      if (occupied[y * dim + x])
+        batch[n++] = (uint32_t)(x << 16 | y);
+    }
+    thread_pool_for(threads, n, hash_job, j);
+    for (size_t i = 0; ok && i < n; i++)
+      ok = tile_index_add(&w, batch[i], j->hashes[i], j->hash_count[i]);
+    done += n;
+    if (n)
+      fprintf(stderr, "\r%zu/%zu tiles", done, found);
+  }
+  uint64_t pairs = w.pairs;
+  ok = ok && tile_index_finish(&w);
+  tile_index_writer_destroy(&w);
+  if (!ok)
+    fprintf(stderr, "\nFailed to write %s\n", out);
+  else
+    fprintf(stderr, "\n%zu tiles, %llu blocks indexed in %.1fs\n", done,
+            (unsigned long long)pairs, now() - start);
+  for (size_t i = 0; i < BATCH; i++)
+    free(j->hashes[i]);
+  free(occupied);
+  return ok;
+}
+
+// The template's opaque pixels in palette colours, the rest transparent,
+// and its palette plane, 0 where any pixel matches.
+static bool load_template(const char *path, pumpkin_t *p, uint8_t **indices,
+                          uint32_t *width, uint32_t *height) {
+  tile_buf_t buf = {0};
+  png_info_t info;
+  uint8_t *rgba = NULL;
+  bool ok = tile_io_read(path, &buf) &&
+            tile_png_info(buf.data, buf.len, &info) && info.width &&
+            info.height && info.width <= 0xFFFF && info.height <= 0xFFFF;
+  size_t pixels = ok ? (size_t)info.width * info.height : 0;
+  ok = ok && (rgba = malloc(pixels * 4)) && (*indices = malloc(pixels)) &&
+       tile_png_decode_rgba(buf.data, buf.len, rgba, pixels * 4, width,
+                            height);
+  for (size_t i = 0; ok && i < pixels; i++) {
+    uint8_t *px = rgba + i * 4;
+    (*indices)[i] = px[3] == 255 ? palette_index_of(px) : PALETTE_TRANSPARENT;
+    palette_indices_to_rgba(*indices + i, 1, px);
+  }
+  ok = ok && pumpkin_init(p, rgba, *width, *height, 4);
+  free(rgba);
+  tile_buf_free(&buf);
+  return ok;
+}
+
+static bool find(job_t *j, uint32_t threads, const char *index_path,
+                 const char *template_path, bool scan) {
+  tile_index_t ix;
+  pumpkin_t p = {0};
+  uint8_t *indices = NULL;
+  uint32_t width, height;
+  if (!tile_index_open(&ix, index_path)) {
+    fprintf(stderr, "Cannot read index %s\n", index_path);
+    return false;
+  }
+  if (!load_template(template_path, &p, &indices, &width, &height)) {
+    fprintf(stderr, "Cannot read template %s, or it has no opaque pixel\n",
+            template_path);
+    free(indices);
+    tile_index_close(&ix);
+    return false;
+  }
+
+  double start = now();
+  uint32_t *tiles = NULL;
+  size_t count = 0;
+  bool pruned = false;
+  bool ok = true;
+  if (scan) {
+    tiles = malloc((ix.tile_count ? ix.tile_count : 1) * sizeof(*tiles));
+    ok = tiles != NULL;
+    if (ok)
+      memcpy(tiles, ix.tiles, ix.tile_count * sizeof(*tiles));
+    count = ix.tile_count;
+  } else {
+    ok = tile_index_candidates(&ix, indices, width, height, &tiles, &count,
+                               &pruned);
+    if (ok && !pruned)
+      fprintf(stderr, "The template has no 4x4 block of two colours or more "
+                      "at some alignment, checking every tile\n");
+  }
+  double looked_up = now();
+
+  j->tile_size = ix.tile_size;
+  j->tiles = tiles;
+  j->template = &p;
+  j->found = malloc((count ? count : 1) * sizeof(*j->found));
+  j->status = malloc(count ? count : 1);
+  ok = ok && j->found && j->status && init_workers(j, threads);
+  if (ok)
+    thread_pool_for(threads, count, find_job, j);
+
+  size_t matches = 0, failed = 0;
+  for (size_t i = 0; ok && i < count; i++) {
+    failed += j->status[i] == FAILED;
+    if (j->status[i] != HIT)
+      continue;
+    matches++;
+    printf("%u %u %u %u\n", tiles[i] >> 16, tiles[i] & 0xFFFF,
+           j->found[i] >> 16, j->found[i] & 0xFFFF);
+  }
+  if (ok)
+    fprintf(stderr,
+            "%zu of %u tiles checked, %zu matches in %.2fs "
+            "(%.3fs in the index)\n",
+            count, ix.tile_count, matches, now() - start, looked_up - start);
+  else
+    fprintf(stderr, "Out of memory\n");
+  if (failed)
+    fprintf(stderr, "%zu tiles failed\n", failed);
+
+  free_workers(j, threads);
+  free(j->found);
+  free(j->status);
+  free(tiles);
+  free(indices);
+  pumpkin_destroy(&p);
+  tile_index_close(&ix);
+  return ok && !failed;
+}
+
+int main(int argc, char **argv) {
+  uint32_t tile_size = 1000, threads = thread_pool_default_threads();
+  const char *out = NULL, *index = NULL, *paths[2] = {NULL, NULL};
+  int npaths = 0;
+  bool scan = false;
+  if (argc < 2 || (strcmp(argv[1], "build") != 0 &&
+                   strcmp(argv[1], "find") != 0)) {
+    usage(argv[0]);
+    return 1;
+  }
+  bool building = strcmp(argv[1], "build") == 0;
+
+  for (int i = 2; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+    if (strncmp(arg, "--", 2) != 0 && npaths < 2) {
+      paths[npaths++] = arg;
+      continue;
+    }
+    if (strcmp(arg, "--scan") == 0) {
+      scan = true;
+      continue;
+    }
+    if (!val) {
+      usage(argv[0]);
+      return 1;
+    }
+    i++;
+    if (strcmp(arg, "--threads") == 0)
+      threads = (uint32_t)atoi(val);
+    else if (strcmp(arg, "--tile-size") == 0)
+      tile_size = (uint32_t)atoi(val);
+    else if (strcmp(arg, "--out") == 0)
+      out = val;
+    else if (strcmp(arg, "--index") == 0)
+      index = val;
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (threads == 0 || tile_size < TILE_INDEX_BLOCK || tile_size > 0xFFFF ||
+      (building ? npaths != 1 || !out : npaths != 2 || !index)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  job_t *j = calloc(1, sizeof(job_t));
+  const char *release = paths[building ? 0 : 1];
+  if (!j || !tile_source_open(&j->src, release, BASE_Z)) {
+    fprintf(stderr, "Failed to open %s\n", release);
+    free(j);
+    return 1;
+  }
+  j->tile_size = tile_size;
+  bool ok = building ? build(j, threads, out)
+                     : find(j, threads, index, paths[0], scan);
+  if (building)
+    free_workers(j, threads);
+  tile_source_close(&j->src);
+  free(j);
+  return ok ? 0 : 1;
+}
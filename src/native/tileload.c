@@ -0,0 +1,714 @@
+// Load generator for the tile backend, replaying what map viewers do:
+//
+//   tileload --slugs A,B,...|@FILE [--host ADDR] [--port N] [--viewers N]
+//            [--connections N] [--duration S] [--area Z/X0/Y0/X1/Y1]
+//            [--mix PAN,ZOOM,SCRUB] [--think-ms N] [--viewport WxH]
+//            [--seed N] [--timeout S]
+//
+// Every viewer looks at the tiles of one release at one zoom, a viewport of
+// 512px tiles as MapLibre shows them, and keeps doing one of three things:
+// panning a tile or two, zooming in or out by one level, or scrubbing the
+// timeline a few releases forward or back, which asks for the same view in
+// every release passed. After all tiles of a step arrived the viewer thinks
+// for an exponentially distributed while (scrub steps follow each other at
+// once), then moves on. Like a browser it keeps a few keep-alive
+// connections and one request in flight on each.
+//
+// Viewers start inside --area, at its zoom, and pan within it. Latency is
+// measured from writing a request to reading the last byte of its response
+// and printed as JSON at the end, overall and per kind of step, with the
+// throughput and the status codes seen. A request without a response after
+// --timeout seconds is given up as an error, and the requests still in flight
+// when the run ends are counted too, both at the latency they had reached, so
+// a stalled server shows in the tail instead of dropping out of it.
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_Z 11
+#define VIEW_TILE_PX 512
+#define HIST_BUCKETS 2048
+#define SCRUB_GAP_NS 50000000ull // between scrub steps, a quick drag
+
+typedef enum { STEP_PAN, STEP_ZOOM, STEP_SCRUB, STEP_KINDS } step_kind_t;
+
+static const char *const step_names[STEP_KINDS] = {"pan", "zoom", "scrub"};
+
+// Latency histogram in microseconds: exact below 64, then 32 buckets per
+// power of two, about 3% wide.
+typedef struct {
+  uint64_t counts[HIST_BUCKETS];
+  uint64_t total, sum_us, max_us;
+} histogram_t;
+
+typedef struct {
+  uint32_t z, x, y;
+  uint32_t slug;
+} tile_t;
+
+typedef struct viewer viewer_t;
+
+typedef struct {
+  int fd;
+  viewer_t *viewer;
+  bool connected, busy, header_done, close_after;
+  tile_t tile;
+  step_kind_t kind;
+  uint64_t sent_ns;
+  int status;
+  uint64_t body_left, body_len;
+  size_t head_len;
+  char head[2048];
+  char out[256];
+  size_t out_len, out_sent;
+} conn_t;
+
+struct viewer {
+  uint32_t z, slug;
+  double cx, cy; // view centre in tiles of z
+  step_kind_t kind;
+  uint32_t scrub_left;
+  int scrub_dir;
+  tile_t *queue;
+  size_t queued, next, done, cap;
+  uint64_t wake_ns; // next step, 0 while a step is loading
+  conn_t *conns;
+  uint64_t rng;
+};
+
+typedef struct {
+  struct sockaddr_in addr;
+  char host_header[64];
+  char *slug_text, **slugs; // slugs point into slug_text
+  uint32_t slug_count;
+  uint32_t viewers, connections;
+  uint32_t area_z, area_x0, area_y0, area_x1, area_y1;
+  uint32_t mix[STEP_KINDS];
+  double think_ms;
+  uint64_t timeout_ns;
+  uint32_t cols, rows;
+  int epoll_fd;
+  histogram_t all, by_kind[STEP_KINDS];
+  uint64_t status_counts[600];
+  uint64_t errors, timeouts, unfinished, bytes;
+} load_t;
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig) {
+  (void)sig;
+  stop = 1;
+}
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s --slugs A,B,...|@FILE [--host ADDR] [--port N]\n"
+          "          [--viewers N] [--connections N] [--duration S]\n"
+          "          [--area Z/X0/Y0/X1/Y1] [--mix PAN,ZOOM,SCRUB]\n"
+          "          [--think-ms N] [--viewport WxH] [--seed N]\n"
+          "          [--timeout S]\n",
+          argv0);
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// splitmix64, one stream per viewer
+static uint64_t next_rand(uint64_t *state) {
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+static double uniform(uint64_t *state) {
+  return (double)(next_rand(state) >> 11) / 9007199254740992.0;
+}
+
+static uint32_t hist_bucket(uint64_t us) {
+  if (us < 64)
+    return (uint32_t)us;
+  uint32_t e = 63 - (uint32_t)__builtin_clzll(us);
+  uint32_t b = 64 + (e - 6) * 32 + (uint32_t)(us >> (e - 5)) - 32;
+  return b < HIST_BUCKETS ? b : HIST_BUCKETS - 1;
+}
+
+// middle of a bucket, in microseconds
+static double hist_value(uint32_t b) {
+  if (b < 64)
+    return b;
+  uint32_t e = (b - 64) / 32 + 6, sub = (b - 64) % 32 + 32;
+  return ((double)sub + 0.5) * (double)(1ull << (e - 5));
+}
+
+static void hist_add(histogram_t *h, uint64_t us) {
+  h->counts[hist_bucket(us)]++;
+  h->total++;
+  h->sum_us += us;
+  if (us > h->max_us)
+    h->max_us = us;
+}
+
+static double hist_percentile(const histogram_t *h, double p) {
+  uint64_t rank = (uint64_t)ceil(p * (double)h->total), seen = 0;
+  for (uint32_t b = 0; b < HIST_BUCKETS; b++) {
+    seen += h->counts[b];
+    if (seen >= rank && seen)
+      return hist_value(b);
+  }
+  return 0;
+}
+
+static void print_latency(const histogram_t *h) {
+  printf("{\"count\": %llu, \"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, "
+         "\"p99\": %.3f, \"p999\": %.3f, \"max\": %.3f}",
+         (unsigned long long)h->total,
+         h->total ? (double)h->sum_us / (double)h->total / 1000 : 0,
+         hist_percentile(h, 0.5) / 1000, hist_percentile(h, 0.9) / 1000,
+         hist_percentile(h, 0.99) / 1000, hist_percentile(h, 0.999) / 1000,
+         (double)h->max_us / 1000);
+}
+
+// The viewport around the centre, at the current zoom and release.
+static bool queue_view(load_t *l, viewer_t *v) {
+  uint32_t dim = 1u << v->z;
+  size_t want = (size_t)l->cols * l->rows;
+  if (want > v->cap) {
+    tile_t *grown = realloc(v->queue, want * sizeof(*grown));
+    if (!grown)
+      return false;
+    v->queue = grown;
+    v->cap = want;
+  }
+  v->queued = v->next = v->done = 0;
+  int64_t x0 = (int64_t)floor(v->cx - l->cols / 2.0);
+  int64_t y0 = (int64_t)floor(v->cy - l->rows / 2.0);
+  for (int64_t y = y0; y < y0 + l->rows; y++) {
+    for (int64_t x = x0; x < x0 + l->cols; x++) {
+      if (x >= 0 && y >= 0 && x < (int64_t)dim && y < (int64_t)dim)
+        v->queue[v->queued++] =
+            (tile_t){v->z, (uint32_t)x, (uint32_t)y, v->slug};
+    }
+  }
+  return true;
+}
+
+// The area at zoom z, in tiles.
+static void area_at(const load_t *l, uint32_t z, double *x0, double *y0,
+                    double *x1, double *y1) {
+  double scale = ldexp(1.0, (int)z - (int)l->area_z);
+  *x0 = l->area_x0 * scale;
+  *y0 = l->area_y0 * scale;
+  *x1 = (l->area_x1 + 1) * scale;
+  *y1 = (l->area_y1 + 1) * scale;
+}
+
+static void clamp_to_area(const load_t *l, viewer_t *v) {
+  double x0, y0, x1, y1;
+  area_at(l, v->z, &x0, &y0, &x1, &y1);
+  v->cx = v->cx < x0 ? x0 : v->cx > x1 ? x1 : v->cx;
+  v->cy = v->cy < y0 ? y0 : v->cy > y1 ? y1 : v->cy;
+}
+
+// Picks and applies the next step of a viewer and queues its tiles.
+static bool next_step(load_t *l, viewer_t *v) {
+  if (v->scrub_left) {
+    v->scrub_left--;
+    int64_t slug = (int64_t)v->slug + v->scrub_dir;
+    if (slug < 0 || slug >= l->slug_count) {
+      v->scrub_dir = -v->scrub_dir;
+      slug = (int64_t)v->slug + v->scrub_dir;
+    }
+    v->slug = (uint32_t)(slug < 0 ? 0 : slug);
+    return queue_view(l, v);
+  }
+
+  uint32_t total = l->mix[0] + l->mix[1] + l->mix[2];
+  uint32_t pick = (uint32_t)(next_rand(&v->rng) % total);
+  v->kind = pick < l->mix[0]                ? STEP_PAN
+            : pick < l->mix[0] + l->mix[1] ? STEP_ZOOM
+                                           : STEP_SCRUB;
+  if (v->kind == STEP_SCRUB && l->slug_count < 2)
+    v->kind = STEP_PAN;
+
+  if (v->kind == STEP_PAN) {
+    double angle = uniform(&v->rng) * 2 * M_PI;
+    double dist = 0.5 + uniform(&v->rng) * 1.5;
+    v->cx += cos(angle) * dist;
+    v->cy += sin(angle) * dist;
+  } else if (v->kind == STEP_ZOOM) {
+    bool in = v->z == l->area_z ||
+              (v->z < MAX_Z && next_rand(&v->rng) % 2 == 0);
+    if (in) {
+      v->z++;
+      // towards a random point of the view, as a wheel or a tap does
+      v->cx = v->cx * 2 + (uniform(&v->rng) - 0.5) * l->cols;
+      v->cy = v->cy * 2 + (uniform(&v->rng) - 0.5) * l->rows;
+    } else {
+      v->z--;
+      v->cx /= 2;
+      v->cy /= 2;
+    }
+  } else {
+    v->scrub_dir = next_rand(&v->rng) % 2 ? 1 : -1;
+    v->scrub_left = 2 + (uint32_t)(next_rand(&v->rng) % 8);
+    return next_step(l, v);
+  }
+  clamp_to_area(l, v);
+  return queue_view(l, v);
+}
+
+static void close_conn(load_t *l, conn_t *c) {
+  if (c->fd >= 0) {
+    epoll_ctl(l->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+  }
+  c->fd = -1;
+  c->connected = false;
+}
+
+static bool open_conn(load_t *l, conn_t *c) {
+  c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (c->fd < 0)
+    return false;
+  int one = 1;
+  setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if (connect(c->fd, (struct sockaddr *)&l->addr, sizeof(l->addr)) != 0 &&
+      errno != EINPROGRESS) {
+    close_conn(l, c);
+    return false;
+  }
+  struct epoll_event ev = {.events = EPOLLOUT | EPOLLIN, .data.ptr = c};
+  if (epoll_ctl(l->epoll_fd, EPOLL_CTL_ADD, c->fd, &ev) != 0) {
+    close_conn(l, c);
+    return false;
+  }
+  c->connected = true;
+  return true;
+}
+
+static void set_events(load_t *l, conn_t *c, uint32_t events) {
+  struct epoll_event ev = {.events = events, .data.ptr = c};
+  epoll_ctl(l->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+// Writes as much of the request as the socket takes.
+static bool send_pending(load_t *l, conn_t *c) {
+  while (c->out_sent < c->out_len) {
+    ssize_t n = write(c->fd, c->out + c->out_sent, c->out_len - c->out_sent);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    c->out_sent += (size_t)n;
+  }
+  set_events(l, c, c->out_sent < c->out_len ? EPOLLOUT : EPOLLIN);
+  return true;
+}
+
+static void fail_request(load_t *l, conn_t *c) {
+  l->errors++;
+  close_conn(l, c);
+  if (c->busy) {
+    c->busy = false;
+    c->viewer->done++;
+  }
+}
+
+// Hands the next queued tile of the viewer to an idle connection.
+static void dispatch(load_t *l, viewer_t *v, uint64_t now) {
+  for (uint32_t i = 0; i < l->connections && v->next < v->queued; i++) {
+    conn_t *c = &v->conns[i];
+    if (c->busy)
+      continue;
+    if (!c->connected && !open_conn(l, c)) {
+      // counts as a failed request of the step
+      l->errors++;
+      v->next++;
+      v->done++;
+      continue;
+    }
+    tile_t t = v->queue[v->next++];
+    int n = snprintf(c->out, sizeof(c->out),
+                     "GET /tiles/world-%s/%u/%u/%u.png HTTP/1.1\r\n"
+                     "Host: %s\r\n\r\n",
+                     l->slugs[t.slug], t.z, t.x, t.y, l->host_header);
+    c->out_len = (size_t)n < sizeof(c->out) ? (size_t)n : sizeof(c->out);
+    c->out_sent = 0;
+    c->busy = true;
+    c->header_done = false;
+    c->head_len = 0;
+    c->tile = t;
+    c->kind = v->kind;
+    c->sent_ns = now;
+    if (!send_pending(l, c))
+      fail_request(l, c);
+  }
+}
+
+// Parses the status line and the headers that matter once they are in.
+static bool parse_head(conn_t *c) {
+  char *end = memmem(c->head, c->head_len, "\r\n\r\n", 4);
+  if (!end)
+    return false;
+  *end = 0;
+  c->status = 0;
+  sscanf(c->head, "HTTP/1.%*d %d", &c->status);
+  c->body_len = 0;
+  c->close_after = false;
+  for (char *line = strstr(c->head, "\r\n"); line; line = strstr(line, "\r\n")) {
+    line += 2;
+    if (strncasecmp(line, "Content-Length:", 15) == 0)
+      c->body_len = strtoull(line + 15, NULL, 10);
+    else if (strncasecmp(line, "Connection:", 11) == 0 &&
+             strcasestr(line, "close") != NULL)
+      c->close_after = true;
+  }
+  size_t head = (size_t)(end - c->head) + 4;
+  size_t extra = c->head_len - head;
+  c->body_left = c->body_len > extra ? c->body_len - extra : 0;
+  c->header_done = true;
+  return true;
+}
+
+static void add_latency(load_t *l, const conn_t *c, uint64_t now) {
+  uint64_t us = (now - c->sent_ns) / 1000;
+  hist_add(&l->all, us);
+  hist_add(&l->by_kind[c->kind], us);
+}
+
+static void finish_request(load_t *l, conn_t *c, uint64_t now) {
+  add_latency(l, c, now);
+  if (c->status > 0 && c->status < 600)
+    l->status_counts[c->status]++;
+  l->bytes += c->body_len;
+  c->busy = false;
+  c->viewer->done++;
+  if (c->close_after)
+    close_conn(l, c);
+}
+
+static void on_readable(load_t *l, conn_t *c, uint64_t now) {
+  static char sink[65536];
+  for (;;) {
+    ssize_t n;
+    if (!c->header_done) {
+      n = read(c->fd, c->head + c->head_len, sizeof(c->head) - c->head_len);
+      if (n > 0) {
+        c->head_len += (size_t)n;
+        if (!parse_head(c)) {
+          if (c->head_len == sizeof(c->head)) {
+            fail_request(l, c);
+            return;
+          }
+          continue;
+        }
+        if (!c->body_left) {
+          finish_request(l, c, now);
+          return;
+        }
+        continue;
+      }
+    } else {
+      size_t want = c->body_left < sizeof(sink) ? c->body_left : sizeof(sink);
+      n = read(c->fd, sink, want);
+      if (n > 0) {
+        c->body_left -= (size_t)n;
+        if (!c->body_left) {
+          finish_request(l, c, now);
+          return;
+        }
+        continue;
+      }
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return;
+    if (n < 0 && errno == EINTR)
+      continue;
+    // the server closed, idle connections just reconnect later
+    if (c->busy)
+      fail_request(l, c);
+    else
+      close_conn(l, c);
+    return;
+  }
+}
+
+static bool parse_area(const char *s, load_t *l) {
+  if (sscanf(s, "%u/%u/%u/%u/%u", &l->area_z, &l->area_x0, &l->area_y0,
+             &l->area_x1, &l->area_y1) != 5)
+    return false;
+  uint32_t dim = 1u << (l->area_z <= MAX_Z ? l->area_z : 0);
+  return l->area_z <= MAX_Z && l->area_x0 <= l->area_x1 &&
+         l->area_y0 <= l->area_y1 && l->area_x1 < dim && l->area_y1 < dim;
+}
+
+// A comma separated list, or one slug per line of a file after @.
+static bool parse_slugs(const char *arg, load_t *l) {
+  char *text = NULL;
+  if (arg[0] == '@') {
+    FILE *f = fopen(arg + 1, "r");
+    size_t cap = 0;
+    if (!f)
+      return false;
+    ssize_t n = getdelim(&text, &cap, '\0', f);
+    fclose(f);
+    if (n < 0) {
+      free(text);
+      return false;
+    }
+  } else if (!(text = strdup(arg))) {
+    return false;
+  }
+  l->slug_text = text;
+  for (char *save = NULL, *tok = strtok_r(text, ",\r\n", &save); tok;
+       tok = strtok_r(NULL, ",\r\n", &save)) {
+    char **grown = realloc(l->slugs, (l->slug_count + 1) * sizeof(*grown));
+    if (!grown)
+      return false;
+    l->slugs = grown;
+    l->slugs[l->slug_count++] = tok;
+  }
+  return l->slug_count > 0;
+}
+
+int main(int argc, char **argv) {
+  const char *host = "127.0.0.1", *slugs = NULL;
+  uint32_t port = 8080, viewport_w = 1920, viewport_h = 1080;
+  double duration = 30, timeout = 10;
+  uint64_t seed = 1;
+  load_t l = {.viewers = 100, .connections = 6, .area_z = 0,
+              .mix = {50, 20, 30}, .think_ms = 500};
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[++i] : NULL;
+    bool ok = val != NULL;
+    if (!ok)
+      ;
+    else if (strcmp(arg, "--slugs") == 0)
+      slugs = val;
+    else if (strcmp(arg, "--host") == 0)
+      host = val;
+    else if (strcmp(arg, "--port") == 0)
+      port = (uint32_t)atoi(val);
+    else if (strcmp(arg, "--viewers") == 0)
+      l.viewers = (uint32_t)atoi(val);
+    else if (strcmp(arg, "--connections") == 0)
+      l.connections = (uint32_t)atoi(val);
+    else if (strcmp(arg, "--duration") == 0)
+      duration = atof(val);
+    else if (strcmp(arg, "--area") == 0)
+      ok = parse_area(val, &l);
+    else if (strcmp(arg, "--mix") == 0)
+      ok = sscanf(val, "%u,%u,%u", &l.mix[0], &l.mix[1], &l.mix[2]) == 3 &&
+           l.mix[0] + l.mix[1] + l.mix[2] > 0;
+    else if (strcmp(arg, "--think-ms") == 0)
+      l.think_ms = atof(val);
+    else if (strcmp(arg, "--viewport") == 0)
+      ok = sscanf(val, "%ux%u", &viewport_w, &viewport_h) == 2 &&
+           viewport_w && viewport_h;
+    else if (strcmp(arg, "--seed") == 0)
+      seed = strtoull(val, NULL, 10);
+    else if (strcmp(arg, "--timeout") == 0)
+      timeout = atof(val);
+    else
+      ok = false;
+    if (!ok) {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (!slugs || !parse_slugs(slugs, &l) || port == 0 || port > 65535 ||
+      l.viewers == 0 || l.connections == 0 || duration <= 0 ||
+      l.think_ms < 0 || timeout <= 0) {
+    usage(argv[0]);
+    return 1;
+  }
+  l.timeout_ns = (uint64_t)(timeout * 1e9);
+  l.addr = (struct sockaddr_in){.sin_family = AF_INET,
+                                .sin_port = htons((uint16_t)port)};
+  if (inet_pton(AF_INET, host, &l.addr.sin_addr) != 1) {
+    fprintf(stderr, "Bad address %s\n", host);
+    return 1;
+  }
+  snprintf(l.host_header, sizeof(l.host_header), "%s:%u", host, port);
+  l.cols = (viewport_w + VIEW_TILE_PX - 1) / VIEW_TILE_PX + 1;
+  l.rows = (viewport_h + VIEW_TILE_PX - 1) / VIEW_TILE_PX + 1;
+
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+
+  viewer_t *viewers = calloc(l.viewers, sizeof(*viewers));
+  conn_t *conns = calloc((size_t)l.viewers * l.connections, sizeof(*conns));
+  l.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (!viewers || !conns || l.epoll_fd < 0) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+  uint64_t start = now_ns();
+  for (uint32_t i = 0; i < l.viewers; i++) {
+    viewer_t *v = &viewers[i];
+    double x0, y0, x1, y1;
+    v->rng = seed * 0x9E3779B97F4A7C15ull + i;
+    v->conns = &conns[(size_t)i * l.connections];
+    for (uint32_t k = 0; k < l.connections; k++) {
+      v->conns[k].fd = -1;
+      v->conns[k].viewer = v;
+    }
+    v->z = l.area_z;
+    area_at(&l, v->z, &x0, &y0, &x1, &y1);
+    v->cx = x0 + uniform(&v->rng) * (x1 - x0);
+    v->cy = y0 + uniform(&v->rng) * (y1 - y0);
+    v->slug = (uint32_t)(next_rand(&v->rng) % l.slug_count);
+    v->kind = STEP_PAN;
+    // arrivals spread over the first second
+    v->wake_ns = start + next_rand(&v->rng) % 1000000000ull;
+  }
+
+  struct sigaction sa = {.sa_handler = on_signal};
+  sigaction(SIGINT, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+  fprintf(stderr,
+          "%u viewers with %u connections each on %s:%u, %u releases, "
+          "%ux%u tiles a view, %.0fs\n",
+          l.viewers, l.connections, host, port, l.slug_count, l.cols, l.rows,
+          duration);
+
+  uint64_t end = start + (uint64_t)(duration * 1e9);
+  struct epoll_event events[512];
+  uint64_t now = start;
+  while (!stop && now < end) {
+    // viewers due for their next step, and when the next one is
+    uint64_t next_wake = end;
+    for (uint32_t i = 0; i < l.viewers; i++) {
+      viewer_t *v = &viewers[i];
+      bool expired = false;
+      for (uint32_t k = 0; k < l.connections; k++) {
+        conn_t *c = &v->conns[k];
+        if (!c->busy)
+          continue;
+        uint64_t deadline = c->sent_ns + l.timeout_ns;
+        if (deadline <= now) {
+          add_latency(&l, c, now);
+          l.timeouts++;
+          fail_request(&l, c);
+          expired = true;
+        } else if (deadline < next_wake) {
+          next_wake = deadline;
+        }
+      }
+      if (expired)
+        dispatch(&l, v, now);
+      if (v->wake_ns && v->wake_ns <= now) {
+        v->wake_ns = 0;
+        if (!next_step(&l, v)) {
+          fprintf(stderr, "Out of memory\n");
+          return 1;
+        }
+        dispatch(&l, v, now);
+      }
+      if (!v->wake_ns && v->done == v->queued) {
+        // step complete, think before the next one
+        double think = v->scrub_left ? (double)SCRUB_GAP_NS
+                                     : -log(1 - uniform(&v->rng)) *
+                                           l.think_ms * 1e6;
+        v->wake_ns = now + (uint64_t)think + 1;
+      }
+      if (v->wake_ns && v->wake_ns < next_wake)
+        next_wake = v->wake_ns;
+    }
+
+    int timeout = next_wake > now ? (int)((next_wake - now + 999999) / 1000000)
+                                  : 0;
+    int n = epoll_wait(l.epoll_fd, events, 512, timeout);
+    now = now_ns();
+    for (int i = 0; i < n; i++) {
+      conn_t *c = events[i].data.ptr;
+      if (c->fd < 0)
+        continue;
+      if (events[i].events & (EPOLLERR | EPOLLHUP) &&
+          !(events[i].events & EPOLLIN))
+        fail_request(&l, c);
+      else if (events[i].events & EPOLLOUT) {
+        if (!send_pending(&l, c))
+          fail_request(&l, c);
+      } else if (events[i].events & EPOLLIN)
+        on_readable(&l, c, now);
+      if (c->fd < 0 || !c->busy)
+        dispatch(&l, c->viewer, now);
+    }
+  }
+  double elapsed = (double)(now - start) / 1e9;
+  for (size_t i = 0; i < (size_t)l.viewers * l.connections; i++) {
+    if (conns[i].busy) {
+      add_latency(&l, &conns[i], now);
+      l.unfinished++;
+    }
+  }
+  uint64_t answered = l.all.total - l.timeouts - l.unfinished;
+
+  printf("{\n  \"duration_s\": %.3f,\n  \"viewers\": %u,\n"
+         "  \"connections\": %u,\n  \"releases\": %u,\n"
+         "  \"requests\": %llu,\n  \"errors\": %llu,\n"
+         "  \"timeouts\": %llu,\n  \"unfinished\": %llu,\n"
+         "  \"throughput_rps\": %.1f,\n  \"throughput_mbps\": %.2f,\n"
+         "  \"status\": {",
+         elapsed, l.viewers, l.viewers * l.connections, l.slug_count,
+         (unsigned long long)l.all.total, (unsigned long long)l.errors,
+         (unsigned long long)l.timeouts, (unsigned long long)l.unfinished,
+         (double)answered / elapsed,
+         (double)l.bytes * 8 / 1e6 / elapsed);
+  const char *sep = "";
+  for (int s = 0; s < 600; s++) {
+    if (!l.status_counts[s])
+      continue;
+    printf("%s\"%d\": %llu", sep, s, (unsigned long long)l.status_counts[s]);
+    sep = ", ";
+  }
+  printf("},\n  \"latency_ms\": ");
+  print_latency(&l.all);
+  for (int k = 0; k < STEP_KINDS; k++) {
+    printf(",\n  \"%s_latency_ms\": ", step_names[k]);
+    print_latency(&l.by_kind[k]);
+  }
+  printf("\n}\n");
+
+  for (size_t i = 0; i < (size_t)l.viewers * l.connections; i++) {
+    if (conns[i].fd >= 0)
+      close(conns[i].fd);
+  }
+  for (uint32_t i = 0; i < l.viewers; i++)
+    free(viewers[i].queue);
+  free(viewers);
+  free(conns);
+  free(l.slug_text);
+  free(l.slugs);
+  close(l.epoll_fd);
+  return 0;
+}
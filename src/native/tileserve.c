@@ -0,0 +1,1243 @@
+// Serves the tiles of packed releases over HTTP:
+//
+//   tileserve --releases DIR [--host ADDR] [--port N] [--cache-mb N]
+//             [--render-depth N] [--render-threads N]
+//             [--max-connections N] [--tile-size PX]
+//
+// GET /tiles/world-<slug>/<z>/<x>/<y>.png is answered from
+// DIR/world-<slug>.pmtiles or DIR/world-<slug>.tar, mapped, so a stored tile
+// goes out with one writev straight from the mapping. GET
+// /tiles/delta-<slug>/<z>/<x>/<y>.delta is answered the same way from
+// DIR/delta-<slug>.pmtiles, the delta tiles deltas packed from the release
+// before to that of the slug; there is nothing to render for those.
+//
+// The release files are found by scanning DIR at startup and every 30
+// seconds after on a thread of its own, which opens them, and indexes a tar
+// the first time it sees one, without holding up the event loop. A slug
+// with no file at the last scan is answered 404 and costs nothing.
+//
+// Tiles a release does not store, such as every parent level of a release
+// tar, are rendered on first request from their children with the mode
+// reducer pyramid uses, recursing into children that are missing too, at
+// most --render-depth levels deep. Every tile rendered on the way is kept in
+// a byte bounded LRU cache, along with the tiles found to be empty, so
+// zooming out renders one level at a time. A tile more than --render-depth
+// levels above the stored and cached tiles is answered 503 with a
+// Retry-After. Zooming out step by step caches the levels between, but the
+// cache may evict them again, so a release viewed far out should be packed
+// with the parent levels pyramid builds. A tile being rendered is a flight:
+// requests and other renders that need it meanwhile wait for that render
+// instead of starting their own.
+//
+// The event loop is one thread on epoll, where an idle keep-alive viewer
+// costs a socket and a connection struct. Renders run on worker threads,
+// which hand finished flights back to the loop through an eventfd.
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "palette.h"
+#include "thread_pool.h"
+#include "tile_archive.h"
+#include "tile_cache.h"
+#include "tile_png.h"
+#include "tile_reduce.h"
+#include "tile_source.h"
+
+#define BASE_Z 11
+#define SLUG_MAX 64
+#define REQUEST_MAX 4096
+#define RESCAN_S 30 // between looks for new release files
+#define SETTLE_S 5  // unchanged before a new release file is opened
+#define RETRY_S 1   // asked of a viewer whose tile is too deep to render
+// Cache keys put the release id above bit 40 and the tile id below it. Tile
+// ids up to BASE_Z are below 2^23, so ids get the 24 bits left.
+#define RELEASE_MAX (1u << 24)
+#define FLIGHT_BUCKETS 4096
+
+typedef struct {
+  char slug[SLUG_MAX + 1];
+  bool deltas; // a delta archive, served as stored
+  uint32_t id; // in cache keys, below RELEASE_MAX
+  tile_archive_t archive;
+  uint8_t *below[BASE_Z + 1]; // bit y * 2^z + x: base tiles under z/x/y
+} release_t;
+
+typedef enum {
+  RENDER_TILE,
+  RENDER_EMPTY,    // none of the tiles below has anything
+  RENDER_TOO_DEEP, // needs tiles deeper than --render-depth, not cached
+  RENDER_FAILED,
+} render_status_t;
+
+typedef struct conn conn_t;
+
+typedef struct flight {
+  uint64_t key;
+  const release_t *release;
+  uint32_t z, x, y;
+  bool started, done;
+  render_status_t status;
+  tile_cache_entry_t *entry; // pinned, for RENDER_TILE and RENDER_EMPTY
+  conn_t **waiters;          // requests, answered by the event loop
+  size_t waiter_count, waiter_cap;
+  uint32_t holders; // render, queue, loop and renders waiting for it
+  struct flight *chain; // in the bucket while not done
+  struct flight *next;  // in the render queue, then in the landed list
+} flight_t;
+
+struct conn {
+  int fd;
+  bool keep_alive, head_only, dead;
+  bool deltas; // the request is for a delta tile
+  uint32_t events; // epoll interest
+  flight_t *waiting;
+  size_t in_len;
+  char head[384];
+  size_t head_len, head_sent;
+  const uint8_t *body; // into a release mapping or a pinned cache entry
+  size_t body_len, body_sent;
+  tile_cache_entry_t *pinned;
+  conn_t *next_dead; // closed, freed after the current batch of events
+  char in[REQUEST_MAX];
+};
+
+typedef struct {
+  uint8_t **planes; // one per render depth
+  uint8_t *rgba;
+} worker_t;
+
+// A release file that would not open, tried again once it changed.
+typedef struct {
+  char name[NAME_MAX + 1];
+  time_t mtime;
+  off_t size;
+} unopened_t;
+
+typedef struct {
+  const char *dir;
+  uint32_t tile_size, render_depth, render_threads;
+  int epoll_fd, listen_fd, wake_fd;
+  // added by the scanner only, so it reads them without the lock
+  pthread_mutex_t releases_lock;
+  release_t **releases; // sorted, world before delta, then by slug
+  size_t release_count, release_cap;
+  unopened_t *unopened; // the scanner's
+  size_t unopened_count, unopened_cap;
+  size_t connections, max_connections;
+  uint64_t requests, served, not_found;
+  conn_t *dead; // closed connections nothing refers to any more
+
+  // shared with the workers
+  pthread_mutex_t lock;
+  pthread_cond_t work, landed_cond, rescan;
+  tile_cache_t cache;
+  flight_t *flights[FLIGHT_BUCKETS];
+  flight_t *queue, *queue_tail;
+  flight_t *landed; // done flights with requests waiting
+  bool stopping;
+  uint64_t rendered, coalesced;
+  worker_t *workers;
+} server_t;
+
+static volatile sig_atomic_t stop;
+static char listen_tag, wake_tag;
+
+static void on_signal(int sig) {
+  (void)sig;
+  stop = 1;
+}
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s --releases DIR [--host ADDR] [--port N] [--cache-mb N]\n"
+          "          [--render-depth N] [--render-threads N]\n"
+          "          [--max-connections N] [--tile-size PX]\n",
+          argv0);
+}
+
+// Marks every tile with base tiles below it, so renders skip empty areas
+// without counting them against the render depth.
+static bool map_base_tiles(release_t *r) {
+  size_t dim = (size_t)1 << BASE_Z;
+  uint8_t *occupied = calloc(dim * dim, 1);
+  bool ok = occupied != NULL;
+  for (uint32_t z = 0; z <= BASE_Z; z++)
+    ok = ok && (r->below[z] = calloc(((size_t)1 << (z * 2)) / 8 + 1, 1));
+  if (!ok) {
+    for (uint32_t z = 0; z <= BASE_Z; z++) {
+      free(r->below[z]);
+      r->below[z] = NULL;
+    }
+    free(occupied);
+    return false;
+  }
+  tile_archive_scan_level(&r->archive, BASE_Z, occupied);
+  for (size_t i = 0; i < dim * dim; i++) {
+    if (!occupied[i])
+      continue;
+    size_t x = i % dim, y = i / dim;
+    for (uint32_t z = BASE_Z + 1; z-- > 0;) {
+      size_t shift = BASE_Z - z, bit = ((y >> shift) << z) + (x >> shift);
+      if (r->below[z][bit / 8] & 1 << bit % 8)
+        break;
+      r->below[z][bit / 8] |= (uint8_t)(1 << bit % 8);
+    }
+  }
+  free(occupied);
+  return true;
+}
+
+static bool has_base_tiles(const release_t *r, uint32_t z, uint32_t x,
+                           uint32_t y) {
+  size_t bit = ((size_t)y << z) + x;
+  return r->below[z][bit / 8] >> bit % 8 & 1;
+}
+
+// Whether ch can be the nth character of a slug.
+static bool slug_char(char ch, size_t n) {
+  return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+         (ch >= '0' && ch <= '9') || ch == '-' || ch == '_' ||
+         (ch == '.' && n > 0);
+}
+
+// Splits world-<slug>.pmtiles, world-<slug>.tar or delta-<slug>.pmtiles.
+static bool release_name(const char *name, char *slug, bool *deltas,
+                         bool *tar) {
+  const char *dot = strrchr(name, '.');
+  if (strncmp(name, "world-", 6) != 0 && strncmp(name, "delta-", 6) != 0)
+    return false;
+  *deltas = name[0] == 'd';
+  *tar = dot && strcmp(dot, ".tar") == 0;
+  if (!dot || (*tar ? *deltas : strcmp(dot, ".pmtiles") != 0))
+    return false;
+  size_t n = (size_t)(dot - name) - 6;
+  if (!n || n > SLUG_MAX)
+    return false;
+  for (size_t i = 0; i < n; i++) {
+    if (!slug_char(name[6 + i], i))
+      return false;
+    slug[i] = name[6 + i];
+  }
+  slug[n] = 0;
+  return true;
+}
+
+static int release_cmp(const release_t *r, const char *slug, bool deltas) {
+  if (r->deltas != deltas)
+    return r->deltas ? 1 : -1;
+  return strcmp(r->slug, slug);
+}
+
+// Where the release of a slug is or would go in s->releases.
+static size_t release_slot(const server_t *s, const char *slug, bool deltas,
+                           bool *found) {
+  size_t lo = 0, hi = s->release_count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (release_cmp(s->releases[mid], slug, deltas) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  *found = lo < s->release_count &&
+           release_cmp(s->releases[lo], slug, deltas) == 0;
+  return lo;
+}
+
+// The release of a slug, or its delta archive, NULL if the scans found no
+// file for it. Releases stay where they are, the workers hold pointers to
+// them.
+static const release_t *find_release(server_t *s, const char *slug,
+                                     bool deltas) {
+  bool found;
+  pthread_mutex_lock(&s->releases_lock);
+  size_t i = release_slot(s, slug, deltas, &found);
+  const release_t *r = found ? s->releases[i] : NULL;
+  pthread_mutex_unlock(&s->releases_lock);
+  return r;
+}
+
+static unopened_t *find_unopened(server_t *s, const char *name) {
+  for (size_t i = 0; i < s->unopened_count; i++)
+    if (strcmp(s->unopened[i].name, name) == 0)
+      return &s->unopened[i];
+  return NULL;
+}
+
+// Opens a release file and adds it to the releases, on the scanner. A file
+// that does not open is remembered, so it is not tried again every scan.
+static void open_release(server_t *s, const char *path, const char *name,
+                         const char *slug, bool deltas,
+                         const struct stat *st) {
+  release_t *r = calloc(1, sizeof(*r));
+  bool ok = r && tile_archive_open(&r->archive, path, BASE_Z);
+  if (ok && !deltas && !map_base_tiles(r)) {
+    tile_archive_close(&r->archive);
+    ok = false;
+  }
+  unopened_t *u = find_unopened(s, name);
+  if (!ok) {
+    fprintf(stderr, "Cannot open %s\n", path);
+    free(r);
+    if (!u && s->unopened_count == s->unopened_cap) {
+      size_t cap = s->unopened_cap ? s->unopened_cap * 2 : 16;
+      unopened_t *grown = realloc(s->unopened, cap * sizeof(*grown));
+      if (!grown)
+        return;
+      s->unopened = grown;
+      s->unopened_cap = cap;
+    }
+    if (!u) {
+      u = &s->unopened[s->unopened_count++];
+      snprintf(u->name, sizeof(u->name), "%s", name);
+    }
+    u->mtime = st->st_mtime;
+    u->size = st->st_size;
+    return;
+  }
+  if (u)
+    *u = s->unopened[--s->unopened_count];
+  if (r->archive.index_unsaved)
+    fprintf(stderr, "Cannot store the index of %s, it is built again on "
+                    "every start\n", path);
+  snprintf(r->slug, sizeof(r->slug), "%s", slug);
+  r->deltas = deltas;
+  r->id = (uint32_t)s->release_count;
+
+  pthread_mutex_lock(&s->releases_lock);
+  if (s->release_count == s->release_cap) {
+    size_t cap = s->release_cap ? s->release_cap * 2 : 64;
+    release_t **grown = realloc(s->releases, cap * sizeof(*grown));
+    if (grown) {
+      s->releases = grown;
+      s->release_cap = cap;
+    }
+  }
+  bool found, added = s->release_count < s->release_cap;
+  if (added) {
+    size_t i = release_slot(s, slug, deltas, &found);
+    memmove(s->releases + i + 1, s->releases + i,
+            (s->release_count - i) * sizeof(*s->releases));
+    s->releases[i] = r;
+    s->release_count++;
+  }
+  pthread_mutex_unlock(&s->releases_lock);
+  if (!added) {
+    fprintf(stderr, "Out of memory for %s\n", path);
+    tile_archive_close(&r->archive);
+    for (uint32_t z = 0; z <= BASE_Z; z++)
+      free(r->below[z]);
+    free(r);
+    return;
+  }
+  fprintf(stderr, "Serving %s\n", path);
+}
+
+// Opens the release files that appeared in DIR since the last scan.
+static void scan_releases(server_t *s) {
+  DIR *dir = opendir(s->dir);
+  if (!dir) {
+    fprintf(stderr, "Cannot read %s: %s\n", s->dir, strerror(errno));
+    return;
+  }
+  time_t now = time(NULL);
+  for (struct dirent *e; (e = readdir(dir));) {
+    char slug[SLUG_MAX + 1], path[4096];
+    bool deltas, tar, found;
+    struct stat st;
+    if (!release_name(e->d_name, slug, &deltas, &tar))
+      continue;
+    release_slot(s, slug, deltas, &found);
+    if (found)
+      continue;
+    // a release packed both ways is served from its PMTiles
+    snprintf(path, sizeof(path), "%s/world-%s.pmtiles", s->dir, slug);
+    if (tar && stat(path, &st) == 0)
+      continue;
+    snprintf(path, sizeof(path), "%s/%s", s->dir, e->d_name);
+    // still being written, or did not open and has not changed since
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode) ||
+        now - st.st_mtime < SETTLE_S)
+      continue;
+    unopened_t *u = find_unopened(s, e->d_name);
+    if (u && u->mtime == st.st_mtime && u->size == st.st_size)
+      continue;
+    if (s->release_count == RELEASE_MAX) {
+      fprintf(stderr, "Not serving more than %u releases\n", RELEASE_MAX);
+      break;
+    }
+    open_release(s, path, e->d_name, slug, deltas, &st);
+  }
+  closedir(dir);
+}
+
+// Scans DIR every RESCAN_S seconds until the server stops.
+static void *scanner_main(void *arg) {
+  server_t *s = arg;
+  pthread_mutex_lock(&s->lock);
+  while (!s->stopping) {
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += RESCAN_S;
+    while (!s->stopping &&
+           pthread_cond_timedwait(&s->rescan, &s->lock, &until) != ETIMEDOUT)
+      ;
+    if (s->stopping)
+      break;
+    pthread_mutex_unlock(&s->lock);
+    scan_releases(s);
+    pthread_mutex_lock(&s->lock);
+  }
+  pthread_mutex_unlock(&s->lock);
+  return NULL;
+}
+
+static uint64_t cache_key(const release_t *r, uint32_t z, uint32_t x,
+                          uint32_t y) {
+  return (uint64_t)r->id << 40 | pmtiles_tile_id(z, x, y);
+}
+
+// Flights, all with the lock held.
+
+static flight_t **flight_slot(server_t *s, uint64_t key) {
+  flight_t **at = &s->flights[(key ^ key >> 29) % FLIGHT_BUCKETS];
+  while (*at && (*at)->key != key)
+    at = &(*at)->chain;
+  return at;
+}
+
+static flight_t *flight_new(server_t *s, const release_t *r, uint32_t z,
+                            uint32_t x, uint32_t y) {
+  flight_t *f = calloc(1, sizeof(*f));
+  if (!f)
+    return NULL;
+  f->key = cache_key(r, z, x, y);
+  f->release = r;
+  f->z = z;
+  f->x = x;
+  f->y = y;
+  *flight_slot(s, f->key) = f;
+  return f;
+}
+
+static void flight_release(flight_t *f) {
+  if (--f->holders)
+    return;
+  if (f->entry)
+    tile_cache_unpin(f->entry);
+  free(f->waiters);
+  free(f);
+}
+
+// Publishes the result of a render to whoever waits for it.
+static void flight_land(server_t *s, flight_t *f, render_status_t status,
+                        tile_cache_entry_t *entry) {
+  *flight_slot(s, f->key) = f->chain;
+  f->done = true;
+  f->status = status;
+  f->entry = entry;
+  if (f->waiter_count) {
+    f->next = s->landed;
+    s->landed = f;
+    uint64_t one = 1;
+    if (write(s->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+      perror("eventfd");
+  }
+  pthread_cond_broadcast(&s->landed_cond);
+}
+
+// Rendering, on the worker threads.
+
+static render_status_t render_flight(server_t *s, worker_t *w, flight_t *f,
+                                     uint32_t depth, uint8_t *plane);
+
+static render_status_t decode(server_t *s, worker_t *w, const uint8_t *png,
+                              size_t len, uint8_t *plane) {
+  return tile_source_decode_plane(png, len, s->tile_size, w->rgba, plane)
+             ? RENDER_TILE
+             : RENDER_FAILED;
+}
+
+// Palette indices of a tile at depth below the render that needs it,
+// stored, cached, landed or rendered here.
+static render_status_t load_plane(server_t *s, worker_t *w, const release_t *r,
+                                  uint32_t z, uint32_t x, uint32_t y,
+                                  uint32_t depth, uint8_t *plane) {
+  const uint8_t *png;
+  size_t len;
+  if (tile_archive_find(&r->archive, z, x, y, &png, &len)) {
+    render_status_t status = decode(s, w, png, len, plane);
+    if (status == RENDER_FAILED)
+      fprintf(stderr, "Cannot decode %s %u/%u/%u\n", r->slug, z, x, y);
+    return status;
+  }
+
+  uint64_t key = cache_key(r, z, x, y);
+  pthread_mutex_lock(&s->lock);
+  tile_cache_entry_t *e = tile_cache_get(&s->cache, key);
+  flight_t *f = e ? NULL : *flight_slot(s, key);
+  if (!e && f && f->started) {
+    // another worker renders it, which only ever waits on tiles further down
+    f->holders++;
+    s->coalesced++;
+    while (!f->done)
+      pthread_cond_wait(&s->landed_cond, &s->lock);
+    if (f->entry)
+      tile_cache_pin(e = f->entry);
+    render_status_t status = f->status;
+    flight_release(f);
+    if (!e) {
+      pthread_mutex_unlock(&s->lock);
+      return status;
+    }
+  }
+  if (e) {
+    pthread_mutex_unlock(&s->lock);
+    render_status_t status =
+        e->len ? decode(s, w, e->data, e->len, plane) : RENDER_EMPTY;
+    pthread_mutex_lock(&s->lock);
+    tile_cache_unpin(e);
+    pthread_mutex_unlock(&s->lock);
+    return status;
+  }
+
+  // queued for a request but not started yet, so taken over from the queue
+  // rather than waited for: a worker waiting on a queued flight could leave
+  // nobody to render it
+  if (f) {
+    f->holders++;
+    s->coalesced++;
+  } else if (!(f = flight_new(s, r, z, x, y))) {
+    pthread_mutex_unlock(&s->lock);
+    return RENDER_FAILED;
+  } else {
+    f->holders = 1;
+  }
+  f->started = true;
+  pthread_mutex_unlock(&s->lock);
+  return render_flight(s, w, f, depth, plane);
+}
+
+// Reduces the four children of a tile into plane.
+static render_status_t render_children(server_t *s, worker_t *w,
+                                       const release_t *r, uint32_t z,
+                                       uint32_t x, uint32_t y, uint32_t depth,
+                                       uint8_t *plane) {
+  if (z >= BASE_Z)
+    return RENDER_EMPTY;
+  if (depth >= s->render_depth)
+    return RENDER_TOO_DEEP;
+  uint8_t *child = w->planes[depth + 1];
+  uint32_t size = s->tile_size, half = size / 2;
+  render_status_t status = RENDER_EMPTY;
+  memset(plane, PALETTE_TRANSPARENT, (size_t)size * size);
+  for (uint32_t q = 0; q < 4; q++) {
+    uint32_t cx = x * 2 + (q & 1), cy = y * 2 + (q >> 1);
+    if (!has_base_tiles(r, z + 1, cx, cy))
+      continue;
+    render_status_t got = load_plane(s, w, r, z + 1, cx, cy, depth + 1, child);
+    if (got == RENDER_TOO_DEEP || got == RENDER_FAILED)
+      return got;
+    if (got == RENDER_EMPTY)
+      continue;
+    tile_reduce_indices(child, size, size, size,
+                        plane + (size_t)(q >> 1) * half * size +
+                            (q & 1) * half,
+                        size);
+    status = RENDER_TILE;
+  }
+  return status;
+}
+
+// Renders a flight this worker started, caches and lands it, and lets go of
+// it.
+static render_status_t render_flight(server_t *s, worker_t *w, flight_t *f,
+                                     uint32_t depth, uint8_t *plane) {
+  render_status_t status =
+      render_children(s, w, f->release, f->z, f->x, f->y, depth, plane);
+  uint8_t *png = NULL;
+  size_t len = 0;
+  if (status == RENDER_TILE &&
+      !tile_png_encode_indexed(plane, s->tile_size, s->tile_size,
+                               s->tile_size, wplace_palette, PALETTE_SIZE, 6,
+                               TILE_PNG_FAST, &png, &len))
+    status = RENDER_FAILED;
+
+  pthread_mutex_lock(&s->lock);
+  tile_cache_entry_t *e = NULL;
+  // empty tiles are cached too, as empty bodies
+  if ((status == RENDER_TILE || status == RENDER_EMPTY) &&
+      !(e = tile_cache_put(&s->cache, f->key, png, len)))
+    status = RENDER_FAILED;
+  s->rendered += status == RENDER_TILE;
+  flight_land(s, f, status, e);
+  flight_release(f);
+  pthread_mutex_unlock(&s->lock);
+  free(png);
+  return status;
+}
+
+static void *worker_main(void *arg) {
+  server_t *s = ((void **)arg)[0];
+  worker_t *w = ((void **)arg)[1];
+  free(arg);
+  pthread_mutex_lock(&s->lock);
+  for (;;) {
+    while (!s->queue && !s->stopping)
+      pthread_cond_wait(&s->work, &s->lock);
+    flight_t *f = s->queue;
+    if (!f)
+      break;
+    if (!(s->queue = f->next))
+      s->queue_tail = NULL;
+    f->next = NULL;
+    if (f->started) {
+      // taken over by a render that needed it
+      flight_release(f);
+      continue;
+    }
+    f->started = true;
+    pthread_mutex_unlock(&s->lock);
+    render_flight(s, w, f, 0, w->planes[0]);
+    pthread_mutex_lock(&s->lock);
+  }
+  pthread_mutex_unlock(&s->lock);
+  return NULL;
+}
+
+// HTTP, on the event loop.
+
+// /tiles/world-<slug>/<z>/<x>/<y>.png or /tiles/delta-<slug>/<z>/<x>/<y>.delta,
+// with an optional query
+static bool parse_path(const char *path, size_t len, char *slug,
+                       bool *deltas, uint32_t *z, uint32_t *x, uint32_t *y) {
+  static const char prefix[] = "/tiles/world-";
+  const char *at = path + sizeof(prefix) - 1, *end = path + len;
+  if (len < sizeof(prefix))
+    return false;
+  if (memcmp(path, prefix, sizeof(prefix) - 1) == 0)
+    *deltas = false;
+  else if (memcmp(path, "/tiles/delta-", sizeof(prefix) - 1) == 0)
+    *deltas = true;
+  else
+    return false;
+  size_t n = 0;
+  for (; at < end && *at != '/'; at++) {
+    if (!slug_char(*at, n) || n == SLUG_MAX)
+      return false;
+    slug[n++] = *at;
+  }
+  slug[n] = 0;
+  uint32_t *parts[3] = {z, x, y};
+  for (int i = 0; i < 3; i++) {
+    if (at == end || *at++ != '/' || at == end || *at < '0' || *at > '9')
+      return false;
+    uint64_t v = 0;
+    while (at < end && *at >= '0' && *at <= '9' && v < 1u << 24)
+      v = v * 10 + (uint64_t)(*at++ - '0');
+    *parts[i] = (uint32_t)v;
+  }
+  const char *suffix = *deltas ? ".delta" : ".png";
+  size_t suffix_len = strlen(suffix);
+  if ((size_t)(end - at) < suffix_len || memcmp(at, suffix, suffix_len) != 0 ||
+      ((size_t)(end - at) > suffix_len && at[suffix_len] != '?'))
+    return false;
+  return n && *z <= BASE_Z && *x < 1u << *z && *y < 1u << *z;
+}
+
+// Starts a response with the given Cache-Control, respond picks the usual
+// one for the status.
+static void respond_cached(server_t *s, conn_t *c, int status,
+                           const char *reason, const char *cache,
+                           const uint8_t *body, size_t len, bool head_only) {
+  const char *type = status != 200 ? "text/plain"
+                     : c->deltas   ? "application/octet-stream"
+                                   : "image/png";
+  char retry[32] = "";
+  if (status == 503)
+    snprintf(retry, sizeof(retry), "Retry-After: %d\r\n", RETRY_S);
+  int n = snprintf(c->head, sizeof(c->head),
+                   "HTTP/1.1 %d %s\r\n"
+                   "Content-Type: %s\r\n"
+                   "Content-Length: %zu\r\n"
+                   "Cache-Control: %s\r\n"
+                   "%s"
+                   "Access-Control-Allow-Origin: *\r\n"
+                   "Connection: %s\r\n\r\n",
+                   status, reason, type, len, cache, retry,
+                   c->keep_alive ? "keep-alive" : "close");
+  c->head_len = (size_t)n;
+  c->head_sent = 0;
+  c->body = head_only ? NULL : body;
+  c->body_len = head_only ? 0 : len;
+  c->body_sent = 0;
+  if (status == 200)
+    s->served++;
+  else if (status == 404)
+    s->not_found++;
+}
+
+static void respond(server_t *s, conn_t *c, int status, const char *reason,
+                    const uint8_t *body, size_t len, bool head_only) {
+  const char *cache = status == 200   ? "public, max-age=31536000, immutable"
+                      : status == 404 ? "public, max-age=3600"
+                                      : "no-store";
+  respond_cached(s, c, status, reason, cache, body, len, head_only);
+}
+
+// Answers from a cache entry or a landed render, pinning the body for the
+// time it is being written. Called with the lock held.
+static void respond_rendered(server_t *s, conn_t *c, render_status_t status,
+                             tile_cache_entry_t *e, bool head_only) {
+  if (status == RENDER_TILE) {
+    tile_cache_pin(e);
+    c->pinned = e;
+    respond(s, c, 200, "OK", e->data, e->len, head_only);
+  } else if (status == RENDER_EMPTY) {
+    respond(s, c, 404, "Not Found", NULL, 0, head_only);
+  } else if (status == RENDER_TOO_DEEP) {
+    // renders once zooming out cached the levels below, ask to come back
+    respond(s, c, 503, "Service Unavailable", NULL, 0, head_only);
+  } else {
+    respond(s, c, 500, "Internal Server Error", NULL, 0, head_only);
+  }
+}
+
+// Answers a tile request, or queues the request on the flight of the tile
+// when it has to be rendered first.
+static void respond_tile(server_t *s, conn_t *c, const char *slug,
+                         bool deltas, uint32_t z, uint32_t x, uint32_t y,
+                         bool head_only) {
+  const release_t *r = find_release(s, slug, deltas);
+  const uint8_t *png;
+  size_t len;
+  if (!r) {
+    // not stored: the release may be uploaded and found by the next scan
+    respond_cached(s, c, 404, "Not Found", "no-store", NULL, 0, head_only);
+    return;
+  }
+  if (tile_archive_find(&r->archive, z, x, y, &png, &len)) {
+    respond(s, c, 200, "OK", png, len, head_only);
+    return;
+  }
+  if (deltas || !has_base_tiles(r, z, x, y)) {
+    respond(s, c, 404, "Not Found", NULL, 0, head_only);
+    return;
+  }
+
+  uint64_t key = cache_key(r, z, x, y);
+  pthread_mutex_lock(&s->lock);
+  tile_cache_entry_t *e = tile_cache_get(&s->cache, key);
+  if (e) {
+    respond_rendered(s, c, e->len ? RENDER_TILE : RENDER_EMPTY, e, head_only);
+    tile_cache_unpin(e);
+    pthread_mutex_unlock(&s->lock);
+    return;
+  }
+  flight_t *f = *flight_slot(s, key);
+  if (f) {
+    s->coalesced++;
+  } else if ((f = flight_new(s, r, z, x, y))) {
+    f->holders = 1; // the queue
+    if (s->queue_tail)
+      s->queue_tail->next = f;
+    else
+      s->queue = f;
+    s->queue_tail = f;
+    pthread_cond_signal(&s->work);
+  }
+  if (f && f->waiter_count == f->waiter_cap) {
+    size_t cap = f->waiter_cap ? f->waiter_cap * 2 : 4;
+    conn_t **grown = realloc(f->waiters, cap * sizeof(*grown));
+    if (grown) {
+      f->waiters = grown;
+      f->waiter_cap = cap;
+    }
+  }
+  if (!f || f->waiter_count == f->waiter_cap) {
+    pthread_mutex_unlock(&s->lock);
+    respond(s, c, 500, "Internal Server Error", NULL, 0, head_only);
+    return;
+  }
+  if (!f->waiter_count)
+    f->holders++; // the loop, until it answered them all
+  f->waiters[f->waiter_count++] = c;
+  c->waiting = f;
+  c->head_only = head_only;
+  pthread_mutex_unlock(&s->lock);
+}
+
+// Case insensitive search for a header line, value into out.
+static bool header_value(const char *headers, size_t len, const char *name,
+                         char *out, size_t size) {
+  size_t name_len = strlen(name);
+  for (const char *at = headers, *end = headers + len; at < end;) {
+    const char *eol = memchr(at, '\n', (size_t)(end - at));
+    if (!eol)
+      eol = end;
+    if ((size_t)(eol - at) > name_len && at[name_len] == ':' &&
+        strncasecmp(at, name, name_len) == 0) {
+      const char *v = at + name_len + 1;
+      while (v < eol && (*v == ' ' || *v == '\t'))
+        v++;
+      size_t n = (size_t)(eol - v);
+      while (n && (v[n - 1] == '\r' || v[n - 1] == ' '))
+        n--;
+      n = n < size - 1 ? n : size - 1;
+      memcpy(out, v, n);
+      out[n] = 0;
+      return true;
+    }
+    at = eol + 1;
+  }
+  return false;
+}
+
+// Handles the complete request at the start of c->in, false if there is
+// none yet. The request is consumed once its response is set up or its
+// render queued.
+static bool handle_request(server_t *s, conn_t *c) {
+  char *end = memmem(c->in, c->in_len, "\r\n\r\n", 4);
+  if (!end)
+    return false;
+  size_t request_len = (size_t)(end - c->in) + 4;
+  s->requests++;
+
+  char *line_end = memchr(c->in, '\r', request_len);
+  char *method_end = memchr(c->in, ' ', (size_t)(line_end - c->in));
+  char *path = method_end ? method_end + 1 : NULL;
+  char *path_end =
+      path ? memchr(path, ' ', (size_t)(line_end - path)) : NULL;
+  bool http11 = path_end && line_end - path_end == 9 &&
+                memcmp(path_end + 1, "HTTP/1.1", 8) == 0;
+  char connection[32] = "";
+  header_value(line_end, (size_t)(end - line_end), "Connection", connection,
+               sizeof(connection));
+  c->keep_alive = http11 ? strcasecmp(connection, "close") != 0
+                         : strcasecmp(connection, "keep-alive") == 0;
+
+  char slug[SLUG_MAX + 1];
+  bool deltas = false;
+  uint32_t z, x, y;
+  bool get = method_end && method_end - c->in == 3 &&
+             memcmp(c->in, "GET", 3) == 0;
+  bool head = method_end && method_end - c->in == 4 &&
+              memcmp(c->in, "HEAD", 4) == 0;
+  if (!path_end) {
+    c->keep_alive = false;
+    respond(s, c, 400, "Bad Request", NULL, 0, false);
+  } else if (!get && !head) {
+    respond(s, c, 405, "Method Not Allowed", NULL, 0, false);
+  } else if (!parse_path(path, (size_t)(path_end - path), slug, &deltas, &z,
+                         &x, &y)) {
+    respond(s, c, 404, "Not Found", NULL, 0, head);
+  } else {
+    c->deltas = deltas;
+    respond_tile(s, c, slug, deltas, z, x, y, head);
+  }
+
+  memmove(c->in, c->in + request_len, c->in_len - request_len);
+  c->in_len -= request_len;
+  return true;
+}
+
+static void unpin(server_t *s, conn_t *c) {
+  if (!c->pinned)
+    return;
+  pthread_mutex_lock(&s->lock);
+  tile_cache_unpin(c->pinned);
+  pthread_mutex_unlock(&s->lock);
+  c->pinned = NULL;
+}
+
+// Frees a closed connection after the current batch of events, which may
+// still hold a hangup for it.
+static void bury(server_t *s, conn_t *c) {
+  c->next_dead = s->dead;
+  s->dead = c;
+}
+
+// Closes the socket at once but only marks the connection. It is freed
+// after the current batch of events, or once the render it waits for landed.
+static void close_conn(server_t *s, conn_t *c) {
+  if (c->dead)
+    return;
+  unpin(s, c);
+  epoll_ctl(s->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+  close(c->fd);
+  s->connections--;
+  c->dead = true;
+  if (!c->waiting)
+    bury(s, c);
+}
+
+// Writes what is pending of the response. false on a broken connection.
+static bool flush(conn_t *c) {
+  while (c->head_sent < c->head_len || c->body_sent < c->body_len) {
+    struct iovec iov[2];
+    int n = 0;
+    if (c->head_sent < c->head_len)
+      iov[n++] = (struct iovec){c->head + c->head_sent,
+                                c->head_len - c->head_sent};
+    if (c->body_sent < c->body_len)
+      iov[n++] = (struct iovec){(void *)(c->body + c->body_sent),
+                                c->body_len - c->body_sent};
+    ssize_t w = writev(c->fd, iov, n);
+    if (w < 0)
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    size_t head = c->head_len - c->head_sent;
+    head = (size_t)w < head ? (size_t)w : head;
+    c->head_sent += head;
+    c->body_sent += (size_t)w - head;
+  }
+  return true;
+}
+
+static bool pending(const conn_t *c) {
+  return c->head_sent < c->head_len || c->body_sent < c->body_len;
+}
+
+static void set_events(server_t *s, conn_t *c, uint32_t events) {
+  if (c->events == events)
+    return;
+  struct epoll_event ev = {.events = events, .data.ptr = c};
+  epoll_ctl(s->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+  c->events = events;
+}
+
+// Answers the requests read so far, one at a time, until one waits for the
+// socket to drain or for a render, or no complete request is left.
+static void advance(server_t *s, conn_t *c) {
+  for (;;) {
+    if (pending(c)) {
+      if (!flush(c)) {
+        close_conn(s, c);
+        return;
+      }
+      if (pending(c)) {
+        set_events(s, c, EPOLLOUT);
+        return;
+      }
+    }
+    unpin(s, c);
+    if (c->head_len && !c->keep_alive) {
+      close_conn(s, c);
+      return;
+    }
+    c->head_len = 0;
+    if (!handle_request(s, c))
+      break;
+    if (c->waiting) {
+      // reading on would only fill the buffer, hangups still arrive
+      set_events(s, c, 0);
+      return;
+    }
+  }
+  set_events(s, c, EPOLLIN);
+  if (c->in_len == sizeof(c->in)) {
+    c->keep_alive = false;
+    respond(s, c, 431, "Request Header Fields Too Large", NULL, 0, false);
+    advance(s, c);
+  }
+}
+
+// Answers the requests waiting for renders that landed.
+static void on_landed(server_t *s) {
+  uint64_t count;
+  if (read(s->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    perror("eventfd");
+  pthread_mutex_lock(&s->lock);
+  flight_t *landed = s->landed;
+  s->landed = NULL;
+  for (flight_t *f = landed; f; f = f->next) {
+    for (size_t i = 0; i < f->waiter_count; i++) {
+      conn_t *c = f->waiters[i];
+      c->waiting = NULL;
+      if (!c->dead)
+        respond_rendered(s, c, f->status, f->entry, c->head_only);
+    }
+  }
+  pthread_mutex_unlock(&s->lock);
+
+  for (flight_t *f = landed, *next; f; f = next) {
+    next = f->next;
+    for (size_t i = 0; i < f->waiter_count; i++) {
+      conn_t *c = f->waiters[i];
+      if (c->dead)
+        bury(s, c);
+      else
+        advance(s, c);
+    }
+    pthread_mutex_lock(&s->lock);
+    flight_release(f);
+    pthread_mutex_unlock(&s->lock);
+  }
+}
+
+static void on_readable(server_t *s, conn_t *c) {
+  while (c->in_len < sizeof(c->in)) {
+    ssize_t n = read(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len);
+    if (n > 0) {
+      c->in_len += (size_t)n;
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+    if (n < 0 && errno == EINTR)
+      continue;
+    close_conn(s, c);
+    return;
+  }
+  advance(s, c);
+}
+
+static void on_accept(server_t *s) {
+  for (;;) {
+    int fd = accept4(s->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+          errno != ECONNABORTED)
+        perror("accept");
+      return;
+    }
+    conn_t *c = s->connections < s->max_connections ? malloc(sizeof(*c))
+                                                    : NULL;
+    if (!c) {
+      close(fd);
+      continue;
+    }
+    memset(c, 0, offsetof(conn_t, in));
+    c->fd = fd;
+    c->events = EPOLLIN;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = c};
+    if (epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+      close(fd);
+      free(c);
+      continue;
+    }
+    s->connections++;
+  }
+}
+
+static int listen_on(const char *host, uint16_t port) {
+  struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port)};
+  if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+    fprintf(stderr, "Bad address %s\n", host);
+    return -1;
+  }
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  int one = 1;
+  if (fd < 0 ||
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+      bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    perror("listen");
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int main(int argc, char **argv) {
+  const char *host = "0.0.0.0";
+  uint32_t port = 8080, cache_mb = 512;
+  server_t s = {.tile_size = 1000, .render_depth = 3,
+                .render_threads = thread_pool_default_threads(),
+                .max_connections = 16384};
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[++i] : NULL;
+    if (!val) {
+      usage(argv[0]);
+      return 1;
+    }
+    if (strcmp(arg, "--releases") == 0)
+      s.dir = val;
+    else if (strcmp(arg, "--host") == 0)
+      host = val;
+    else if (strcmp(arg, "--port") == 0)
+      port = (uint32_t)atoi(val);
+    else if (strcmp(arg, "--cache-mb") == 0)
+      cache_mb = (uint32_t)atoi(val);
+    else if (strcmp(arg, "--render-depth") == 0)
+      s.render_depth = (uint32_t)atoi(val);
+    else if (strcmp(arg, "--render-threads") == 0)
+      s.render_threads = (uint32_t)atoi(val);
+    else if (strcmp(arg, "--max-connections") == 0)
+      s.max_connections = (size_t)atol(val);
+    else if (strcmp(arg, "--tile-size") == 0)
+      s.tile_size = (uint32_t)atoi(val);
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (!s.dir || port == 0 || port > 65535 || s.render_depth > BASE_Z ||
+      s.render_threads == 0 || s.tile_size < 2 || s.tile_size % 2 ||
+      s.max_connections == 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // every connection is a descriptor
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+
+  size_t pixels = (size_t)s.tile_size * s.tile_size;
+  bool ok = tile_cache_init(&s.cache, (size_t)cache_mb << 20) &&
+            (s.workers = calloc(s.render_threads, sizeof(worker_t)));
+  for (uint32_t t = 0; ok && t < s.render_threads; t++) {
+    worker_t *w = &s.workers[t];
+    ok = (w->planes = calloc(s.render_depth + 1, sizeof(*w->planes))) &&
+         (w->rgba = malloc(pixels * 4));
+    for (uint32_t d = 0; ok && d <= s.render_depth; d++)
+      ok = (w->planes[d] = malloc(pixels)) != NULL;
+  }
+  if (!ok) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+
+  s.listen_fd = listen_on(host, (uint16_t)port);
+  s.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  s.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  struct epoll_event listen_ev = {.events = EPOLLIN, .data.ptr = &listen_tag};
+  struct epoll_event wake_ev = {.events = EPOLLIN, .data.ptr = &wake_tag};
+  if (s.listen_fd < 0 || s.epoll_fd < 0 || s.wake_fd < 0 ||
+      epoll_ctl(s.epoll_fd, EPOLL_CTL_ADD, s.listen_fd, &listen_ev) != 0 ||
+      epoll_ctl(s.epoll_fd, EPOLL_CTL_ADD, s.wake_fd, &wake_ev) != 0)
+    return 1;
+
+  pthread_mutex_init(&s.lock, NULL);
+  pthread_mutex_init(&s.releases_lock, NULL);
+  pthread_cond_init(&s.work, NULL);
+  pthread_cond_init(&s.landed_cond, NULL);
+  pthread_cond_init(&s.rescan, NULL);
+  // before the loop answers anything, so none of them is a 404 meanwhile
+  scan_releases(&s);
+  pthread_t scanner;
+  if (pthread_create(&scanner, NULL, scanner_main, &s) != 0) {
+    perror("pthread_create");
+    return 1;
+  }
+  pthread_t *threads = calloc(s.render_threads, sizeof(*threads));
+  for (uint32_t t = 0; threads && t < s.render_threads; t++) {
+    void **arg = malloc(2 * sizeof(void *));
+    if (!arg)
+      return 1;
+    arg[0] = &s;
+    arg[1] = &s.workers[t];
+    if (pthread_create(&threads[t], NULL, worker_main, arg) != 0) {
+      perror("pthread_create");
+      return 1;
+    }
+  }
+
+  struct sigaction sa = {.sa_handler = on_signal};
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+  fprintf(stderr, "Serving %s on http://%s:%u, %u render threads (%s)\n",
+          s.dir, host, port, s.render_threads,
+          tile_reduce_simd_active() ? "avx2" : "scalar");
+
+  struct epoll_event events[256];
+  while (!stop) {
+    int n = epoll_wait(s.epoll_fd, events, 256, -1);
+    if (n < 0 && errno != EINTR) {
+      perror("epoll_wait");
+      break;
+    }
+    for (int i = 0; i < n; i++) {
+      void *tag = events[i].data.ptr;
+      conn_t *c = tag;
+      if (tag == &listen_tag)
+        on_accept(&s);
+      else if (tag == &wake_tag)
+        on_landed(&s);
+      else if (c->dead)
+        continue; // closed earlier in this batch, its fd may be reused
+      else if (events[i].events & (EPOLLERR | EPOLLHUP) &&
+               !(events[i].events & (EPOLLIN | EPOLLOUT)))
+        close_conn(&s, c);
+      else if (c->events == EPOLLOUT)
+        advance(&s, c);
+      else if (c->events == EPOLLIN)
+        on_readable(&s, c);
+    }
+    while (s.dead) {
+      conn_t *c = s.dead;
+      s.dead = c->next_dead;
+      free(c);
+    }
+  }
+
+  pthread_mutex_lock(&s.lock);
+  s.stopping = true;
+  pthread_cond_broadcast(&s.work);
+  pthread_cond_broadcast(&s.rescan);
+  pthread_mutex_unlock(&s.lock);
+  pthread_join(scanner, NULL);
+  for (uint32_t t = 0; threads && t < s.render_threads; t++)
+    pthread_join(threads[t], NULL);
+  free(threads);
+
+  fprintf(stderr,
+          "%llu requests: %llu tiles, %llu not found; %llu rendered, "
+          "%llu coalesced; cache %llu hits, %llu misses, %llu evictions, "
+          "%zu MB\n",
+          (unsigned long long)s.requests, (unsigned long long)s.served,
+          (unsigned long long)s.not_found, (unsigned long long)s.rendered,
+          (unsigned long long)s.coalesced, (unsigned long long)s.cache.hits,
+          (unsigned long long)s.cache.misses,
+          (unsigned long long)s.cache.evictions, s.cache.bytes >> 20);
+  close(s.listen_fd);
+  close(s.epoll_fd);
+  close(s.wake_fd);
+  for (size_t i = 0; i < s.release_count; i++) {
+    tile_archive_close(&s.releases[i]->archive);
+    for (uint32_t z = 0; z <= BASE_Z; z++)
+      free(s.releases[i]->below[z]);
+    free(s.releases[i]);
+  }
+  free(s.releases);
+  free(s.unopened);
+  for (uint32_t t = 0; t < s.render_threads; t++) {
+    for (uint32_t d = 0; d <= s.render_depth; d++)
+      free(s.workers[t].planes[d]);
+    free(s.workers[t].planes);
+    free(s.workers[t].rgba);
+  }
+  free(s.workers);
+  // connections still open die with the process; their pins do not matter
+  tile_cache_free(&s.cache);
+  return 0;
+}
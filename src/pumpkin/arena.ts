@@ -0,0 +1,73 @@
+import { nativePumpkin } from "./native.ts";
+
+// Most wplace tiles compress to a few dozen KB, larger bodies fall back to the heap.
+const SLOT_SIZE = 128 * 1024;
+
+// A tile body that lives either in a recycled arena slot or, if it did not fit, on the heap.
+// `release` must be called once decoding and matching are done with `data`.
+export type TileBody = {
+	data: Buffer;
+	release(): void;
+};
+
+let arena: { buffer: ArrayBuffer; slotSize: number } | undefined;
+
+// One arena per worker thread, with a slot for every request the worker keeps in flight.
+export function initTileArena(slotCount: number) {
+	arena = nativePumpkin.createTileArena(slotCount, SLOT_SIZE);
+}
+
+function heapBody(chunks: Uint8Array[], length: number): TileBody {
+	return { data: Buffer.concat(chunks, length), release() {} };
+}
+
+// Streams a response body straight into an arena slot without intermediate ArrayBuffers.
+export async function readTileBody(body: AsyncIterable<Uint8Array>, contentLength?: number): Promise<TileBody> {
+	const slot = arena && (contentLength === undefined || contentLength <= arena.slotSize) ? nativePumpkin.acquireTileSlot() : -1;
+
+	if (slot < 0) {
+		const chunks: Uint8Array[] = [];
+		let length = 0;
+		for await (const chunk of body) {
+			chunks.push(chunk);
+			length += chunk.length;
+		}
+		return heapBody(chunks, length);
+	}
+
+	const view = Buffer.from(arena!.buffer, slot * arena!.slotSize, arena!.slotSize);
+	let length = 0;
+	let overflow: Uint8Array[] | undefined;
+
+	try {
+		for await (const chunk of body) {
+			if (overflow) {
+				overflow.push(chunk);
+			} else if (length + chunk.length > view.length) {
+				// Content-Length lied or was missing, continue on the heap
+				overflow = [Buffer.from(view.subarray(0, length)), chunk];
+			} else {
+				view.set(chunk, length);
+			}
+			length += chunk.length;
+		}
+	} catch (error) {
+		nativePumpkin.releaseTileSlot(slot);
+		throw error;
+	}
+
+	if (overflow) {
+		nativePumpkin.releaseTileSlot(slot);
+		return heapBody(overflow, length);
+	}
+
+	let released = false;
+	return {
+		data: view.subarray(0, length),
+		release() {
+			if (released) return;
+			released = true;
+			nativePumpkin.releaseTileSlot(slot);
+		},
+	};
+}
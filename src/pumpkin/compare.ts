@@ -1,20 +1,11 @@
 import { dirname, join } from "path";
 import sharp, { type OutputInfo } from "sharp";
-import { createRequire } from "module";
 import { fileURLToPath } from "url";
+import { nativePumpkin } from "./native.ts";
 
-const require = createRequire(import.meta.url);
 const __filename = fileURLToPath(import.meta.url);
 const __dirname = dirname(__filename);
 
-type NativePumpkin = {
-	setPumpkinData(data: Buffer, width: number, height: number, channels: number): void;
-	findPumpkin(data: Buffer, width: number, height: number, channels: number): { x: number; y: number } | null;
-};
-
-const addonPath = join(__dirname, "..", "..", "build", "Release", "pumpkin.node");
-const nativePumpkin: NativePumpkin = require(addonPath);
-
 const pumpkinReady = (async () => {
 	const pumpkinPath = join(__dirname, "pumpkin.png");
 	const pumpkin = await sharp(pumpkinPath).ensureAlpha().raw().toBuffer({ resolveWithObject: true });
@@ -30,7 +21,7 @@ const pumpkinReady = (async () => {
 	return info;
 })();
 
-export async function hasPumpkin(input: { data: Buffer; info: OutputInfo }, logMatches = false) {
+export async function hasPumpkin(input: { data: Buffer; info: Pick<OutputInfo, "width" | "height" | "channels"> }, logMatches = false) {
 	const { data, info } = input;
 
 	if (info.channels !== 4) {
@@ -1,7 +1,10 @@
 import sharp from "sharp";
 import { fetch } from "undici";
-import { getDispatcher } from "./freebind.ts";
+import { getDispatcher, retireDispatcher } from "./freebind.ts";
 import { hasPumpkin } from "./compare.ts";
+import { recordTile, type ScanSchedule } from "./schedule.ts";
+import { readTileBody, type TileBody } from "./arena.ts";
+import { decodeTile, type DecodedTile } from "./planes.ts";
 
 process.env.NODE_TLS_REJECT_UNAUTHORIZED = "0";
 
@@ -14,10 +17,11 @@ export type TileMatch = {
 	offsetY: number;
 };
 
-export async function fetchTile(x: number, y: number, tries = 0) {
+export async function fetchTile(x: number, y: number, tries = 0): Promise<TileBody | undefined> {
+	const dispatcher = getDispatcher();
 	try {
 		const response = await fetch(`https://backend.wplace.live/files/s0/tiles/${x}/${y}.png`, {
-			dispatcher: getDispatcher(),
+			dispatcher,
 		});
 
 		if (response.status === 404) {
@@ -31,6 +35,7 @@ export async function fetchTile(x: number, y: number, tries = 0) {
 			}
 
 			const retryAfterMs = parseInt(retryAfter, 10) * 1000;
+			retireDispatcher(dispatcher);
 
 			console.warn(
 				`Rate limit exceeded, retrying after ${retryAfterMs} ms for tile ${x}, ${y}`
@@ -45,11 +50,16 @@ export async function fetchTile(x: number, y: number, tries = 0) {
 			throw new Error(`Failed to fetch tile at ${x}, ${y}: ${response.statusText} (${response.status})`);
 		}
 
-		const arrayBuffer = await response.arrayBuffer();
-		const buffer = Buffer.from(arrayBuffer);
+		if (!response.body) {
+			throw new Error(`Empty body for tile at ${x}, ${y}`);
+		}
+
+		const contentLength = response.headers.get("Content-Length");
 
-		return buffer;
+		// streamed into a recycled arena slot instead of arrayBuffer() + Buffer.from()
+		return await readTileBody(response.body, contentLength ? parseInt(contentLength, 10) : undefined);
 	} catch (error) {
+		retireDispatcher(dispatcher);
 		if (tries >= 3) {
 			throw new Error(`Failed to fetch tile at ${x}, ${y} after 3 attempts: ${error}`);
 		}
@@ -59,21 +69,32 @@ export async function fetchTile(x: number, y: number, tries = 0) {
 	}
 }
 
-export async function processTile(x: number, y: number): Promise<TileMatch | undefined> {
+export async function processTile(x: number, y: number, schedule?: ScanSchedule): Promise<TileMatch | undefined> {
+	const body = await fetchTile(x, y);
+
+	if (!body) {
+		if (schedule) recordTile(schedule, x, y, null, null, false);
+		return;
+	}
+
+	let decoded: DecodedTile | undefined;
+
 	try {
-		const buffer = await fetchTile(x, y);
+		const buffer = body.data;
 
-		if (!buffer) {
-			return;
-		}
+		// decoded from the arena slot into a pooled plane, both are recycled once the match is done
+		decoded = await decodeTile(buffer).catch(() => undefined);
 
-		const result = await sharp(buffer)
-			.ensureAlpha()
-			.raw()
-			.toBuffer({ resolveWithObject: true });
+		const result = decoded
+			? { data: decoded.data, info: { width: decoded.width, height: decoded.height, channels: 4 as const } }
+			: await sharp(buffer).ensureAlpha().raw().toBuffer({ resolveWithObject: true });
 
 		const match = await hasPumpkin(result);
 
+		if (schedule) {
+			recordTile(schedule, x, y, buffer, { data: result.data, width: result.info.width, height: result.info.height }, !!match);
+		}
+
 		if (!match) {
 			return;
 		}
@@ -86,5 +107,8 @@ export async function processTile(x: number, y: number): Promise<TileMatch | und
 		};
 	} catch (error) {
 		throw error instanceof Error ? error : new Error(String(error));
+	} finally {
+		decoded?.release();
+		body.release();
 	}
 }
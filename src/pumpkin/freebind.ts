@@ -1,8 +1,10 @@
 // @ts-ignore
-import { randomDispatcher, dispatcherFromIP } from './freebind/dispatcher.js';
+import { dispatcherFromIP } from './freebind/dispatcher.js';
+// @ts-ignore
+import { generateRandomIP } from './freebind/ip.js';
 // @ts-ignore
 import ipaddr from 'ipaddr.js';
-import { ProxyAgent, fetch, setGlobalDispatcher } from "undici";
+import type { Dispatcher } from "undici";
 import { config } from "dotenv"
 import { dirname, join } from "path";
 import { fileURLToPath } from "url";
@@ -63,6 +65,50 @@ function getNextIP(): string {
 	return bigintToIPv6(ipValue);
 }
 
-export function getDispatcher() {
-	return randomDispatcher(`${BASE_IP}/48`)
+// Tiles are fetched through a small pool of keep-alive agents, each bound to one random source address of the /48, so a tile costs one
+// request on a warm connection (HTTP/2 where the server offers it) instead of a new socket, DNS lookup and TLS handshake. Agents are
+// handed out round robin and an address is replaced by a fresh one after POOL_REQUESTS requests, or at once when it got rate limited.
+const POOL_SIZE = Number.parseInt(process.env.WPLACE_FREEBIND_POOL ?? "", 10) || 16;
+const POOL_REQUESTS = Number.parseInt(process.env.WPLACE_FREEBIND_REQUESTS ?? "", 10) || 1000;
+
+type PooledAgent = {
+	agent: Dispatcher;
+	requests: number;
+};
+
+const pool: PooledAgent[] = [];
+let nextAgent = 0;
+
+function createAgent(): PooledAgent {
+	const ip = generateRandomIP(`${BASE_IP}/48`);
+	const agent = dispatcherFromIP(ip, {
+		allowH2: true,
+		keepAliveTimeout: 30_000,
+		keepAliveMaxTimeout: 600_000,
+		connect: { allowH2: true },
+	});
+	return { agent, requests: 0 };
+}
+
+function replaceAgent(slot: number) {
+	const old = pool[slot];
+	pool[slot] = createAgent();
+	// requests still running on the old address finish first
+	old.agent.close().catch(() => {});
+}
+
+export function getDispatcher(): Dispatcher {
+	while (pool.length < POOL_SIZE) pool.push(createAgent());
+
+	const slot = nextAgent;
+	nextAgent = (nextAgent + 1) % POOL_SIZE;
+	if (pool[slot].requests >= POOL_REQUESTS) replaceAgent(slot);
+	pool[slot].requests += 1;
+	return pool[slot].agent;
+}
+
+// Moves the pool slot of a dispatcher from getDispatcher to a new address, e.g. after a 429 or a failed connection.
+export function retireDispatcher(dispatcher: Dispatcher) {
+	const slot = pool.findIndex((entry) => entry.agent === dispatcher);
+	if (slot >= 0) replaceAgent(slot);
 }
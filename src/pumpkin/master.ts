@@ -6,6 +6,7 @@ import { MAX_OFFSET } from "./freebind.ts";
 import { dirname, join } from "path";
 import { fileURLToPath } from "url";
 import { tlPxToGps } from "./mercator.ts";
+import { createSchedule, prepareSweep, saveSchedule, type ScanSchedule } from "./schedule.ts";
 import { existsSync, readFileSync, writeFileSync } from "fs";
 
 import sharp, { type OutputInfo } from "sharp";
@@ -33,6 +34,10 @@ try {
 const MAX_X = 2048;
 const MAX_Y = 2048;
 
+// Per-tile history of previous sweeps, used to visit the most promising tiles first
+const statsPath = join(dirname(pumpkinJsonPath), 'sweep_stats.bin')
+const schedule = createSchedule(statsPath, MAX_X, MAX_Y, Object.values(pumpkins))
+
 const defaultWorkerCount = Math.min(cpus().length, 8);
 const workerCount =
 	Number.parseInt(process.env.WPLACE_WORKERS ?? "", 10) || defaultWorkerCount;
@@ -48,23 +53,20 @@ type WorkerMessage =
 	}
 	| {
 		type: "done";
-		data: { startY: number; endY: number; maxX: number };
+		data: { processed: number; planesHighWater: number };
 	};
 
 let tilesCounter = 0
 
 async function spawnWorker(
-	startY: number,
-	endY: number,
+	schedule: ScanSchedule,
 	ipStartOffset: bigint,
 	onMatch: (match: TileMatch) => void,
 ) {
 	return new Promise<void>((resolve, reject) => {
 		const worker = new Worker(join(__dirname, "worker.ts"), {
 			workerData: {
-				startY,
-				endY,
-				maxX: MAX_X,
+				schedule,
 				concurrency: workerConcurrency,
 				ipStartOffset: ipStartOffset.toString(),
 			} as WorkerConfig,
@@ -97,9 +99,8 @@ async function spawnWorker(
 					break;
 				}
 				case "done": {
-					const processedRows = message.data.endY - message.data.startY;
 					console.log(
-						`Worker completed rows ${message.data.startY}-${message.data.endY - 1} (${processedRows} rows).`,
+						`Worker completed (${message.data.processed} tiles, at most ${message.data.planesHighWater} decoded tiles in memory).`,
 					);
 					break;
 				}
@@ -122,31 +123,27 @@ async function spawnWorker(
 async function main() {
 	const matches: TileMatch[] = [];
 
-	const rowsPerWorker = Math.ceil(MAX_Y / workerCount);
 	const workerPromises: Promise<void>[] = [];
 	const ipOffsetsPerWorker = BigInt(MAX_OFFSET) / BigInt(workerCount);
 	let currentIPOffset = 1n;
 
-	console.log({ workerCount, rowsPerWorker, ipOffsetsPerWorker });
+	console.log({ workerCount, ipOffsetsPerWorker });
+
+	prepareSweep(schedule);
+
+	const statsInterval = setInterval(() => saveSchedule(schedule, statsPath), 60_000);
 
-	setInterval(() => {
+	const progressInterval = setInterval(() => {
 		const tilesPerSecond = (tilesCounter / 5).toFixed(1)
 		process.stdout.write(`\rProcessed tiles: ${tilesCounter} (${tilesPerSecond} tiles/sec)   `)
 		tilesCounter = 0
 	}, 5000);
 
 	for (let index = 0; index < workerCount; index += 1) {
-		const startY = index * rowsPerWorker;
-		const endY = Math.min(startY + rowsPerWorker, MAX_Y);
-
-		console.log(`Spawning worker ${index + 1}/${workerCount} for rows ${startY}-${endY - 1}`);
-
-		if (startY >= endY) {
-			break;
-		}
+		console.log(`Spawning worker ${index + 1}/${workerCount}`);
 
 		workerPromises.push(
-			spawnWorker(startY, endY,
+			spawnWorker(schedule,
 				currentIPOffset,
 				async (match) => {
 					matches.push(match);
@@ -179,6 +176,10 @@ async function main() {
 
 	await Promise.all(workerPromises);
 
+	clearInterval(statsInterval);
+	clearInterval(progressInterval);
+	saveSchedule(schedule, statsPath);
+
 	if (matches.length === 0) {
 		console.log("No pumpkins detected across processed tiles.");
 	} else {
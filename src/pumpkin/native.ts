@@ -0,0 +1,96 @@
+import { dirname, join } from "path";
+import { createRequire } from "module";
+import { fileURLToPath } from "url";
+
+const require = createRequire(import.meta.url);
+const __filename = fileURLToPath(import.meta.url);
+const __dirname = dirname(__filename);
+
+export type NativePumpkin = {
+	setPumpkinData(data: Buffer, width: number, height: number, channels: number): void;
+	findPumpkin(data: Buffer, width: number, height: number, channels: number): { x: number; y: number } | null;
+	recordTileStat(
+		stats: Uint8Array,
+		index: number,
+		body: Uint8Array | null,
+		pixels: Uint8Array | null,
+		width: number,
+		height: number,
+		matched: boolean,
+	): void;
+	buildScanOrder(stats: Uint8Array, width: number, height: number, order: Uint32Array): void;
+	createTileArena(slotCount: number, slotSize: number): { buffer: ArrayBuffer; slotSize: number };
+	acquireTileSlot(): number;
+	releaseTileSlot(slot: number): void;
+	createTileSlab(maxPlanes: number, planeSize: number): void;
+	decodeTile(body: Uint8Array): Promise<{ plane: number; data: Uint8Array; width: number; height: number }> | null;
+	releaseTilePlane(plane: number): void;
+	tileSlabStats(): TileSlabStats;
+	quantizeTile(pixels: Uint8Array): void;
+	openTileArchive(path: string, defaultZ?: number): TileArchive;
+	readArchiveTile(archive: TileArchive, z: number, x: number, y: number): Buffer | null;
+	closeTileArchive(archive: TileArchive): void;
+	createUntar(outDir: string, gzip?: boolean, writers?: number): Untar;
+	untarPush(untar: Untar, chunk: Uint8Array): Promise<void>;
+	untarFinish(untar: Untar): Promise<UntarStats>;
+	/** Gives up on an extraction: a push in flight rejects and untarFinish may not be called after. */
+	untarAbort(untar: Untar): void;
+	createTarIngest(slots: number, slotSize: number, gzip: boolean, onReady: () => void): TarIngest;
+	ingestPush(ingest: TarIngest, chunk: Uint8Array): Promise<void>;
+	ingestTake(ingest: TarIngest): TarIngestEntry[];
+	ingestRelease(ingest: TarIngest, slot: number): void;
+	ingestFinish(ingest: TarIngest): boolean;
+	ingestCancel(ingest: TarIngest): void;
+	encodeTileManifest(tiles: Uint32Array, hashes: Uint8Array): Buffer;
+	decodeTileManifest(manifest: Uint8Array): TileManifest;
+	/**
+	 * tlPxToGps of mercator.ts over TlX, TlY, PxX, PxY quadruples, returning lat, lng pairs. Written to out when given, which must not
+	 * share memory with tlPx.
+	 */
+	tlPxToGpsBatch(tlPx: Float64Array, z?: number, scale?: number, out?: Float64Array): Float64Array;
+	/** gpsToTlPx of mercator.ts over lat, lng pairs, returning TlX, TlY, PxX, PxY quadruples. */
+	gpsToTlPxBatch(latLng: Float64Array, z?: number, scale?: number, out?: Float64Array): Float64Array;
+};
+
+/** Opaque handle of a memory mapped tar or PMTiles archive. */
+export type TileArchive = { readonly __tileArchive: unique symbol };
+
+/** Opaque handle of a streaming extraction, pushes must not overlap. */
+export type Untar = { readonly __untar: unique symbol };
+
+/**
+ * Opaque handle of a tar parsed into a fixed ring of entry slots. onReady is called when entries can be taken, a
+ * push waits until every entry of its chunk has a slot, pushes must not overlap.
+ */
+export type TarIngest = { readonly __tarIngest: unique symbol };
+
+/**
+ * A taken entry keeps its slot until released, file data must not be used after that. hash is the hex content key of
+ * the file, 128 bits of XXH64.
+ */
+export type TarIngestEntry =
+	| { slot: number; type: "file"; name: string; data: Uint8Array; hash: string }
+	| { slot: number; type: "link"; name: string; linkName: string };
+
+/** tiles holds z, x, y and hash index for every tile of a release, hashes its distinct content keys, 16 bytes each. */
+export type TileManifest = { tiles: Uint32Array; hashes: Buffer };
+
+export type UntarStats = {
+	files: number;
+	links: number;
+	dirs: number;
+	bytes: number;
+	skipped: number;
+	failed: number;
+};
+
+export type TileSlabStats = {
+	inUse: number;
+	allocated: number;
+	highWater: number;
+	maxPlanes: number;
+	planeSize: number;
+};
+
+const addonPath = join(__dirname, "..", "..", "build", "Release", "pumpkin.node");
+export const nativePumpkin: NativePumpkin = require(addonPath);
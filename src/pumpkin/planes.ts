@@ -0,0 +1,57 @@
+import { nativePumpkin } from "./native.ts";
+
+// wplace tiles are always 1000x1000 RGBA
+const PLANE_SIZE = 1000 * 1000 * 4;
+
+// Decoded tile living in a pooled native plane, `release` hands the plane back.
+export type DecodedTile = {
+	data: Buffer;
+	width: number;
+	height: number;
+	release(): void;
+};
+
+const waiters: (() => void)[] = [];
+
+// Caps the decoded tiles a worker holds at once, so its RSS stays at maxPlanes * 4 MB
+// instead of growing with every sharp output buffer the GC has not collected yet.
+export function initTileSlab(maxPlanes: number) {
+	nativePumpkin.createTileSlab(maxPlanes, PLANE_SIZE);
+}
+
+export function tileSlabStats() {
+	return nativePumpkin.tileSlabStats();
+}
+
+// Rejects if the PNG is not supported by the native decoder (e.g. interlaced).
+export async function decodeTile(body: Buffer): Promise<DecodedTile> {
+	while (true) {
+		const pending = nativePumpkin.decodeTile(body);
+
+		if (!pending) {
+			// every plane is borrowed, wait until one is released
+			await new Promise<void>((resolve) => waiters.push(resolve));
+			continue;
+		}
+
+		const decoded = await pending.catch((error) => {
+			// the native side already returned the plane
+			waiters.shift()?.();
+			throw error;
+		});
+		const { plane, data, width, height } = decoded;
+		let released = false;
+
+		return {
+			data: Buffer.from(data.buffer, data.byteOffset, data.length),
+			width,
+			height,
+			release() {
+				if (released) return;
+				released = true;
+				nativePumpkin.releaseTilePlane(plane);
+				waiters.shift()?.();
+			},
+		};
+	}
+}
@@ -0,0 +1,91 @@
+import { existsSync, readFileSync, writeFileSync } from "fs";
+import { nativePumpkin } from "./native.ts";
+
+// Must match sizeof(tile_stat_t) in src/native/tile_sched.h
+const TILE_STAT_SIZE = 8;
+const TILE_STAT_MATCHES = 6;
+
+// Tiles handed out per Atomics.add, keeps contention on the cursor negligible.
+const POP_BATCH = 64;
+
+// Everything a worker needs to pull tiles from the shared, priority ordered queue.
+export type ScanSchedule = {
+	width: number;
+	height: number;
+	stats: SharedArrayBuffer; // tile_stat_t[width * height]
+	order: SharedArrayBuffer; // Uint32Array of tile indices, best first
+	cursor: SharedArrayBuffer; // Int32Array(1), next index into order
+};
+
+export function createSchedule(
+	statsPath: string,
+	width: number,
+	height: number,
+	matchedTiles: { tileX: number; tileY: number }[] = [],
+): ScanSchedule {
+	const count = width * height;
+	const stats = new SharedArrayBuffer(count * TILE_STAT_SIZE);
+	const bytes = new Uint8Array(stats);
+
+	if (existsSync(statsPath)) {
+		const previous = readFileSync(statsPath);
+		if (previous.length === bytes.length) {
+			bytes.set(previous);
+		} else {
+			console.warn(`Ignoring ${statsPath}: expected ${bytes.length} bytes, got ${previous.length}`);
+		}
+	}
+
+	// Seed match history from pumpkins found before the stats file existed.
+	for (const { tileX, tileY } of matchedTiles) {
+		if (tileX < 0 || tileY < 0 || tileX >= width || tileY >= height) continue;
+		const offset = (tileY * width + tileX) * TILE_STAT_SIZE + TILE_STAT_MATCHES;
+		if (bytes[offset] === 0) bytes[offset] = 1;
+	}
+
+	return {
+		width,
+		height,
+		stats,
+		order: new SharedArrayBuffer(count * Uint32Array.BYTES_PER_ELEMENT),
+		cursor: new SharedArrayBuffer(Int32Array.BYTES_PER_ELEMENT),
+	};
+}
+
+// Ranks all tiles by the statistics of the previous sweeps and rewinds the queue.
+export function prepareSweep(schedule: ScanSchedule) {
+	nativePumpkin.buildScanOrder(new Uint8Array(schedule.stats), schedule.width, schedule.height, new Uint32Array(schedule.order));
+	Atomics.store(new Int32Array(schedule.cursor), 0, 0);
+}
+
+export function saveSchedule(schedule: ScanSchedule, statsPath: string) {
+	writeFileSync(statsPath, new Uint8Array(schedule.stats));
+}
+
+// Returns the next batch of tile indices or undefined once the sweep is exhausted.
+export function popTiles(schedule: ScanSchedule): Uint32Array | undefined {
+	const total = schedule.width * schedule.height;
+	const start = Atomics.add(new Int32Array(schedule.cursor), 0, POP_BATCH);
+	if (start >= total) return;
+
+	return new Uint32Array(schedule.order, start * Uint32Array.BYTES_PER_ELEMENT, Math.min(POP_BATCH, total - start));
+}
+
+export function recordTile(
+	schedule: ScanSchedule,
+	x: number,
+	y: number,
+	body: Uint8Array | null,
+	pixels: { data: Uint8Array; width: number; height: number } | null,
+	matched: boolean,
+) {
+	nativePumpkin.recordTileStat(
+		new Uint8Array(schedule.stats),
+		y * schedule.width + x,
+		body,
+		pixels?.data ?? null,
+		pixels?.width ?? 0,
+		pixels?.height ?? 0,
+		matched,
+	);
+}
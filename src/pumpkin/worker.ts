@@ -2,33 +2,46 @@ import { parentPort, workerData, isMainThread } from "worker_threads";
 import PQueue from "p-queue";
 import { processTile } from "./fetch.ts";
 import { setIPStart } from "./freebind.ts";
+import { popTiles, type ScanSchedule } from "./schedule.ts";
+import { initTileArena } from "./arena.ts";
+import { initTileSlab, tileSlabStats } from "./planes.ts";
 
 export type WorkerConfig = {
-	startY: number;
-	endY: number;
-	maxX: number;
+	schedule: ScanSchedule;
 	concurrency?: number;
 	ipStartOffset: string
 };
 
 
 async function runWorker(config: WorkerConfig) {
-	const { startY, endY, maxX, concurrency = 16 } = config;
+	const { schedule, concurrency = 16 } = config;
 
 	const queue = new PQueue({
 		concurrency,
 	});
 
 	setIPStart(BigInt(config.ipStartOffset));
+	initTileArena(concurrency);
+	initTileSlab(Number.parseInt(process.env.WPLACE_TILE_PLANES ?? "", 10) || 8);
+
+	let processed = 0;
+	let batch: Uint32Array | undefined;
+
+	// All workers pop from the same priority order, so the most promising tiles
+	// of the whole map are fetched first instead of row by row per band.
+	while ((batch = popTiles(schedule))) {
+		for (const index of batch) {
+			const x = index % schedule.width;
+			const y = Math.floor(index / schedule.width);
 
-	for (let y = startY; y < endY; y++) {
-		for (let x = 0; x < maxX; x++) {
 			// Throttle pending tasks to avoid unbounded memory growth.
 			await queue.onSizeLessThan(concurrency * 2);
 
+			processed += 1;
+
 			queue.add(async () => {
 				try {
-					const match = await processTile(x, y);
+					const match = await processTile(x, y, schedule);
 
 					if (match) {
 						parentPort?.postMessage({
@@ -59,9 +72,8 @@ async function runWorker(config: WorkerConfig) {
 	parentPort?.postMessage({
 		type: "done",
 		data: {
-			startY,
-			endY,
-			maxX,
+			processed,
+			planesHighWater: tileSlabStats().highWater,
 		},
 	});
 }
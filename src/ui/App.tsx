@@ -154,6 +154,11 @@ function App() {
 		const params = parseHash();
 		return params.pumpkins === "1" || params.pumpkins === "true";
 	});
+	const [isHeatmapOn, setIsHeatmapOn] = useState(() => {
+		if (typeof window === "undefined") return false;
+		const params = parseHash();
+		return params.heatmap === "1" || params.heatmap === "true";
+	});
 	let [times, setTimes] = useState<Date[]>(defaultTimes);
 
 	const [isTakingScreenshot, setIsTakingScreenshot] = useState(false);
@@ -293,6 +298,13 @@ function App() {
 							];
 						}),
 					),
+					// changed pixels per area over all releases, summed up the pyramid by src/native/heatmap.c
+					heatmap: {
+						type: "raster",
+						tiles: ["https://wplace.samuelscheit.com/tiles/heatmap/{z}/{x}/{y}.png"],
+						scheme: "xyz",
+						maxzoom: 11,
+					},
 				},
 				layers: [
 					{
@@ -329,6 +341,17 @@ function App() {
 							},
 						};
 					}),
+					{
+						id: "heatmap",
+						type: "raster",
+						source: "heatmap",
+						paint: {
+							"raster-opacity": 0.75,
+						},
+						layout: {
+							visibility: isHeatmapOn ? "visible" : "none",
+						},
+					},
 				],
 			},
 			renderWorldCopies: false,
@@ -350,6 +373,7 @@ function App() {
 			applyParamsToMap(params);
 			const shouldOpenPumpkins = params.pumpkins === "1" || params.pumpkins === "true";
 			setIsPumpkinsOpen(shouldOpenPumpkins);
+			setIsHeatmapOn(params.heatmap === "1" || params.heatmap === "true");
 		};
 		window.addEventListener("hashchange", onHashChange);
 
@@ -649,6 +673,13 @@ function App() {
 		updateHashParams({ pumpkins: isPumpkinsOpen ? "1" : undefined });
 	}, [isPumpkinsOpen]);
 
+	useEffect(() => {
+		updateHashParams({ heatmap: isHeatmapOn ? "1" : undefined });
+		const map = mapRef.current;
+		if (!map || !map.getLayer("heatmap")) return;
+		map.setLayoutProperty("heatmap", "visibility", isHeatmapOn ? "visible" : "none");
+	}, [isHeatmapOn, forceUpdate]);
+
 	useEffect(() => {
 		if (!isAboutOpen) return;
 		const onKeyDown = (event: KeyboardEvent) => {
@@ -787,6 +818,15 @@ function App() {
 						</svg>
 					)}
 				</button>
+				<button
+					type="button"
+					onClick={() => setIsHeatmapOn((on) => !on)}
+					className="rounded bg-neutral-900/70 px-3 py-1 text-xs font-medium text-neutral-100 shadow-md backdrop-blur hover:bg-neutral-800/70 flex flex-row items-center gap-2"
+					aria-pressed={isHeatmapOn}
+					title="Where the canvas changed the most across all releases"
+				>
+					{isHeatmapOn ? "Hide Activity" : "Show Activity"}
+				</button>
 				<button
 					type="button"
 					className="rounded bg-neutral-900/70 px-3 py-1 text-xs font-medium text-neutral-100 shadow-md backdrop-blur hover:bg-neutral-800/70 flex flex-row items-center gap-2"
@@ -0,0 +1,208 @@
+// Delta tiles let a viewer step from the tile of one release to the same z/x/y of the next release with a patch of the palette indices
+// that changed, instead of the whole PNG. They are packed by src/native/deltas.c and the format is described in src/native/tile_delta.h:
+//   "WPDT", u8 version 1, u8 flags, u16 tile size, u32 hash of the plane before, u32 hash of the plane after, the patch,
+// where the patch is a varint count of changed rows, a varint row delta and a varint change count per such row, then a u16 column and
+// then a u8 palette index per change.
+
+export const DELTA_TILE_HEADER = 16;
+export const DELTA_TILE_UNCHANGED = 1;
+
+// Index 0 is transparent, same order as src/native/palette.c
+export const PALETTE: readonly (readonly [number, number, number])[] = [
+	[0, 0, 0],
+	[0, 0, 0],
+	[60, 60, 60],
+	[120, 120, 120],
+	[210, 210, 210],
+	[255, 255, 255],
+	[96, 0, 24],
+	[237, 28, 36],
+	[255, 127, 39],
+	[246, 170, 9],
+	[249, 221, 59],
+	[255, 250, 188],
+	[14, 185, 104],
+	[19, 230, 123],
+	[135, 255, 94],
+	[12, 129, 110],
+	[16, 174, 166],
+	[19, 225, 190],
+	[40, 80, 158],
+	[64, 147, 228],
+	[96, 247, 242],
+	[107, 80, 246],
+	[153, 177, 251],
+	[120, 12, 153],
+	[170, 56, 185],
+	[224, 159, 249],
+	[203, 0, 122],
+	[236, 31, 128],
+	[243, 141, 169],
+	[104, 70, 52],
+	[149, 104, 42],
+	[248, 178, 119],
+	[170, 170, 170],
+	[165, 14, 30],
+	[250, 128, 114],
+	[228, 92, 26],
+	[156, 132, 49],
+	[197, 173, 49],
+	[232, 212, 95],
+	[74, 107, 58],
+	[90, 148, 74],
+	[132, 197, 115],
+	[15, 121, 159],
+	[187, 250, 242],
+	[125, 199, 255],
+	[77, 49, 184],
+	[74, 66, 132],
+	[122, 113, 196],
+	[181, 174, 241],
+	[155, 82, 73],
+	[209, 128, 120],
+	[250, 182, 164],
+	[219, 164, 99],
+	[123, 99, 82],
+	[156, 132, 107],
+	[214, 181, 148],
+	[209, 128, 81],
+	[255, 197, 165],
+	[109, 100, 63],
+	[148, 140, 107],
+	[205, 197, 158],
+	[51, 57, 65],
+	[109, 117, 141],
+	[179, 185, 209],
+];
+
+const exactIndex = new Map<number, number>(PALETTE.slice(1).map(([r, g, b], i) => [(r << 16) | (g << 8) | b, i + 1]));
+
+// Like palette_index_of: transparent for alpha 0, the exact entry for palette colours, otherwise the nearest colour.
+function indexOf(r: number, g: number, b: number, a: number) {
+	if (a === 0) return 0;
+	const exact = exactIndex.get((r << 16) | (g << 8) | b);
+	if (exact !== undefined) return exact;
+
+	let best = Infinity;
+	let bestIndex = 1;
+	for (let i = 1; i < PALETTE.length; i++) {
+		const [pr, pg, pb] = PALETTE[i];
+		const d = (r - pr) ** 2 + (g - pg) ** 2 + (b - pb) ** 2;
+		if (d < best) {
+			best = d;
+			bestIndex = i;
+		}
+	}
+	return bestIndex;
+}
+
+// Palette plane of a decoded tile, e.g. the data of getImageData on the tile drawn to a canvas.
+export function rgbaToIndices(rgba: Uint8Array | Uint8ClampedArray, out = new Uint8Array(rgba.length / 4)) {
+	const px = new Uint32Array(rgba.buffer, rgba.byteOffset, out.length);
+	// runs of the same colour are the common case in pixel art
+	let last = 0;
+	let lastIndex = 0;
+	for (let i = 0; i < out.length; i++) {
+		if (px[i] !== last || i === 0) {
+			last = px[i];
+			lastIndex = indexOf(rgba[i * 4], rgba[i * 4 + 1], rgba[i * 4 + 2], rgba[i * 4 + 3]);
+		}
+		out[i] = lastIndex;
+	}
+	return out;
+}
+
+export function indicesToRgba(plane: Uint8Array, out = new Uint8ClampedArray(plane.length * 4)) {
+	for (let i = 0; i < plane.length; i++) {
+		const index = plane[i] & 63;
+		const [r, g, b] = PALETTE[index];
+		out[i * 4] = r;
+		out[i * 4 + 1] = g;
+		out[i * 4 + 2] = b;
+		out[i * 4 + 3] = index ? 255 : 0;
+	}
+	return out;
+}
+
+// FNV-1a, as tile_delta_hash
+export function deltaTileHash(plane: Uint8Array) {
+	let h = 0x811c9dc5;
+	for (let i = 0; i < plane.length; i++) {
+		h = Math.imul(h ^ plane[i], 0x01000193);
+	}
+	return h >>> 0;
+}
+
+// Applies a delta tile to the palette plane of a size x size tile in place. Returns false, leaving the plane as it was, if the delta tile is
+// corrupt, for another tile size or made against a different plane, and false as well if the result does not hash as it should; the
+// tile has to be fetched whole then.
+export function applyDeltaTile(tile: Uint8Array, size: number, plane: Uint8Array) {
+	const view = new DataView(tile.buffer, tile.byteOffset, tile.byteLength);
+	if (
+		tile.length < DELTA_TILE_HEADER ||
+		tile[0] !== 0x57 || // WPDT
+		tile[1] !== 0x50 ||
+		tile[2] !== 0x44 ||
+		tile[3] !== 0x54 ||
+		tile[4] !== 1 ||
+		view.getUint16(6, true) !== size ||
+		plane.length !== size * size
+	) {
+		return false;
+	}
+	if (tile[5] & DELTA_TILE_UNCHANGED) return tile.length === DELTA_TILE_HEADER;
+
+	let at = DELTA_TILE_HEADER;
+	const varint = () => {
+		let v = 0;
+		for (let scale = 1; at < tile.length && scale < 2 ** 49; scale *= 128) {
+			const byte = tile[at++];
+			v += (byte & 0x7f) * scale;
+			if (!(byte & 0x80)) return v;
+		}
+		return -1;
+	};
+
+	// row headers first, checked in full before the plane is touched
+	const rowCount = varint();
+	if (rowCount < 0 || rowCount > size) return false;
+	const rows = new Uint32Array(rowCount);
+	const counts = new Uint32Array(rowCount);
+	let total = 0;
+	for (let r = 0, next = 0; r < rowCount; r++) {
+		const delta = varint();
+		const n = varint();
+		if (delta < 0 || n <= 0 || n > size || next + delta >= size) return false;
+		rows[r] = next + delta;
+		counts[r] = n;
+		next += delta + 1;
+		total += n;
+	}
+	const cols = at;
+	const indices = cols + total * 2;
+	if (tile.length - at !== total * 3) return false;
+	for (let i = 0; i < total; i++) {
+		if (view.getUint16(cols + i * 2, true) >= size) return false;
+	}
+	if (deltaTileHash(plane) !== view.getUint32(8, true)) return false;
+
+	for (let r = 0, i = 0; r < rowCount; r++) {
+		const row = rows[r] * size;
+		for (const end = i + counts[r]; i < end; i++) {
+			plane[row + view.getUint16(cols + i * 2, true)] = tile[indices + i];
+		}
+	}
+	return deltaTileHash(plane) === view.getUint32(12, true);
+}
+
+export function deltaTileUrl(slug: string, z: number, x: number, y: number) {
+	return `https://wplace.samuelscheit.com/tiles/delta-${slug}/${z}/${x}/${y}.delta`;
+}
+
+// Steps plane, the tile z/x/y of the release before slug, to the tile of slug. Returns false if there is no delta tile or it does not
+// apply, in which case the PNG of slug is the way to get the tile.
+export async function stepTile(plane: Uint8Array, size: number, slug: string, z: number, x: number, y: number, signal?: AbortSignal) {
+	const res = await fetch(deltaTileUrl(slug, z, x, y), { signal });
+	if (!res.ok) return false;
+	return applyDeltaTile(new Uint8Array(await res.arrayBuffer()), size, plane);
+}